@@ -140,6 +140,57 @@ namespace Compression {
         inline uint32_t decode_varuint32(const uint8_t *&buf) {
                 return UnpackUInt32(buf);
         }
+
+        // Same as check_decode_varuint32() followed by decode_varuint32(), except that it decodes from a single
+        // 64bit load(the terminator is located by masking the continuation bits) when at least 8 bytes are available
+        // Returns false if the varuint32 is not fully contained in [p, e)
+        inline bool decode_varuint32(const uint8_t *&p, const uint8_t *const e, uint32_t *const out) noexcept {
+                if (likely(p < e && *p < 128)) {
+                        *out = *p++;
+                        return true;
+                }
+
+#if defined(__x86_64__)
+                if (likely(e - p >= 8)) {
+                        uint64_t word;
+
+                        memcpy(&word, p, sizeof(word));
+
+                        // bit 7 of terminators among the first 5 bytes
+                        const uint64_t stops = ~word & 0x0000008080808080ull;
+
+                        if (unlikely(!stops)) {
+                                return false;
+                        }
+
+                        const auto bits = __builtin_ctzll(stops) + 1;
+
+                        word &= (uint64_t(1) << bits) - 1;
+                        *out = (word & 0x7f) | ((word >> 1) & (0x7fu << 7)) | ((word >> 2) & (0x7fu << 14)) | ((word >> 3) & (0x7fu << 21)) | ((word >> 4) & (uint64_t(0x7f) << 28));
+                        p += bits / 8;
+                        return true;
+                }
+#endif
+
+                if (unlikely(!UnpackUInt32Check(p, e))) {
+                        return false;
+                }
+
+                *out = UnpackUInt32(p);
+                return true;
+        }
+
+        // Decodes n consecutive varuint32s from [p, e) into out
+        // Returns a pointer past the last one, or nullptr if they are not all contained in [p, e)
+        inline const uint8_t *decode_varuint32_batch(const uint8_t *p, const uint8_t *const e, uint32_t *const out, const std::size_t n) noexcept {
+                for (std::size_t i{0}; i < n; ++i) {
+                        if (unlikely(!decode_varuint32(p, e, out + i))) {
+                                return nullptr;
+                        }
+                }
+
+                return p;
+        }
 } // namespace Compression
 
 void IOBuffer::SerializeVarUInt32(const uint32_t n) {
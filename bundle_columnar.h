@@ -0,0 +1,192 @@
+#pragma once
+#include "common.h"
+#include <compress.h>
+#include <emmintrin.h>
+
+// See Switch/ext/FastPFor/src/simdunalignedbitpacking.cpp
+// Packs/unpacks exactly 128 integers of the specified bit width to/from (bit * 16) bytes
+namespace FastPForLib {
+        void usimdpack(const uint32_t *__restrict__ in, __m128i *__restrict__ out, uint32_t bit);
+        void usimdunpack(const __m128i *__restrict__ in, uint32_t *__restrict__ out, uint32_t bit);
+} // namespace FastPForLib
+
+// Columnar message sets; see tank_encoding.md
+//
+// A column of N integers is encoded as ceil(N / 128) blocks. Each block begins with a u8 mode:
+// if mode <= 32, it is followed by the block's 128 integers(zero padded) bit-packed to mode bits each, otherwise(varint_block)
+// it is followed by the block's integers encoded as varuint32s. Encoders only use varint blocks for the last block, if it's smaller.
+namespace TANKUtil::columnar {
+        static constexpr std::size_t block_size{128};
+        static constexpr uint8_t     varint_block{0xff};
+
+        inline constexpr std::size_t padded(const std::size_t n) noexcept {
+                return (n + block_size - 1) & ~(block_size - 1);
+        }
+
+        inline constexpr uint32_t zigzag(const int32_t v) noexcept {
+                return (uint32_t(v) << 1) ^ uint32_t(v >> 31);
+        }
+
+        inline constexpr int32_t unzigzag(const uint32_t v) noexcept {
+                return int32_t(v >> 1) ^ -int32_t(v & 1);
+        }
+
+        inline std::size_t varuint32_size(const uint32_t v) noexcept {
+                return v < (1u << 7) ? 1 : v < (1u << 14) ? 2 : v < (1u << 21) ? 3 : v < (1u << 28) ? 4 : 5;
+        }
+
+        inline void encode_column(IOBuffer *const b, const uint32_t *const values, const std::size_t n) {
+                uint32_t block[block_size];
+
+                for (std::size_t i{0}; i < n; i += block_size) {
+                        const auto  cnt = std::min(block_size, n - i);
+                        uint32_t    acc{0};
+                        std::size_t varint_len{0};
+
+                        for (std::size_t k{0}; k < cnt; ++k) {
+                                acc |= values[i + k];
+                                varint_len += varuint32_size(values[i + k]);
+                        }
+
+                        const uint32_t bits = acc ? 32 - __builtin_clz(acc) : 0;
+                        const auto     len  = bits * 16;
+
+                        if (cnt < block_size && varint_len <= len) {
+                                b->pack(varint_block);
+                                for (std::size_t k{0}; k < cnt; ++k) {
+                                        b->encode_varuint32(values[i + k]);
+                                }
+                        } else {
+                                memcpy(block, values + i, cnt * sizeof(uint32_t));
+                                memset(block + cnt, 0, (block_size - cnt) * sizeof(uint32_t));
+
+                                b->pack(static_cast<uint8_t>(bits));
+                                b->reserve(len);
+                                FastPForLib::usimdpack(block, reinterpret_cast<__m128i *>(b->data() + b->size()), bits);
+                                b->advance_size(len);
+                        }
+                }
+        }
+
+        // out must have room for padded(n) integers
+        // Returns nullptr if the column is not fully contained in [p, end)
+        inline const uint8_t *decode_column(const uint8_t *p, const uint8_t *const end, uint32_t *const out, const std::size_t n) noexcept {
+                for (std::size_t i{0}; i < n; i += block_size) {
+                        if (unlikely(p >= end)) {
+                                return nullptr;
+                        }
+
+                        const auto mode = *p++;
+
+                        if (mode == varint_block) {
+                                if (unlikely(!(p = Compression::decode_varuint32_batch(p, end, out + i, std::min(n - i, block_size))))) {
+                                        return nullptr;
+                                }
+                        } else if (likely(mode <= 32)) {
+                                const std::size_t len = mode * 16;
+
+                                if (unlikely(p + len > end)) {
+                                        return nullptr;
+                                }
+
+                                FastPForLib::usimdunpack(reinterpret_cast<const __m128i *>(p), out + i, mode);
+                                p += len;
+                        } else {
+                                return nullptr;
+                        }
+                }
+
+                return p;
+        }
+
+        // Decodes a columnar message set, and then iterates its messages
+        // Keys and content reference the message set content
+        struct msgset_reader final {
+                std::vector<uint32_t> columns;
+                const uint32_t *      ts_deltas, *key_lens, *content_lens, *seqnum_deltas;
+                const uint8_t *       keys, *content;
+                uint64_t              ts;
+                uint32_t              idx, cnt;
+
+                // Returns false if the message set is malformed
+                bool reset(const uint8_t *p, const uint8_t *const end, const uint32_t msgs_cnt, const bool sparse) {
+                        const auto  n = padded(msgs_cnt);
+                        std::size_t keys_len{0}, content_len{0};
+
+                        idx = 0;
+                        cnt = msgs_cnt;
+                        if (unlikely(p + sizeof(uint64_t) > end)) {
+                                return false;
+                        }
+                        ts = decode_pod<uint64_t>(p);
+
+                        // every block of every column is at least 1 byte long; don't trust msgs_cnt before we size columns for it
+                        if (unlikely((n / block_size) * (sparse ? 4 : 3) > std::size_t(end - p))) {
+                                return false;
+                        }
+
+                        if (columns.size() < n * 4) {
+                                columns.resize(n * 4);
+                        }
+
+                        auto out = columns.data();
+
+                        ts_deltas     = out;
+                        key_lens      = out + n;
+                        content_lens  = out + n * 2;
+                        seqnum_deltas = out + n * 3;
+                        for (unsigned i{0}; i < (sparse ? 4 : 3); ++i) {
+                                if (unlikely(!(p = decode_column(p, end, out + n * i, msgs_cnt)))) {
+                                        return false;
+                                }
+                        }
+
+                        if (!sparse) {
+                                memset(out + n * 3, 0, msgs_cnt * sizeof(uint32_t));
+                        }
+
+                        for (uint32_t i{0}; i < msgs_cnt; ++i) {
+                                if (unlikely(key_lens[i] > std::numeric_limits<uint8_t>::max())) {
+                                        return false;
+                                }
+
+                                keys_len += key_lens[i];
+                                content_len += content_lens[i];
+                        }
+
+                        if (unlikely(p + keys_len + content_len != end)) {
+                                return false;
+                        }
+
+                        keys    = p;
+                        content = p + keys_len;
+                        return true;
+                }
+
+                // seqnum_delta is the number of sequence numbers skipped since the previous message(always 0 unless this is a SPARSE bundle)
+                // Returns false if there are no more messages
+                inline bool next(uint64_t *const msg_ts, str_view8 *const key, str_view32 *const msg_content, uint32_t *const seqnum_delta) noexcept {
+                        if (idx == cnt) {
+                                return false;
+                        }
+
+                        const auto key_len     = key_lens[idx];
+                        const auto content_len = content_lens[idx];
+
+                        ts += unzigzag(ts_deltas[idx]);
+                        *msg_ts = ts;
+                        if (key_len) {
+                                key->set(reinterpret_cast<const char *>(keys), key_len);
+                                keys += key_len;
+                        } else {
+                                key->reset();
+                        }
+                        msg_content->set(reinterpret_cast<const char *>(content), content_len);
+                        content += content_len;
+                        *seqnum_delta = seqnum_deltas[idx];
+
+                        ++idx;
+                        return true;
+                }
+        };
+} // namespace TANKUtil::columnar
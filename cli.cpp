@@ -920,6 +920,12 @@ int main(int argc, char *argv[]) {
 				if (const auto v = it.version) {
                                         Print(Buffer{}.append("Version"_s32, align_to(32), v / 100, '.', v % 100), "\n");
 				}
+
+                                Print(Buffer{}.append("Reactor Stalls"_s32, align_to(32), dotnotation_repr(it.metrics.reactor_stalls)), "\n");
+                                Print(Buffer{}.append("Slow Operations"_s32, align_to(32), dotnotation_repr(it.metrics.slow_ops)), "\n");
+                                if (const auto v = it.metrics.slowest_op_us) {
+                                        Print(Buffer{}.append("Slowest Recent Operation"_s32, align_to(32), duration_repr(v)), "\n");
+                                }
                         }
                 }
 
@@ -995,29 +1001,109 @@ int main(int argc, char *argv[]) {
                 return 0;
         } else if (cmd.Eq(_S("mirror"))) {
                 // See: https://eng.uber.com/umirrormaker/
+                //
+                // Bundles are passed-through; they are forwarded to the destination exactly as they are stored in the source
+                // partition's log, in ProduceWithSeqnum requests. This way we don't need to decompress, decode, re-bundle and re-compress
+                // every message on every hop, so that mirroring is bound by the network, not the CPU.
+                // Only bundles that straddle the sequence number we consume from (or are not contiguous with it, unless they are SPARSE bundles)
+                // are decoded and their messages re-bundled (see -C and -S), and that is only likely to happen once per session.
+                //
+                // Partitions are pipelined independently of each other: as soon as the content consumed for a partition has been
+                // acknowledged by the destination, we 'll consume more content for that partition.
                 TankClient dest;
                 uint32_t   reqId1, reqId2;
                 // XXX: arbitrary defaults
-                size_t bundleMsgsSetCntThreshold{128};
-                size_t bundleMsgsSetSizeThreshold{4 * 1024 * 1024};
-                size_t sleepTime{0};
+                size_t   bundleMsgsSetCntThreshold{128};
+                size_t   bundleMsgsSetSizeThreshold{4 * 1024 * 1024};
+                size_t   sleepTime{0};
+                bool     pass_through{true};
+                uint64_t max_bytes_per_sec{0}, max_msgs_per_sec{0};
+                size_t   max_inflight_partitions{std::numeric_limits<size_t>::max()};
+
+                const auto parse_rate = [](str_view32 s) -> uint64_t {
+                        uint64_t scale{1};
+
+                        if (s) {
+                                switch (s.back()) {
+                                        case 'k':
+                                        case 'K':
+                                                scale = 1024;
+                                                s.strip_suffix(1);
+                                                break;
+
+                                        case 'm':
+                                        case 'M':
+                                                scale = 1024 * 1024;
+                                                s.strip_suffix(1);
+                                                break;
+
+                                        case 'g':
+                                        case 'G':
+                                                scale = 1024 * 1024 * 1024;
+                                                s.strip_suffix(1);
+                                                break;
+
+                                        default:
+                                                break;
+                                }
+                        }
+
+                        return s && s.all_of_digits() ? s.as_uint64() * scale : 0;
+                };
 
-                // TODO: throttling options
                 optind = 0;
-                while ((r = getopt(argc, argv, "+hC:S:z:")) != -1) {
+                while ((r = getopt(argc, argv, "+hC:S:z:dB:M:P:")) != -1) {
                         switch (r) {
                                 case 'z':
                                         sleepTime = strwlen32_t(optarg).AsUint64();
                                         break;
 
+                                case 'd':
+                                        pass_through = false;
+                                        break;
+
+                                case 'B':
+                                        max_bytes_per_sec = parse_rate(str_view32(optarg));
+                                        if (!max_bytes_per_sec) {
+                                                Print("Invalid value ", optarg, "\n");
+                                                return 1;
+                                        }
+                                        break;
+
+                                case 'M':
+                                        max_msgs_per_sec = parse_rate(str_view32(optarg));
+                                        if (!max_msgs_per_sec) {
+                                                Print("Invalid value ", optarg, "\n");
+                                                return 1;
+                                        }
+                                        break;
+
+                                case 'P':
+                                        max_inflight_partitions = strwlen32_t(optarg).AsUint32();
+                                        if (!IsBetweenRange<size_t>(max_inflight_partitions, 1, TANK_Limits::max_topic_partitions)) {
+                                                Print("Invalid value ", optarg, "\n");
+                                                return 1;
+                                        }
+                                        break;
+
                                 case 'h':
                                         Print("Usage: ", app, " mirror [options] endpoint\n");
-                                        Print(Buffer{}.append(left_aligned(5, "Mirrors either 1 or all selected topic's partitions from the selected broker to <endpoint>.\nThe topic and partitions to be mirrored must be defined in the destination endpoint before attempting to mirror them from the source.\nIf you specify the partition explicitly using -p or <topic>/<partition> notation, then only that partition will be mirrored, otherwise all partitions will be mirrored."_s32, 86)), "\n");
+                                        Print(Buffer{}.append(left_aligned(5, "Mirrors either 1 or all selected topic's partitions from the selected broker to <endpoint>.\nThe topic and partitions to be mirrored must be defined in the destination endpoint before attempting to mirror them from the source.\nIf you specify the partition explicitly using -p or <topic>/<partition> notation, then only that partition will be mirrored, otherwise all partitions will be mirrored.\nBundles are forwarded as they are stored in the source, without being decoded or re-encoded, unless -d is specified."_s32, 86)), "\n");
                                         Print("\nOptions:\n\n"_s32);
                                         Print(Buffer{}.append(align_to(3), "-C <count>"_s32), "\n");
-                                        Print(Buffer{}.append(left_aligned(5, "Specify the size of bundles in messages. A bundle will not contain more than <count> messages. Default is 1"_s32, 76)), "\n\n");
+                                        Print(Buffer{}.append(left_aligned(5, "Specify the size of bundles in messages, for messages that need to be re-bundled. A bundle will not contain more than <count> messages. Default is 128"_s32, 76)), "\n\n");
                                         Print(Buffer{}.append(align_to(3), "-S <size>"_s32), "\n");
-                                        Print(Buffer{}.append(left_aligned(5, "Specify the size of bundles in bytes. Produces bundles will not be larger than <size> bytes."_s32, 76)), "\n\n");
+                                        Print(Buffer{}.append(left_aligned(5, "Specify the size of bundles in bytes, for messages that need to be re-bundled. Produced bundles will not be larger than <size> bytes."_s32, 76)), "\n\n");
+                                        Print(Buffer{}.append(align_to(3), "-d"_s32), "\n");
+                                        Print(Buffer{}.append(left_aligned(5, "Decode all consumed messages and re-bundle them, instead of forwarding bundles as they are."_s32, 76)), "\n\n");
+                                        Print(Buffer{}.append(align_to(3), "-B <rate>"_s32), "\n");
+                                        Print(Buffer{}.append(left_aligned(5, "Do not mirror more than <rate> bytes/second. You can use k, m, g suffixes (e.g 64m)"_s32, 76)), "\n\n");
+                                        Print(Buffer{}.append(align_to(3), "-M <rate>"_s32), "\n");
+                                        Print(Buffer{}.append(left_aligned(5, "Do not mirror more than <rate> messages/second. You can use k, m, g suffixes"_s32, 76)), "\n\n");
+                                        Print(Buffer{}.append(align_to(3), "-P <count>"_s32), "\n");
+                                        Print(Buffer{}.append(left_aligned(5, "Do not mirror more than <count> partitions concurrently. By default, all partitions are mirrored concurrently"_s32, 76)), "\n\n");
+                                        Print(Buffer{}.append(align_to(3), "-z <ms>"_s32), "\n");
+                                        Print(Buffer{}.append(left_aligned(5, "Pause for <ms> milliseconds between consume requests to the source"_s32, 76)), "\n\n");
                                         return 0;
 
                                 case 'C':
@@ -1074,24 +1160,63 @@ int main(int argc, char *argv[]) {
                 }
 
                 struct partition_ctx final {
+                        enum class State : uint8_t {
+                                Idle = 0,
+                                Consuming,
+                                Producing
+                        } state;
+
                         uint16_t id;
-                        bool     pending;
-                        uint64_t nextBase, last;
                         uint64_t next;
                         uint32_t fetch_size;
+                        uint32_t consume_req_id;
+                        uint32_t pending_acks;
+                        // if set, we can't pass-through the next bundle consumed, because
+                        // there is a gap between it and the last message in the destination
+                        bool rebundle;
+                };
+
+                // token bucket; we account for content after we have consumed it
+                // so tokens may go negative, in which case we won't consume more until they are replenished
+                struct rate_limiter final {
+                        uint64_t rate;
+                        double   tokens;
+                        uint64_t last_update;
+
+                        void refill(const uint64_t now) noexcept {
+                                if (rate) {
+                                        tokens = std::min<double>(rate, tokens + static_cast<double>(now - last_update) * rate / 1000.0);
+                                }
+                                last_update = now;
+                        }
+
+                        void take(const uint64_t n) noexcept {
+                                if (rate) {
+                                        tokens -= n;
+                                }
+                        }
+
+                        // milliseconds until we can proceed
+                        uint64_t delay() const noexcept {
+                                return rate && tokens <= 0 ? static_cast<uint64_t>(-tokens * 1000.0 / rate) + 1 : 0;
+                        }
                 };
 
                 simple_allocator                                                                           allocator{4096};
                 robin_hood::unordered_map<uint16_t, partition_ctx *>                                       map;
                 std::vector<partition_ctx *>                                                               pending;
                 std::vector<std::pair<TankClient::topic_partition, std::pair<uint64_t, uint32_t>>>         inputs;
-                std::vector<uint8_t>                                                                       outputsOrder;
                 uint16_t                                                                                   src_partitions_cnt{0};
                 std::vector<std::pair<TankClient::topic_partition, std::vector<TankClient::consumed_msg>>> collected_withseqnum;
-                std::vector<std::pair<TankClient::topic_partition, std::vector<TankClient::msg>>>          collected;
-                std::vector<bool>                                                                          collections_tracker;
+                std::vector<std::pair<TankClient::topic_partition, std::vector<TankClient::raw_bundle>>>   collected_bundles;
+                std::vector<uint32_t>                                                                      completed_consume_reqs;
                 static constexpr bool                                                                      trace{false};
                 static constexpr size_t                                                                    min_fetch_size = 16 * 1024 * 1024;
+                rate_limiter                                                                               bytes_limiter{max_bytes_per_sec, static_cast<double>(max_bytes_per_sec), Timings::Milliseconds::Tick()};
+                rate_limiter                                                                               msgs_limiter{max_msgs_per_sec, static_cast<double>(max_msgs_per_sec), Timings::Milliseconds::Tick()};
+                uint64_t                                                                                   next_consume_ts{0}, next_report_ts{0};
+                size_t                                                                                     inflight{0};
+                uint64_t                                                                                   total_bytes{0}, total_msgs{0}, total_raw_bundles{0};
 
                 while (tank_client.should_poll()) {
                         tank_client.poll(1e3);
@@ -1137,7 +1262,7 @@ int main(int argc, char *argv[]) {
 
                                 pending.reserve(n);
                                 if (n) {
-                                        all = static_cast<partition_ctx **>(malloc(sizeof(partition_ctx *) * n));
+                                        all = static_cast<partition_ctx **>(calloc(n, sizeof(partition_ctx *)));
                                 }
 
                                 for (unsigned i = 0; i < v.watermarks.size(); ++i) {
@@ -1149,12 +1274,13 @@ int main(int argc, char *argv[]) {
                                                         Print("From source(accept) ", i, " from ", p->second + 1, "\n");
                                                 }
 
-                                                partition->id         = i;
-                                                partition->pending    = true;
-                                                partition->nextBase   = UINT64_MAX;
-                                                partition->last       = 0;
-                                                partition->next       = p->second + 1;
-                                                partition->fetch_size = min_fetch_size;
+                                                partition->id             = i;
+                                                partition->state          = partition_ctx::State::Idle;
+                                                partition->next           = p->second + 1;
+                                                partition->fetch_size     = min_fetch_size;
+                                                partition->consume_req_id = 0;
+                                                partition->pending_acks   = 0;
+                                                partition->rebundle       = false;
 
                                                 pending.emplace_back(partition);
                                                 all[partition->id] = partition;
@@ -1191,212 +1317,254 @@ int main(int argc, char *argv[]) {
                 Print("Will now mirror ", dotnotation_repr(map.size()), " partitions of ", ansifmt::bold, topicPartition.first, ansifmt::reset, "\n");
                 Print("You can safely abort mirroring by stoping this tank-cli process (e.g CTRL-C or otherwise). Next mirror session will pick up mirroring from where this session ended\n");
 
-                for (reqId1 = 0;;) {
-                        if (!reqId1 && !pending.empty() && !dest.should_poll()) {
-                                inputs.clear();
-                                for (const auto it : pending) {
-                                        if (verbose) {
-                                                Print("Scheduling for partition ", it->id, " from ", it->next, "\n");
-                                        }
+                const auto make_idle = [&](partition_ctx *p) {
+                        TANK_EXPECT(p->state != partition_ctx::State::Idle);
 
-                                        it->pending = false;
-                                        inputs.emplace_back(
-                                            std::make_pair(TankClient::topic_partition{
-                                                               topicPartition.first,
-                                                               it->id},
-                                                           std::make_pair(it->next, it->fetch_size)));
-                                }
+                        p->state = partition_ctx::State::Idle;
+                        pending.emplace_back(p);
+                        --inflight;
+                };
 
-                                reqId1 = tank_client.consume(inputs, 100, 1);
+                for (;;) {
+                        const auto now = Timings::Milliseconds::Tick();
+                        uint64_t   throttle_delay;
 
-                                if (!reqId1) {
-                                        Print("Failed to issue consume request\n");
-                                        return 1;
-                                }
+                        bytes_limiter.refill(now);
+                        msgs_limiter.refill(now);
+                        throttle_delay = std::max(bytes_limiter.delay(), msgs_limiter.delay());
 
-                                pending.clear();
+                        if (now < next_consume_ts) {
+                                throttle_delay = std::max(throttle_delay, next_consume_ts - now);
                         }
 
-                        tank_client.poll(8000);
+                        if (!throttle_delay && !pending.empty() && inflight < max_inflight_partitions) {
+                                const auto n           = std::min(pending.size(), max_inflight_partitions - inflight);
+                                const auto capture_raw = [pass_through](const partition_ctx *p) noexcept {
+                                        return pass_through && !p->rebundle;
+                                };
 
-                        if (!tank_client.faults().empty()) {
-                                for (const auto &it : tank_client.faults()) {
-                                        if (it.type == TankClient::fault::Type::BoundaryCheck) {
-                                                auto       partition = all[it.partition];
-                                                const auto to        = it.adjust_seqnum_by_boundaries(partition->next);
+                                // raw bundles capture is set per consume request, so we may need two of them
+                                for (const auto raw : {true, false}) {
+                                        inputs.clear();
+                                        for (size_t i{0}; i < n; ++i) {
+                                                auto it = pending[i];
 
-                                                if (verbose) {
-                                                        Print("Adjusted seqnunce number for partition from ", it.partition, " ", partition->next, " => ", to, "\n");
+                                                if (capture_raw(it) != raw) {
+                                                        continue;
                                                 }
 
-                                                partition->next = to;
-                                                if (!partition->pending) {
-                                                        partition->pending = true;
-                                                        pending.emplace_back(partition);
+                                                // don't fetch much more than what we are allowed to transfer/second
+                                                const auto fetch_size = max_bytes_per_sec
+                                                                            ? std::max<size_t>(std::min<size_t>(it->fetch_size, max_bytes_per_sec), 64 * 1024)
+                                                                            : it->fetch_size;
+
+                                                if (verbose) {
+                                                        Print("Scheduling for partition ", it->id, " from ", it->next, raw ? "" : " (rebundle)", "\n");
                                                 }
-                                        } else {
-                                                consider_fault(it);
-                                                return 1;
-                                        }
-                                }
 
-                                reqId1 = 0;
-                        }
+                                                inputs.emplace_back(
+                                                    std::make_pair(TankClient::topic_partition{
+                                                                       topicPartition.first,
+                                                                       it->id},
+                                                                   std::make_pair(it->next, fetch_size)));
+                                        }
 
-                        if (tank_client.consumed().empty()) {
-                                continue;
-                        }
+                                        if (inputs.empty()) {
+                                                continue;
+                                        }
 
-                        reqId1 = 0;
-                        collected.clear();
-                        collected_withseqnum.clear();
-                        collections_tracker.clear();
+                                        tank_client.set_capture_raw_bundles(raw);
+                                        reqId1 = tank_client.consume(inputs, 100, 1);
 
-                        for (const auto &it : tank_client.consumed()) {
-                                const auto partition = all[it.partition];
-                                const auto n         = it.msgs.size();
+                                        if (!reqId1) {
+                                                Print("Failed to issue consume request\n");
+                                                return 1;
+                                        }
 
-                                partition->fetch_size = std::max<size_t>(min_fetch_size, it.next.minFetchSize);
+                                        for (size_t i{0}; i < n; ++i) {
+                                                auto it = pending[i];
 
-                                if (0 == n) {
-                                        if (!partition->pending) {
-                                                partition->pending = true;
-                                                pending.emplace_back(partition);
+                                                if (capture_raw(it) == raw) {
+                                                        it->state          = partition_ctx::State::Consuming;
+                                                        it->consume_req_id = reqId1;
+                                                }
                                         }
+                                }
 
-                                        continue;
+                                for (size_t i{0}; i < n; ++i) {
+                                        pending[i]->rebundle = false;
                                 }
 
-                                const auto data     = it.msgs.offset;
-                                auto       expected = partition->last + 1;
+                                pending.erase(pending.begin(), pending.begin() + n);
+                                inflight += n;
 
-                                if (trace) {
-                                        SLog("n = ", n, ", expected = ", expected, "\n");
+                                if (sleepTime) {
+                                        next_consume_ts = now + sleepTime;
                                 }
+                        }
 
-                                TANK_EXPECT(it.topic);
-                                for (size_t i{0}; i < n;) {
-                                        size_t     sum         = 0;
-                                        const auto upto        = std::min<size_t>(n, i + bundleMsgsSetCntThreshold);
-                                        bool       need_sparse = false;
-                                        auto       k           = i;
+                        const auto src_busy  = tank_client.should_poll();
+                        const auto dest_busy = dest.should_poll();
+                        // if we need to poll both, we can't block on either for long
+                        const uint32_t timeout = src_busy && dest_busy ? 2 : throttle_delay ? std::min<uint64_t>(throttle_delay, 1000) : 1000;
 
-                                        // need to figure out if we are going
-                                        // to need a *sparse* bundle or not here
-                                        do {
-                                                const auto &m = data[k];
+                        if (!src_busy && !dest_busy) {
+                                // throttled, or nothing to do
+                                Timings::Milliseconds::Sleep(timeout);
+                                continue;
+                        }
 
-                                                need_sparse |= (expected != m.seqNum);
-                                                expected = m.seqNum + 1;
+                        if (src_busy) {
+                                tank_client.poll(timeout);
 
-                                                sum += m.key.size() + m.content.size();
-                                        } while (++k < upto && sum < bundleMsgsSetSizeThreshold);
+                                completed_consume_reqs.clear();
+                                for (const auto &it : tank_client.faults()) {
+                                        if (it.type == TankClient::fault::Type::BoundaryCheck) {
+                                                auto       partition = all[it.partition];
+                                                const auto to        = it.adjust_seqnum_by_boundaries(partition->next);
 
-                                        const auto span = k - i;
+                                                if (verbose) {
+                                                        Print("Adjusted seqnunce number for partition from ", it.partition, " ", partition->next, " => ", to, "\n");
+                                                }
 
-                                        if (trace && false) {
-                                                SLog("span = ", span, ", need_sparse = ", need_sparse, "\n");
+                                                if (to != partition->next) {
+                                                        // first bundle past the gap needs to be re-bundled as a SPARSE bundle
+                                                        partition->rebundle = true;
+                                                }
+
+                                                partition->next = to;
+                                                completed_consume_reqs.emplace_back(it.clientReqId);
+                                                make_idle(partition);
+                                        } else {
+                                                consider_fault(it);
+                                                return 1;
                                         }
+                                }
 
-                                        if (need_sparse) {
-                                                std::vector<TankClient::consumed_msg> msgs;
+                                collected_withseqnum.clear();
+                                collected_bundles.clear();
 
-                                                msgs.reserve(span);
-                                                while (i < k) {
-                                                        msgs.emplace_back(data[i++]);
-                                                }
+                                for (const auto &it : tank_client.consumed()) {
+                                        const auto partition = all[it.partition];
+                                        const auto n         = it.msgs.size();
+                                        const auto data      = it.msgs.offset;
+                                        uint64_t   bytes{0}, msgs_cnt{n};
 
-                                                TANK_EXPECT(!msgs.empty());
-                                                collected_withseqnum.emplace_back(std::make_pair(std::make_pair(it.topic, it.partition), std::move(msgs)));
-                                                collections_tracker.emplace_back(true);
-                                        } else {
-                                                std::vector<TankClient::msg> msgs;
+                                        TANK_EXPECT(it.topic);
+                                        TANK_EXPECT(partition->state == partition_ctx::State::Consuming);
+
+                                        completed_consume_reqs.emplace_back(it.clientReqId);
+                                        partition->fetch_size   = std::max<size_t>(min_fetch_size, it.next.minFetchSize);
+                                        partition->next         = it.next.seqNum;
+                                        partition->pending_acks = 0;
+
+                                        for (size_t i{0}; i < n;) {
+                                                size_t                                sum  = 0;
+                                                const auto                            upto = std::min<size_t>(n, i + bundleMsgsSetCntThreshold);
+                                                std::vector<TankClient::consumed_msg> msgs;
 
-                                                msgs.reserve(span);
                                                 do {
                                                         const auto &m = data[i++];
 
-                                                        msgs.emplace_back(TankClient::msg{
-                                                            .content = m.content,
-                                                            .ts      = m.ts,
-                                                            .key     = m.key});
-                                                } while (i < k);
-
-                                                TANK_EXPECT(!msgs.empty());
-                                                collected.emplace_back(std::make_pair(
-                                                    std::make_pair(it.topic, it.partition), std::move(msgs)));
+                                                        sum += m.key.size() + m.content.size();
+                                                        msgs.emplace_back(m);
+                                                } while (i < upto && sum < bundleMsgsSetSizeThreshold);
 
-                                                collections_tracker.emplace_back(false);
+                                                bytes += sum;
+                                                collected_withseqnum.emplace_back(std::make_pair(std::make_pair(it.topic, it.partition), std::move(msgs)));
+                                                ++partition->pending_acks;
                                         }
-                                }
 
-                                partition->last = data[n - 1].seqNum;
-                                partition->next = it.next.seqNum;
-                        }
+                                        if (const auto cnt = it.bundles.size()) {
+                                                if (n) {
+                                                        // We can't produce both in the same round, because they will be delivered
+                                                        // in distinct requests, and we need to respect the order. Re-bundled messages
+                                                        // always come first, so we 'll consume those bundles again next time
+                                                        partition->next = it.bundles.offset[0].first_msg_seqnum;
+                                                } else {
+                                                        std::vector<TankClient::raw_bundle> bundles(it.bundles.offset, it.bundles.offset + cnt);
 
-                        const auto cnt = collections_tracker.size();
-                        uint32_t   collected_i{0}, collected_withseqnum_i{0};
+                                                        for (const auto &b : bundles) {
+                                                                bytes += b.content.size();
+                                                                msgs_cnt += b.msgs_cnt;
+                                                        }
 
-                        TANK_EXPECT(cnt == collected.size() + collected_withseqnum.size());
+                                                        if (trace) {
+                                                                SLog("Will forward ", cnt, " bundles for ", it.partition, " [", bundles.front().first_msg_seqnum, ", ", bundles.back().last_msg_seqnum, "]\n");
+                                                        }
 
-                        if (trace) {
-                                SLog("cnt = ", cnt, "\n");
-                        }
+                                                        total_raw_bundles += cnt;
+                                                        partition->pending_acks += cnt;
+                                                        collected_bundles.emplace_back(std::make_pair(std::make_pair(it.topic, it.partition), std::move(bundles)));
+                                                }
+                                        }
 
-                        // we need to do this in order
-                        // for now, we can't guarantee that they will be processed in order and in sequence, rather they will
-                        // likely be processed in parallel, and thus, we can't guarantee that the messages will be persisted in the correct order
-                        // so for now, we 'll just do it one request/time.
-                        // We may support chaining requests in the future in the client though
-                        for (size_t i = 0; i < cnt;) {
-                                const auto base = i;
-                                const auto b    = collections_tracker[i];
-                                uint32_t   req_id;
+                                        bytes_limiter.take(bytes);
+                                        msgs_limiter.take(msgs_cnt);
+                                        total_bytes += bytes;
+                                        total_msgs += msgs_cnt;
 
-                                do {
-                                        //
-                                } while (++i < cnt && collections_tracker[i] == b);
+                                        if (partition->pending_acks) {
+                                                partition->state = partition_ctx::State::Producing;
+                                        } else {
+                                                make_idle(partition);
+                                        }
+                                }
 
-                                const auto span = i - base;
+                                if (!completed_consume_reqs.empty()) {
+                                        // partitions that were not reported in a completed response(e.g because of faults for other partitions)
+                                        // will need to be consumed again
+                                        for (const auto &it : map) {
+                                                auto p = it.second;
 
-                                if (trace) {
-                                        SLog("FOR ", static_cast<bool>(b), " ", span, "\n");
+                                                if (p->state == partition_ctx::State::Consuming &&
+                                                    std::find(completed_consume_reqs.begin(), completed_consume_reqs.end(), p->consume_req_id) != completed_consume_reqs.end()) {
+                                                        make_idle(p);
+                                                }
+                                        }
                                 }
 
-                                if (b) {
-                                        req_id = dest.produce_with_seqnum(collected_withseqnum.data() + collected_withseqnum_i, span);
-                                        collected_withseqnum_i += span;
-                                } else {
-                                        req_id = dest.produce(collected.data() + collected_i, span);
-                                        collected_i += span;
+                                if (!collected_withseqnum.empty()) {
+                                        if (!dest.produce_with_seqnum(collected_withseqnum)) {
+                                                Print("Failed to produce to destination\n");
+                                                return 1;
+                                        }
                                 }
 
-                                if (!req_id) {
-                                        Print("Failed to produce to destination\n");
-                                        return 1;
+                                if (!collected_bundles.empty()) {
+                                        if (!dest.produce_bundles_with_seqnum(collected_bundles)) {
+                                                Print("Failed to produce to destination\n");
+                                                return 1;
+                                        }
                                 }
+                        }
 
-                                while (dest.should_poll()) {
-                                        dest.poll(1000);
+                        if (dest.should_poll()) {
+                                dest.poll(src_busy ? 0 : timeout);
 
-                                        if (!dest.faults().empty()) {
-                                                for (const auto &it : dest.faults()) {
-                                                        consider_fault(it);
-                                                }
-                                                return 1;
+                                if (!dest.faults().empty()) {
+                                        for (const auto &it : dest.faults()) {
+                                                consider_fault(it);
                                         }
+                                        return 1;
+                                }
 
-                                        for (const auto &it : dest.produce_acks()) {
-                                                const auto partition = it.partition;
-                                                auto       p         = all[partition];
+                                for (const auto &it : dest.produce_acks()) {
+                                        auto p = all[it.partition];
 
-                                                if (!p->pending) {
-                                                        p->pending = true;
-                                                        pending.emplace_back(p);
-                                                }
+                                        TANK_EXPECT(p->state == partition_ctx::State::Producing);
+                                        TANK_EXPECT(p->pending_acks);
+
+                                        if (0 == --(p->pending_acks)) {
+                                                make_idle(p);
                                         }
                                 }
                         }
+
+                        if (verbose && total_msgs && now >= next_report_ts) {
+                                next_report_ts = now + 5000;
+                                Print("Mirrored ", dotnotation_repr(total_msgs), " messages, ", size_repr(total_bytes), ", ", dotnotation_repr(total_raw_bundles), " bundles passed-through\n");
+                        }
                 }
 
                 return 0;
@@ -1819,6 +1987,7 @@ int main(int argc, char *argv[]) {
                                         Print("Type can be:\n");
                                         Print("p2c:  Measures latency when producing from client to broker and consuming(tailing) the broker that message\n");
                                         Print("p2b:  Measures latency when producing from client to broker\n");
+                                        Print("failover: Produces continuously and measures produce latency and unavailability windows, e.g while partition leadership changes\n");
                                         Print("Options include:\n");
                                         return 0;
 
@@ -2015,6 +2184,144 @@ int main(int argc, char *argv[]) {
                                         return 0;
                                 }
                         }
+                } else if (type.Eq(_S("failover"))) {
+                        // Produce for a while, one request at a time, and track how long each request took to be acknowledged
+                        // and for how long we were unable to produce. In cluster mode a produce request is acknowledged once
+                        // the partition's ISR have it, so latencies also reflect replication lag.
+                        size_t   size{128}, batchSize{1};
+                        uint64_t duration{60}, interval{10};
+
+                        optind = 0;
+                        while ((r = getopt(argc, argv, "+hs:B:d:i:R")) != -1) {
+                                switch (r) {
+                                        case 's':
+                                                size = strwlen32_t(optarg).AsUint32();
+                                                break;
+
+                                        case 'B':
+                                                batchSize = strwlen32_t(optarg).AsUint32();
+                                                break;
+
+                                        case 'd':
+                                                duration = strwlen32_t(optarg).AsUint32();
+                                                break;
+
+                                        case 'i':
+                                                interval = strwlen32_t(optarg).AsUint32();
+                                                break;
+
+                                        case 'R':
+                                                tank_client.set_compression_strategy(TankClient::CompressionStrategy::CompressNever);
+                                                break;
+
+                                        case 'h':
+                                                Print("Produces to the selected partition until the benchmark duration elapses, and reports produce latencies and the unavailability windows, i.e\n");
+                                                Print("how long it took for produce requests to succeed again after they begun failing(e.g because the partition leader went away)\n");
+                                                Print("You can kill or restart cluster nodes while this is running to measure failover time\n");
+                                                Print("Options include:\n");
+                                                Print("-s message content length (default 128 bytes)\n");
+                                                Print("-B batch size(default 1)\n");
+                                                Print("-d duration in seconds(default 60)\n");
+                                                Print("-i interval between produce requests in milliseconds(default 10)\n");
+                                                Print("-R: do not compress bundle\n");
+                                                return 0;
+
+                                        default:
+                                                return 1;
+                                }
+                        }
+                        argc -= optind;
+                        argv += optind;
+
+                        auto     data = std::make_unique<char[]>(size + 16);
+                        uint64_t state{0};
+
+                        for (uint32_t i{0}; i != size; ++i) {
+                                state = lcrng(state);
+
+                                data[i] = (state >> 32) & 0xff;
+                        }
+
+                        const strwlen32_t            content(data.get(), size);
+                        std::vector<TankClient::msg> msgs(batchSize, TankClient::msg{content, 0, {}});
+                        std::vector<uint64_t>        latencies, windows;
+                        const auto                   end = Timings::Milliseconds::Tick() + duration * 1000;
+                        uint64_t                     failing_since{0}, sent_at{0}, next_produce{0};
+                        uint32_t                     pending{0}, faults_cnt{0};
+
+                        Print("Will produce to ", topicPartition.first, "/", topicPartition.second, " for ", duration_repr(Timings::Seconds::ToMicros(duration)), "\n");
+
+                        for (;;) {
+                                const auto now = Timings::Milliseconds::Tick();
+
+                                if (now >= end) {
+                                        break;
+                                }
+
+                                if (!pending && now >= next_produce) {
+                                        sent_at = Timings::Microseconds::Tick();
+                                        pending = tank_client.produce({{topicPartition, msgs}});
+
+                                        if (!pending) {
+                                                Print("Unable to schedule publisher request\n");
+                                                return 1;
+                                        }
+                                }
+
+                                tank_client.poll(pending ? 100 : std::min<uint64_t>(next_produce - now, 100));
+
+                                for (const auto &it : tank_client.produce_acks()) {
+                                        if (it.clientReqId != pending) {
+                                                continue;
+                                        }
+
+                                        latencies.emplace_back(Timings::Microseconds::Since(sent_at));
+                                        if (failing_since) {
+                                                windows.emplace_back(Timings::Microseconds::Tick() - failing_since);
+                                                failing_since = 0;
+                                        }
+
+                                        pending      = 0;
+                                        next_produce = Timings::Milliseconds::Tick() + interval;
+                                }
+
+                                for (const auto &it : tank_client.faults()) {
+                                        if (it.clientReqId != pending) {
+                                                continue;
+                                        }
+
+                                        if (!failing_since) {
+                                                failing_since = sent_at;
+                                        }
+
+                                        ++faults_cnt;
+                                        pending = 0;
+                                        // retry ASAP, but don't spin
+                                        next_produce = Timings::Milliseconds::Tick() + std::min<uint64_t>(interval, 50);
+                                }
+                        }
+
+                        if (failing_since) {
+                                windows.emplace_back(Timings::Microseconds::Tick() - failing_since);
+                        }
+
+                        const auto percentile = [](const std::vector<uint64_t> &v, const double p) -> uint64_t {
+                                return v.empty() ? 0 : v[std::min<size_t>(v.size() - 1, v.size() * p)];
+                        };
+
+                        std::sort(latencies.begin(), latencies.end());
+                        std::sort(windows.begin(), windows.end());
+
+                        Print("Acknowledged ", dotnotation_repr(latencies.size()), " produce requests, ", dotnotation_repr(faults_cnt), " faults\n");
+                        Print("Produce latency p50 = ", duration_repr(percentile(latencies, 0.5)),
+                              ", p99 = ", duration_repr(percentile(latencies, 0.99)),
+                              ", p99.9 = ", duration_repr(percentile(latencies, 0.999)),
+                              ", max = ", duration_repr(latencies.empty() ? 0 : latencies.back()), "\n");
+                        Print(dotnotation_repr(windows.size()), " unavailability windows");
+                        if (!windows.empty()) {
+                                Print(", p50 = ", duration_repr(percentile(windows, 0.5)), ", max = ", duration_repr(windows.back()));
+                        }
+                        Print("\n");
                 } else {
                         Print("Unknown benchmark type\n");
                         return 1;
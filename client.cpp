@@ -1,5 +1,8 @@
 #include "client_common.h"
 #include <sys/eventfd.h>
+#ifdef HAVE_TANK_TLS
+#include <openssl/ssl.h>
+#endif
 
 TankClient::TankClient(const strwlen32_t endpoints) {
         interrupt_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
@@ -31,6 +34,12 @@ TankClient::~TankClient() {
         }
 
         reset(true);
+
+#ifdef HAVE_TANK_TLS
+        if (tls_ctx) {
+                SSL_CTX_free(tls_ctx);
+        }
+#endif
 }
 
 // XXX: we may have missed something here, and it's important that we get it right otherwise we
@@ -82,7 +91,8 @@ void TankClient::reset(const bool dtor_context) {
 
                 eb64_delete(&br->unreachable_brokers_tree_node);
 
-                br->reachability = broker::Reachability::MaybeReachable;
+                br->reachability    = broker::Reachability::MaybeReachable;
+                br->throttled_until = 0;
                 br->ch.reset();
 
                 if (dtor_context || (0 == (br->flags & (1u << unsigned(broker::Flags::Important))))) {
@@ -162,6 +172,10 @@ void TankClient::reset(const bool dtor_context) {
                 c->throttler.write.ll.try_detach_and_reset();
 #endif
 
+#ifdef HAVE_TANK_TLS
+                release_tls(c);
+#endif
+
                 if (auto b = std::exchange(c->in.b, nullptr)) {
                         release_mb(b);
                 }
@@ -188,6 +202,8 @@ void TankClient::reset(const bool dtor_context) {
         unreachable_brokers_tree  = EB_ROOT;
 
         api_reqs_expirations_tree_next = timers_ebtree_next = retry_bundles_next = unreachable_brokers_tree_next = std::numeric_limits<uint64_t>::max();
+        throttled_brokers.clear();
+        throttled_brokers_next = std::numeric_limits<uint64_t>::max();
 #ifdef HAVE_NETIO_THROTTLE
         throttled_connections_read_list_next = throttled_connections_write_list_next = std::numeric_limits<uint64_t>::max();
 #endif
@@ -217,6 +233,7 @@ void TankClient::reset(const bool dtor_context) {
 
         ranges.clear();
         leaders.clear();
+        preferred_replicas.ruled_out.clear();
         ready_responses.clear();
         pending_responses.clear();
         rsrc_tracker.clear();
@@ -274,6 +291,48 @@ void TankClient::set_leader(const str_view8 topic, const uint16_t partition, con
         leaders[topic_partition{topic, partition}] = e;
 }
 
+void TankClient::set_preferred_replicas(const std::vector<Switch::endpoint> &endpoints) {
+        preferred_replicas.endpoints = endpoints;
+        preferred_replicas.ruled_out.clear();
+}
+
+// Returns the preferred broker to consume from for that partition, if any
+// The partition's position in the preferred endpoints list is determined by the partition index, so that partitions are spread across them
+Switch::endpoint TankClient::preferred_replica(const str_view8 topic, const uint16_t partition) {
+        // after that long, we 'll try the ruled out preferred endpoints again; they may have joined the ISR or caught up since
+        static constexpr uint64_t retry_after_ms{30 * 1000};
+        const auto &              endpoints = preferred_replicas.endpoints;
+        uint8_t                   skip{0};
+
+        if (endpoints.empty()) {
+                return {};
+        }
+
+        if (const auto it = preferred_replicas.ruled_out.find(topic_partition{topic, partition}); it != preferred_replicas.ruled_out.end()) {
+                if (now_ms - it->second.since >= retry_after_ms) {
+                        preferred_replicas.ruled_out.erase(it);
+                } else if (it->second.cnt >= endpoints.size()) {
+                        return {};
+                } else {
+                        skip = it->second.cnt;
+                }
+        }
+
+        return endpoints[(partition + skip) % endpoints.size()];
+}
+
+// Invoked when the broker e redirected a consume request for that partition to its leader
+void TankClient::rule_out_preferred_replica(const str_view8 topic, const uint16_t partition, const Switch::endpoint e) {
+        if (!e || preferred_replica(topic, partition) != e) {
+                return;
+        }
+
+        const auto res = preferred_replicas.ruled_out.emplace(topic_partition{topic, partition},
+                                                              decltype(preferred_replicas)::partition_state{0, now_ms});
+
+        ++res.first->second.cnt;
+}
+
 Switch::endpoint TankClient::leader_for(const str_view8 topic, const uint16_t partition) {
         if (const auto it = leaders.find(topic_partition{topic, partition}); it != leaders.end()) {
                 return it->second;
@@ -34,6 +34,14 @@ bool TankClient::process_msg(connection *const c, const uint8_t msg, const uint8
                 case TankAPIMsgType::Status:
                         return process_srv_status(c, content, len);
 
+                case TankAPIMsgType::JoinGroup:
+                case TankAPIMsgType::CommitOffsets:
+                case TankAPIMsgType::FetchOffsets:
+                        return process_consumer_group_resp(c, TankAPIMsgType(msg), content, len);
+
+                case TankAPIMsgType::Throttle:
+                        return process_throttle(c, content, len);
+
                 case TankAPIMsgType::Ping:
                         if (trace) {
                                 SLog("PING\n");
@@ -47,3 +55,33 @@ bool TankClient::process_msg(connection *const c, const uint8_t msg, const uint8
         }
 }
 
+
+// The broker exceeded a client or topic quota processing request req_id, and we are asked to back off
+// We won't transmit requests to it until then; see try_transmit() and check_throttled_brokers()
+bool TankClient::process_throttle(connection *const c, const uint8_t *const content, const size_t len) {
+        static constexpr bool trace{false};
+
+        if (unlikely(len < sizeof(uint32_t) + sizeof(uint32_t))) {
+                shutdown(c, __LINE__);
+                return false;
+        }
+
+        const auto *p          = content;
+        const auto  req_id     = decode_pod<uint32_t>(p);
+        const auto  delay      = decode_pod<uint32_t>(p);
+        auto        br         = c->as.tank.br;
+        const auto  throttled  = br->throttled_until != 0;
+        const auto  until      = now_ms + delay;
+
+        if (trace) {
+                SLog("Throttled by ", br->ep, " for ", duration_repr(Timings::Milliseconds::ToMicros(delay)), " (request ", req_id, ")\n");
+        }
+
+        br->throttled_until    = std::max(br->throttled_until, until);
+        throttled_brokers_next = std::min(throttled_brokers_next, br->throttled_until);
+        if (!throttled) {
+                throttled_brokers.emplace_back(br);
+        }
+
+        return true;
+}
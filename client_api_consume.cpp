@@ -1,4 +1,5 @@
 #include "client_common.h"
+#include "bundle_columnar.h"
 
 // build a consume payload for a broker API request
 TankClient::broker_outgoing_payload *TankClient::build_consume_broker_req_payload(const broker_api_request *broker_req) {
@@ -17,9 +18,9 @@ TankClient::broker_outgoing_payload *TankClient::build_consume_broker_req_payloa
         b->pack(static_cast<uint8_t>(TankAPIMsgType::Consume)); // request type
         b->pack(static_cast<uint32_t>(0));                      // size (will patch)
 
-        b->pack(static_cast<uint16_t>(2)); // client version
+        b->pack(static_cast<uint16_t>(3)); // client version
         b->pack(broker_req->id);
-        b->pack(""_s8); // client identifier
+        b->pack(clientId); // client identifier
         b->pack(api_req->as.consume.max_wait);
         b->pack(static_cast<uint32_t>(api_req->as.consume.min_size));
 
@@ -158,9 +159,10 @@ uint32_t TankClient::consume(const std::pair<topic_partition, std::pair<uint64_t
         }
 
         // initialize the api request for consume
-        api_req->as.consume.max_wait = max_wait;
-        api_req->as.consume.min_size = min_size;
-        api_req->type                = api_request::Type::Consume;
+        api_req->as.consume.max_wait            = max_wait;
+        api_req->as.consume.min_size            = min_size;
+        api_req->as.consume.capture_raw_bundles = behavior.capture_raw_bundles;
+        api_req->type                           = api_request::Type::Consume;
 
         // we could have a generic method that returns
         // a decltype(contexts) and then we would
@@ -183,7 +185,7 @@ uint32_t TankClient::consume(const std::pair<topic_partition, std::pair<uint64_t
                 // would save us an unordered_map<>::emplace.
                 //
                 // We are not doing this for now though.
-                auto broker = partition_leader(topic, partition) ?: any_broker();
+                auto broker = partition_leader(topic, partition, true) ?: any_broker();
 
                 // initialize the broker partition request context
                 req_part->topic     = topic;
@@ -252,6 +254,8 @@ bool TankClient::process_consume(connection *const c, const uint8_t *const conte
         const auto                           it            = pending_brokers_requests.find(req_id);
         str_view8                            key;
         std::vector<request_partition_ctx *> no_leader, retry; // TODO: reuse
+        static thread_local TANKUtil::columnar::msgset_reader columnar_tls;
+        auto &                                                columnar_reader{columnar_tls};
 
 #ifndef LEAN_SWITCH
         if (trace) {
@@ -275,14 +279,16 @@ bool TankClient::process_consume(connection *const c, const uint8_t *const conte
                 return true;
         }
 
-        auto                        br_req            = it->second;
-        auto                        api_req           = br_req->api_req;
-        auto                        br_req_partctx_it = br_req->partitions_list.next;
-        bool                        retain_buffer     = false;
-        const auto                  topics_cnt        = decode_pod<uint8_t>(p);
-        bool                        any_faults        = false;
-        [[maybe_unused]] const auto before            = Timings::Microseconds::Tick();
+        auto                        br_req              = it->second;
+        auto                        api_req             = br_req->api_req;
+        auto                        br_req_partctx_it   = br_req->partitions_list.next;
+        bool                        retain_buffer       = false;
+        const auto                  topics_cnt          = decode_pod<uint8_t>(p);
+        const auto                  capture_raw_bundles = api_req->as.consume.capture_raw_bundles;
+        bool                        any_faults          = false;
+        [[maybe_unused]] const auto before              = Timings::Microseconds::Tick();
         std::vector<IOBuffer *>     used_buffers; // TODO: reuse
+        std::vector<raw_bundle>     raw_bundles;  // TODO: reuse
 
         DEFER({
                 for (auto b : used_buffers) {
@@ -449,6 +455,7 @@ bool TankClient::process_consume(connection *const c, const uint8_t *const conte
                                         SLog(ansifmt::color_cyan, "Leader for ", topic_name, "/", partition_id, " is now ", ep, ansifmt::reset, "\n");
                                 }
 
+                                rule_out_preferred_replica(req_part->topic, req_part->partition, br_req->br->ep);
                                 set_leader(intern_topic(topic_name), partition_id, ep);
                                 retry.emplace_back(req_part);
 
@@ -486,9 +493,11 @@ bool TankClient::process_consume(connection *const c, const uint8_t *const conte
                         auto req_part = switch_list_entry(request_partition_ctx,
                                                           partitions_list_ll, br_req_partctx_it);
 
-                        // OK, we know that this broker is the current leader for this partition
+                        // OK, we know that this broker is the current leader for this partition, unless it's a preferred replica
                         // see comment sin TankClient::consume() about an optimization
-                        set_leader(req_part->topic, req_part->partition, br_req->br->ep);
+                        if (br_req->br->ep != preferred_replica(req_part->topic, req_part->partition)) {
+                                set_leader(req_part->topic, req_part->partition, br_req->br->ep);
+                        }
 
                         if (unlikely(p + sizeof(uint64_t) + sizeof(uint32_t) > end)) {
                                 if (trace) {
@@ -566,17 +575,24 @@ bool TankClient::process_consume(connection *const c, const uint8_t *const conte
                         size_t       consumed         = 0;
                         uint32_t     last_bucket_size = sizeof_array(msgs_bucket::data);
 
+                        // if we are capturing raw bundles, this is the sequence number
+                        // the next bundle needs to begin from to be captured as-is(unless it's a SPARSE bundle)
+                        uint64_t raw_next_seqnum = requested_seqnum;
+
                         if (trace) {
                                 SLog("partition bundles_chunk_len = ", bundles_chunk_len, " (", size_repr(bundles_chunk_len), "), drained_partition = ", drained_partition, "\n");
                         }
 
                         used_buffers.clear();
+                        raw_bundles.clear();
                         // process all bundles in this partition's bundles chunk
                         for (const auto *p = partition_bundles, *const chunk_end = std::min(end, bundles_chunk);;) {
                                 need_from = p;               // it's important to track need_from from the beginning of the bundl
                                 need_upto = need_from + 512; // 256 was a bit too low
 
-                                if (unlikely(!Compression::check_decode_varuint32(p, chunk_end))) {
+                                uint32_t bundle_len;
+
+                                if (unlikely(!Compression::decode_varuint32(p, chunk_end, &bundle_len))) {
                                         if (trace) {
                                                 SLog("Unable to decode bundle_len:", std::distance(need_from, chunk_end), " to end of the chunk. Consumed so far ", size_repr(std::distance(content, need_from)), "\n");
                                         }
@@ -584,8 +600,8 @@ bool TankClient::process_consume(connection *const c, const uint8_t *const conte
                                         break;
                                 }
 
-                                const auto bundle_len = Compression::decode_varuint32(p);
-                                const auto bundle_end = p + bundle_len;
+                                const auto bundle_start = p;
+                                const auto bundle_end   = p + bundle_len;
 
                                 // assume we will need until the end of the bundle at least
                                 // we will adjust this as we understand better the response structure
@@ -610,13 +626,17 @@ bool TankClient::process_consume(connection *const c, const uint8_t *const conte
                                 uint64_t                            msgset_end;
                                 range_base<const uint8_t *, size_t> msgset_content;
 
+                                if (unlikely(!TANKUtil::skip_bundle_extra_hdr(bundle_hdr_flags, p, chunk_end))) {
+                                        break;
+                                }
+
+                                const auto columnar = TANKUtil::bundle_is_columnar(bundle_start);
+
                                 if (0 == msgset_size) {
 					// message set(in messages) > 15
 					// so encoded separately as a varu32
-                                        if (unlikely(!Compression::check_decode_varuint32(p, chunk_end))) {
+                                        if (unlikely(!Compression::decode_varuint32(p, chunk_end, &msgset_size))) {
                                                 break;
-                                        } else {
-                                                msgset_size = Compression::decode_varuint32(p);
                                         }
                                 }
 
@@ -664,6 +684,53 @@ bool TankClient::process_consume(connection *const c, const uint8_t *const conte
                                         continue;
                                 }
 
+                                if (capture_raw_bundles && requested_seqnum != std::numeric_limits<uint64_t>::max()) {
+                                        const auto bundle_first_seqnum = sparse_bundle ? first_msg_seqnum : log_base_seqnum;
+
+                                        if (sparse_bundle ? bundle_first_seqnum >= raw_next_seqnum : bundle_first_seqnum == raw_next_seqnum) {
+                                                if (bundle_end > chunk_end) {
+                                                        // we need the whole bundle
+                                                        need_upto = bundle_end;
+                                                        break;
+                                                } else if (msgset_end - 1 > highwater_mark) {
+                                                        if (trace) {
+                                                                SLog("Raw bundle past HW mark\n");
+                                                        }
+
+                                                        goto next_partition;
+                                                }
+
+                                                raw_bundle rb;
+
+                                                rb.first_msg_seqnum = bundle_first_seqnum;
+                                                rb.last_msg_seqnum  = msgset_end - 1;
+                                                rb.msgs_cnt         = msgset_size;
+                                                rb.content.Set(bundle_start, bundle_len);
+                                                raw_bundles.emplace_back(rb);
+
+                                                if (trace) {
+                                                        SLog("Captured raw bundle [", rb.first_msg_seqnum, ", ", rb.last_msg_seqnum, "] of ", size_repr(bundle_len), "\n");
+                                                }
+
+                                                // bundles reference the connection's input buffer
+                                                retain_buffer   = true;
+                                                raw_next_seqnum = msgset_end;
+                                                log_base_seqnum = msgset_end;
+                                                p               = bundle_end;
+                                                continue;
+                                        } else if (!raw_bundles.empty()) {
+                                                // decoding this bundle would report messages past bundles we have already captured
+                                                // the next consume request will start from this bundle instead
+                                                goto next_partition;
+                                        }
+                                }
+
+                                if (columnar && bundle_end > chunk_end) {
+                                        // columnar message sets can only be decoded in full
+                                        need_upto = bundle_end;
+                                        break;
+                                }
+
                                 if (codec) {
                                         if (trace) {
                                                 SLog("Need to decompress for ", codec, ", ", std::distance(p, bundle_end), " bytes\n");
@@ -708,10 +775,70 @@ bool TankClient::process_consume(connection *const c, const uint8_t *const conte
                                 uint32_t   msg_idx             = 0;
                                 const auto min_accepted_seqnum = requested_seqnum == std::numeric_limits<uint64_t>::max() ? 0 : requested_seqnum;
 
+                                const auto capture_msg         = [&](const uint64_t msg_abs_seqnum, const str_view32 content) {
+                                        if (last_bucket_size == sizeof_array(msgs_bucket::data)) {
+                                                auto b = get_msgs_bucket();
+
+                                                b->next = nullptr;
+                                                if (last_bucket) {
+                                                        consumed += last_bucket_size;
+                                                        last_bucket->next = b;
+                                                } else {
+                                                        first_bucket = b;
+                                                }
+
+                                                last_bucket      = b;
+                                                last_bucket_size = 0;
+                                        }
+
+                                        auto m = last_bucket->data + last_bucket_size++;
+
+                                        any_captured = true;
+                                        m->seqNum    = msg_abs_seqnum;
+                                        m->content   = content;
+                                        m->ts        = ts;
+                                        m->key       = key;
+
+                                        if (trace && false) {
+                                                SLog("Got key = [", key, "] ts = ",
+                                                     Date::ts_repr(ts / 1000),
+                                                     ", content.len = ", size_repr(content.size()), "\n");
+                                        }
+                                };
+
                                 if (trace) {
                                         SLog("Scanning message set of length ", size_repr(msgset_content.size()), "\n");
                                 }
 
+                                if (columnar) {
+                                        str_view32 content;
+                                        uint32_t   seqnum_delta;
+
+                                        if (unlikely(!columnar_reader.reset(msgset_content.offset, msgset_content.offset + msgset_content.size(), msgset_size, sparse_bundle))) {
+                                                if (trace) {
+                                                        SLog("Malformed columnar message set\n");
+                                                }
+
+                                                goto next_partition;
+                                        }
+
+                                        for (; columnar_reader.next(&ts, &key, &content, &seqnum_delta); ++msg_idx, ++log_base_seqnum) {
+                                                if (sparse_bundle) {
+                                                        // see below
+                                                        log_base_seqnum = msg_idx ? log_base_seqnum + seqnum_delta : first_msg_seqnum;
+                                                }
+
+                                                if (log_base_seqnum > highwater_mark) {
+                                                        goto next_partition;
+                                                } else if (log_base_seqnum >= min_accepted_seqnum) {
+                                                        capture_msg(log_base_seqnum, content);
+                                                }
+                                        }
+
+                                        raw_next_seqnum = std::max(raw_next_seqnum, log_base_seqnum);
+                                        continue;
+                                }
+
                                 for (const auto *p = msgset_content.offset, *const msgset_end = p + msgset_content.size();; ++msg_idx, ++log_base_seqnum) {
                                         if (!codec && any_captured) {
                                                 // this makes sense because we didn't need to decompress the bundle
@@ -757,7 +884,9 @@ bool TankClient::process_consume(connection *const c, const uint8_t *const conte
                                                                 SLog("Last, setting to ", last_msg_seqnum, "\n");
                                                         }
                                                 } else {
-                                                        if (unlikely(!Compression::check_decode_varuint32(p, msgset_end))) {
+                                                        uint32_t delta;
+
+                                                        if (unlikely(!Compression::decode_varuint32(p, msgset_end, &delta))) {
                                                                 if (trace) {
                                                                         SLog("Can't decode delta\n");
                                                                 }
@@ -765,8 +894,6 @@ bool TankClient::process_consume(connection *const c, const uint8_t *const conte
                                                                 goto next_partition;
                                                         }
 
-                                                        const auto delta = Compression::decode_varuint32(p);
-
                                                         if (trace) {
                                                                 SLog("Advance by ", delta + 1, "\n");
                                                         }
@@ -816,7 +943,9 @@ bool TankClient::process_consume(connection *const c, const uint8_t *const conte
                                                 key.reset();
                                         }
 
-                                        if (unlikely(!Compression::check_decode_varuint32(p, msgset_end))) {
+                                        uint32_t len;
+
+                                        if (unlikely(!Compression::decode_varuint32(p, msgset_end, &len))) {
                                                 if (trace) {
                                                         SLog("Not Enough Content Available\n");
                                                 }
@@ -824,8 +953,6 @@ bool TankClient::process_consume(connection *const c, const uint8_t *const conte
                                                 goto next_partition;
                                         }
 
-                                        const auto len = Compression::decode_varuint32(p);
-
                                         if (trace) {
                                                 SLog("Message content length:", len, "\n");
                                         }
@@ -852,40 +979,14 @@ bool TankClient::process_consume(connection *const c, const uint8_t *const conte
 
                                                 goto next_partition;
                                         } else if (msg_abs_seqnum >= min_accepted_seqnum) {
-                                                const str_view32 content(reinterpret_cast<const char *>(p), len);
-
-                                                if (last_bucket_size == sizeof_array(msgs_bucket::data)) {
-                                                        auto b = get_msgs_bucket();
-
-                                                        b->next = nullptr;
-                                                        if (last_bucket) {
-                                                                consumed += last_bucket_size;
-                                                                last_bucket->next = b;
-                                                        } else {
-                                                                first_bucket = b;
-                                                        }
-
-                                                        last_bucket      = b;
-                                                        last_bucket_size = 0;
-                                                }
-
-                                                auto m = last_bucket->data + last_bucket_size++;
-
-                                                any_captured = true;
-                                                m->seqNum    = msg_abs_seqnum;
-                                                m->content   = content;
-                                                m->ts        = ts;
-                                                m->key       = key;
-
-                                                if (trace && false) {
-                                                        SLog("Got key = [", key, "] ts = ",
-                                                             Date::ts_repr(ts / 1000),
-                                                             ", content.len = ", size_repr(content.size()), "\n");
-                                                }
+                                                capture_msg(msg_abs_seqnum, str_view32(reinterpret_cast<const char *>(p), len));
                                         }
 
                                         p += len; // to next bundle for this partition
                                 }
+
+                                // all messages of this bundle were considered
+                                raw_next_seqnum = std::max(raw_next_seqnum, log_base_seqnum);
                         }
 
                 next_partition:
@@ -897,13 +998,18 @@ bool TankClient::process_consume(connection *const c, const uint8_t *const conte
 
                         auto       next          = br_req_partctx_it->next;
                         const auto next_min_span = std::distance(need_from, need_upto); // TODO: + 256
-                        const auto next_seqnum   = consumed
+                        auto       next_seqnum   = consumed
                                                      ? requested_seqnum == std::numeric_limits<uint64_t>::max()
                                                            ? last_bucket->data[last_bucket_size - 1].seqNum + 1
                                                            : std::max(requested_seqnum, last_bucket->data[last_bucket_size - 1].seqNum + 1)
                                                      : requested_seqnum == std::numeric_limits<uint64_t>::max() ? highwater_mark + 1 : requested_seqnum;
                         auto &req_part_resp = req_part->as_op.consume.response;
 
+                        if (!raw_bundles.empty()) {
+                                // raw bundles always follow any decoded messages
+                                next_seqnum = std::max(next_seqnum, raw_bundles.back().last_msg_seqnum + 1);
+                        }
+
                         if (trace) {
                                 SLog(ansifmt::bgcolor_red, "consumed = ", consumed,
                                      ", used_buffers = ", used_buffers.size(),
@@ -926,7 +1032,16 @@ bool TankClient::process_consume(connection *const c, const uint8_t *const conte
                         // older applications wouldn't be affected by the change in the semantics
                         //
                         // UPDATE: implemented
-                        req_part_resp.drained = drained_partition || (behavior.report_drain_if_consumed_upto_hwmark && consumed && last_bucket->data[last_bucket_size - 1].seqNum == highwater_mark);
+                        req_part_resp.drained = drained_partition || (behavior.report_drain_if_consumed_upto_hwmark && consumed && last_bucket->data[last_bucket_size - 1].seqNum == highwater_mark) || (behavior.report_drain_if_consumed_upto_hwmark && !raw_bundles.empty() && raw_bundles.back().last_msg_seqnum == highwater_mark);
+
+                        if (const auto n = raw_bundles.size()) {
+                                req_part_resp.bundles.cnt  = n;
+                                req_part_resp.bundles.list = static_cast<raw_bundle *>(malloc(sizeof(raw_bundle) * n));
+
+                                memcpy(req_part_resp.bundles.list, raw_bundles.data(), sizeof(raw_bundle) * n);
+                        } else {
+                                req_part_resp.bundles.cnt = 0;
+                        }
 
                         if (const auto n = used_buffers.size()) {
                                 req_part_resp.used_buffers.size = n;
@@ -0,0 +1,268 @@
+#include "client_common.h"
+
+// Consumer groups requests are all directed to a single broker (the group coordinator), which is always
+// any_broker() because consumer groups are only supported by standalone brokers.
+// JoinGroup and CommitOffsets requests are encoded when scheduled(api_request::as.consumer_group.content), whereas
+// FetchOffsets requests are encoded from the request_partition_ctx's associated with the broker request, so that we can
+// map the sequence numbers in the response back to them.
+uint32_t TankClient::schedule_consumer_group_req(const api_request::Type type, const str_view8 group, std::vector<request_partition_ctx *> &&req_parts, const str_view32 content) {
+        auto                                                      api_req = get_api_request(4 * 1000);
+        auto                                                      br      = any_broker();
+        std::vector<std::pair<broker *, request_partition_ctx *>> contexts;
+
+        api_req->type                          = type;
+        api_req->as.consumer_group.group.len   = group.size();
+        api_req->as.consumer_group.group.p     = group.Copy();
+        api_req->as.consumer_group.content.len = content.size();
+        api_req->as.consumer_group.content.p   = content ? content.Copy() : nullptr;
+
+        if (req_parts.empty()) {
+                auto req_part = get_request_partition_ctx(); // dummy
+
+                req_part->topic.reset();
+                req_part->partition                    = 0; // not used
+                req_part->as_op.join_group.assigned    = nullptr;
+                req_part->as_op.join_group.generation  = 0;
+                req_part->as_op.join_group.members_cnt = 0;
+                req_parts.emplace_back(req_part);
+        }
+
+        for (auto req_part : req_parts) {
+                contexts.emplace_back(std::make_pair(br, req_part));
+        }
+
+        assign_req_partitions_to_api_req(api_req.get(), &contexts);
+        return schedule_new_api_req(std::move(api_req));
+}
+
+uint32_t TankClient::join_group(const str_view8 group, const str_view8 member_id, const std::vector<str_view8> &topics, const uint32_t session_timeout_ms) {
+        IOBuffer content;
+
+        TANK_EXPECT(group);
+        TANK_EXPECT(member_id);
+        TANK_EXPECT(topics.size() <= std::numeric_limits<uint8_t>::max());
+
+        content.pack(member_id, session_timeout_ms, static_cast<uint8_t>(topics.size()));
+        for (const auto &t : topics) {
+                content.pack(t);
+        }
+
+        return schedule_consumer_group_req(api_request::Type::JoinGroup, group, {}, str_view32(content.data(), content.size()));
+}
+
+uint32_t TankClient::commit_offsets(const str_view8 group, const uint64_t generation, const std::vector<std::pair<topic_partition, uint64_t>> &offsets) {
+        std::vector<std::pair<topic_partition, uint64_t>> all(offsets.begin(), offsets.end());
+        IOBuffer                                          content;
+        uint8_t                                           topics_cnt{0};
+
+        TANK_EXPECT(group);
+
+        std::sort(all.begin(), all.end(), [](const auto &a, const auto &b) noexcept {
+                if (const auto r = a.first.first.Cmp(b.first.first); r < 0) {
+                        return true;
+                } else if (0 == r) {
+                        return a.first.second < b.first.second;
+                } else {
+                        return false;
+                }
+        });
+
+        content.pack(generation);
+        content.pack(static_cast<uint8_t>(0)); // patched
+
+        for (const auto *p = all.data(), *const e = p + all.size(); p < e;) {
+                const auto topic = p->first.first;
+                const auto base  = p;
+
+                TANK_EXPECT(topics_cnt != std::numeric_limits<uint8_t>::max());
+                content.pack(topic);
+                content.pack(static_cast<uint16_t>(0)); // patched
+
+                const auto cnt_offset = content.size() - sizeof(uint16_t);
+
+                do {
+                        content.pack(p->first.second, p->second);
+                } while (++p < e && p->first.first == topic);
+
+                *reinterpret_cast<uint16_t *>(content.data() + cnt_offset) = p - base;
+                ++topics_cnt;
+        }
+
+        *reinterpret_cast<uint8_t *>(content.data() + sizeof(uint64_t)) = topics_cnt;
+        return schedule_consumer_group_req(api_request::Type::CommitOffsets, group, {}, str_view32(content.data(), content.size()));
+}
+
+uint32_t TankClient::fetch_offsets(const str_view8 group, const std::vector<topic_partition> &partitions) {
+        std::vector<request_partition_ctx *> req_parts;
+
+        TANK_EXPECT(group);
+        TANK_EXPECT(!partitions.empty());
+        // see assign_req_partitions_to_api_req()
+        TANK_EXPECT(partitions.size() <= 250);
+
+        for (const auto &it : partitions) {
+                auto req_part = get_request_partition_ctx();
+
+                req_part->topic                      = intern_topic(it.first);
+                req_part->partition                  = it.second;
+                req_part->as_op.fetch_offset.seq_num = std::numeric_limits<uint64_t>::max();
+                req_parts.emplace_back(req_part);
+        }
+
+        return schedule_consumer_group_req(api_request::Type::FetchOffsets, group, std::move(req_parts), {});
+}
+
+TankClient::broker_outgoing_payload *TankClient::build_consumer_group_broker_req_payload(const broker_api_request *br_req) {
+        auto payload = new_req_payload(const_cast<broker_api_request *>(br_req));
+        auto b       = payload->b;
+        auto api_req = br_req->api_req;
+        TANK_EXPECT(api_req);
+        TANK_EXPECT(b);
+
+        switch (api_req->type) {
+                case api_request::Type::JoinGroup:
+                        b->pack(static_cast<uint8_t>(TankAPIMsgType::JoinGroup));
+                        break;
+
+                case api_request::Type::CommitOffsets:
+                        b->pack(static_cast<uint8_t>(TankAPIMsgType::CommitOffsets));
+                        break;
+
+                default:
+                        b->pack(static_cast<uint8_t>(TankAPIMsgType::FetchOffsets));
+                        break;
+        }
+        b->pack(static_cast<uint32_t>(0));
+
+        b->pack(br_req->id);
+        b->pack(api_req->as.consumer_group.group);
+
+        if (api_req->type == api_request::Type::FetchOffsets) {
+                // request partitions are sorted by (topic, partition); see assign_req_partitions_to_api_req()
+                const auto topics_cnt_offset = b->size();
+                uint8_t    topics_cnt{0};
+
+                b->pack(static_cast<uint8_t>(0)); // patched
+                for (auto it = br_req->partitions_list.next; it != &br_req->partitions_list;) {
+                        const auto topic      = switch_list_entry(request_partition_ctx, partitions_list_ll, it)->topic;
+                        const auto cnt_offset = b->size() + sizeof(uint8_t) + topic.size();
+                        uint16_t   cnt{0};
+
+                        b->pack(topic, static_cast<uint16_t>(0));
+                        do {
+                                b->pack(switch_list_entry(request_partition_ctx, partitions_list_ll, it)->partition);
+                                ++cnt;
+                        } while ((it = it->next) != &br_req->partitions_list && switch_list_entry(request_partition_ctx, partitions_list_ll, it)->topic == topic);
+
+                        *reinterpret_cast<uint16_t *>(b->data() + cnt_offset) = cnt;
+                        ++topics_cnt;
+                }
+
+                *reinterpret_cast<uint8_t *>(b->data() + topics_cnt_offset) = topics_cnt;
+        } else {
+                b->serialize(api_req->as.consumer_group.content.data(), api_req->as.consumer_group.content.size());
+        }
+
+        *reinterpret_cast<uint32_t *>(b->data() + sizeof(uint8_t)) = b->size() - sizeof(uint8_t) - sizeof(uint32_t); // patch
+
+        payload->iovecs.data[0].iov_base = b->data();
+        payload->iovecs.data[0].iov_len  = b->size();
+        payload->iovecs.size             = 1;
+
+        return payload;
+}
+
+bool TankClient::process_consumer_group_resp(connection *const c, const TankAPIMsgType msg, const uint8_t *const content, const size_t len) {
+        [[maybe_unused]] static constexpr bool trace{false};
+        TANK_EXPECT(c);
+        TANK_EXPECT(c->type == connection::Type::Tank);
+        const auto *p      = content;
+        const auto  req_id = decode_pod<uint32_t>(p);
+        const auto  _it    = pending_brokers_requests.find(req_id);
+
+        if (_it == pending_brokers_requests.end()) {
+                return true;
+        }
+
+        auto       br_req  = _it->second;
+        auto       api_req = br_req->api_req;
+        const auto err     = decode_pod<uint8_t>(p);
+
+        if (trace) {
+                SLog("Consumer group response ", unsigned(msg), ", err = ", err, "\n");
+        }
+
+        if (err) {
+                switch (err) {
+                        case 5:
+                                capture_readonly_fault(api_req);
+                                break;
+
+                        case 10:
+                                capture_invalid_req_fault(api_req, ""_s8, 0);
+                                break;
+
+                        case 12:
+                                // cluster aware
+                                capture_unsupported_request(api_req);
+                                break;
+
+                        case 13:
+                                capture_stale_generation_fault(api_req);
+                                break;
+
+                        default:
+                                capture_system_fault(api_req, ""_s8, 0);
+                                break;
+                }
+
+                while (!br_req->partitions_list.empty()) {
+                        auto req_part = switch_list_entry(request_partition_ctx, partitions_list_ll, br_req->partitions_list.next);
+
+                        req_part->partitions_list_ll.detach_and_reset();
+                        clear_request_partition_ctx(api_req, req_part);
+                        put_request_partition_ctx(req_part);
+                }
+        } else if (msg == TankAPIMsgType::JoinGroup) {
+                TANK_EXPECT(br_req->partitions_list.size() == 1);
+                auto       req_part    = switch_list_entry(request_partition_ctx, partitions_list_ll, br_req->partitions_list.next);
+                const auto generation  = decode_pod<uint64_t>(p);
+                const auto members_cnt = decode_pod<uint16_t>(p);
+                const auto topics_cnt  = decode_pod<uint8_t>(p);
+                auto       assigned    = std::make_unique<std::vector<topic_partition>>();
+
+                for (uint32_t i{0}; i < topics_cnt; ++i) {
+                        const auto topic = intern_topic(str_view8(reinterpret_cast<const char *>(p) + 1, *p));
+
+                        p += topic.size() + sizeof(uint8_t);
+                        for (auto cnt = decode_pod<uint16_t>(p); cnt; --cnt) {
+                                assigned->emplace_back(topic, decode_pod<uint16_t>(p));
+                        }
+                }
+
+                req_part->as_op.join_group.generation  = generation;
+                req_part->as_op.join_group.members_cnt = members_cnt;
+                req_part->as_op.join_group.assigned    = assigned.release();
+
+                req_part->partitions_list_ll.detach_and_reset();
+                api_req->ready_partitions_list.push_back(&req_part->partitions_list_ll);
+        } else {
+                // for FetchOffsets, a sequence number for each partition, in the order they were requested
+                while (!br_req->partitions_list.empty()) {
+                        auto req_part = switch_list_entry(request_partition_ctx, partitions_list_ll, br_req->partitions_list.next);
+
+                        if (msg == TankAPIMsgType::FetchOffsets) {
+                                req_part->as_op.fetch_offset.seq_num = decode_pod<uint64_t>(p);
+                        }
+
+                        req_part->partitions_list_ll.detach_and_reset();
+                        api_req->ready_partitions_list.push_back(&req_part->partitions_list_ll);
+                }
+        }
+
+        unlink_broker_req(br_req, __LINE__);
+        put_broker_api_request(br_req);
+
+        try_make_api_req_ready(api_req, __LINE__);
+        return true;
+}
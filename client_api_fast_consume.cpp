@@ -1,5 +1,6 @@
 // https://github.com/phaistos-networks/TANK/issues/1
 #include "client_common.h"
+#include "bundle_columnar.h"
 
 #ifdef TANK_CLIENT_FAST_CONSUME
 void TankClient::clear_tank_resp(connection *const c) {
@@ -501,6 +502,7 @@ bool TankClient::process_consume_content_impl(connection *const c) {
                                 req_part_resp.next.min_size = next_min_span;
                                 req_part_resp.msgs.cnt      = consumed;
                                 req_part_resp.drained       = drained_partition;
+                                req_part_resp.bundles.cnt   = 0; // raw bundles capture is not supported here
 
                                 if (consumed) {
                                         auto out = consumed <= sizeof_array(req_part_resp.msgs.list.small)
@@ -555,12 +557,13 @@ bool TankClient::process_consume_content_impl(connection *const c) {
                                 SLog(ansifmt::color_brown, ansifmt::inverse, "Parsing next bundle log_base_seqnum = ", cur_part.log_base_seqnum, ansifmt::reset, "\n");
                         }
 
-                        if (!Compression::check_decode_varuint32(p, chunk_end)) {
+                        uint32_t bundle_len;
+
+                        if (!Compression::decode_varuint32(p, chunk_end, &bundle_len)) {
                                 cur_part.need_upto = std::distance(base, p + 256);
                                 PROCESS_EXHAUSTION();
                         }
 
-                        const auto bundle_len = Compression::decode_varuint32(p);
                         const auto bundle_end = p + bundle_len;
 
                         if (trace) {
@@ -581,11 +584,15 @@ bool TankClient::process_consume_content_impl(connection *const c) {
                         uint32_t   msgset_size      = (bundle_hdr_flags >> 2) & 0xf;
                         uint64_t   msgset_end;
 
+                        if (!TANKUtil::skip_bundle_extra_hdr(bundle_hdr_flags, p, chunk_end)) {
+                                PROCESS_EXHAUSTION();
+                        }
+
+                        const auto columnar = TANKUtil::bundle_is_columnar(bundle_end - bundle_len);
+
                         if (0 == msgset_size) {
-                                if (!Compression::check_decode_varuint32(p, chunk_end)) {
+                                if (!Compression::decode_varuint32(p, chunk_end, &msgset_size)) {
                                         PROCESS_EXHAUSTION();
-                                } else {
-                                        msgset_size = Compression::decode_varuint32(p);
                                 }
                         }
 
@@ -639,10 +646,16 @@ bool TankClient::process_consume_content_impl(connection *const c) {
                         cur_bundle.size             = bundle_len;
                         cur_bundle.codec            = codec;
                         cur_bundle.sparse           = sparse_bundle;
+                        cur_bundle.columnar         = columnar;
                         cur_bundle.first_msg_seqnum = first_msg_seqnum;
                         cur_bundle.last_msg_seqnum  = last_msg_seqnum;
                         cur_bundle.cur_msg_set.size = msgset_size;
 
+                        if (columnar && bundle_end > chunk_end) {
+                                // columnar message sets can only be decoded in full
+                                PROCESS_EXHAUSTION();
+                        }
+
                         if (codec) {
                                 if (trace) {
                                         SLog("Need to decompress bundle msgs set\n");
@@ -736,6 +749,50 @@ bool TankClient::process_consume_content_impl(connection *const c) {
                                         SLog("Attempting to parse messages set from data of size ", std::distance(p, msgset_end), "\n");
                                 }
 
+                                if (cur_bundle.columnar) {
+                                        static thread_local TANKUtil::columnar::msgset_reader columnar_tls;
+                                        auto &                                                columnar_reader{columnar_tls};
+                                        str_view32                                            content;
+                                        uint32_t                                              seqnum_delta;
+
+                                        if (!columnar_reader.reset(p, msgset_end, msgset_size, sparse_bundle)) {
+                                                goto try_next_bundle;
+                                        }
+
+                                        for (; columnar_reader.next(&cur_msgset.ts, &key, &content, &seqnum_delta); ++msg_idx, ++log_base_seqnum) {
+                                                if (sparse_bundle) {
+                                                        log_base_seqnum = msg_idx ? log_base_seqnum + seqnum_delta : cur_bundle.first_msg_seqnum;
+                                                }
+
+                                                if (log_base_seqnum >= min_accepted_seqnum) {
+                                                        if (cctx.last_bucket_size == sizeof_array(msgs_bucket::data)) {
+                                                                auto b = get_msgs_bucket();
+
+                                                                b->next = nullptr;
+                                                                if (cctx.last_bucket) {
+                                                                        cctx.last_bucket->next = b;
+                                                                } else {
+                                                                        cctx.first_bucket = b;
+                                                                }
+
+                                                                cctx.last_bucket      = b;
+                                                                cctx.last_bucket_size = 0;
+                                                        }
+
+                                                        auto m = cctx.last_bucket->data + cctx.last_bucket_size++;
+
+                                                        cctx.consumed++;
+                                                        any_captured = cur_bundle.any_captured = true;
+                                                        m->seqNum                              = log_base_seqnum;
+                                                        m->content                             = content;
+                                                        m->ts                                  = cur_msgset.ts;
+                                                        m->key                                 = key;
+                                                }
+                                        }
+
+                                        goto try_next_bundle;
+                                }
+
                                 for (;; ++msg_idx, ++log_base_seqnum) {
                                         if (trace) {
                                                 SLog("Parsing next message msg_idx = ", msg_idx, ", log_base_seqnum = ", log_base_seqnum, "\n");
@@ -764,15 +821,15 @@ bool TankClient::process_consume_content_impl(connection *const c) {
                                                 } else if (msg_idx == msgset_size - 1) {
                                                         log_base_seqnum = cur_bundle.last_msg_seqnum;
                                                 } else {
-                                                        if (!Compression::check_decode_varuint32(p, msgset_end)) {
+                                                        uint32_t delta;
+
+                                                        if (!Compression::decode_varuint32(p, msgset_end, &delta)) {
                                                                 if (trace) {
                                                                         SLog("Not enough data\n");
                                                                 }
                                                                 goto try_next_bundle;
                                                         }
 
-                                                        const auto delta = Compression::decode_varuint32(p);
-
                                                         log_base_seqnum += delta;
                                                 }
                                         }
@@ -804,15 +861,15 @@ bool TankClient::process_consume_content_impl(connection *const c) {
                                                 key.reset();
                                         }
 
-                                        if (!Compression::check_decode_varuint32(p, msgset_end)) {
+                                        uint32_t len;
+
+                                        if (!Compression::decode_varuint32(p, msgset_end, &len)) {
                                                 if (trace) {
                                                         SLog("Not enough data\n");
                                                 }
                                                 goto try_next_bundle;
                                         }
 
-                                        const auto len = Compression::decode_varuint32(p);
-
                                         if (const auto e = p + len; e > msgset_end) {
                                                 if (!codec && any_captured) {
                                                         // can optimize
@@ -1,4 +1,5 @@
 #include "client_common.h"
+#include "bundle_columnar.h"
 
 TankClient::broker_outgoing_payload *TankClient::build_produce_broker_req_payload(const broker_api_request *br_req) {
         static constexpr bool trace{false};
@@ -15,11 +16,12 @@ TankClient::broker_outgoing_payload *TankClient::build_produce_broker_req_payloa
         b->pack(static_cast<uint8_t>(api_req->type == api_request::Type::ProduceWithSeqnum ? TankAPIMsgType::ProduceWithSeqnum : TankAPIMsgType::Produce));
         b->pack(static_cast<uint32_t>(0)); // length, to be patched later
 
-        b->pack(static_cast<uint16_t>(2)); // client version
+        b->pack(static_cast<uint16_t>(3)); // client version
         b->pack(static_cast<uint32_t>(br_req->id));
-        b->pack("c++"_s8); // client ID
+        b->pack(clientId); // client ID
 
-        b->pack(static_cast<uint8_t>(0));  // TODO: required acks
+        // required acks
+        b->pack(behavior.durable_acks ? TANKUtil::produce_request_acks::ISR_durable() : TANKUtil::produce_request_acks::ISR());
         b->pack(static_cast<uint32_t>(0)); // TODO: ack timeout
 
         const auto topics_cnt_offset = b->size();
@@ -137,6 +139,73 @@ static uint8_t choose_compression_codec(const TankClient::msg *msgs, const size_
         return 0;
 }
 
+// Columnar message sets encode timestamps as deltas from the previous message's
+template <typename T>
+static bool columnar_msgset_fits(const T *const msgs, const size_t cnt) noexcept {
+        for (size_t i{1}; i < cnt; ++i) {
+                const auto delta = static_cast<int64_t>(msgs[i].ts - msgs[i - 1].ts);
+
+                if (delta < std::numeric_limits<int32_t>::min() || delta > std::numeric_limits<int32_t>::max()) {
+                        return false;
+                }
+        }
+
+        return true;
+}
+
+// See bundle_columnar.h and tank_encoding.md
+template <typename T>
+static void encode_columnar_msgset(IOBuffer *const b, const T *const msgs, const size_t cnt, const bool sparse) {
+        static thread_local std::vector<uint32_t> column_tls;
+        auto &                                    column{column_tls};
+
+        column.resize(cnt);
+        b->pack(static_cast<uint64_t>(msgs[0].ts));
+
+        column[0] = 0;
+        for (size_t i{1}; i < cnt; ++i) {
+                column[i] = TANKUtil::columnar::zigzag(static_cast<int32_t>(msgs[i].ts - msgs[i - 1].ts));
+        }
+        TANKUtil::columnar::encode_column(b, column.data(), cnt);
+
+        for (size_t i{0}; i < cnt; ++i) {
+                column[i] = msgs[i].key.size();
+        }
+        TANKUtil::columnar::encode_column(b, column.data(), cnt);
+
+        for (size_t i{0}; i < cnt; ++i) {
+                column[i] = msgs[i].content.size();
+        }
+        TANKUtil::columnar::encode_column(b, column.data(), cnt);
+
+        if constexpr (std::is_same_v<T, TankClient::consumed_msg>) {
+                if (sparse) {
+                        column[0] = 0;
+                        for (size_t i{1}; i < cnt; ++i) {
+                                column[i] = msgs[i].seqNum - msgs[i - 1].seqNum - 1;
+                        }
+                        TANKUtil::columnar::encode_column(b, column.data(), cnt);
+                }
+        } else {
+                TANK_EXPECT(!sparse);
+        }
+
+        for (size_t i{0}; i < cnt; ++i) {
+                b->serialize(msgs[i].key.data(), msgs[i].key.size());
+        }
+        for (size_t i{0}; i < cnt; ++i) {
+                b->serialize(msgs[i].content.data(), msgs[i].content.size());
+        }
+}
+
+// The CRC32C placeholder at crc_offset covers everything in the bundle that follows it
+static void seal_bundle_crc32c(IOBuffer *const b, const uint32_t crc_offset) {
+        const auto from = b->data() + crc_offset + sizeof(uint32_t);
+        const auto crc  = TANKUtil::crc32c(from, b->size() - (crc_offset + sizeof(uint32_t)));
+
+        memcpy(b->data() + crc_offset, &crc, sizeof(crc));
+}
+
 bool TankClient::process_produce(connection *const c, const uint8_t *const content, const size_t len) {
         static constexpr bool trace{false};
         TANK_EXPECT(c);
@@ -293,9 +362,28 @@ bool TankClient::process_produce(connection *const c, const uint8_t *const conte
 
                                 any_faults = true;
                         } else if (err == 0x3) {
-                                // unable to get acks.
+                                // unable to get acks., or to sync the bundle(see set_durable_acks()), within the ack. timeout
+                                // the bundle may have been appended regardless
+                                capture_system_fault(api_req, req_part->topic, req_part->partition);
+
+                                clear_request_partition_ctx(api_req, req_part);
+                                put_request_partition_ctx(req_part);
+
                                 any_faults = true;
-                                IMPLEMENT_ME();
+                        } else if (err == 0x5) {
+                                // bundle CRC32C mismatch; corrupted in transit or by a buggy encoder
+                                any_faults = true;
+                                capture_invalid_req_fault(api_req, req_part->topic, req_part->partition);
+
+                                clear_request_partition_ctx(api_req, req_part);
+                                put_request_partition_ctx(req_part);
+                        } else if (err == 0x6) {
+                                // idempotent producer bundle sequence number is too old for the broker to tell if it was appended
+                                any_faults = true;
+                                capture_invalid_req_fault(api_req, req_part->topic, req_part->partition);
+
+                                clear_request_partition_ctx(api_req, req_part);
+                                put_request_partition_ctx(req_part);
                         } else if (err == 0x4) {
                                 // insufficient replicas - cannot service the produce request
                                 capture_insuficient_replicas(api_req, req_part->topic, req_part->partition);
@@ -346,6 +434,20 @@ bool TankClient::process_produce(connection *const c, const uint8_t *const conte
         return true;
 }
 
+void TankClient::set_idempotent_producer(const bool v) {
+        idempotent_producer.seqs.clear();
+
+        if (v) {
+                std::random_device                      dev;
+                std::mt19937_64                         rng(dev());
+                std::uniform_int_distribution<uint64_t> dist(1, std::numeric_limits<uint64_t>::max());
+
+                idempotent_producer.id = dist(rng);
+        } else {
+                idempotent_producer.id = 0;
+        }
+}
+
 uint32_t TankClient::produce(const std::pair<topic_partition, std::vector<msg>> *const list, const size_t list_size) {
         static constexpr bool                                     trace{false};
         auto                                                      api_req = get_api_request(8 * 1000);
@@ -380,6 +482,8 @@ uint32_t TankClient::produce(const std::pair<topic_partition, std::vector<msg>>
                 const auto codec        = choose_compression_codec(msgs.data(), msgs.size());
                 uint8_t    bundle_flags = 0;
                 const auto total_msgs   = msgs.size();
+                const auto columnar     = behavior.columnar_bundles && columnar_msgset_fits(msgs.data(), total_msgs);
+                uint32_t   crc_offset   = 0;
 
                 if (trace) {
                         SLog("Bundle for ", topic_name, "/", partition, ", codec = ", codec, ", total_msgs = ", total_msgs, "\n");
@@ -395,15 +499,58 @@ uint32_t TankClient::produce(const std::pair<topic_partition, std::vector<msg>>
                         // we can encode the message set size in flags, because it can fit
                         // in the 4bits we have reserved for that purpose
                         bundle_flags |= total_msgs << 2;
-                        b.pack(bundle_flags);
+                }
+
+                if (idempotent_producer.id || behavior.bundle_checksums || columnar) {
+                        uint8_t extra_flags = 0;
+
+                        if (idempotent_producer.id) {
+                                extra_flags |= static_cast<uint8_t>(TankFlags::BundleExtraFlags::ProducerSeq);
+                        }
+                        if (behavior.bundle_checksums) {
+                                extra_flags |= static_cast<uint8_t>(TankFlags::BundleExtraFlags::CRC32C);
+                        }
+                        if (columnar) {
+                                extra_flags |= static_cast<uint8_t>(TankFlags::BundleExtraFlags::Columnar);
+                        }
+
+                        // extra flags set
+                        bundle_flags |= (1u << 7);
+                        b.pack(bundle_flags, extra_flags);
+
+                        if (idempotent_producer.id) {
+                                // retries re-send the same payload, so the broker will see the same sequence number again
+                                b.pack(idempotent_producer.id,
+                                       ++idempotent_producer.seqs[topic_partition(topic_name, partition)]);
+                        }
+
+                        if (behavior.bundle_checksums) {
+                                // filled in once the message set is encoded
+                                crc_offset = b.size();
+                                b.pack(static_cast<uint32_t>(0));
+                        }
                 } else {
                         b.pack(bundle_flags);
+                }
+
+                if (total_msgs >= 16) {
                         b.encode_varuint32(total_msgs);
                 }
                 // END: bundle header
 
                 // BEGIN: messages set
-                if (!codec) {
+                if (columnar) {
+                        if (!codec) {
+                                encode_columnar_msgset(&b, msgs.data(), total_msgs, false);
+                        } else {
+                                cb.clear();
+                                encode_columnar_msgset(&cb, msgs.data(), total_msgs, false);
+
+                                if (!Compression::Compress(Compression::Algo::SNAPPY, cb.data(), cb.size(), &b)) {
+                                        IMPLEMENT_ME();
+                                }
+                        }
+                } else if (!codec) {
                         for (size_t i{0}; i < total_msgs; ++i) {
                                 const auto &m     = msgs[i];
                                 uint8_t     flags = m.key ? static_cast<uint8_t>(TankFlags::BundleMsgFlags::HaveKey) : 0;
@@ -456,6 +603,10 @@ uint32_t TankClient::produce(const std::pair<topic_partition, std::vector<msg>>
                 }
                 // END: messages set
 
+                if (crc_offset) {
+                        seal_bundle_crc32c(&b, crc_offset);
+                }
+
                 if (trace) {
                         SLog("Generated for ", topic_name, "/", partition, " ", b.size(), "\n");
                 }
@@ -512,6 +663,8 @@ uint32_t TankClient::produce_with_seqnum(const std::pair<topic_partition, std::v
 
                 const uint8_t codec        = msgs_size > 512 || sum > 1024 ? 1 : 0;
                 uint8_t       bundle_flags = 0;
+                uint32_t      crc_offset   = 0;
+                const auto    columnar     = behavior.columnar_bundles && columnar_msgset_fits(msgs.data(), msgs_size);
 
                 b.reserve(sum + 128);
                 v->reserve(msgs_size);
@@ -535,9 +688,30 @@ uint32_t TankClient::produce_with_seqnum(const std::pair<topic_partition, std::v
                         // we can encode the message set size in flags, because it can fit
                         // in the 4bits we have reserved for that purpose
                         bundle_flags |= msgs_size << 2;
-                        b.pack(bundle_flags);
+                }
+
+                if (behavior.bundle_checksums || columnar) {
+                        uint8_t extra_flags = 0;
+
+                        if (behavior.bundle_checksums) {
+                                extra_flags |= static_cast<uint8_t>(TankFlags::BundleExtraFlags::CRC32C);
+                        }
+                        if (columnar) {
+                                extra_flags |= static_cast<uint8_t>(TankFlags::BundleExtraFlags::Columnar);
+                        }
+
+                        bundle_flags |= (1u << 7);
+                        b.pack(bundle_flags, extra_flags);
+
+                        if (behavior.bundle_checksums) {
+                                crc_offset = b.size();
+                                b.pack(static_cast<uint32_t>(0));
+                        }
                 } else {
                         b.pack(bundle_flags);
+                }
+
+                if (msgs_size >= 16) {
                         b.encode_varuint32(msgs_size);
                 }
 
@@ -554,7 +728,18 @@ uint32_t TankClient::produce_with_seqnum(const std::pair<topic_partition, std::v
                 const auto penultimate = msgs_size - 1;
 
                 // See: Service::persist_peer_partitions_content()
-                if (!codec) {
+                if (columnar) {
+                        if (!codec) {
+                                encode_columnar_msgset(&b, msgs.data(), msgs_size, as_sparse);
+                        } else {
+                                cb.clear();
+                                encode_columnar_msgset(&cb, msgs.data(), msgs_size, as_sparse);
+
+                                if (!Compression::Compress(Compression::Algo::SNAPPY, cb.data(), cb.size(), &b)) {
+                                        IMPLEMENT_ME();
+                                }
+                        }
+                } else if (!codec) {
                         for (size_t i{0}; i < msgs_size; ++i) {
                                 const auto &m                     = msgs[i];
                                 uint8_t     flags                 = m.key ? static_cast<uint8_t>(TankFlags::BundleMsgFlags::HaveKey) : 0;
@@ -641,6 +826,10 @@ uint32_t TankClient::produce_with_seqnum(const std::pair<topic_partition, std::v
                 }
                 // END: messages set
 
+                if (crc_offset) {
+                        seal_bundle_crc32c(&b, crc_offset);
+                }
+
                 if (trace) {
                         SLog("Generated for ", topic_name, "/", partition, " ", b.size(), "\n");
                 }
@@ -656,6 +845,50 @@ uint32_t TankClient::produce_with_seqnum(const std::pair<topic_partition, std::v
         return schedule_new_api_req(std::move(api_req));
 }
 
+uint32_t TankClient::produce_bundles_with_seqnum(const std::pair<topic_partition, std::vector<raw_bundle>> *const list, const size_t list_size) {
+        static constexpr bool                                     trace{false};
+        auto                                                      api_req = get_api_request(8 * 1000);
+        std::vector<std::pair<broker *, request_partition_ctx *>> contexts;
+
+        api_req->type = api_request::Type::ProduceWithSeqnum;
+        contexts.reserve(list_size);
+
+        for (size_t i{0}; i < list_size; ++i) {
+                const auto &it         = list[i];
+                const auto  topic_name = intern_topic(it.first.first);
+                const auto  partition  = it.first.second;
+                auto        broker     = partition_leader(topic_name, partition) ?: any_broker();
+
+                // one partition request/bundle, because that's how
+                // produce requests encode bundles; they are delivered in order (see assign_req_partitions_to_api_req())
+                for (const auto &bundle : it.second) {
+                        auto       req_part = get_request_partition_ctx();
+                        const auto size     = bundle.content.size();
+                        auto       data     = static_cast<uint8_t *>(malloc(size));
+
+                        TANK_EXPECT(size);
+                        memcpy(data, bundle.content.offset, size);
+
+                        if (trace) {
+                                SLog("Bundle [", bundle.first_msg_seqnum, ", ", bundle.last_msg_seqnum, "] of ", size_repr(size), " for ", topic_name, "/", partition, "\n");
+                        }
+
+                        req_part->topic                          = topic_name;
+                        req_part->partition                      = partition;
+                        req_part->as_op.produce.payload.size     = size;
+                        req_part->as_op.produce.payload.data     = data;
+                        req_part->as_op.produce.first_msg_seqnum = bundle.first_msg_seqnum;
+
+                        contexts.emplace_back(std::make_pair(broker, req_part));
+                }
+        }
+
+        // we may have many more contexts for the same partition here
+        // 3 iovecs/partition request, and up to 1 more for its topic
+        assign_req_partitions_to_api_req(api_req.get(), &contexts, sizeof_array(broker_outgoing_payload::IOVECS::data) / 4);
+        return schedule_new_api_req(std::move(api_req));
+}
+
 uint32_t TankClient::produce_to(const topic_partition &to, const std::vector<msg> &msgs) {
         const std::vector<std::pair<topic_partition, std::vector<msg>>> v{
             std::make_pair(to, msgs)};
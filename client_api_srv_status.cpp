@@ -50,6 +50,12 @@ bool TankClient::process_srv_status(connection *const c, const uint8_t *const co
                 if (p < e) {
                         req_part->as_op.srv_status.version = decode_pod<uint32_t>(p);
                 }
+
+                if (p + sizeof(uint32_t) * 3 <= e) {
+                        metrics.reactor_stalls = decode_pod<uint32_t>(p);
+                        metrics.slow_ops       = decode_pod<uint32_t>(p);
+                        metrics.slowest_op_us  = decode_pod<uint32_t>(p);
+                }
         }
 
         req_part->partitions_list_ll.detach_and_reset();
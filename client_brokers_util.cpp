@@ -73,7 +73,8 @@ void TankClient::flush_broker(broker *const br) {
                 auto api_req = breq->api_req;
                 TANK_EXPECT(api_req);
                 const bool is_idempotent =
-                    (api_req->type == api_request::Type::Consume || api_req->type == api_request::Type::DiscoverPartitions || api_req->type == api_request::Type::ReloadConfig);
+                    (api_req->type == api_request::Type::Consume || api_req->type == api_request::Type::DiscoverPartitions || api_req->type == api_request::Type::ReloadConfig ||
+                     api_req->type == api_request::Type::JoinGroup || api_req->type == api_request::Type::FetchOffsets);
                 //const bool is_idempotent = false;
 
                 if (trace) {
@@ -161,6 +162,14 @@ void TankClient::clear_request_partition_ctx(api_request *const api_req, request
                 case api_request::Type::SrvStatus:
                         break;
 
+                case api_request::Type::JoinGroup:
+                        delete std::exchange(par->as_op.join_group.assigned, nullptr);
+                        break;
+
+                case api_request::Type::CommitOffsets:
+                case api_request::Type::FetchOffsets:
+                        break;
+
                 default:
                         IMPLEMENT_ME();
         }
@@ -254,6 +263,10 @@ void TankClient::gc_api_request(std::unique_ptr<api_request> api_req) {
                                         std::free(resp.msgs.list.large);
                                 }
 
+                                if (resp.bundles.cnt) {
+                                        std::free(resp.bundles.list);
+                                }
+
                                 if (const auto n = resp.used_buffers.size) {
                                         for (size_t i{0}; i < n; ++i) {
                                                 put_buffer(resp.used_buffers.data[i]);
@@ -315,6 +328,26 @@ void TankClient::gc_api_request(std::unique_ptr<api_request> api_req) {
                         }
                         break;
 
+                case api_request::Type::JoinGroup:
+                case api_request::Type::CommitOffsets:
+                case api_request::Type::FetchOffsets:
+                        for (auto it = api_req->ready_partitions_list.next; it != &api_req->ready_partitions_list;) {
+                                auto next = it->next;
+                                auto p    = switch_list_entry(request_partition_ctx, partitions_list_ll, it);
+
+                                clear_request_partition_ctx(api_req_ptr, p);
+                                put_request_partition_ctx(p);
+                                it = next;
+                        }
+
+                        if (api_req->type == api_request::Type::JoinGroup) {
+                                delete api_req_ptr->materialized_resp.join_group.v;
+                        }
+
+                        std::free(const_cast<char *>(api_req_ptr->as.consumer_group.group.data()));
+                        std::free(const_cast<char *>(api_req_ptr->as.consumer_group.content.data()));
+                        break;
+
                 default:
                         IMPLEMENT_ME();
         }
@@ -357,6 +390,7 @@ bool TankClient::materialize_consume_api_request(api_request *api_req) {
                                                    ? resp_ctx.msgs.list.small
                                                    : resp_ctx.msgs.list.large),
                     resp_ctx.msgs.cnt);
+                const range_base<raw_bundle *, uint32_t> bundles(resp_ctx.bundles.cnt ? resp_ctx.bundles.list : nullptr, resp_ctx.bundles.cnt);
 
                 if (trace) {
                         SLog("Got ", resp_ctx.msgs.cnt, " for ", req_part->topic, "/", req_part->partition, "\n");
@@ -369,6 +403,7 @@ bool TankClient::materialize_consume_api_request(api_request *api_req) {
                     .respComplete      = true,
                     .drained           = resp_ctx.drained,
                     .msgs              = msgs,
+                    .bundles           = bundles,
                     .next.seqNum       = resp_ctx.next.seq_num,
                     .next.minFetchSize = static_cast<uint32_t>(resp_ctx.next.min_size),
                 });
@@ -427,6 +462,50 @@ bool TankClient::materialize_srv_request(api_request *api_req) {
         return false;
 }
 
+bool TankClient::materialize_join_group_request(api_request *api_req) {
+        if (api_req->ready_partitions_list.empty()) {
+                return false;
+        }
+
+        const auto req_part = switch_list_entry(request_partition_ctx, partitions_list_ll, api_req->ready_partitions_list.next);
+        auto       v        = std::exchange(req_part->as_op.join_group.assigned, nullptr);
+
+        TANK_EXPECT(v);
+        group_assignments_v.emplace_back(group_assignment{
+            .clientReqId = api_req->request_id,
+            .generation  = req_part->as_op.join_group.generation,
+            .members_cnt = req_part->as_op.join_group.members_cnt,
+            .partitions  = {v->data(), static_cast<uint32_t>(v->size())},
+        });
+
+        // retained until the next poll()
+        api_req->materialized_resp.join_group.v = v;
+        return true;
+}
+
+bool TankClient::materialize_commit_offsets_request(api_request *api_req) {
+        if (!api_req->ready_partitions_list.empty()) {
+                offsets_commit_acks_v.emplace_back(offsets_commit_ack{
+                    .clientReqId = api_req->request_id});
+        }
+
+        return false;
+}
+
+bool TankClient::materialize_fetch_offsets_request(api_request *api_req) {
+        for (const auto it : api_req->ready_partitions_list) {
+                const auto req_part = switch_list_entry(request_partition_ctx, partitions_list_ll, it);
+
+                fetched_offsets_v.emplace_back(fetched_offset{
+                    .clientReqId = api_req->request_id,
+                    .topic       = req_part->topic,
+                    .partition   = req_part->partition,
+                    .seq_num     = req_part->as_op.fetch_offset.seq_num});
+        }
+
+        return false;
+}
+
 bool TankClient::materialize_produce_request(api_request *api_req) {
         static constexpr bool trace{false};
 
@@ -546,6 +625,15 @@ bool TankClient::materialize_api_response(api_request *api_req) {
                 case api_request::Type::SrvStatus:
                         return materialize_srv_request(api_req);
 
+                case api_request::Type::JoinGroup:
+                        return materialize_join_group_request(api_req);
+
+                case api_request::Type::CommitOffsets:
+                        return materialize_commit_offsets_request(api_req);
+
+                case api_request::Type::FetchOffsets:
+                        return materialize_fetch_offsets_request(api_req);
+
                 default:
                         IMPLEMENT_ME();
         }
@@ -712,6 +800,12 @@ TankClient::broker_outgoing_payload *TankClient::build_broker_req_payload(broker
                         payload = build_srv_status_broker_req_payload(req);
                         break;
 
+                case api_request::Type::JoinGroup:
+                case api_request::Type::CommitOffsets:
+                case api_request::Type::FetchOffsets:
+                        payload = build_consumer_group_broker_req_payload(req);
+                        break;
+
                 default:
                         payload = nullptr;
                         break;
@@ -735,7 +829,9 @@ switch_dlist *TankClient::assign_req_partitions_to_api_req(api_request *api_req,
         switch_dlist *        next{&api_req->broker_requests_list};
 
         // sort by (ptr(broker) asc, topic asc, partition asc)
-        std::sort(contexts->begin(), contexts->end(), [](const auto &a, const auto &b) noexcept {
+        // stable, because produce_bundles_with_seqnum() may use multiple contexts for the same partition
+        // and they need to be delivered in the order they were specified
+        std::stable_sort(contexts->begin(), contexts->end(), [](const auto &a, const auto &b) noexcept {
                 if (a.first < b.first) {
                         return true;
                 } else if (b.first < a.first) {
@@ -863,7 +959,15 @@ void TankClient::shift_failed_broker(broker *br) {
 // in flush_broker() we can check all outstanding request_partition_ctx, and
 // partition_leader(ctx.topic, ctx.partition) == broker, we need to retry later for the same broker, if not
 // then we mark the broker as failed and use any_broker() again to get another node, and if we can't then wait anyway
-TankClient::broker *TankClient::partition_leader(const str_view8 topic, const uint16_t partition) {
+//
+// If any_replica is set(i.e for consume requests), we 'll prefer a broker set by set_preferred_replicas() to the leader
+TankClient::broker *TankClient::partition_leader(const str_view8 topic, const uint16_t partition, const bool any_replica) {
+        if (any_replica) {
+                if (const auto e = preferred_replica(topic, partition)) {
+                        return broker_by_endpoint(e);
+                }
+        }
+
         if (const auto it = leaders.find(topic_partition{topic, partition}); it != leaders.end()) {
                 const auto e = it->second;
 
@@ -1188,9 +1292,17 @@ void TankClient::process_undeliverable_broker_req(broker_api_request *br_req, co
                         std::vector<broker_api_request *> reqs;
                         bool                              any_failed{false};
 
+                        const auto consume = api_req->type == api_request::Type::Consume;
+
                         for (auto it : br_req->partitions_list) {
                                 auto req_part = switch_list_entry(request_partition_ctx, partitions_list_ll, it);
-                                auto broker   = partition_leader(req_part->topic, req_part->partition) ?: any_broker();
+
+                                if (consume) {
+                                        // try the next preferred replica, or the leader
+                                        rule_out_preferred_replica(req_part->topic, req_part->partition, br->ep);
+                                }
+
+                                auto broker = partition_leader(req_part->topic, req_part->partition, consume) ?: any_broker();
 
                                 contexts.emplace_back(std::make_pair(broker, req_part));
                         }
@@ -1289,7 +1401,7 @@ bool TankClient::schedule_req_partitions(api_request *api_req, request_partition
         // pair each partition with a node (likely the leader)
         for (size_t i{0}; i < cnt; ++i) {
                 auto req_part = l[i];
-                auto broker   = partition_leader(req_part->topic, req_part->partition) ?: any_broker();
+                auto broker   = partition_leader(req_part->topic, req_part->partition, api_req->type == api_request::Type::Consume) ?: any_broker();
 
                 if (trace) {
                         SLog("For ", req_part->topic, "/", req_part->partition, " ", broker->ep, "\n");
@@ -1390,7 +1502,10 @@ bool TankClient::try_transmit(broker *const br) {
 
         auto c = br->ch.get();
 
-        if (!c) {
+        if (br->throttled_until > now_ms) {
+                // check_throttled_brokers() will get to it
+                return true;
+        } else if (!c) {
                 if (!init_broker_connection(br)) {
                         flush_broker(br);
                         return false;
@@ -1546,6 +1661,21 @@ void TankClient::capture_invalid_req_fault(api_request *api_req, const str_view8
         });
 }
 
+void TankClient::capture_stale_generation_fault(api_request *api_req) {
+        if (trace_captured_faults) {
+                SLog("Captured FAULT\n");
+        }
+
+        api_req->set_failed();
+
+        all_captured_faults.emplace_back(fault{
+            .clientReqId = api_req->request_id,
+            .type        = fault::Type::StaleGeneration,
+            .topic       = ""_s8,
+            .partition   = 0,
+        });
+}
+
 void TankClient::capture_readonly_fault(api_request *api_req) {
         if (trace_captured_faults) {
                 SLog("Captured FAULT\n");
@@ -1,6 +1,7 @@
 #pragma once
 #include "tank_client.h"
 #include <date.h>
+#include <random>
 #include <switch_algorithms.h>
 #include <sys/uio.h>
 #include <text.h>
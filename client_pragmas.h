@@ -31,6 +31,12 @@ void abort_api_request(api_request *);
 
 bool materialize_srv_request(api_request *);
 
+bool materialize_join_group_request(api_request *);
+
+bool materialize_commit_offsets_request(api_request *);
+
+bool materialize_fetch_offsets_request(api_request *);
+
 bool materialize_reload_config_request(api_request *);
 
 bool materialize_create_topic_requet(api_request *);
@@ -49,6 +55,8 @@ void wakeup_unreachable_broker(broker *);
 
 void check_unreachable_brokers();
 
+void check_throttled_brokers();
+
 void try_make_api_req_ready(api_request *, const uint32_t);
 
 void clear_request_partition_ctx(api_request *, request_partition_ctx *);
@@ -73,7 +81,11 @@ void set_leader(const str_view8, const uint16_t, const Switch::endpoint);
 
 void set_leader(const str_view8, const uint16_t, const str_view32);
 
-broker *partition_leader(const str_view8, const uint16_t);
+broker *partition_leader(const str_view8, const uint16_t, const bool any_replica = false);
+
+Switch::endpoint preferred_replica(const str_view8, const uint16_t);
+
+void rule_out_preferred_replica(const str_view8, const uint16_t, const Switch::endpoint);
 
 void capture_unsupported_request(api_request *);
 
@@ -97,6 +109,8 @@ void capture_insuficient_replicas(api_request *, const str_view8, const uint16_t
 
 void capture_readonly_fault(api_request *);
 
+void capture_stale_generation_fault(api_request *);
+
 void fail_api_req(api_request *);
 
 void gc_api_request(std::unique_ptr<api_request>);
@@ -200,6 +214,16 @@ bool process_srv_in(connection *);
 
 void drain_pipe(int);
 
+#ifdef HAVE_TANK_TLS
+void begin_tls_handshake(connection *);
+
+bool set_tls_peer_identity(connection *, ssl_st *);
+
+bool tls_handshake(connection *);
+
+void release_tls(connection *);
+#endif
+
 bool process_io(const size_t);
 
 uint64_t reactor_next_wakeup() const noexcept;
@@ -224,8 +248,16 @@ bool process_create_topic(connection *const c, const uint8_t *const content, con
 
 bool process_srv_status(connection *const, const uint8_t *, const size_t);
 
+bool process_throttle(connection *const, const uint8_t *, const size_t);
+
 broker_outgoing_payload *build_srv_status_broker_req_payload(const broker_api_request *);
 
+bool process_consumer_group_resp(connection *const, const TankAPIMsgType, const uint8_t *, const size_t);
+
+broker_outgoing_payload *build_consumer_group_broker_req_payload(const broker_api_request *);
+
+uint32_t schedule_consumer_group_req(const api_request::Type, const str_view8, std::vector<request_partition_ctx *> &&, const str_view32);
+
 bool process_msg(connection *const c, const uint8_t msg, const uint8_t *const content, const size_t len);
 
 
@@ -339,6 +371,18 @@ const auto &statuses() const noexcept {
 	return collected_cluster_status_v;
 }
 
+const auto &group_assignments() const noexcept {
+        return group_assignments_v;
+}
+
+const auto &offsets_commit_acks() const noexcept {
+        return offsets_commit_acks_v;
+}
+
+const auto &fetched_offsets() const noexcept {
+        return fetched_offsets_v;
+}
+
 inline void poll(const uint32_t timeout_ms) {
         reactor_step(timeout_ms);
 }
@@ -352,7 +396,10 @@ bool any_responses() const noexcept {
                discovered_partitions().size() ||
                reloaded_partition_configs().size() ||
                created_topics().size() ||
-               statuses().size();
+               statuses().size() ||
+               group_assignments().size() ||
+               offsets_commit_acks().size() ||
+               fetched_offsets().size();
 }
 
 [[gnu::warn_unused_result, nodiscard]] uint32_t produce(const std::pair<topic_partition, std::vector<msg>> *, const size_t);
@@ -374,6 +421,15 @@ bool any_responses() const noexcept {
 	return produce_with_seqnum(req.data(), req.size());
 }
 
+// Like produce_with_seqnum(), except that bundles are forwarded as they are, without
+// being decoded or re-encoded. Each bundle is produced in order, in its own partition request.
+// This is what tank-cli uses for pass-through mirroring; see set_capture_raw_bundles()
+[[gnu::warn_unused_result, nodiscard]] uint32_t produce_bundles_with_seqnum(const std::pair<topic_partition, std::vector<raw_bundle>> *, const size_t);
+
+[[gnu::warn_unused_result, nodiscard]] inline uint32_t produce_bundles_with_seqnum(const std::vector<std::pair<topic_partition, std::vector<raw_bundle>>> &req) {
+	return produce_bundles_with_seqnum(req.data(), req.size());
+}
+
 [[gnu::warn_unused_result, nodiscard]] uint32_t consume(const std::pair<topic_partition, std::pair<uint64_t, uint32_t>> *, const std::size_t, const uint64_t maxWait, const uint32_t minSize);
 
 [[gnu::warn_unused_result, nodiscard]] uint32_t consume(const std::vector<std::pair<topic_partition,
@@ -395,6 +451,25 @@ bool any_responses() const noexcept {
 
 [[gnu::warn_unused_result, nodiscard]] uint32_t service_status();
 
+// Consumer groups(standalone brokers only)
+//
+// Joins, or heartbeats(by re-joining), the group. The broker assigns partitions of the subscribed topics to the group members, and
+// the response is reported in group_assignments(). Members are expected to re-join well within session_timeout_ms, and whenever
+// a commit_offsets() fails with fault::Type::StaleGeneration.
+// A session_timeout_ms of 0 leaves the group
+[[gnu::warn_unused_result, nodiscard]] uint32_t join_group(const str_view8 group, const str_view8 member_id, const std::vector<str_view8> &topics, const uint32_t session_timeout_ms);
+
+[[gnu::warn_unused_result, nodiscard]] inline uint32_t leave_group(const str_view8 group, const str_view8 member_id) {
+        return join_group(group, member_id, {}, 0);
+}
+
+// Commits the sequence number of the next message to be consumed for each partition. If generation is not 0, the commit
+// is rejected unless it matches the group's current generation
+[[gnu::warn_unused_result, nodiscard]] uint32_t commit_offsets(const str_view8 group, const uint64_t generation, const std::vector<std::pair<topic_partition, uint64_t>> &offsets);
+
+// Results are reported in fetched_offsets()
+[[gnu::warn_unused_result, nodiscard]] uint32_t fetch_offsets(const str_view8 group, const std::vector<topic_partition> &partitions);
+
 bool any_requests_pending_delivery() const noexcept;
 
 void reset(const bool dtor_context = false);
@@ -403,6 +478,11 @@ void set_client_id(const char *const p, const uint32_t len) {
         clientId.Set(p, len);
 }
 
+// Encrypt connections to brokers; brokers certificates are verified against ca_file if provided, or the default trust store,
+// and must have been issued for the broker's IP address, or peer_name if provided
+// Requires a library built with TANK_TLS=1, and brokers configured for TLS; see service_tls.cpp
+void set_tls(const char *ca_file = nullptr, const char *peer_name = nullptr);
+
 void set_retry_strategy(const RetryStrategy) noexcept {
 	// no-op
 }
@@ -455,3 +535,44 @@ inline size_t count_brokers() const noexcept {
 void set_report_draine_if_consumed_upto_hwmark(const bool v = true) {
 	behavior.report_drain_if_consumed_upto_hwmark = true;
 }
+
+// If set, complete bundles that begin at or past the requested sequence number are not decoded; they are
+// instead reported in partition_content::bundles, as they are found in the partition's log. Bundles that straddle
+// the requested sequence number, or that do not follow it or the previous bundle contiguously(unless SPARSE),
+// are still decoded into partition_content::msgs
+// This applies to consume requests scheduled while it is set.
+// Raw bundles are only valid until the next poll(), same as messages
+void set_capture_raw_bundles(const bool v = true) noexcept {
+	behavior.capture_raw_bundles = v;
+}
+
+// If set, bundles produced via produce() carry a randomly generated producer id and a per-partition sequence number,
+// which brokers use to identify bundles re-sent on retries; those are acknowledged without being appended again.
+// Setting it again generates a new producer id and resets the sequence numbers.
+void set_idempotent_producer(const bool v = true);
+
+// If set, bundles produced carry a CRC32C of their content, which brokers validate before appending them
+// and when replicating them, and `tank verify` checks for every bundle of the segments it verifies
+void set_bundle_checksums(const bool v = true) noexcept {
+	behavior.bundle_checksums = v;
+}
+
+// If set, message sets of bundles produced are encoded in columns(timestamps, key and content lengths, and sequence numbers,
+// followed by all keys and content) instead of a header per message, which is smaller and much faster to decode for small messages.
+// Consumers and brokers must support columnar message sets; see tank_encoding.md
+void set_columnar_bundles(const bool v = true) noexcept {
+	behavior.columnar_bundles = v;
+}
+
+// If set, brokers acknowledge produce requests only once the bundles produced have been fdatasync()ed to their segments
+// (and, in cluster mode, acknowledged by all peers in the ISR). Produce requests not acknowledged within the ack. timeout
+// fail with a system error.
+void set_durable_acks(const bool v = true) noexcept {
+	behavior.durable_acks = v;
+}
+
+// Brokers to consume from, instead of the partitions leaders, e.g the brokers in the same rack or zone as the client.
+// In cluster mode, any broker in the ISR of a partition can serve consume requests for it, up to the highwater mark it knows about.
+// Partitions are spread across the preferred brokers; if a preferred broker is not in the ISR of a partition(or lags behind),
+// the next one is tried, and the partition leader is used if none can serve the partition.
+void set_preferred_replicas(const std::vector<Switch::endpoint> &);
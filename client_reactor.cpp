@@ -653,6 +653,9 @@ void TankClient::begin_reactor_loop_iteration() {
         produce_acks_v.clear();
         created_topics_v.clear();
 	collected_cluster_status_v.clear();
+        group_assignments_v.clear();
+        offsets_commit_acks_v.clear();
+        fetched_offsets_v.clear();
 }
 
 void TankClient::drain_pipe(int fd) {
@@ -713,8 +716,24 @@ bool TankClient::process_io(const size_t events_count) {
                         continue;
                 }
 
+#ifdef HAVE_TANK_TLS
+                if (c->tls) {
+                        // see client_tls.cpp
+                        tls_handshake(c);
+                        continue;
+                }
+#endif
+
                 if (events & EPOLLOUT) {
                         if (c->state.flags & (1u << unsigned(connection::State::Flags::ConnectionAttempt))) {
+#ifdef HAVE_TANK_TLS
+                                if (tls_ctx && !(c->state.flags & (1u << unsigned(connection::State::Flags::SecureChannel)))) {
+                                        // we 'll get here again once the handshake is complete
+                                        begin_tls_handshake(c);
+                                        continue;
+                                }
+#endif
+
                                 if (trace) {
                                         SLog("Connection was established\n");
                                 }
@@ -811,6 +830,28 @@ void TankClient::wakeup_unreachable_broker(broker *br) {
         }
 }
 
+void TankClient::check_throttled_brokers() {
+        throttled_brokers_next = std::numeric_limits<uint64_t>::max();
+
+        for (size_t i{0}; i < throttled_brokers.size();) {
+                auto br = throttled_brokers[i];
+
+                if (br->throttled_until > now_ms) {
+                        throttled_brokers_next = std::min(throttled_brokers_next, br->throttled_until);
+                        ++i;
+                        continue;
+                }
+
+                throttled_brokers[i] = throttled_brokers.back();
+                throttled_brokers.pop_back();
+                br->throttled_until = 0;
+
+                if (!br->outgoing_content.empty()) {
+                        try_transmit(br);
+                }
+        }
+}
+
 void TankClient::check_unreachable_brokers() {
         eb64_node *it;
 
@@ -844,6 +885,7 @@ void TankClient::check_unreachable_brokers() {
 uint64_t TankClient::reactor_next_wakeup() const noexcept {
         uint64_t until = TANKUtil::minimum(
             unreachable_brokers_tree_next,
+            throttled_brokers_next,
             retry_bundles_next,
             conns_pend_est_next_expiration,
             api_reqs_expirations_tree_next);
@@ -917,6 +959,10 @@ void TankClient::reactor_step(uint32_t timeout_ms) {
                         check_unreachable_brokers();
                 }
 
+                if (now_ms >= throttled_brokers_next) {
+                        check_throttled_brokers();
+                }
+
 #ifdef HAVE_NETIO_THROTTLE
                 if (now_ms >= throttled_connections_read_list_next ||
                     now_ms >= throttled_connections_write_list_next) {
@@ -1123,6 +1169,10 @@ bool TankClient::shutdown(connection *const c, const uint32_t ref, const bool fa
         c->throttler.write.ll.try_detach_and_reset();
 #endif
 
+#ifdef HAVE_TANK_TLS
+        release_tls(c);
+#endif
+
         c->all_conns_list_ll.try_detach_and_reset();
 
 #ifdef TANK_CLIENT_FAST_CONSUME
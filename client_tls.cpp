@@ -0,0 +1,128 @@
+#include "client_common.h"
+#ifdef HAVE_TANK_TLS
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+#endif
+
+// Like brokers(see service_tls.cpp), we only use OpenSSL for the handshake, and then hand the session to the kernel(kTLS), so that
+// we keep reading from and writing to connections like we do for plaintext connections.
+// A connection is not considered established until the handshake is complete; see process_io()
+//
+// Brokers certificates are always verified, against ca_file if provided, or the system's default trust store otherwise, and
+// must have been issued for the broker's IP address, or for peer_name if provided(e.g a certificate shared by all brokers).
+void TankClient::set_tls(const char *const ca_file, const char *const peer_name) {
+#ifdef HAVE_TANK_TLS
+        auto ctx = SSL_CTX_new(TLS_client_method());
+
+        if (!ctx) {
+                throw Switch::runtime_error("Failed to initialize TLS:", ERR_error_string(ERR_get_error(), nullptr));
+        }
+
+        SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+        SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS | SSL_OP_NO_COMPRESSION | SSL_OP_NO_RENEGOTIATION);
+
+        if (SSL_CTX_set_cipher_list(ctx, "ECDHE+AESGCM:ECDHE+CHACHA20") != 1 ||
+            SSL_CTX_set_ciphersuites(ctx, "TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384:TLS_CHACHA20_POLY1305_SHA256") != 1) {
+                SSL_CTX_free(ctx);
+                throw Switch::runtime_error("Failed to initialize TLS ciphers:", ERR_error_string(ERR_get_error(), nullptr));
+        }
+
+        if (ca_file) {
+                if (SSL_CTX_load_verify_locations(ctx, ca_file, nullptr) != 1) {
+                        SSL_CTX_free(ctx);
+                        throw Switch::runtime_error("Failed to load CA ", ca_file, ":", ERR_error_string(ERR_get_error(), nullptr));
+                }
+        } else if (SSL_CTX_set_default_verify_paths(ctx) != 1) {
+                SSL_CTX_free(ctx);
+                throw Switch::runtime_error("Failed to load the default CA locations:", ERR_error_string(ERR_get_error(), nullptr));
+        }
+
+        SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, nullptr);
+
+        if (tls_ctx) {
+                SSL_CTX_free(tls_ctx);
+        }
+        tls_ctx       = ctx;
+        tls_peer_name = peer_name ? peer_name : "";
+#else
+        throw Switch::runtime_error("TLS support not available; build with TANK_TLS=1");
+#endif
+}
+
+#ifdef HAVE_TANK_TLS
+void TankClient::begin_tls_handshake(connection *const c) {
+        auto ssl = SSL_new(tls_ctx);
+
+        if (!ssl || SSL_set_fd(ssl, c->fd) != 1 || !set_tls_peer_identity(c, ssl)) {
+                if (ssl) {
+                        SSL_free(ssl);
+                }
+
+                shutdown(c, __LINE__);
+                return;
+        }
+
+        SSL_set_connect_state(ssl);
+        c->tls = ssl;
+        tls_handshake(c);
+}
+
+// verify that we are talking to the broker we meant to
+bool TankClient::set_tls_peer_identity(connection *const c, ssl_st *const ssl) {
+        if (!tls_peer_name.empty()) {
+                return SSL_set1_host(ssl, tls_peer_name.c_str()) == 1 && SSL_set_tlsext_host_name(ssl, tls_peer_name.c_str()) == 1;
+        }
+
+        const auto br = c->as.tank.br;
+
+        return br && X509_VERIFY_PARAM_set1_ip(SSL_get0_param(ssl), reinterpret_cast<const unsigned char *>(&br->ep.addr4), sizeof(br->ep.addr4)) == 1;
+}
+
+bool TankClient::tls_handshake(connection *const c) {
+        static constexpr bool trace{false};
+        auto                  ssl = c->tls;
+
+        ERR_clear_error();
+        if (const auto r = SSL_do_handshake(ssl); r != 1) {
+                switch (SSL_get_error(ssl, r)) {
+                        case SSL_ERROR_WANT_READ:
+                                poller.set_data_events(c->fd, c, EPOLLIN);
+                                return true;
+
+                        case SSL_ERROR_WANT_WRITE:
+                                poller.set_data_events(c->fd, c, EPOLLOUT);
+                                return true;
+
+                        default:
+                                if (trace) {
+                                        SLog("TLS handshake failed:", ERR_error_string(ERR_get_error(), nullptr), "\n");
+                                }
+
+                                return shutdown(c, __LINE__);
+                }
+        }
+
+        if (!BIO_get_ktls_send(SSL_get_wbio(ssl)) || !BIO_get_ktls_recv(SSL_get_rbio(ssl))) {
+                if (trace) {
+                        SLog("kTLS not available for cipher ", SSL_get_cipher_name(ssl), "\n");
+                }
+
+                return shutdown(c, __LINE__);
+        }
+
+        // the kernel owns the session now; SSL_set_fd() won't close the socket
+        release_tls(c);
+        c->state.flags |= 1u << uint8_t(connection::State::Flags::SecureChannel);
+
+        // process_io() will consider it established
+        poller.set_data_events(c->fd, c, EPOLLIN | EPOLLOUT);
+        return true;
+}
+
+void TankClient::release_tls(connection *const c) {
+        if (auto ssl = std::exchange(c->tls, nullptr)) {
+                SSL_free(ssl);
+        }
+}
+#endif
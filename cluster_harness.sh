@@ -0,0 +1,151 @@
+#!/bin/bash
+# Starts a local TANK cluster of N nodes backed by tank-consul-standin(see consul_standin.cpp), creates a replicated topic, and
+# runs `tank-cli bm failover` against it while churning nodes, so that we can measure failover time, produce latency and
+# how long produced messages take to be acknowledged by the partition's ISR(replication lag).
+# The replication lag of every follower of the benchmarked partition is also sampled once a second from the leader's
+# Prometheus metrics(tanksrv_partition_replication_lag) into <data dir>/replication_lag.log, and summarized at the end.
+#
+# Node <id> listens at :<base port + id>, exports Prometheus metrics at :<metrics base port + id>, and its data are stored in <data dir>/<id>.
+# Nodes run in <data dir>, so that the consul token file the harness creates won't end up in the caller's working directory.
+# Every <churn interval> seconds, the leader of the benchmarked partition is killed(SIGKILL) and restarted <restart delay> seconds later.
+# Node 1 is the node tank-cli talks to, so if it's the leader, another node is killed instead(ISR churn).
+set -u
+
+NODES=3
+DURATION=60
+CHURN=15
+RESTART_DELAY=5
+PARTITIONS=4
+RF=3
+CLUSTER=harness
+TOPIC=bench
+DATA_DIR=/tmp/tank_harness
+BASE_PORT=11010
+PROM_BASE_PORT=9110
+CONSUL_PORT=8500
+
+usage() {
+	echo "Usage: $0 [-n nodes] [-d duration] [-k churn interval] [-w restart delay] [-p partitions] [-r replication factor] [-D data dir]"
+	echo "Use -k 0 to disable churn"
+}
+
+while getopts "n:d:k:w:p:r:D:h" opt; do
+	case $opt in
+		n) NODES=$OPTARG ;;
+		d) DURATION=$OPTARG ;;
+		k) CHURN=$OPTARG ;;
+		w) RESTART_DELAY=$OPTARG ;;
+		p) PARTITIONS=$OPTARG ;;
+		r) RF=$OPTARG ;;
+		D) DATA_DIR=$OPTARG ;;
+		*) usage; exit 1 ;;
+	esac
+done
+
+for bin in ./tank ./tank-cli ./tank-consul-standin; do
+	if [ ! -x $bin ]; then
+		echo "$bin is missing; build it first(make all consul-standin)"
+		exit 1
+	fi
+done
+
+# nodes don't run in the current directory; see start_node()
+TANK=$(realpath ./tank)
+DATA_DIR=$(realpath -m $DATA_DIR)
+CONSUL=http://127.0.0.1:$CONSUL_PORT/v1/kv/TANK/clusters/$CLUSTER
+declare -A PIDS
+
+cleanup() {
+	for pid in "${PIDS[@]}"; do
+		kill -9 $pid 2>/dev/null
+	done
+	wait 2>/dev/null
+}
+trap cleanup EXIT
+
+start_node() {
+	local id=$1
+
+	mkdir -p $DATA_DIR/$id
+	# tank reads tank_consul.token from its working directory
+	(cd $DATA_DIR && exec $TANK -p $DATA_DIR/$id -l :$((BASE_PORT + id)) -P 127.0.0.1:$((PROM_BASE_PORT + id)) -C "$id@$CLUSTER|:$CONSUL_PORT") > $DATA_DIR/$id.log 2>&1 &
+	PIDS[$id]=$!
+}
+
+partition_leader() {
+	curl -s "$CONSUL/leaders/$TOPIC/0?raw"
+}
+
+# appends "<ts> <leader> <follower> <lag in messages>" for every follower of the benchmarked partition, once a second
+sample_replication_lag() {
+	while kill -0 $BM 2>/dev/null; do
+		local leader=$(partition_leader)
+
+		if [ -n "$leader" ]; then
+			curl -s -m 1 "http://127.0.0.1:$((PROM_BASE_PORT + leader))/metrics" |
+				awk -v ts=$(date +%s) -v leader=$leader -v series="tanksrv_partition_replication_lag{topic=\"$TOPIC\",partition=\"0\"," \
+					'index($0, series) == 1 && match($0, /node="[0-9]+"/) { print ts, leader, substr($0, RSTART + 6, RLENGTH - 7), $NF }' >> $DATA_DIR/replication_lag.log
+		fi
+		sleep 1
+	done
+}
+
+rm -rf $DATA_DIR
+mkdir -p $DATA_DIR
+# the stand-in ignores the token, but tank requires one
+echo "harness" > $DATA_DIR/tank_consul.token
+
+./tank-consul-standin -l :$CONSUL_PORT > $DATA_DIR/consul.log 2>&1 &
+PIDS[consul]=$!
+sleep 0.5
+
+for id in $(seq 1 $NODES); do
+	start_node $id
+done
+sleep 2
+
+curl -s -X PUT -d "{\"rf\": $RF}" "$CONSUL/configs/$TOPIC" > /dev/null
+./tank-cli -b :$((BASE_PORT + 1)) -t $TOPIC create_topic $PARTITIONS || exit 1
+curl -s -X PUT "$CONSUL/conf-updates/$TOPIC" > /dev/null
+
+# wait for the partition to get a leader
+for i in $(seq 1 50); do
+	[ -n "$(partition_leader)" ] && break
+	sleep 0.2
+done
+
+./tank-cli -b :$((BASE_PORT + 1)) -t $TOPIC -p 0 bm failover -d $DURATION &
+BM=$!
+
+sample_replication_lag &
+PIDS[lag]=$!
+
+if [ "$CHURN" -gt 0 ] && [ "$NODES" -gt 1 ]; then
+	while kill -0 $BM 2>/dev/null; do
+		sleep $CHURN
+		kill -0 $BM 2>/dev/null || break
+
+		victim=$(partition_leader)
+		if [ -z "$victim" ] || [ "$victim" = "1" ]; then
+			victim=$((2 + RANDOM % (NODES - 1)))
+		fi
+
+		echo "$(date +%T) killing node $victim"
+		kill -9 ${PIDS[$victim]} 2>/dev/null
+		sleep $RESTART_DELAY
+		echo "$(date +%T) restarting node $victim"
+		start_node $victim
+	done
+fi
+
+wait $BM
+BM_RES=$?
+wait ${PIDS[lag]} 2>/dev/null
+
+if [ -s $DATA_DIR/replication_lag.log ]; then
+	echo "Replication lag of $TOPIC/0 followers, in messages:"
+	awk '{ n[$3]++; sum[$3] += $4; if ($4 > max[$3]) max[$3] = $4 }
+		END { for (f in n) printf "node %s: samples %d, avg %.1f, max %d\n", f, n[f], sum[f] / n[f], max[f] }' $DATA_DIR/replication_lag.log | sort
+fi
+
+exit $BM_RES
@@ -2,6 +2,10 @@
 #include <switch.h>
 #include <ext/martinus/robin_hood.h>
 #include <cassert>
+#include <array>
+#ifdef __x86_64__
+#include <nmmintrin.h>
+#endif
 
 #define TANK_RUNTIME_CHECKS 1
 
@@ -26,6 +30,16 @@ namespace TankFlags {
                 UseLastSpecifiedTS = 2,
                 SeqNumPrevPlusOne  = 4
         };
+
+        // extra_flags:u8 follows the bundle header flags iff bit 7 of the header flags is set
+        // See tank_encoding.md
+        enum class BundleExtraFlags : uint8_t {
+                RichProducerInfo = 1,
+                ProducerSeq      = 2,
+                CRC32C           = 4,
+                // the message set is encoded in columns; see bundle_columnar.h
+                Columnar         = 8
+        };
 }
 
 namespace TANK_Limits {
@@ -55,6 +69,14 @@ enum class TankAPIMsgType : uint8_t {
         ReloadConf         = 0x8,
         ConsumePeer        = 0x9,
         Status             = 10,
+
+        // Consumer groups; see tank_protocol.md
+        JoinGroup     = 11,
+        CommitOffsets = 12,
+        FetchOffsets  = 13,
+
+        // Sent by brokers to clients that exceeded their quotas; see tank_protocol.md
+        Throttle = 14,
 };
 
 namespace TANKUtil {
@@ -81,9 +103,15 @@ namespace TANKUtil {
                         return 255;
                 }
 
+                // Require ack from all nodes in ISR, and the leader(or the standalone broker) to have fdatasync()ed the bundles
+                inline uint8_t ISR_durable() noexcept {
+                        return 254;
+                }
+
                 inline uint8_t value(const uint8_t v) {
                         TANK_EXPECT(v != ISR());
                         TANK_EXPECT(v != ISR_quorum());
+                        TANK_EXPECT(v != ISR_durable());
                         return v;
                 }
         } // namespace produce_request_acks
@@ -93,12 +121,154 @@ namespace TANKUtil {
                 return end >= start ? end - start : 0;
         }
 
+        // The size of the fields that follow extra_flags:u8 in the bundle header
+        inline constexpr std::size_t bundle_extra_hdr_fields_size(const uint8_t extra_flags) noexcept {
+                std::size_t n{0};
+
+                if (extra_flags & uint8_t(TankFlags::BundleExtraFlags::RichProducerInfo)) {
+                        n += sizeof(uint32_t) + sizeof(uint64_t) + sizeof(uint16_t);
+                }
+                if (extra_flags & uint8_t(TankFlags::BundleExtraFlags::ProducerSeq)) {
+                        n += sizeof(uint64_t) + sizeof(uint32_t);
+                }
+                if (extra_flags & uint8_t(TankFlags::BundleExtraFlags::CRC32C)) {
+                        n += sizeof(uint32_t);
+                }
+                return n;
+        }
+
+        // Skips past extra_flags:u8 and its fields, if bit 7 is set in the bundle header flags
+        // Returns the extra flags (0 if none were set)
+        inline uint8_t skip_bundle_extra_hdr(const uint8_t bundle_hdr_flags, const uint8_t *&p) noexcept {
+                if (!(bundle_hdr_flags & (1u << 7))) {
+                        return 0;
+                }
+
+                const auto extra_flags = *p++;
+
+                p += bundle_extra_hdr_fields_size(extra_flags);
+                return extra_flags;
+        }
+
+        // Same as above, except that it won't read past end
+        // Returns false if the extra header is not fully contained in [p, end)
+        inline bool skip_bundle_extra_hdr(const uint8_t bundle_hdr_flags, const uint8_t *&p, const uint8_t *const end) noexcept {
+                if (!(bundle_hdr_flags & (1u << 7))) {
+                        return true;
+                } else if (p >= end) {
+                        return false;
+                }
+
+                const auto n = sizeof(uint8_t) + bundle_extra_hdr_fields_size(*p);
+
+                if (p + n > end) {
+                        return false;
+                }
+
+                p += n;
+                return true;
+        }
+
+        namespace crc32c_impl {
+                constexpr std::array<uint32_t, 256> make_table() {
+                        std::array<uint32_t, 256> t{};
+
+                        for (uint32_t i{0}; i < 256; ++i) {
+                                uint32_t c = i;
+
+                                for (int k{0}; k < 8; ++k) {
+                                        c = (c & 1) ? (c >> 1) ^ 0x82f63b78 : c >> 1;
+                                }
+                                t[i] = c;
+                        }
+                        return t;
+                }
+
+                inline constexpr auto table = make_table();
+
+                inline uint32_t sw(uint32_t crc, const uint8_t *p, std::size_t n) noexcept {
+                        while (n--) {
+                                crc = table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+                        }
+                        return crc;
+                }
+
+#ifdef __x86_64__
+                __attribute__((target("sse4.2"))) inline uint32_t hw(uint32_t crc, const uint8_t *p, std::size_t n) noexcept {
+                        uint64_t c = crc;
+
+                        for (; n >= sizeof(uint64_t); n -= sizeof(uint64_t), p += sizeof(uint64_t)) {
+                                uint64_t v;
+
+                                memcpy(&v, p, sizeof(v));
+                                c = _mm_crc32_u64(c, v);
+                        }
+
+                        crc = static_cast<uint32_t>(c);
+                        while (n--) {
+                                crc = _mm_crc32_u8(crc, *p++);
+                        }
+                        return crc;
+                }
+#endif
+        } // namespace crc32c_impl
+
+        // CRC32C(Castagnoli) of [data, data + len), using the SSE4.2 crc32 instruction if available
+        // Pass the result of a previous call as crc to checksum non-contiguous content
+        inline uint32_t crc32c(const void *data, const std::size_t len, const uint32_t crc = 0) noexcept {
+                const auto p = static_cast<const uint8_t *>(data);
+
+#ifdef __x86_64__
+                static const bool have_sse42 = __builtin_cpu_supports("sse4.2");
+
+                if (have_sse42) {
+                        return ~crc32c_impl::hw(~crc, p, len);
+                }
+#endif
+                return ~crc32c_impl::sw(~crc, p, len);
+        }
+
+        // bundle points to the bundle header flags, and bundle_end to the end of the bundle
+        // The CRC32C, if present, covers everything in the bundle that follows it
+        //
+        // Returns false iff the bundle is truncated, or carries a CRC32C that doesn't match its content
+        inline bool verify_bundle_crc32c(const uint8_t *const bundle, const uint8_t *const bundle_end) noexcept {
+                if (bundle >= bundle_end || !(*bundle & (1u << 7))) {
+                        return true;
+                } else if (bundle + sizeof(uint8_t) * 2 > bundle_end) {
+                        return false;
+                }
+
+                const auto extra_flags = bundle[1];
+
+                if (!(extra_flags & uint8_t(TankFlags::BundleExtraFlags::CRC32C))) {
+                        return true;
+                }
+
+                // the CRC32C is the last of the extra header fields
+                const auto *p = bundle + sizeof(uint8_t) * 2 + bundle_extra_hdr_fields_size(extra_flags) - sizeof(uint32_t);
+
+                if (p + sizeof(uint32_t) > bundle_end) {
+                        return false;
+                }
+
+                const auto expected = decode_pod<uint32_t>(p);
+
+                return crc32c(p, bundle_end - p) == expected;
+        }
+
+        // bundle points to the bundle header flags, and its extra flags, if any, must be available
+        inline bool bundle_is_columnar(const uint8_t *const bundle) noexcept {
+                return (bundle[0] & (1u << 7)) && (bundle[1] & uint8_t(TankFlags::BundleExtraFlags::Columnar));
+        }
+
 	inline void safe_close(int fd) {
 		TANK_EXPECT(fd > 2);
 		close(fd);
 	}
 
         // saniy check
+        static_assert(crc32c_impl::table[1] == 0xf26b8303);
         static_assert(time32_delta(0, 10) == 10);
         static_assert(time32_delta(11, 10) == 0);
 } // namespace TANKUtil
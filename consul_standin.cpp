@@ -0,0 +1,1112 @@
+// A loopback stand-in for the subset of the Consul HTTP API TANK cluster nodes depend on(see service_consul.cpp and service_json.cpp)
+// so that we can exercise and benchmark cluster mode(leader failover, ISR churn, replication) locally and in CI without a Consul agent.
+//
+// Supported:
+// - KV: GET(single key, ?raw, ?recurse, blocking queries via ?index and ?wait), PUT(?cas, ?acquire, ?release, ?flags), DELETE(?recurse, ?cas)
+// - Sessions: create, renew, destroy, info. Sessions are invalidated when their TTL expires, and their locks are released(or the keys are deleted,
+// 	depending on the session Behavior). LockDelay is respected.
+// - Transactions: KV verbs set, cas, lock, unlock, get, delete, delete-tree, delete-cas, check-index, check-session, check-not-exists
+//
+// Not supported: ACLs(X-Consul-Token is ignored), health checks, persistence, gzip encoding. State is lost on restart.
+#include <base64.h>
+#include <ext/json/single_include/nlohmann/json.hpp>
+#include <fcntl.h>
+#include <map>
+#include <netinet/tcp.h>
+#include <network.h>
+#include <random>
+#include <set>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <switch.h>
+#include <sysexits.h>
+#include <timings.h>
+#include <unordered_map>
+
+using json = nlohmann::json;
+
+namespace {
+        struct kv_entry final {
+                std::string value;
+                std::string session;
+                uint64_t    flags{0};
+                uint64_t    create_index{0};
+                uint64_t    modify_index{0};
+                uint64_t    lock_index{0};
+        };
+
+        struct session final {
+                std::string           id;
+                std::string           name;
+                bool                  delete_behavior{false};
+                uint64_t              ttl_ms{0};
+                uint64_t              lock_delay_ms{15 * 1000};
+                uint64_t              expiration{0};
+                uint64_t              create_index{0};
+                std::set<std::string> locks;
+        };
+
+        struct connection final {
+                int         fd;
+                std::string in;
+                std::string out;
+                bool        keep_alive{true};
+                bool        blocked{false};
+                bool        closed{false};
+        };
+
+        // a blocking query; we respond as soon as the index of the monitored key or prefix exceeds index, or when it expires
+        struct blocking_query final {
+                connection *c;
+                std::string key;
+                bool        recurse;
+                uint64_t    index;
+                uint64_t    expiration;
+        };
+
+        struct txn_fault final {
+                size_t      op_index;
+                std::string what;
+        };
+
+        uint64_t now_ms;
+
+        class store final {
+              public:
+                std::map<std::string, kv_entry>              kv;
+                // deleted keys, so that blocking queries on a prefix will also consider deletions
+                std::map<std::string, uint64_t>              tombstones;
+                std::unordered_map<std::string, uint64_t>    lock_delays;
+                std::unordered_map<std::string, session>     sessions;
+                std::mt19937_64                              rng{std::random_device{}()};
+                uint64_t                                     index{1};
+
+                uint64_t key_index(const std::string &key, const bool recurse) const {
+                        uint64_t res{0};
+
+                        if (!recurse) {
+                                if (const auto it = kv.find(key); it != kv.end()) {
+                                        res = it->second.modify_index;
+                                }
+                                if (const auto it = tombstones.find(key); it != tombstones.end()) {
+                                        res = std::max(res, it->second);
+                                }
+                        } else {
+                                for (auto it = kv.lower_bound(key); it != kv.end() && it->first.compare(0, key.size(), key) == 0; ++it) {
+                                        res = std::max(res, it->second.modify_index);
+                                }
+                                for (auto it = tombstones.lower_bound(key); it != tombstones.end() && it->first.compare(0, key.size(), key) == 0; ++it) {
+                                        res = std::max(res, it->second);
+                                }
+                        }
+
+                        // never report 0; clients treat that as "no index"
+                        return res ?: 1;
+                }
+
+                std::string new_session_id() {
+                        static constexpr const char hex[] = "0123456789abcdef";
+                        std::string                 id;
+
+                        do {
+                                id.clear();
+                                for (size_t i{0}; i < 32; ++i) {
+                                        if (i == 8 || i == 12 || i == 16 || i == 20) {
+                                                id.push_back('-');
+                                        }
+                                        id.push_back(hex[rng() & 15]);
+                                }
+                        } while (sessions.count(id));
+
+                        return id;
+                }
+
+                void set(const std::string &key, const std::string &value, const uint64_t flags, const uint64_t idx) {
+                        auto &e = kv[key];
+
+                        if (!e.create_index) {
+                                e.create_index = idx;
+                        }
+
+                        e.value        = value;
+                        e.flags        = flags;
+                        e.modify_index = idx;
+                        tombstones.erase(key);
+                }
+
+                void erase(std::map<std::string, kv_entry>::iterator it, const uint64_t idx) {
+                        if (!it->second.session.empty()) {
+                                if (auto s = sessions.find(it->second.session); s != sessions.end()) {
+                                        s->second.locks.erase(it->first);
+                                }
+                        }
+
+                        tombstones[it->first] = idx;
+                        kv.erase(it);
+                }
+
+                void erase_tree(const std::string &prefix, const uint64_t idx) {
+                        for (auto it = kv.lower_bound(prefix); it != kv.end() && it->first.compare(0, prefix.size(), prefix) == 0;) {
+                                erase(it++, idx);
+                        }
+                }
+
+                bool lock_delayed(const std::string &key) {
+                        if (const auto it = lock_delays.find(key); it == lock_delays.end()) {
+                                return false;
+                        } else if (it->second > now_ms) {
+                                return true;
+                        } else {
+                                lock_delays.erase(it);
+                                return false;
+                        }
+                }
+
+                // see https://www.consul.io/docs/internals/sessions.html
+                bool acquire(const std::string &key, const std::string &sid, const std::string &value, const uint64_t flags, const uint64_t idx) {
+                        auto s = sessions.find(sid);
+
+                        if (s == sessions.end()) {
+                                return false;
+                        }
+
+                        if (const auto it = kv.find(key); it != kv.end() && !it->second.session.empty()) {
+                                if (it->second.session != sid) {
+                                        return false;
+                                }
+
+                                // already held by this session; just update the value
+                                set(key, value, flags, idx);
+                                return true;
+                        }
+
+                        if (lock_delayed(key)) {
+                                return false;
+                        }
+
+                        set(key, value, flags, idx);
+
+                        auto &e = kv[key];
+
+                        e.session = sid;
+                        ++e.lock_index;
+                        s->second.locks.insert(key);
+                        return true;
+                }
+
+                bool release(const std::string &key, const std::string &sid, const std::string *value, const uint64_t flags, const uint64_t idx) {
+                        const auto it = kv.find(key);
+
+                        if (it == kv.end() || it->second.session != sid) {
+                                return false;
+                        }
+
+                        if (value) {
+                                it->second.value = *value;
+                                it->second.flags = flags;
+                        }
+
+                        it->second.session.clear();
+                        it->second.modify_index = idx;
+
+                        if (auto s = sessions.find(sid); s != sessions.end()) {
+                                s->second.locks.erase(key);
+                        }
+
+                        return true;
+                }
+
+                void invalidate_session(const std::string &sid, const bool apply_lock_delay) {
+                        const auto it = sessions.find(sid);
+
+                        if (it == sessions.end()) {
+                                return;
+                        }
+
+                        const auto idx   = ++index;
+                        auto       locks = std::move(it->second.locks);
+
+                        for (const auto &key : locks) {
+                                auto e = kv.find(key);
+
+                                if (e == kv.end() || e->second.session != sid) {
+                                        continue;
+                                }
+
+                                if (apply_lock_delay && it->second.lock_delay_ms) {
+                                        lock_delays[key] = now_ms + it->second.lock_delay_ms;
+                                }
+
+                                if (it->second.delete_behavior) {
+                                        erase(e, idx);
+                                } else {
+                                        e->second.session.clear();
+                                        e->second.modify_index = idx;
+                                }
+                        }
+
+                        sessions.erase(it);
+                }
+
+                uint64_t expire_sessions() {
+                        uint64_t                 next{std::numeric_limits<uint64_t>::max()};
+                        std::vector<std::string> expired;
+
+                        for (const auto &it : sessions) {
+                                if (!it.second.ttl_ms) {
+                                        continue;
+                                } else if (it.second.expiration <= now_ms) {
+                                        expired.emplace_back(it.first);
+                                } else {
+                                        next = std::min(next, it.second.expiration);
+                                }
+                        }
+
+                        for (const auto &sid : expired) {
+                                invalidate_session(sid, true);
+                        }
+
+                        return next;
+                }
+        };
+
+        store       state;
+        std::string scratch;
+
+        void append_json_string(std::string &out, const std::string &s) {
+                out.push_back('"');
+                for (const auto c : s) {
+                        switch (c) {
+                                case '"':
+                                        out.append("\\\"");
+                                        break;
+
+                                case '\\':
+                                        out.append("\\\\");
+                                        break;
+
+                                case '\n':
+                                        out.append("\\n");
+                                        break;
+
+                                default:
+                                        if (static_cast<unsigned char>(c) < 0x20) {
+                                                char buf[8];
+
+                                                out.append(buf, snprintf(buf, sizeof(buf), "\\u%04x", c));
+                                        } else {
+                                                out.push_back(c);
+                                        }
+                                        break;
+                        }
+                }
+                out.push_back('"');
+        }
+
+        void append_kv_entry(std::string &out, const std::string &key, const kv_entry &e) {
+                out.append(R"({"LockIndex":)").append(std::to_string(e.lock_index));
+                out.append(R"(,"Key":)");
+                append_json_string(out, key);
+                out.append(R"(,"Flags":)").append(std::to_string(e.flags));
+                out.append(R"(,"Value":)");
+                if (e.value.empty()) {
+                        out.append("null");
+                } else {
+                        Buffer b;
+
+                        Base64::Encode(reinterpret_cast<const uint8_t *>(e.value.data()), e.value.size(), &b);
+                        out.push_back('"');
+                        out.append(b.data(), b.size());
+                        out.push_back('"');
+                }
+                if (!e.session.empty()) {
+                        out.append(R"(,"Session":)");
+                        append_json_string(out, e.session);
+                }
+                out.append(R"(,"CreateIndex":)").append(std::to_string(e.create_index));
+                out.append(R"(,"ModifyIndex":)").append(std::to_string(e.modify_index));
+                out.push_back('}');
+        }
+
+        void append_session(std::string &out, const session &s) {
+                out.append(R"({"ID":)");
+                append_json_string(out, s.id);
+                out.append(R"(,"Name":)");
+                append_json_string(out, s.name);
+                out.append(R"(,"LockDelay":)").append(std::to_string(s.lock_delay_ms * 1000 * 1000));
+                out.append(R"(,"Behavior":)").append(s.delete_behavior ? R"("delete")" : R"("release")");
+                out.append(R"(,"TTL":")").append(std::to_string(s.ttl_ms / 1000)).append(R"(s")");
+                out.append(R"(,"CreateIndex":)").append(std::to_string(s.create_index));
+                out.append(R"(,"ModifyIndex":)").append(std::to_string(s.create_index));
+                out.push_back('}');
+        }
+
+        std::string url_decode(const str_view32 s) {
+                std::string res;
+
+                for (const char *p = s.data(), *const e = p + s.size(); p < e; ++p) {
+                        if (*p == '%' && p + 2 < e && isxdigit(p[1]) && isxdigit(p[2])) {
+                                const char h[3] = {p[1], p[2], '\0'};
+
+                                res.push_back(static_cast<char>(strtoul(h, nullptr, 16)));
+                                p += 2;
+                        } else {
+                                res.push_back(*p);
+                        }
+                }
+
+                return res;
+        }
+
+        // durations are expressed as e.g 10s, 250ms, 2m
+        uint64_t parse_duration_ms(str_view32 s) {
+                if (s.EndsWith(_S("ms"))) {
+                        return s.AsTrimmedBy(2).as_uint64();
+                } else if (s.EndsWith('s')) {
+                        return s.AsTrimmedBy(1).as_uint64() * 1000;
+                } else if (s.EndsWith('m')) {
+                        return s.AsTrimmedBy(1).as_uint64() * 60 * 1000;
+                } else if (s.EndsWith('h')) {
+                        return s.AsTrimmedBy(1).as_uint64() * 3600 * 1000;
+                } else {
+                        // nanoseconds
+                        return s.as_uint64() / (1000 * 1000);
+                }
+        }
+
+        uint64_t json_duration_ms(const json &v) {
+                if (v.is_string()) {
+                        const auto s = v.get<std::string>();
+
+                        return parse_duration_ms(str_view32(s.data(), s.size()));
+                } else if (v.is_number()) {
+                        return v.get<uint64_t>() / (1000 * 1000);
+                } else {
+                        return 0;
+                }
+        }
+
+        void respond(connection *c, const int rc, const std::string &content, const uint64_t idx = 0) {
+                const char *reason;
+
+                switch (rc) {
+                        case 200:
+                                reason = "OK";
+                                break;
+
+                        case 400:
+                                reason = "Bad Request";
+                                break;
+
+                        case 404:
+                                reason = "Not Found";
+                                break;
+
+                        case 405:
+                                reason = "Method Not Allowed";
+                                break;
+
+                        case 409:
+                                reason = "Conflict";
+                                break;
+
+                        default:
+                                reason = "Internal Server Error";
+                                break;
+                }
+
+                c->out.append("HTTP/1.1 ").append(std::to_string(rc)).append(" ").append(reason).append("\r\n");
+                c->out.append("Content-Type: application/json\r\n");
+                if (idx) {
+                        c->out.append("X-Consul-Index: ").append(std::to_string(idx)).append("\r\n");
+                        c->out.append("X-Consul-Knownleader: true\r\nX-Consul-Lastcontact: 0\r\n");
+                }
+                c->out.append("Content-Length: ").append(std::to_string(content.size())).append("\r\n");
+                c->out.append(c->keep_alive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n");
+                c->out.append(content);
+        }
+
+        void respond_kv_get(connection *c, const std::string &key, const bool recurse) {
+                const auto idx = state.key_index(key, recurse);
+
+                scratch.clear();
+                if (recurse) {
+                        scratch.push_back('[');
+                        for (auto it = state.kv.lower_bound(key); it != state.kv.end() && it->first.compare(0, key.size(), key) == 0; ++it) {
+                                if (scratch.size() > 1) {
+                                        scratch.push_back(',');
+                                }
+                                append_kv_entry(scratch, it->first, it->second);
+                        }
+                        scratch.push_back(']');
+                } else if (const auto it = state.kv.find(key); it != state.kv.end()) {
+                        scratch.push_back('[');
+                        append_kv_entry(scratch, it->first, it->second);
+                        scratch.push_back(']');
+                }
+
+                if (scratch.size() < 3) {
+                        respond(c, 404, {}, idx);
+                } else {
+                        respond(c, 200, scratch, idx);
+                }
+        }
+
+        bool run_txn_op(const json &op, std::vector<std::pair<std::string, kv_entry>> *results, const uint64_t idx) {
+                const auto &kv_op = op.at("KV");
+                const auto  verb  = kv_op.at("Verb").get<std::string>();
+                const auto  key   = kv_op.value("Key", std::string{});
+                const auto  flags = kv_op.value("Flags", uint64_t(0));
+                const auto  sid   = kv_op.value("Session", std::string{});
+                const auto  index = kv_op.value("Index", uint64_t(0));
+                std::string value;
+
+                if (const auto it = kv_op.find("Value"); it != kv_op.end() && it->is_string()) {
+                        const auto b64 = it->get<std::string>();
+                        Buffer     b;
+
+                        if (Base64::Decode(reinterpret_cast<const uint8_t *>(b64.data()), b64.size(), &b) == -1) {
+                                return false;
+                        }
+                        value.assign(b.data(), b.size());
+                }
+
+                const auto it = state.kv.find(key);
+
+                if (verb == "set") {
+                        state.set(key, value, flags, idx);
+                } else if (verb == "cas") {
+                        if (index == 0 ? it != state.kv.end() : (it == state.kv.end() || it->second.modify_index != index)) {
+                                return false;
+                        }
+                        state.set(key, value, flags, idx);
+                } else if (verb == "lock") {
+                        if (!state.acquire(key, sid, value, flags, idx)) {
+                                return false;
+                        }
+                } else if (verb == "unlock") {
+                        if (!state.release(key, sid, &value, flags, idx)) {
+                                return false;
+                        }
+                } else if (verb == "get") {
+                        if (it == state.kv.end()) {
+                                return false;
+                        }
+                } else if (verb == "delete") {
+                        if (it != state.kv.end()) {
+                                state.erase(it, idx);
+                        }
+                        return true;
+                } else if (verb == "delete-tree") {
+                        state.erase_tree(key, idx);
+                        return true;
+                } else if (verb == "delete-cas") {
+                        if (it == state.kv.end() || it->second.modify_index != index) {
+                                return false;
+                        }
+                        state.erase(it, idx);
+                        return true;
+                } else if (verb == "check-index") {
+                        return it != state.kv.end() && it->second.modify_index == index;
+                } else if (verb == "check-session") {
+                        return it != state.kv.end() && it->second.session == sid;
+                } else if (verb == "check-not-exists") {
+                        return it == state.kv.end();
+                } else {
+                        return false;
+                }
+
+                results->emplace_back(key, state.kv[key]);
+                return true;
+        }
+
+        // Consul applies transactions atomically; we snapshot the affected state and restore it on failure
+        void handle_txn(connection *c, const std::string &body) {
+                json doc;
+
+                try {
+                        doc = json::parse(body);
+                } catch (const std::exception &e) {
+                        respond(c, 400, std::string("Failed to parse body: ") + e.what());
+                        return;
+                }
+
+                if (!doc.is_array()) {
+                        respond(c, 400, "Expected an array of operations");
+                        return;
+                }
+
+                const auto                                             saved_kv         = state.kv;
+                const auto                                             saved_tombstones = state.tombstones;
+                std::unordered_map<std::string, std::set<std::string>> saved_locks;
+                std::vector<std::pair<std::string, kv_entry>>  results;
+                std::vector<txn_fault>                                 faults;
+                const auto                                             idx = state.index + 1;
+
+                for (const auto &it : state.sessions) {
+                        saved_locks.emplace(it.first, it.second.locks);
+                }
+
+                for (size_t i{0}; i < doc.size(); ++i) {
+                        try {
+                                if (!run_txn_op(doc[i], &results, idx)) {
+                                        faults.push_back({i, "operation failed"});
+                                }
+                        } catch (const std::exception &e) {
+                                faults.push_back({i, e.what()});
+                        }
+                }
+
+                if (!faults.empty()) {
+                        state.kv         = saved_kv;
+                        state.tombstones = saved_tombstones;
+                        for (auto &it : saved_locks) {
+                                state.sessions[it.first].locks = std::move(it.second);
+                        }
+
+                        scratch.assign(R"({"Results":null,"Errors":[)");
+                        for (const auto &f : faults) {
+                                if (scratch.back() == '}') {
+                                        scratch.push_back(',');
+                                }
+                                scratch.append(R"({"OpIndex":)").append(std::to_string(f.op_index)).append(R"(,"What":)");
+                                append_json_string(scratch, f.what);
+                                scratch.push_back('}');
+                        }
+                        scratch.append("]}");
+                        respond(c, 409, scratch);
+                        return;
+                }
+
+                state.index = idx;
+                scratch.assign(R"({"Results":[)");
+                for (const auto &it : results) {
+                        if (scratch.back() == '}') {
+                                scratch.push_back(',');
+                        }
+                        scratch.append(R"({"KV":)");
+                        append_kv_entry(scratch, it.first, it.second);
+                        scratch.push_back('}');
+                }
+                scratch.append(R"(],"Errors":null})");
+                respond(c, 200, scratch, idx);
+        }
+
+        void handle_session(connection *c, const str_view32 method, str_view32 path, const std::string &body) {
+                if (path.Eq(_S("create"))) {
+                        session s;
+
+                        s.id           = state.new_session_id();
+                        s.create_index = ++state.index;
+
+                        if (!body.empty()) {
+                                try {
+                                        const auto doc = json::parse(body);
+
+                                        if (const auto it = doc.find("Name"); it != doc.end() && it->is_string()) {
+                                                s.name = it->get<std::string>();
+                                        }
+                                        if (const auto it = doc.find("TTL"); it != doc.end()) {
+                                                s.ttl_ms = json_duration_ms(*it);
+                                        }
+                                        if (const auto it = doc.find("LockDelay"); it != doc.end()) {
+                                                s.lock_delay_ms = json_duration_ms(*it);
+                                        }
+                                        if (const auto it = doc.find("Behavior"); it != doc.end() && it->is_string()) {
+                                                s.delete_behavior = it->get<std::string>() == "delete";
+                                        }
+                                } catch (const std::exception &e) {
+                                        respond(c, 400, std::string("Request decode failed: ") + e.what());
+                                        return;
+                                }
+                        }
+
+                        if (s.ttl_ms) {
+                                s.expiration = now_ms + s.ttl_ms;
+                        }
+
+                        scratch.assign(R"({"ID":)");
+                        append_json_string(scratch, s.id);
+                        scratch.push_back('}');
+                        state.sessions.emplace(s.id, std::move(s));
+                        respond(c, 200, scratch, state.index);
+                        return;
+                }
+
+                str_view32 verb, sid;
+
+                std::tie(verb, sid) = path.Divided('/');
+
+                const std::string id(sid.data(), sid.size());
+                const auto        it = state.sessions.find(id);
+
+                if (verb.Eq(_S("renew"))) {
+                        if (it == state.sessions.end()) {
+                                respond(c, 404, "Session id '" + id + "' not found");
+                        } else {
+                                if (it->second.ttl_ms) {
+                                        it->second.expiration = now_ms + it->second.ttl_ms;
+                                }
+
+                                scratch.assign("[");
+                                append_session(scratch, it->second);
+                                scratch.push_back(']');
+                                respond(c, 200, scratch, state.index);
+                        }
+                } else if (verb.Eq(_S("destroy"))) {
+                        // explicitly destroyed sessions are not subject to lock-delay
+                        state.invalidate_session(id, false);
+                        respond(c, 200, "true", state.index);
+                } else if (verb.Eq(_S("info"))) {
+                        scratch.assign("[");
+                        if (it != state.sessions.end()) {
+                                append_session(scratch, it->second);
+                        }
+                        scratch.push_back(']');
+                        respond(c, 200, scratch, state.index);
+                } else {
+                        respond(c, 404, {});
+                }
+        }
+
+        class standin final {
+              private:
+                EPoller                                                  poller;
+                int                                                      listen_fd{-1};
+                std::unordered_map<int, std::unique_ptr<connection>>     conns;
+                // connections shut down while processing events; released once we are done with them
+                std::vector<std::unique_ptr<connection>>                 released;
+                std::vector<blocking_query>                              blocked;
+                bool                                                     verbose{false};
+
+              private:
+                void shutdown(connection *c) {
+                        for (auto it = blocked.begin(); it != blocked.end();) {
+                                if (it->c == c) {
+                                        it = blocked.erase(it);
+                                } else {
+                                        ++it;
+                                }
+                        }
+
+                        if (const auto it = conns.find(c->fd); it != conns.end()) {
+                                released.emplace_back(std::move(it->second));
+                                conns.erase(it);
+                        }
+
+                        poller.erase(c->fd);
+                        close(c->fd);
+                        c->closed = true;
+                }
+
+                // returns false if the connection was shut down
+                bool try_tx(connection *c) {
+                        if (c->closed) {
+                                return false;
+                        }
+
+                        while (!c->out.empty()) {
+                                const auto r = write(c->fd, c->out.data(), c->out.size());
+
+                                if (r == -1) {
+                                        if (errno == EINTR) {
+                                                continue;
+                                        } else if (errno == EAGAIN) {
+                                                poller.set_data_events(c->fd, c, EPOLLIN | EPOLLOUT);
+                                                return true;
+                                        } else {
+                                                shutdown(c);
+                                                return false;
+                                        }
+                                }
+
+                                c->out.erase(0, r);
+                        }
+
+                        poller.set_data_events(c->fd, c, EPOLLIN);
+
+                        if (!c->keep_alive && !c->blocked) {
+                                shutdown(c);
+                                return false;
+                        }
+
+                        return true;
+                }
+
+                // responds to blocking queries that are ready, or expired
+                void wakeup_blocked(const bool expired_only) {
+                        std::vector<blocking_query> ready;
+
+                        for (auto it = blocked.begin(); it != blocked.end();) {
+                                if (it->expiration <= now_ms || (!expired_only && state.key_index(it->key, it->recurse) > it->index)) {
+                                        ready.emplace_back(*it);
+                                        it = blocked.erase(it);
+                                } else {
+                                        ++it;
+                                }
+                        }
+
+                        for (const auto &it : ready) {
+                                auto c = it.c;
+
+                                c->blocked = false;
+                                respond_kv_get(c, it.key, it.recurse);
+                                if (try_tx(c)) {
+                                        process_input(c);
+                                }
+                        }
+                }
+
+                void kv_changed() {
+                        wakeup_blocked(false);
+                }
+
+                void process_req(connection *c, const str_view32 method, const str_view32 target, const std::string &body) {
+                        auto [path, query]   = target.Divided('?');
+                        bool        recurse  = false;
+                        bool        raw      = false;
+                        bool        cas_set  = false;
+                        uint64_t    index    = 0, cas = 0, flags = 0, wait_ms = 5 * 60 * 1000;
+                        std::string acquire, release;
+
+                        if (verbose) {
+                                Print(method, " ", target, "\n");
+                        }
+
+                        while (query) {
+                                const auto [param, rest] = query.Divided('&');
+                                const auto [k, v]        = param.Divided('=');
+
+                                if (k.Eq(_S("raw"))) {
+                                        raw = true;
+                                } else if (k.Eq(_S("recurse"))) {
+                                        recurse = !v || !v.Eq(_S("false"));
+                                } else if (k.Eq(_S("index"))) {
+                                        index = v.as_uint64();
+                                } else if (k.Eq(_S("wait"))) {
+                                        wait_ms = std::min<uint64_t>(parse_duration_ms(v), 10 * 60 * 1000);
+                                } else if (k.Eq(_S("cas"))) {
+                                        cas     = v.as_uint64();
+                                        cas_set = true;
+                                } else if (k.Eq(_S("flags"))) {
+                                        flags = v.as_uint64();
+                                } else if (k.Eq(_S("acquire"))) {
+                                        acquire = url_decode(v);
+                                } else if (k.Eq(_S("release"))) {
+                                        release = url_decode(v);
+                                }
+
+                                query = rest;
+                        }
+
+                        if (path.StripPrefix(_S("/v1/kv/"))) {
+                                const auto key = url_decode(path);
+
+                                if (method.Eq(_S("GET"))) {
+                                        if (raw && !recurse) {
+                                                if (const auto it = state.kv.find(key); it != state.kv.end()) {
+                                                        respond(c, 200, it->second.value, state.key_index(key, false));
+                                                } else {
+                                                        respond(c, 404, {}, state.key_index(key, false));
+                                                }
+                                        } else if (index && state.key_index(key, recurse) <= index) {
+                                                c->blocked = true;
+                                                blocked.push_back({c, key, recurse, index, now_ms + wait_ms});
+                                        } else {
+                                                respond_kv_get(c, key, recurse);
+                                        }
+                                } else if (method.Eq(_S("PUT"))) {
+                                        const auto it  = state.kv.find(key);
+                                        const auto idx = state.index + 1;
+                                        bool       res;
+
+                                        if (cas_set && (cas == 0 ? it != state.kv.end() : (it == state.kv.end() || it->second.modify_index != cas))) {
+                                                res = false;
+                                        } else if (!acquire.empty()) {
+                                                if (!state.sessions.count(acquire)) {
+                                                        respond(c, 500, "invalid session \"" + acquire + "\"");
+                                                        return;
+                                                }
+                                                res = state.acquire(key, acquire, body, flags, idx);
+                                        } else if (!release.empty()) {
+                                                res = state.release(key, release, &body, flags, idx);
+                                        } else {
+                                                state.set(key, body, flags, idx);
+                                                res = true;
+                                        }
+
+                                        if (res) {
+                                                state.index = idx;
+                                        }
+
+                                        respond(c, 200, res ? "true" : "false", state.index);
+                                        if (res) {
+                                                kv_changed();
+                                        }
+                                } else if (method.Eq(_S("DELETE"))) {
+                                        const auto it = state.kv.find(key);
+
+                                        if (cas_set && (it == state.kv.end() || it->second.modify_index != cas)) {
+                                                respond(c, 200, "false", state.index);
+                                                return;
+                                        }
+
+                                        const auto idx = ++state.index;
+
+                                        if (recurse) {
+                                                state.erase_tree(key, idx);
+                                        } else if (it != state.kv.end()) {
+                                                state.erase(it, idx);
+                                        }
+
+                                        respond(c, 200, "true", state.index);
+                                        kv_changed();
+                                } else {
+                                        respond(c, 405, {});
+                                }
+                        } else if (path.StripPrefix(_S("/v1/session/"))) {
+                                if (method.Eq(_S("GET")) && !path.BeginsWith(_S("info/"))) {
+                                        respond(c, 405, {});
+                                        return;
+                                }
+
+                                handle_session(c, method, path, body);
+                                kv_changed();
+                        } else if (path.Eq(_S("/v1/txn"))) {
+                                handle_txn(c, body);
+                                kv_changed();
+                        } else if (path.Eq(_S("/v1/status/leader"))) {
+                                respond(c, 200, R"("127.0.0.1:8300")");
+                        } else {
+                                respond(c, 404, {});
+                        }
+                }
+
+                // returns false if the connection was shut down
+                bool process_input(connection *c) {
+                        auto &in = c->in;
+
+                        while (!c->blocked && !c->closed) {
+                                const auto hdrs_end = in.find("\r\n\r\n");
+
+                                if (hdrs_end == std::string::npos) {
+                                        if (in.size() > 64 * 1024) {
+                                                shutdown(c);
+                                                return false;
+                                        }
+                                        break;
+                                }
+
+                                str_view32 hdrs(in.data(), hdrs_end);
+                                const auto [req_line, rest] = hdrs.Divided('\n');
+                                const auto [method, r]      = req_line.ws_trimmed().Divided(' ');
+                                const auto [target, proto]  = r.Divided(' ');
+                                size_t     content_len{0};
+
+                                c->keep_alive = !proto.Eq(_S("HTTP/1.0"));
+                                for (auto s = rest; s;) {
+                                        const auto [line, next] = s.Divided('\n');
+                                        const auto [name, v]    = line.Divided(':');
+                                        const auto value        = v.ws_trimmed();
+
+                                        if (name.EqNoCase(_S("Content-Length"))) {
+                                                content_len = value.as_uint64();
+                                        } else if (name.EqNoCase(_S("Connection"))) {
+                                                c->keep_alive = !value.EqNoCase(_S("close"));
+                                        }
+
+                                        s = next;
+                                }
+
+                                const auto req_size = hdrs_end + 4 + content_len;
+
+                                if (in.size() < req_size) {
+                                        break;
+                                }
+
+                                const std::string body(in.data() + hdrs_end + 4, content_len);
+                                const std::string m(method.data(), method.size()), t(target.data(), target.size());
+
+                                in.erase(0, req_size);
+                                process_req(c, str_view32(m.data(), m.size()), str_view32(t.data(), t.size()), body);
+
+                                if (!try_tx(c)) {
+                                        return false;
+                                }
+                        }
+
+                        return true;
+                }
+
+                void accept_conns() {
+                        for (;;) {
+                                const int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+                                if (fd == -1) {
+                                        return;
+                                }
+
+                                int one{1};
+
+                                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+                                auto c = std::make_unique<connection>();
+
+                                c->fd = fd;
+                                poller.insert(fd, EPOLLIN, c.get());
+                                conns.emplace(fd, std::move(c));
+                        }
+                }
+
+                void handle_event(connection *c, const uint32_t events) {
+                        if (c->closed) {
+                                return;
+                        } else if (events & (EPOLLERR | EPOLLHUP)) {
+                                shutdown(c);
+                                return;
+                        }
+
+                        if (events & EPOLLOUT) {
+                                if (!try_tx(c)) {
+                                        return;
+                                }
+                        }
+
+                        if (events & EPOLLIN) {
+                                char buf[16 * 1024];
+
+                                for (;;) {
+                                        const auto r = read(c->fd, buf, sizeof(buf));
+
+                                        if (r == -1) {
+                                                if (errno == EINTR) {
+                                                        continue;
+                                                } else if (errno == EAGAIN) {
+                                                        break;
+                                                }
+
+                                                shutdown(c);
+                                                return;
+                                        } else if (r == 0) {
+                                                shutdown(c);
+                                                return;
+                                        }
+
+                                        c->in.append(buf, r);
+                                }
+
+                                process_input(c);
+                        }
+                }
+
+                // returns the next deadline
+                uint64_t process_timers() {
+                        const auto sessions_cnt = state.sessions.size();
+                        auto       next         = state.expire_sessions();
+
+                        // sessions invalidation releases(or deletes) their locks
+                        wakeup_blocked(sessions_cnt == state.sessions.size());
+
+                        for (const auto &it : blocked) {
+                                next = std::min(next, it.expiration);
+                        }
+
+                        return next;
+                }
+
+              public:
+                standin(const bool v)
+                    : verbose{v} {
+                }
+
+                int run(const Switch::endpoint ep) {
+                        struct sockaddr_in sa;
+                        int                one{1};
+
+                        listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP);
+                        if (listen_fd == -1) {
+                                Print("socket() failed:", strerror(errno), "\n");
+                                return EX_OSERR;
+                        }
+
+                        memset(&sa, 0, sizeof(sa));
+                        sa.sin_family      = AF_INET;
+                        sa.sin_port        = htons(ep.port);
+                        sa.sin_addr.s_addr = ep.addr4;
+                        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+                        if (bind(listen_fd, reinterpret_cast<sockaddr *>(&sa), sizeof(sa)) == -1 || listen(listen_fd, 128) == -1) {
+                                Print("Failed to listen at ", ep, ":", strerror(errno), "\n");
+                                return EX_OSERR;
+                        }
+
+                        poller.insert(listen_fd, EPOLLIN, nullptr);
+                        Print("Consul stand-in accepting connections at ", ep, "\n");
+
+                        for (;;) {
+                                now_ms = Timings::Milliseconds::Tick();
+
+                                const auto next = process_timers();
+                                const auto r    = poller.poll(next == std::numeric_limits<uint64_t>::max() ? 1000 : std::min<uint64_t>(next - now_ms, 1000));
+
+                                if (r == -1) {
+                                        if (errno == EINTR) {
+                                                continue;
+                                        }
+
+                                        Print("epoll_wait() failed:", strerror(errno), "\n");
+                                        return EX_OSERR;
+                                }
+
+                                now_ms = Timings::Milliseconds::Tick();
+                                for (const auto it : poller.new_events(r)) {
+                                        if (!it->data.ptr) {
+                                                accept_conns();
+                                        } else {
+                                                handle_event(static_cast<connection *>(it->data.ptr), it->events);
+                                        }
+                                }
+
+                                released.clear();
+                        }
+                }
+        };
+} // namespace
+
+int main(int argc, char *argv[]) {
+        Switch::endpoint ep{.addr4 = htonl(INADDR_LOOPBACK), .port = 8500};
+        bool             verbose{false};
+        int              r;
+
+        while ((r = getopt(argc, argv, "l:vh")) != -1) {
+                switch (r) {
+                        case 'l':
+                                ep = Switch::ParseSrvEndpoint({optarg}, "http"_s8, 8500);
+                                if (!ep) {
+                                        Print("Failed to parse endpoint from ", optarg, "\n");
+                                        return 1;
+                                }
+                                break;
+
+                        case 'v':
+                                verbose = true;
+                                break;
+
+                        case 'h':
+                                Print("Usage: ", argv[0], " [-l <endpoint>] [-v]\n");
+                                Print("Serves the subset of the Consul HTTP API TANK cluster nodes depend on, from memory.\n");
+                                Print(Buffer{}.append(align_to(5), "-l <endpoint>"_s32, align_to(24), "Endpoint to accept connections at(default 127.0.0.1:8500)"_s32), "\n");
+                                Print(Buffer{}.append(align_to(5), "-v"_s32, align_to(24), "Trace requests"_s32), "\n");
+                                Print("\nExample:\n");
+                                Print(Buffer{}.append(left_aligned(7, "./tank-consul-standin -l :8500 & ./tank -p /tmp/TANK/1 -l :11011 -C '1@my_cluster|127.0.0.1:8500'"_s32, 76)), "\n");
+                                return 0;
+
+                        default:
+                                return 1;
+                }
+        }
+
+        signal(SIGPIPE, SIG_IGN);
+        return standin(verbose).run(ep);
+}
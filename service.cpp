@@ -1,4 +1,5 @@
 #include "service_common.h"
+#include "bundle_columnar.h"
 #include <sys/eventfd.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -12,9 +13,8 @@ Service *                       this_service;
 Buffer                          basePath_;
 bool                            read_only{false};
 
-std::mutex                       mboxLock;
-std::vector<std::pair<int, int>> mbox;
-std::condition_variable          mbox_cv;
+// fdatasync() latency(us), recorded by the sync workers
+hdr_histogram<true> fsync_latency;
 
 int Rename(const char *oldpath, const char *newpath);
 int Unlink(const char *pathname);
@@ -53,7 +53,10 @@ void topic_partition_log::consider_ro_segments() {
                         sum += it->fileSize;
                 }
 
-                while (!roSegments->empty() &&
+                // segments that have yet to be sealed are not going to be deleted until they are
+                const size_t pending_seals = partition->pending_seals.load(std::memory_order_acquire);
+
+                while (roSegments->size() > pending_seals &&
                        ((config.roSegmentsCnt && roSegments->size() > config.roSegmentsCnt) ||
                         (config.roSegmentsSize && sum > config.roSegmentsSize) ||
                         (roSegments->front()->createdTS &&
@@ -65,13 +68,18 @@ void topic_partition_log::consider_ro_segments() {
 
                         auto       segment     = roSegments->front();
                         const auto basePathLen = basePath.size();
+                        // we can't reuse its blocks while it's being read
+                        const bool recycle = segment->fdh.use_count() == 1;
 
                         if (trace) {
                                 SLog(ansifmt::bold, ansifmt::color_red, "Removing ", segment->baseSeqNum, ansifmt::reset, "\n");
                         }
 
+                        // unlinked by the reclaimer thread if it's running
                         basePath.append("/", segment->baseSeqNum, "-", segment->lastAvailSeqNum, "_", segment->createdTS, ".ilog");
-                        if (Unlink(basePath.data()) == -1) {
+                        if (this_service->retire_file(-1, partition, basePath.c_str(), recycle)) {
+                                // deferred
+                        } else if (Unlink(basePath.data()) == -1) {
                                 Print("Failed to unlink ", basePath, ": ", strerror(errno), "\n");
                         } else if (trace) {
                                 SLog("Removed ", basePath, "\n");
@@ -79,7 +87,9 @@ void topic_partition_log::consider_ro_segments() {
 
                         basePath.resize(basePathLen);
                         basePath.append("/", segment->baseSeqNum, ".index");
-                        if (Unlink(basePath.data()) == -1) {
+                        if (this_service->retire_file(-1, partition, basePath.c_str())) {
+                                // deferred
+                        } else if (Unlink(basePath.data()) == -1) {
                                 Print("Failed to unlink ", basePath, ": ", strerror(errno), "\n");
                         } else if (trace) {
                                 SLog("Removed ", basePath, "\n");
@@ -127,7 +137,7 @@ void topic_partition_log::consider_ro_segments() {
                         SLog(ansifmt::color_blue, "dirtyBytes = ", dirtyBytes, ", sum = ", sum, ", cleanable_ratio = ", cleanable_ratio, ansifmt::reset, "\n");
                 }
 
-                if (cleanable_ratio >= config.logCleanRatioMin) {
+                if (cleanable_ratio >= config.logCleanRatioMin && !partition->pending_seals.load(std::memory_order_acquire)) {
                         this_service->schedule_compaction(Buffer::build(basePath_, "/", partition->owner->name(), "/", partition->idx, "/").data(), this);
                 }
         }
@@ -137,13 +147,13 @@ void topic_partition_log::schedule_flush(const uint32_t now) {
         cur.flush_state.pendingFlushMsgs = 0;
         cur.flush_state.nextFlushTS      = now + config.flushIntervalSecs;
 
-        // This is obviously not optimal; we should have used a bounded queue, or some lock/wait-free construct
-        // but given this is a rare event, it's not worth it yet
-        mboxLock.lock();
-        mbox.push_back({cur.fdh->fd, cur.index.fd});
-        mboxLock.unlock();
+        auto r = new sync_request();
 
-        mbox_cv.notify_one();
+        r->fdh = cur.fdh;
+        // cur.index.fd is closed when the segment is rolled, possibly before the sync worker gets to it, and
+        // its number may then be reused by another file; the sync worker closes the duplicate(see sync_worker())
+        r->index_fd = cur.index.fd != -1 ? dup(cur.index.fd) : -1;
+        this_service->schedule_sync(this, r);
 }
 
 bool topic_partition::foreach_msg(std::function<bool(topic_partition::msg &)> &l) const {
@@ -154,18 +164,42 @@ bool topic_partition::foreach_msg(std::function<bool(topic_partition::msg &)> &l
                 range_base<const uint8_t *, std::size_t> msgSetContent;
 
                 for (const auto *p = static_cast<const uint8_t *>(fileData), *const e = p + fileSize; p != e;) {
-                        const auto bundleLen          = Compression::decode_varuint32(p);
+                        uint32_t bundleLen, msgsSetSize;
+
+                        if (!Compression::decode_varuint32(p, e, &bundleLen) || !bundleLen || bundleLen > e - p) {
+                                throw Switch::data_error("malformed bundle");
+                        }
+
                         const auto nextBundle         = p + bundleLen;
                         const auto bundleFlags        = *p++;
                         const auto codec              = bundleFlags & 3;
                         const bool sparseBundleBitSet = bundleFlags & (1u << 6);
-                        const auto msgsSetSize        = ((bundleFlags >> 2) & 0xf) ?: Compression::decode_varuint32(p);
+                        const auto extraFlags         = (bundleFlags & (1u << 7)) && p != nextBundle ? *p : uint8_t(0);
+
+                        if (!TANKUtil::skip_bundle_extra_hdr(bundleFlags, p, nextBundle)) {
+                                throw Switch::data_error("malformed bundle header");
+                        }
+
+                        msgsSetSize = (bundleFlags >> 2) & 0xf;
+                        if (!msgsSetSize && !Compression::decode_varuint32(p, nextBundle, &msgsSetSize)) {
+                                throw Switch::data_error("malformed bundle header");
+                        }
 
                         if (sparseBundleBitSet) {
+                                if (p + sizeof(uint64_t) > nextBundle) {
+                                        throw Switch::data_error("malformed bundle header");
+                                }
+
                                 firstMsgSeqNum = decode_pod<uint64_t>(p);
 
                                 if (msgsSetSize != 1) {
-                                        lastMsgSeqNum = firstMsgSeqNum + Compression::decode_varuint32(p) + 1;
+                                        uint32_t delta;
+
+                                        if (!Compression::decode_varuint32(p, nextBundle, &delta)) {
+                                                throw Switch::data_error("malformed bundle header");
+                                        }
+
+                                        lastMsgSeqNum = firstMsgSeqNum + delta + 1;
                                 } else {
                                         lastMsgSeqNum = firstMsgSeqNum;
                                 }
@@ -189,6 +223,28 @@ bool topic_partition::foreach_msg(std::function<bool(topic_partition::msg &)> &l
                         uint32_t msgIdx{0};
 
                         msg.ts = 0;
+                        if (extraFlags & uint8_t(TankFlags::BundleExtraFlags::Columnar)) {
+                                static thread_local TANKUtil::columnar::msgset_reader columnar_tls;
+                                auto &                                                columnar_reader{columnar_tls};
+                                uint32_t                                              seqNumDelta;
+
+                                if (!columnar_reader.reset(msgSetContent.offset, msgSetContent.offset + msgSetContent.size(), msgsSetSize, sparseBundleBitSet)) {
+                                        throw Switch::data_error("malformed columnar message set");
+                                }
+
+                                for (; columnar_reader.next(&msg.ts, &msg.key, &msg.data, &seqNumDelta); ++msgIdx, ++seqNum) {
+                                        if (sparseBundleBitSet) {
+                                                seqNum = msgIdx ? seqNum + seqNumDelta : firstMsgSeqNum;
+                                        }
+
+                                        msg.seqNum = seqNum;
+                                        if (false == l(msg)) {
+                                                return false;
+                                        }
+                                }
+                                continue;
+                        }
+
                         for (const auto *p = msgSetContent.offset, *const e = p + msgSetContent.size(); p != e; ++msgIdx, ++seqNum) {
                                 const auto flags{*p++};
 
@@ -201,22 +257,42 @@ bool topic_partition::foreach_msg(std::function<bool(topic_partition::msg &)> &l
                                                 // incremented in for() (in previous loop iteration)
                                         } else {
                                                 // we encode delta from last - 1, but we already ++seqNum in for() (in previous iteration)
-                                                seqNum += Compression::decode_varuint32(p);
+                                                uint32_t delta;
+
+                                                if (!Compression::decode_varuint32(p, e, &delta)) {
+                                                        throw Switch::data_error("malformed message");
+                                                }
+
+                                                seqNum += delta;
                                         }
                                 }
 
                                 if (!(flags & uint8_t(TankFlags::BundleMsgFlags::UseLastSpecifiedTS))) {
+                                        if (p + sizeof(uint64_t) > e) {
+                                                throw Switch::data_error("malformed message");
+                                        }
+
                                         msg.ts = decode_pod<uint64_t>(p);
                                 }
 
                                 if (flags & uint8_t(TankFlags::BundleMsgFlags::HaveKey)) {
+                                        if (p >= e || p + *p + sizeof(uint8_t) > e) {
+                                                throw Switch::data_error("malformed message");
+                                        }
+
                                         msg.key.set(reinterpret_cast<const char *>(p) + 1, *p);
                                         p += msg.key.size() + sizeof(uint8_t);
                                 } else {
                                         msg.key.reset();
                                 }
 
-                                if (const auto msgLen = Compression::decode_varuint32(p)) {
+                                uint32_t msgLen;
+
+                                if (!Compression::decode_varuint32(p, e, &msgLen) || msgLen > e - p) {
+                                        throw Switch::data_error("malformed message");
+                                }
+
+                                if (msgLen) {
                                         msg.data.set(reinterpret_cast<const char *>(p), msgLen);
                                         p += msgLen;
                                 } else {
@@ -429,6 +505,15 @@ void Service::parse_partition_config(const strwlen32_t contents, partition_confi
                         } else if (k.EqNoCase(_S("flush.secs"))) {
                                 // The amount of time the log can have dirty data before a flush is forced
                                 l->flushIntervalSecs = parse_duration(v);
+                        } else if (k.EqNoCase(_S("log.hot_tail.bytes"))) {
+                                // Recently appended bundles retained in memory for tailing consumers; see topic_partition_log::hot_tail
+                                l->hotTailSize = parse_size(v);
+                        } else if (k.EqNoCase(_S("quota.produce.bytes_per_sec"))) {
+                                // Bytes produced to the topic per second by all clients, before they are throttled; see Service::charge_produce_quotas()
+                                l->produceQuota = parse_size(v);
+                        } else if (k.EqNoCase(_S("quota.consume.bytes_per_sec"))) {
+                                // Bytes consumed from the topic per second by all clients, before they are throttled
+                                l->consumeQuota = parse_size(v);
                         } else {
                                 Print("Unknown topic/partition configuration key '", k, "'\n");
                         }
@@ -551,7 +636,7 @@ void Service::put_outgoing_queue(outgoing_queue *const q) {
                 q->front_ = next;
         }
 
-        outgoingQueuesPool.push_back(q);
+        slabs.release(q, sizeof(outgoing_queue));
 }
 
 void Service::introduce_self(connection *const c, bool &have_cork) {
@@ -589,6 +674,17 @@ Service::Service() {
 
         switch_dlist_init(&allConnections);
 
+        // weights of each traffic class; the quantum granted to a connection is tx_sched_quantum * weight
+        for (size_t i{0}; i < size_t(tx_class::Max); ++i) {
+                static constexpr const char *env_vars[] = {"TANK_TX_WEIGHT_REPLICATION", "TANK_TX_WEIGHT_TAIL", "TANK_TX_WEIGHT_BULK"};
+                static constexpr uint32_t    defaults[] = {8, 4, 1};
+                const auto                   v          = getenv(env_vars[i]);
+
+                static_assert(sizeof_array(env_vars) == size_t(tx_class::Max));
+                tx_sched.ready[i].reset();
+                tx_sched.weights[i] = v ? std::clamp<uint32_t>(strwlen32_t(v).as_uint32(), 1, 1024) : defaults[i];
+        }
+
         _interrupt_efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
         if (_interrupt_efd == -1) {
                 Print(ansifmt::bold, ansifmt::color_red, "eventfd() failed:", ansifmt::reset, " ", strerror(errno), "\n");
@@ -607,6 +703,12 @@ Service::~Service() {
         std::free(patch_list);
         std::free(partitions_requested_eof_patch_list_indices);
 
+#ifdef HAVE_TANK_TLS
+        tear_down_tls();
+#endif
+
+        close_splice_pipe();
+
         if (_interrupt_efd != -1) {
                 TANKUtil::safe_close(_interrupt_efd);
         }
@@ -616,11 +718,6 @@ Service::~Service() {
                 bufs.pop_back();
         }
 
-        while (!outgoingQueuesPool.empty()) {
-                delete outgoingQueuesPool.back();
-                outgoingQueuesPool.pop_back();
-        }
-
         for (auto it : waitctx_deferred_gc) {
                 put_waitctx(it);
         }
@@ -631,22 +728,36 @@ Service::~Service() {
                 delete c;
         }
 
+        // a wait_ctx may be in the waiting list of multiple partitions
+        std::unordered_set<wait_ctx *> pending_waitctxs;
+
         for (auto &it : topics) {
                 for (auto p : *it.second->partitions_) {
                         for (auto &it : p->waiting_list) {
-                                std::free(it.first);
+                                pending_waitctxs.insert(it.first);
                         }
 
                         p->waiting_list.clear();
                 }
         }
 
-        for (auto &it : waitCtxPool) {
-                while (!it.empty()) {
-                        std::free(it.back());
-                        it.pop_back();
+        for (auto it : pending_waitctxs) {
+                put_waitctx(it);
+        }
+}
+
+// Releases pooled memory that was not needed since the last time this was invoked
+void Service::trim_pools() {
+        if (bufs_low_watermark) {
+                for (size_t i{0}; i < bufs_low_watermark && !bufs.empty(); ++i) {
+                        delete bufs.back();
+                        bufs.pop_back();
                 }
         }
+        bufs_low_watermark = bufs.size();
+
+        slabs.trim();
+        next_pools_trim = now_ms + Timings::Seconds::ToMillis(10);
 }
 
 void Service::schedule_cleanup() {
@@ -661,7 +772,7 @@ int Service::safe_open(const char *path, int flags, mode_t mode) {
                 fd = open(path, flags, mode);
 
                 if (-1 == fd) {
-                        if ((ENFILE == errno || EMFILE == errno) && try_shutdown_idle(1)) {
+                        if ((ENFILE == errno || EMFILE == errno) && pthread_equal(pthread_self(), main_thread_id) && try_shutdown_idle(1)) {
                                 continue;
                         } else if (EINTR == errno) {
                                 continue;
@@ -683,15 +794,12 @@ topic *Service::topic_by_name(const strwlen8_t name) const {
 }
 
 void Service::tear_down() {
-        // notify the thread to exit so that we can join()
-        mboxLock.lock();
-        mbox.emplace_back(-1, 1);
-        mboxLock.unlock();
-        mbox_cv.notify_one();
+        stop_sync_workers();
 
-        if (auto t = sync_thread.release()) {
-                t->join();
-                delete t;
+        if (profiler.watchdog) {
+                profiler.watchdog_stop.store(true, std::memory_order_relaxed);
+                profiler.watchdog->join();
+                profiler.watchdog.reset();
         }
 
         if (compactions.compaction_thread) {
@@ -699,6 +807,18 @@ void Service::tear_down() {
                 compactions.workCond.notify_one();
                 compactions.compaction_thread->join();
         }
+
+        if (segments.thread) {
+                // any pending seals are processed before the thread exits
+                segments.pending.push_back(new segment_op{.type = segment_op::Type::Stop});
+                segments.workCond.notify_one();
+                segments.thread->join();
+        }
+
+        stop_partition_open_workers();
+
+        // last, because the threads above may have retired files
+        stop_reclaimer();
 }
 
 void Service::cleanup_scheduled_logs() {
@@ -736,16 +856,23 @@ bool topic_partition::safe_to_reset() const noexcept {
         return enabled() == false;
 }
 
+// active_partitions is kept in LRU order; the most recently accessed partition is last
 void Service::track_accessed_partition(topic_partition *const p, const time_t now) {
         // TODO: maybe only do so if (p->flags & unsigned(topic_partition::Flags::NoDataFiles) == 0)
         if (p->access.ll.empty()) {
                 if (active_partitions.empty()) {
                         next_active_partitions_check = now_ms + Timings::Seconds::ToMillis(8);
                 }
-
-                active_partitions.push_back(&p->access.ll);
+        } else if (active_partitions.prev == &p->access.ll) {
+                // already the most recently accessed
+                p->access.last_access = now;
+                return;
+        } else {
+                p->access.ll.detach_and_reset();
         }
 
+        // switch_dlist::push_front() appends to the list
+        active_partitions.push_front(&p->access.ll);
         p->access.last_access = now;
 }
 
@@ -753,15 +880,23 @@ void Service::consider_active_partitions() {
         for (auto it = active_partitions.next; it != &active_partitions;) {
                 auto       next  = it->next;
                 auto       part  = containerof(topic_partition, access.ll, it);
-                const auto delta = curTime - part->access.last_access;
+                const bool idle  = partitions_lru.idle_secs && curTime - part->access.last_access > partitions_lru.idle_secs;
+                const bool evict = partitions_lru.max_open && total_open_partitions > partitions_lru.max_open;
 
                 TANK_EXPECT(!part->access.ll.empty());
 
-                if (delta > 60 * 5) {
-                        // this may not happend if the partition is currently being compacted
-                        close_partition_log(part);
+                if (!idle && !evict) {
+                        // all other partitions were accessed more recently
+                        break;
+                } else if (part->file_ops_pending()) {
+                        // re-opening it would need to wait for the segments and reclaimer threads; see wait_pending_file_ops()
+                        it = next;
+                        continue;
                 }
 
+                // this may not happend if the partition is currently being compacted
+                close_partition_log(part);
+
                 it = next;
         }
 
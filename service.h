@@ -19,6 +19,7 @@
 #include <crypto.h>
 #include <switch_mallocators.h>
 #include <condition_variable>
+#include <optional>
 
 // if HWM_UPDATE_BASED_ON_ACKS is defined, the current semantics apply:
 // Assuming two producers PR1 and PR2, both publishing to partition P0.
@@ -227,6 +228,10 @@ struct ro_segment_lookup_res final {
         uint32_t     span;
 };
 
+// fdatasync()s and close()s fd, on the reclaimer thread if it's running
+// see Service::reclaimer_main()
+void retire_fd(int);
+
 struct fd_handle
     : public RefCounted<fd_handle> {
         int fd;
@@ -237,12 +242,38 @@ struct fd_handle
 
         ~fd_handle() {
                 if (fd != -1) {
-                        fdatasync(fd);
-                        TANKUtil::safe_close(fd);
+                        retire_fd(fd);
                 }
         }
 };
 
+// A chunk of the hot tail of a partition's current segment; see topic_partition_log::hot_tail
+// Bundles are never split across chunks. Chunks evicted from the hot tail are released once
+// the consumers responses that reference them have been transmitted.
+struct hot_tail_chunk final
+    : public RefCounted<hot_tail_chunk> {
+        static constexpr uint32_t max_capacity{1 * 1024 * 1024};
+
+        uint32_t base; // segment offset of data[0]
+        uint32_t size{0};
+        uint32_t capacity;
+        char *   data;
+
+        hot_tail_chunk(const uint32_t b, const uint32_t c)
+            : base{b}, capacity{c}, data{static_cast<char *>(malloc(c))} {
+        }
+
+        ~hot_tail_chunk() {
+                std::free(data);
+        }
+};
+
+struct hot_tail_bundle final {
+        uint64_t seqnum; // absolute sequence number of the bundle's first message
+        uint32_t offset; // segment offset
+        bool     sparse;
+};
+
 struct adjust_range_start_cache_value final {
         bool     first_bundle_is_sparse;
         uint32_t file_offset;
@@ -329,6 +360,7 @@ struct timer_node final {
                 ShutdownConsumerConn,
                 ForceSetReactorStateIdle,
                 TryBecomeClusterLeader,
+                ThrottledConn,
         } type;
 
         eb64_node node;
@@ -348,6 +380,17 @@ struct append_res final {
         range_base<uint64_t, uint16_t>   msgSeqNumRange;
 };
 
+// Trailing content of a bundle that is still in the socket of the producer connection; see Service::splice_ingest
+struct splice_source final {
+        int      fd;
+        int      pipe[2];
+        uint32_t pipe_size;
+        uint32_t remaining;  // bytes still in the socket
+        bool     pipe_dirty; // may hold content we failed to write
+
+        bool splice_to(const int, loff_t);
+};
+
 struct lookup_res final {
         enum class Fault : uint8_t {
                 NoFault = 0,
@@ -438,6 +481,9 @@ extern struct partition_config final {
         size_t        curSegmentMaxAge{86400 * 7}; // 1 week (soft limit)
         size_t        flushIntervalMsgs{0};        // never
         size_t        flushIntervalSecs{0};        // never
+        size_t        hotTailSize{0};              // see topic_partition_log::hot_tail (0 disables)
+        uint64_t      produceQuota{0};             // bytes/sec produced to the topic by all clients(0 disables); see Service::charge_produce_quotas()
+        uint64_t      consumeQuota{0};             // bytes/sec consumed from the topic by all clients(0 disables); see Service::charge_consume_quotas()
         CleanupPolicy logCleanupPolicy{CleanupPolicy::DELETE};
         float         logCleanRatioMin{0.5}; //
 } config;
@@ -451,6 +497,90 @@ static void PrintImpl(Buffer &out, const lookup_res &res) {
 }
 
 
+// Idempotent producers: the sequence numbers of the bundles most recently appended by each of the most recently active producers
+// Bundles that carry a (producer id, producer sequence) pair in their extra header(see tank_encoding.md) are
+// checked against a partition's window before they are appended, so that bundles re-sent by producers on retries are
+// acknowledged without being appended again.
+//
+// We track exactly which of the last seqs_span sequence numbers were appended, not just the highest one, because a bundle may fail
+// (e.g IO_Fault, InsufficientReplicas) and be retried after later bundles of the same producer were appended. Bundles with sequence
+// numbers older than that are rejected(OpRes::StaleProducerSeq), because we can't tell if they were appended.
+//
+// This is not persisted; it is lazily rebuilt from the tail of the partition log(see topic_partition_log::rebuild_producers_window())
+// the first time a bundle with producer info is produced to the partition after its log is opened.
+struct producer_state final {
+        uint64_t     producer_id;
+        uint32_t     last_seq{0};
+        uint64_t     appended{0}; // bit i is set if (last_seq - i) was appended
+        switch_dlist lru_ll;      // in producers_window::lru
+};
+
+struct producers_window final {
+        static constexpr const std::size_t max_producers{256};
+        static constexpr const uint32_t    rebuild_tail_span{1 * 1024 * 1024};
+        static constexpr const uint32_t    seqs_span{64};
+
+        enum class Check : uint8_t {
+                Append = 0,
+                Duplicate,
+                Stale,
+        };
+
+        // node map, so that lru_ll won't move around
+        robin_hood::unordered_node_map<uint64_t, producer_state> map;
+        // most recently active producer first
+        switch_dlist lru;
+        bool         loaded{false};
+
+        producers_window() {
+                lru.reset();
+        }
+
+        producers_window(const producers_window &) = delete;
+
+        Check check(const uint64_t producer_id, const uint32_t seq) const noexcept {
+                const auto it = map.find(producer_id);
+
+                if (it == map.end() || seq > it->second.last_seq) {
+                        return Check::Append;
+                } else if (const auto d = it->second.last_seq - seq; d >= seqs_span) {
+                        return Check::Stale;
+                } else {
+                        return (it->second.appended & (uint64_t(1) << d)) ? Check::Duplicate : Check::Append;
+                }
+        }
+
+        void track(const uint64_t producer_id, const uint32_t seq) {
+                const auto res = map.emplace(producer_id, producer_state{});
+                auto &     it  = res.first->second;
+
+                if (res.second) {
+                        it.producer_id = producer_id;
+                } else {
+                        it.lru_ll.detach();
+                }
+
+                if (seq > it.last_seq) {
+                        const auto d = seq - it.last_seq;
+
+                        it.appended = (d >= seqs_span ? 0 : it.appended << d) | 1;
+                        it.last_seq = seq;
+                } else if (const auto d = it.last_seq - seq; d < seqs_span) {
+                        it.appended |= uint64_t(1) << d;
+                }
+
+                lru.push_back(&it.lru_ll);
+
+                if (map.size() > max_producers) {
+                        // evict the least recently active producer
+                        auto victim = switch_list_entry(producer_state, lru_ll, lru.prev);
+
+                        victim->lru_ll.detach();
+                        map.erase(victim->producer_id);
+                }
+        }
+};
+
 // An append-only log for storing bundles, divided into segments
 struct topic_partition;
 struct topic_partition_log final {
@@ -463,6 +593,9 @@ struct topic_partition_log final {
         topic_partition * partition;
         std::atomic<bool> compacting{false};
 
+        // the device the partition's segments are stored in; see Service::schedule_sync()
+        std::optional<dev_t> sync_dev;
+
         // Whenever we cleanup, we update lastCleanupMaxSeqNum with the lastAvailSeqNum of the latest ro segment compacted
         uint64_t lastCleanupMaxSeqNum{0};
 
@@ -478,6 +611,9 @@ struct topic_partition_log final {
                 uint64_t baseSeqNum;
                 uint32_t fileSize;
 
+                // The file may extend past fileSize, reading as zeros; see segment_logical_size()
+                bool preallocated{false};
+
                 // We are going to be updating the index and skiplist frequently
                 // This is always initialized to UINT32_MAX, so that we always index the first bundle in the segment, for impl.simplicity
                 uint32_t sinceLastUpdate;
@@ -568,6 +704,26 @@ struct topic_partition_log final {
 
         partition_config config;
 
+        // Idempotent producers dedupe window; see producers_window
+        producers_window producers;
+
+        // The most recently appended bundles of the current segment(up to config.hotTailSize bytes) are retained in memory, so that
+        // tailing consumers and replicas can be served without looking up the file range(see read_cur()), and the response
+        // content is written from memory instead of sendfile()ed from the segment(see flush_file_contents())
+        struct {
+                Switch::shared_refptr<fd_handle>                  fdh; // the segment they were appended to
+                std::deque<Switch::shared_refptr<hot_tail_chunk>> chunks;
+                std::deque<hot_tail_bundle>                       bundles;
+                uint32_t                                          start{0}, end{0}; // segment range in chunks
+
+                void clear() {
+                        fdh.reset(nullptr);
+                        chunks.clear();
+                        bundles.clear();
+                        start = end = 0;
+                }
+        } hot_tail;
+
         // a topic partition is comprised of a set of segments(log file, index file) which
         // are immutable, and we don't need to serialize access to them, and a cur(rent) segment, which is not immutable.
         //
@@ -575,6 +731,15 @@ struct topic_partition_log final {
         // make sure roSegments is sorted
         std::shared_ptr<std::vector<ro_segment *>> roSegments;
 
+        // .next.log and .next.index, created and preallocated by the segments thread
+        // so that roll() won't need to create them itself; see prepare_next_segment()
+        struct {
+                int log_fd{-1};
+                int index_fd{-1};
+                // cleared once we append a bundle without a CRC32C; see append_bundle()
+                bool preallocate{true};
+        } next_segment;
+
         ~topic_partition_log() {
                 if (auto ptr = reinterpret_cast<void *>(const_cast<uint8_t *>(cur.index.ondisk.data)); ptr && ptr != MAP_FAILED) {
                         munmap(ptr, cur.index.ondisk.span);
@@ -590,6 +755,11 @@ struct topic_partition_log final {
                         fdatasync(cur.index.fd);
                         TANKUtil::safe_close(cur.index.fd);
                 }
+
+                if (next_segment.log_fd != -1) {
+                        TANKUtil::safe_close(next_segment.log_fd);
+                        TANKUtil::safe_close(next_segment.index_fd);
+                }
         }
 
         lookup_res read_cur(const uint64_t absSeqNum, const uint32_t maxSize, const uint64_t maxAbsSeqNum);
@@ -606,7 +776,7 @@ struct topic_partition_log final {
                                           const uint32_t,
                                           const uint64_t);
 
-        append_res append_bundle(const time_t, const void *bundle, const size_t bundleSize, const uint32_t bundleMsgsCnt, const uint64_t, const uint64_t);
+        append_res append_bundle(const time_t, const void *bundle, const size_t bundleSize, const uint32_t bundleMsgsCnt, const uint64_t, const uint64_t, splice_source *src = nullptr);
 
         // utility method: appends a non-sparse bundle
         // This is handy for appending bundles to the internal topics/partitions
@@ -638,6 +808,8 @@ struct topic_partition_log final {
 
         bool should_roll(const uint32_t) const;
 
+        bool nearing_roll(const uint32_t) const;
+
         void roll(const uint64_t, const uint64_t);
 
         void flush_index_skiplist();
@@ -646,7 +818,17 @@ struct topic_partition_log final {
 
         void schedule_flush(const uint32_t);
 
+        void hot_tail_append(const uint64_t, const struct iovec *, const uint32_t);
+
+        bool hot_tail_range(const uint64_t, const uint32_t, const uint64_t, lookup_res *);
+
+        hot_tail_chunk *hot_tail_chunk_for(const fd_handle *, const range32_t) const noexcept;
+
         void consider_ro_segments();
+
+        bool rebuild_producers_window();
+
+        bool scan_producers_window(int, const uint32_t, const uint32_t);
 };
 
 struct pending_compaction final {
@@ -656,6 +838,131 @@ struct pending_compaction final {
         topic_partition_log *     log;
 };
 
+// Filesystem work executed by the segments thread on behalf of topic_partition_log::roll()
+// see service_segments.cpp
+struct segment_op final {
+        enum class Type : uint8_t {
+                // create and preallocate .next.log and .next.index
+                Prepare = 0,
+                // rename the rolled segment log to its .ilog name, release its preallocated
+                // space, and persist and close its index
+                Seal,
+                Stop
+        } type;
+
+        segment_op *     next;
+        topic_partition *partition;
+        char             basePartitionPath[PATH_MAX];
+
+        union {
+                struct {
+                        uint64_t log_size;
+                        uint64_t index_size;
+                } prepare;
+
+                struct {
+                        uint64_t base_seqnum;
+                        uint64_t last_avail_seqnum;
+                        uint32_t created_ts;
+                        uint32_t freeze_ts;
+                        bool     name_encodes_ts;
+                        uint32_t file_size;
+                        // dup()ed, because the segment may be closed before we get to this
+                        int log_fd;
+                        int index_fd;
+                } seal;
+        };
+};
+
+struct connection;
+
+// A client request that involves partitions that are being opened by the partition open workers
+// It will be processed once they are all open, and all earlier parked requests of the connection have been processed
+struct parked_request final {
+        switch_dlist conn_ll;
+        connection * c;
+        uint8_t      msg;
+        uint16_t     pending_opens;
+        bool         cancelled; // connection is gone
+        Buffer       content;
+};
+
+// A partition log loaded by a partition open worker; see Service::partition_open_worker()
+struct pending_partition_open final {
+        topic_partition *             partition;
+        partition_config              conf;
+        topic_partition_log *         log{nullptr}; // nullptr if we failed to load it
+        bool                          have_files{false};
+        bool                          installed{false};
+        uint32_t                      duration_ms{0};
+        std::atomic<bool>             loaded{false};
+        std::vector<parked_request *> waiters; // reactor thread only
+};
+
+// A file descriptor to fdatasync() and close(), or a file to unlink, handed off to the reclaimer thread
+struct retired_file final {
+        retired_file *   next;
+        int              fd;
+        topic_partition *partition; // if fd == -1, the owner of path
+        Buffer           path;
+        uint64_t         ts;      // when it was retired(us)
+        bool             recycle; // a segment log that may be reused by process_segment_op() instead of unlinked
+};
+
+struct produce_response;
+
+// A segment log to fdatasync(), handed off to the sync workers; see Service::sync_worker()
+struct sync_request final {
+        Switch::shared_refptr<fd_handle> fdh;           // released on the reactor thread
+        int                              index_fd{-1};  // periodic flushes only, owned by the request; see topic_partition_log::schedule_flush()
+        bool                             failed{false}; // fdatasync() failed
+        uint32_t                         latency{0};    // fdatasync() latency(us) of the segment and its index
+
+        // set for durable produce requests; see process_produce()
+        produce_response *dpr{nullptr};
+        uint64_t          dpr_gen;
+        topic_partition * partition{nullptr}; // retained until the request completes; see Service::schedule_sync()
+        uint8_t           pr_participant_idx;
+};
+
+// Sync requests for segments that are stored in the same device are group committed by a single sync worker at a time
+struct sync_device final {
+        dev_t                       dev;
+        std::vector<sync_request *> pending;
+        bool                        busy{false};   // a worker is syncing a batch
+        bool                        queued{false}; // in syncs.ready
+};
+
+// A token bucket that holds up to a second's worth of bytes; see Service::charge_produce_quotas()
+// It may go into debt, in which case the client is throttled until the debt is repaid
+struct quota_bucket final {
+        static constexpr uint32_t max_delay_ms{30 * 1000};
+
+        int64_t  tokens{0};
+        uint64_t last_refill{0};
+
+        // Returns for how long(ms) the client should be throttled, or 0
+        uint32_t charge(const uint64_t rate, const uint64_t now_ms, const uint64_t n) noexcept {
+                if (!rate) {
+                        return 0;
+                } else if (!last_refill) {
+                        tokens      = rate;
+                        last_refill = now_ms;
+                } else if (const auto credit = (now_ms - last_refill) * rate / 1000) {
+                        tokens      = std::min<int64_t>(rate, tokens + credit);
+                        last_refill = now_ms;
+                }
+
+                tokens -= n;
+                return tokens >= 0 ? 0 : std::min<uint64_t>(max_delay_ms, (uint64_t(-tokens) * 1000 + rate - 1) / rate);
+        }
+};
+
+// Quotas of all connections of clients that identify themselves with the same client id
+struct client_quota final {
+        quota_bucket produce, consume;
+};
+
 using nodeid_t = uint16_t;
 struct cluster_node;
 
@@ -833,7 +1140,13 @@ struct produce_response final {
                         Pending,
                         IO_Fault,
                         InsufficientReplicas,
+                        ChecksumMismatch,
+                        StaleProducerSeq,
                 } res;
+
+                // Pending until the bundle has been fdatasync()ed for a durable produce request, or IO_Fault if that failed
+                // OK otherwise; see process_produce()
+                OpRes sync_res;
         };
 
 #if 1
@@ -878,21 +1191,86 @@ struct produce_response final {
 };
 
 struct repl_stream final {
+        static constexpr const size_t  default_fetch_size{512};
+        static constexpr const size_t  max_fetch_size{16 * 1024 * 1024};
+        static constexpr const uint8_t max_checksum_failures{8};
+
         topic_partition * partition;       // fetching content for this partion
         cluster_node *    src;             // from this peer
         size_t            min_fetch_size;  // next request must be for at least as much data
+        size_t            fetch_size;      // adapts to how far behind the leader we are; see process_peer_consume_resp()
         switch_dlist      repl_streams_ll; // links to cluster_state.replication_streams
         connection_handle ch;
 
+        // a partition is included in at most one outstanding ConsumePeer request
+        // this is only meaningful if ch.get() is valid, i.e the connection is still there
+        bool in_flight;
+
+        // consecutive responses where we got no content past a bundle that failed CRC32C verification
+        // we back off before fetching again, and once we reach max_checksum_failures, we stop replicating
+        // the partition from src, so that the leader will eventually drop us from the ISR
+        struct {
+                uint8_t  failures;
+                uint64_t retry_at;
+                bool     stalled;
+        } checksum;
+
         void reset() {
-                partition      = nullptr;
-                src            = nullptr;
-                min_fetch_size = 512;
+                partition         = nullptr;
+                src               = nullptr;
+                min_fetch_size    = default_fetch_size;
+                fetch_size        = default_fetch_size;
+                in_flight         = false;
+                checksum.failures = 0;
+                checksum.retry_at = 0;
+                checksum.stalled  = false;
                 repl_streams_ll.reset();
                 ch.reset();
         }
 };
 
+// A consumer group; committed offsets are checkpointed to an internal compacted topic
+// and are otherwise served from memory. See service_consumer_groups.cpp
+struct consumer_group final {
+        struct member final {
+                std::string              id;
+                std::vector<std::string> topics; // sorted
+                uint64_t                 expiration;
+        };
+
+        struct pending_commit final {
+                consumer_group *group;
+                std::string     topic;
+                uint16_t        partition;
+                uint64_t        seq_num;
+        };
+
+        std::string         name;
+        uint64_t            generation{0};
+        std::vector<member> members; // sorted by id
+
+        // for each topic, the committed sequence number of each partition
+        // (std::numeric_limits<uint64_t>::max() if nothing was committed for a partition)
+        robin_hood::unordered_map<std::string, std::vector<uint64_t>> offsets;
+
+        uint64_t committed(const std::string &topic, const uint16_t partition) const noexcept {
+                if (const auto it = offsets.find(topic); it != offsets.end() && partition < it->second.size()) {
+                        return it->second[partition];
+                } else {
+                        return std::numeric_limits<uint64_t>::max();
+                }
+        }
+
+        void set_committed(const std::string &topic, const uint16_t partition, const uint64_t seq_num) {
+                auto &v = offsets[topic];
+
+                if (partition >= v.size()) {
+                        v.resize(partition + 1, std::numeric_limits<uint64_t>::max());
+                }
+                v[partition] = seq_num;
+        }
+};
+
 struct cluster_node final {
         const nodeid_t   id;
         bool             available_{true}; // lock (session) set for the node ns key
@@ -980,6 +1358,85 @@ struct cluster_nodeid_update final {
         bool             have_owner;
 };
 
+// Log-linear(HDR-style) histogram
+// Values are grouped by their most significant bit, and each [2^e, 2^(e+1)) range is split into sub_buckets linear buckets
+// so that recording a sample is O(1) (no search) and the relative error of a bucket's upper bound is <= 1/sub_buckets
+//
+// With Atomic, samples can be recorded by another thread while the reactor thread reads the counters
+template <bool Atomic = false>
+struct hdr_histogram final {
+        static constexpr uint8_t  sub_bits{2};
+        static constexpr uint32_t sub_buckets{1u << sub_bits};
+        static constexpr uint8_t  max_bits{32}; // values >= 2^max_bits are clamped to the last bucket
+        static constexpr uint32_t buckets_cnt{(max_bits - sub_bits + 1) * sub_buckets};
+
+        uint64_t buckets[buckets_cnt]{0};
+        uint64_t sum{0}, cnt{0};
+
+        static inline uint32_t bucket_index(uint64_t v) noexcept {
+                if (v < sub_buckets) {
+                        return v;
+                } else if (unlikely(v >= (uint64_t(1) << max_bits))) {
+                        v = (uint64_t(1) << max_bits) - 1;
+                }
+
+                const uint32_t e = 63 - __builtin_clzll(v);
+
+                return (e - sub_bits + 1) * sub_buckets + ((v >> (e - sub_bits)) & (sub_buckets - 1));
+        }
+
+        // inclusive upper bound of values tracked in bucket `i`, i.e the Prometheus `le` label
+        static inline uint64_t bucket_upper_bound(const uint32_t i) noexcept {
+                if (i < sub_buckets) {
+                        return i;
+                }
+
+                const uint32_t e   = i / sub_buckets + sub_bits - 1;
+                const uint32_t sub = i & (sub_buckets - 1);
+
+                return (uint64_t(sub_buckets + sub + 1) << (e - sub_bits)) - 1;
+        }
+
+        void reg_sample(const uint64_t v) noexcept {
+                const auto idx = bucket_index(v);
+
+                if constexpr (Atomic) {
+                        __atomic_fetch_add(&buckets[idx], 1, __ATOMIC_RELAXED);
+                        __atomic_fetch_add(&sum, v, __ATOMIC_RELAXED);
+                        __atomic_fetch_add(&cnt, 1, __ATOMIC_RELAXED);
+                } else {
+                        ++buckets[idx];
+                        sum += v;
+                        ++cnt;
+                }
+        }
+
+        uint64_t count() const noexcept {
+                return __atomic_load_n(&cnt, __ATOMIC_RELAXED);
+        }
+};
+
+// Tracks a quantity per second; last() is the total of the last complete second
+// Both are O(1), so that we can track rates of every partition without a periodic pass over them
+struct rate_window final {
+        uint64_t sec{0};
+        uint64_t cur{0}, prev{0};
+
+        void reg(const uint64_t now_sec, const uint64_t v) noexcept {
+                if (now_sec != sec) {
+                        prev = now_sec == sec + 1 ? cur : 0;
+                        cur  = 0;
+                        sec  = now_sec;
+                }
+
+                cur += v;
+        }
+
+        uint64_t last(const uint64_t now_sec) const noexcept {
+                return now_sec == sec ? prev : now_sec == sec + 1 ? cur : 0;
+        }
+};
+
 struct topic;
 struct topic_partition
     : public RefCounted<topic_partition> {
@@ -992,6 +1449,9 @@ struct topic_partition
                 // Failed to persist messages
                 // likely ran out of disk space or disk is busted
                 IOFailed = 1u << 1,
+
+                // the segments thread is preparing the next segment for the partition log
+                NextSegmentPending = 1u << 2,
         };
         uint16_t         idx; // (0, ...)
         uint32_t         distinctId;
@@ -999,6 +1459,35 @@ struct topic_partition
         partition_config config;
         uint8_t          flags{0};
 
+        // rolled segments the segments thread has yet to seal(rename to .ilog etc)
+        // The log may not delete or compact them, nor can it be re-opened, until that's done
+        std::atomic<uint8_t> pending_seals{0};
+
+        // segment files the reclaimer thread has yet to unlink
+        // The log can't be re-opened until that's done
+        std::atomic<uint16_t> pending_unlinks{0};
+
+        // see Service::wait_pending_file_ops()
+        bool file_ops_pending() const noexcept {
+                return pending_seals.load(std::memory_order_acquire) || pending_unlinks.load(std::memory_order_acquire);
+        }
+
+        // for Prometheus metrics
+        struct {
+                uint64_t bytes_in{0};
+                uint64_t msgs_in{0};
+                uint64_t bytes_out{0};
+                rate_window bytes_in_rate;
+                rate_window bytes_out_rate;
+                // file contents payloads of consume responses pending transmission
+                uint32_t outq_payloads{0};
+                // writev() latency(us) of appended bundles
+                // allocated on the first append, so that partitions that are never produced to don't pay for it
+                std::unique_ptr<hdr_histogram<>> append_latency;
+                // fdatasync() latency(us) of the partition's segments; see Service::complete_sync_requests()
+                std::unique_ptr<hdr_histogram<>> fsync_latency;
+        } metrics;
+
         struct {
                 time_t       last_access{0};
                 switch_dlist ll{&ll, &ll};
@@ -1059,6 +1548,12 @@ struct topic_partition
                 enum class Flags : uint8_t {
                         ISRDirty        = 1u << 0,
                         GC_ISR          = 1u << 1,
+                        // peers acks updated the ISR tracker; see Service::process_dirty_partitions_acks()
+                        AcksDirty       = 1u << 2,
+                        // queued for repair; see Service::repair_cluster_partitions()
+                        RepairPending   = 1u << 3,
+                        // ISR entries expired; see Service::expire_isr_ack()
+                        ISRExpired      = 1u << 4,
                         GeneratedUpdate = 1u << 7,
                 };
 
@@ -1367,51 +1862,24 @@ struct topic
 
         // for Prometheus metrics
         struct metrics_struct final {
-                struct latency_struct final {
-                        // inline is handy here
-                        static inline constexpr uint32_t histogram_scale[]{1, 2, 5, 10, 15, 20, 25, 30, 35, 40, 45, 50, 55, 65, 75, 85, 95, 100, 110, 120, 130, 140, 150, 200, 250, 300, 350, 400, 450, 500};
-                        uint64_t                         hist_buckets[sizeof_array(histogram_scale)] = {0};
-                        uint64_t                         sum{0}, cnt{0};
-
-                        static inline int32_t bucket_index(const uint32_t delta) noexcept {
-                                int32_t top = sizeof_array(histogram_scale) - 1, btm{0};
-
-                                while (btm <= top) {
-                                        const auto mid = (btm + top) / 2;
-                                        const auto v   = histogram_scale[mid];
-
-                                        if (v == delta) {
-                                                btm = mid;
-                                                break;
-                                        } else if (delta < v)
-                                                top = mid - 1;
-                                        else
-                                                btm = mid + 1;
-                                }
-
-                                // -1 if out of bounds
-                                return btm;
-                        }
-
-                        void reg_sample(const uint32_t delta) {
-                                ++cnt;
-                                sum += delta;
-
-                                // currently, histogram_scale[], contains, with the exception of the first 2 values, values that increment by 5 so
-                                // we can compute the index with a simple idiv, but later we may want to use arbitrary scales, and this binary search
-                                // is fast anyway, so we are sticking to it for now
-                                if (const auto idx = bucket_index(delta); idx != -1)
-                                        ++hist_buckets[idx];
-                        }
-                } latency;
+                // consumer latency(ms); time from when a file chunk was scheduled until it was fully sent
+                hdr_histogram<> latency;
 
                 uint64_t bytes_in{0};
                 uint64_t msgs_in{0};
                 uint64_t bytes_out{0};
+                // times clients were throttled because of the topic's quotas
+                uint64_t produce_throttled{0};
+                uint64_t consume_throttled{0};
                 // TODO: count current distinct consumers and producers
                 // i.e distinct connections that have consumed or produced at least one from/to this topic
         } metrics;
 
+        // see partitionConf.produceQuota and partitionConf.consumeQuota
+        struct {
+                quota_bucket produce, consume;
+        } quotas;
+
         struct {
                 uint64_t last_update_gen{0};
                 // by default, we are not replicating anything nor are we accepting any requests
@@ -1580,31 +2048,52 @@ struct payload {
         }
 };
 
+// Traffic classes of streamed consume responses content, in order of priority; see Service::tx_sched
+enum class tx_class : uint8_t {
+        Replication = 0, // ConsumePeer responses
+        Tail,            // content likely just appended(current segment, hot tail)
+        Bulk,            // content of older segments; i.e consumers catching up
+        Max
+};
+
 struct file_contents_payload final
     : public payload {
         content_file_range file_range;
+        hot_tail_chunk *   chunk; // if set, file_range content is written from it; see topic_partition_log::hot_tail
+        tx_class           cls;
         struct
         {
-                uint64_t since;
-                topic *  src_topic;
+                uint64_t          since;
+                topic *           src_topic;
+                topic_partition * src_partition;
         } tracker;
 
         void reset() {
                 payload::reset();
                 file_range.fdhandle = nullptr;
-                tracker.src_topic   = nullptr;
-                tracker.since       = 0;
+                chunk                 = nullptr;
+                cls                   = tx_class::Bulk;
+                tracker.src_topic     = nullptr;
+                tracker.src_partition = nullptr;
+                tracker.since         = 0;
         }
 
-        void init(fd_handle *const fdh, const range32_t r, const uint64_t start, topic *t) {
+        void init(fd_handle *const fdh, const range32_t r, const uint64_t start, topic *t, topic_partition *partition) {
                 TANK_EXPECT(fdh);
 
-                tracker.since       = start;
-                tracker.src_topic   = t;
-                file_range.fdhandle = fdh;
-                file_range.range    = r;
+                tracker.since         = start;
+                tracker.src_topic     = t;
+                tracker.src_partition = partition;
+                file_range.fdhandle   = fdh;
+                file_range.range      = r;
 
                 file_range.fdhandle->Retain();
+                partition->metrics.outq_payloads++;
+        }
+
+        void set_chunk(hot_tail_chunk *const c) {
+                chunk = c;
+                chunk->Retain();
         }
 };
 
@@ -1614,6 +2103,7 @@ struct data_vector_payload final
         char         small_buf[256];
         struct iovec iov[64];
         uint8_t      iov_cnt;
+        uint32_t     zc_seq; // while parked; see Service::retire_payload()
 
         static_assert(std::numeric_limits<decltype(iov_cnt)>::max() >= sizeof_array(iov));
 
@@ -1726,6 +2216,18 @@ struct outgoing_queue final {
                 verify();
         }
 
+        void push_front(payload *p) TANK_NOEXCEPT_IF_NORUNTIME_CHECKS {
+                verify();
+
+                p->next = front_;
+                front_  = p;
+                if (!back_) {
+                        back_ = p;
+                }
+
+                verify();
+        }
+
         void insert_after(payload *const p, payload *const after) TANK_NOEXCEPT_IF_NORUNTIME_CHECKS {
                 TANK_EXPECT(p);
                 TANK_EXPECT(after);
@@ -1896,6 +2398,10 @@ struct CompressionContext final {
         }
 };
 
+// see service_tls.cpp
+struct ssl_st;
+struct ssl_ctx_st;
+
 struct connection final {
         int fd;
 #ifdef TANK_RUNTIME_CHECKS
@@ -1911,6 +2417,24 @@ struct connection final {
         // all active wait_ctx's
         switch_dlist connectionsList;
 
+        // set while the TLS handshake is in progress; see Service::tls_handshake()
+        ssl_st *tls;
+
+        // see Service::tx_sched
+        struct {
+                switch_dlist ll;      // in tx_sched.ready[cls] while waiting for its next quantum
+                uint32_t     deficit; // bytes of file contents we may stream before we yield
+                bool         active;  // has been granted a quantum, and has file contents pending
+        } tx_sched;
+
+        // see Service::zerocopy
+        struct {
+                uint32_t issued;    // MSG_ZEROCOPY sends that transmitted any data
+                uint32_t completed; // all sends before this have completed
+                // payloads sent while sends were pending; released once those complete, in order
+                payload *parked_front, *parked_back;
+        } zc;
+
         // A connection is classified as Unclassified, Idle, or Active
         // and depending on the classifiication, it may be attached to a list
         struct ClassificationTracker final {
@@ -1938,6 +2462,8 @@ struct connection final {
                         NeedOutAvail = 0,
                         ShutdownReasonTimeout,
                         DrainingForShutdown,
+                        SecureChannel, // TLS handshake completed, and the session was handed to the kernel
+                        ZeroCopy,      // SO_ZEROCOPY is set; see Service::zerocopy
                         // 3 MSBs are reserved for the activity tracker list
                 };
 
@@ -2031,7 +2557,24 @@ struct connection final {
                 } consul;
 
                 struct Prometheus final {
+                        // a /metrics response is rendered in slices, one per reactor loop iteration
+                        // so that scraping 100k+ series won't stall the reactor; see Service::render_prom_metrics()
+                        enum class Stage : uint8_t {
+                                Idle = 0,
+                                Preamble,
+                                Topics,
+                        } stage;
+
+                        // in Service::prom_pending_render
+                        bool     pending_render;
+                        uint32_t topic_idx;
+                        uint16_t partition_idx;
+
                         void reset() {
+                                stage          = Stage::Idle;
+                                pending_render = false;
+                                topic_idx      = 0;
+                                partition_idx  = 0;
                         }
 
                 } prometheus;
@@ -2043,8 +2586,26 @@ struct connection final {
                         };
 
                         uint8_t      flags;
+                        // bytes of the current Produce request's bundle we 'll splice from the socket; see Service::consider_splice_ingest()
+                        uint32_t     splice_remaining;
                         switch_dlist waitCtxList;
                         switch_dlist produce_responses_list;
+                        // requests waiting for partitions to be opened, in the order they were received
+                        // see Service::park_request()
+                        switch_dlist parked_requests;
+
+                        // see Service::charge_produce_quotas()
+                        client_quota *quota;
+                        bool          throttle_hints; // client understands Throttle messages
+
+                        // see Service::throttle_connection()
+                        struct {
+                                timer_node timer;
+                                uint64_t   read_until;  // not reading requests from the connection until then
+                                uint64_t   write_until; // not streaming consumed content to the connection until then
+                                uint32_t   consume_request_id; // most recent Consume request; see Service::hold_consume_responses()
+                                bool       hold;               // holding back consumed content; see Service::hold_consume_responses()
+                        } throttle;
 
                         // see consider_pending_client_produce_responses()
                         // for each product request from this client
@@ -2054,9 +2615,18 @@ struct connection final {
                         } pending_produce_reqs_acks;
 
                         void reset() {
-                                flags = 0;
+                                flags            = 0;
+                                splice_remaining = 0;
                                 waitCtxList.reset();
                                 produce_responses_list.reset();
+                                parked_requests.reset();
+                                quota                = nullptr;
+                                throttle_hints       = false;
+                                throttle.timer.type  = timer_node::ContainerType::ThrottledConn;
+                                throttle.read_until  = 0;
+                                throttle.write_until = 0;
+                                throttle.hold        = false;
+                                throttle.timer.reset();
                         }
                 } tank;
 
@@ -2072,9 +2642,13 @@ struct connection final {
                         cluster_node *node;
                         timer_node    attached_timer;
 
+                        // outstanding ConsumePeer requests; see Service::replicate_from()
+                        uint8_t inflight;
+
                         void reset() {
-                                state = State::Idle;
-                                node  = nullptr;
+                                state    = State::Idle;
+                                node     = nullptr;
+                                inflight = 0;
                                 attached_timer.reset();
                         }
                 } consumer;
@@ -2162,6 +2736,174 @@ struct PubSubQueue final {
         }
 };
 
+// Tracks where the reactor thread spends its time, so that we can tell what's stalling it
+// See Service::reactor_main() and Service::stall_watchdog()
+struct reactor_profiler final {
+        enum class Phase : uint8_t {
+                Deferred = 0, // begin_reactor_loop_iteration()
+                Poll,
+                IO,
+                Timers,
+                Consul,
+                ISR,
+                DeferredResponses,
+                ConsumeRetries,
+                Maintenance, // idle connections, active partitions
+                Max,
+        };
+
+        struct slow_op final {
+                uint64_t ts;       // ms
+                uint32_t duration; // us
+                Phase    phase;
+                uint8_t  msg; // TankAPIMsgType of the last request processed, or 0
+                int      fd;  // -1 if not associated with a connection
+                uint16_t partition;
+                uint8_t  topic_len; // 0 if not associated with a partition
+                char     topic[64];
+        };
+
+        // per-phase latency(us)
+        hdr_histogram<> phases[size_t(Phase::Max)];
+        // latency(us) of an iteration, excluding Phase::Poll
+        hdr_histogram<> iterations;
+
+        // the slowest operations that took longer than slow_op_threshold, as a min-heap on duration
+        // (slow_ops[0] is the fastest of them, and is replaced when a slower one comes along)
+        slow_op  slow_ops[64];
+        uint8_t  slow_ops_cnt{0};
+        uint64_t slow_ops_total{0};
+        uint32_t slow_op_threshold{strwlen32_t(getenv("TANK_SLOW_OP_US") ?: "20000").as_uint32()};
+
+        // context of the operation in progress; updated as it touches connections and partitions
+        struct {
+                Phase                  phase;
+                uint8_t                msg;
+                int                    fd;
+                const topic_partition *partition;
+        } cur;
+
+        // 0 while blocked in Phase::Poll, otherwise the time(us) the current iteration began
+        std::atomic<uint64_t>        iteration_start{0};
+        std::atomic<uint64_t>        stalls{0};
+        std::atomic<bool>            watchdog_stop{false};
+        uint32_t                     stall_threshold_ms{strwlen32_t(getenv("TANK_STALL_THRESHOLD_MS") ?: "500").as_uint32()}; // 0 disables the watchdog
+        std::unique_ptr<std::thread> watchdog;
+        // main thread's stack, captured when it stalls
+        void *           stall_frames[64];
+        std::atomic<int> stall_frames_cnt{0};
+
+        static str_view32 phase_name(const Phase p) noexcept {
+                static constexpr str_view32 names[]{"deferred"_s32, "poll"_s32, "io"_s32, "timers"_s32, "consul"_s32,
+                                                    "isr"_s32, "deferred_responses"_s32, "consume_retries"_s32, "maintenance"_s32};
+
+                return names[size_t(p)];
+        }
+
+        void begin_op(const Phase phase, const int fd = -1) noexcept {
+                cur.phase     = phase;
+                cur.msg       = 0;
+                cur.fd        = fd;
+                cur.partition = nullptr;
+        }
+
+        void track_op(const uint64_t duration, const uint64_t now_ms) noexcept;
+
+        uint64_t begin_phase(const Phase phase) noexcept {
+                begin_op(phase);
+                return Timings::Microseconds::Tick();
+        }
+
+        // records the phase latency, and, unless individual operations of that phase are tracked
+        // by the caller, a slow operation if it took too long. Returns the current time(us)
+        uint64_t track_phase(const Phase phase, const uint64_t start, const uint64_t now_ms, const bool track_ops = true) noexcept {
+                const auto now = Timings::Microseconds::Tick();
+
+                phases[size_t(phase)].reg_sample(now - start);
+                if (track_ops) {
+                        track_op(now - start, now_ms);
+                }
+                return now;
+        }
+};
+
+// Size-classed slab allocator for objects the reactor allocates and releases all the time
+// (payloads, outgoing queues, wait contexts), as opposed to per-type freelists that never shrink.
+//
+// Objects are carved out of slabs aligned to slab_size, so that an object's slab can be determined by masking its address.
+// Slabs with no objects in use are retained for reuse, but trim() releases those that were not needed to serve
+// the peak demand since the previous trim(), so that RSS returns to the baseline after a burst.
+// Requests larger than the largest size class are served by malloc().
+//
+// If TANK_HUGEPAGE_SLABS is set, slabs are 2MB and backed by huge pages if possible.
+struct slab_allocator final {
+        static constexpr uint8_t  min_class_bits{6};  // 64 bytes
+        static constexpr uint8_t  max_class_bits{14}; // 16KB
+        static constexpr uint8_t  classes_cnt{max_class_bits - min_class_bits + 1};
+        static constexpr size_t   max_class_size{size_t(1) << max_class_bits};
+
+        struct size_class;
+
+        struct slab final {
+                switch_dlist ll; // in size_class::partial or size_class::empty, unless full
+                size_class * sc;
+                void *       free_list;
+                uint32_t     used;
+                uint32_t     next_fresh; // objects past that index were never handed out
+        };
+
+        struct size_class final {
+                uint32_t     obj_size;
+                uint32_t     objs_per_slab;
+                switch_dlist partial{&partial, &partial}, empty{&empty, &empty};
+                uint32_t     slabs{0}, empty_cnt{0};
+                // peak is reset to in_use by trim()
+                uint64_t in_use{0}, peak{0};
+        };
+
+        size_class classes[classes_cnt];
+        size_t     slab_size;
+        bool       huge_pages;
+
+        struct {
+                uint64_t large_bytes{0}, large_cnt{0};
+                uint64_t slabs_released{0};
+        } stats;
+
+        slab_allocator();
+
+        ~slab_allocator();
+
+        static inline uint8_t class_index(const size_t size) noexcept {
+                return size <= (size_t(1) << min_class_bits) ? 0 : (64 - __builtin_clzll(size - 1)) - min_class_bits;
+        }
+
+        void *alloc(const size_t size);
+
+        void release(void *ptr, const size_t size);
+
+        // releases retained empty slabs
+        void trim();
+
+        size_t reserved_bytes() const noexcept {
+                size_t res{0};
+
+                for (const auto &it : classes) {
+                        res += it.slabs;
+                }
+                return res * slab_size;
+        }
+
+      private:
+        slab *new_slab(size_class *);
+
+        void release_slab(slab *);
+
+        size_t objs_offset() const noexcept {
+                return (sizeof(slab) + 63) & ~size_t(63);
+        }
+};
+
 #define TANK_SRV_LAZY_PARTITION_INIT 1
 
 class Service {
@@ -2531,6 +3273,10 @@ class Service {
                         robin_hood::unordered_map<topic_partition *, std::unique_ptr<partition>>     pm;
                         robin_hood::unordered_map<::topic *, std::unique_ptr<topic>>                 tm;
 
+                        // partitions updates taken from pm, applied in time slices by apply_cluster_state_updates()
+                        std::vector<std::pair<topic_partition *, std::unique_ptr<partition>>> applying;
+                        size_t                                                                applying_next{0};
+
                         auto get_partition(topic_partition *tp) {
                                 TANK_EXPECT(tp);
                                 const auto res = pm.emplace(tp, nullptr);
@@ -2577,9 +3323,9 @@ class Service {
 
                 std::unordered_set<cluster_node *>                                         dirty_nodes;
                 std::unordered_set<topic *>                                                dirty_topics;
-                std::unordered_set<topic_partition *>                                      dirty_partitions;
                 std::vector<std::pair<topic_partition *, bool>>                            part_bool_hashmap;
                 std::vector<topic_partition *>                                             pv;
+                std::vector<topic_partition *>                                             repl_partitions;
                 std::vector<std::pair<cluster_node *, std::pair<topic_partition *, bool>>> nodes_replicas_updates;
                 std::vector<std::pair<topic_partition *, cluster_node *>>                  stream_start, stream_stop;
 
@@ -2607,6 +3353,58 @@ class Service {
                 std::condition_variable         workCond;
                 std::mutex                      workLock;
         } compactions;
+        struct {
+                PubSubQueue<segment_op>      pending;
+                std::unique_ptr<std::thread> thread;
+                std::condition_variable      workCond;
+                std::mutex                   workLock;
+                // see process_segment_op()
+                std::atomic<uint64_t>        recycled{0};
+        } segments;
+        struct {
+                PubSubQueue<retired_file>    pending;
+                std::atomic<uint32_t>        depth{0};
+                // time(us) from retirement to completion
+                hdr_histogram<true>          latency;
+                std::unique_ptr<std::thread> thread;
+                std::condition_variable      workCond;
+                std::mutex                   workLock;
+                // set before the thread is started, and cleared by stop_reclaimer(); only modified while holding workLock
+                std::atomic<bool>            running{false};
+        } reclaimer;
+        // signalled by the segments and reclaimer threads whenever they are done with a partition's file; see wait_pending_file_ops()
+        struct {
+                std::condition_variable cond;
+                std::mutex              lock;
+        } file_ops;
+        struct {
+                std::vector<std::thread>                                              workers;
+                std::deque<pending_partition_open *>                                  queue;
+                bool                                                                  stop{false};
+                std::condition_variable                                               workCond;
+                std::condition_variable                                               loadedCond; // see await_partition_open()
+                std::mutex                                                            workLock;
+                robin_hood::unordered_map<topic_partition *, pending_partition_open *> inflight; // reactor thread only
+                std::vector<topic_partition *>                                        collected;
+        } partition_opens;
+        // see sync_worker()
+        struct {
+                std::vector<std::thread>                                     workers;
+                std::deque<sync_device *>                                    ready;
+                bool                                                         stop{false};
+                std::condition_variable                                      workCond;
+                std::mutex                                                   workLock;
+                robin_hood::unordered_map<dev_t, std::unique_ptr<sync_device>> devices;
+                // fdatasync() batches, and segment logs synced
+                std::atomic<uint64_t> batches{0}, synced{0};
+        } syncs;
+        // see consider_active_partitions()
+        struct {
+                // close partitions that haven't been accessed for that long(0 disables)
+                uint32_t idle_secs{strwlen32_t(getenv("TANK_PARTITION_IDLE_CLOSE_SECS") ?: "300").as_uint32()};
+                // close the least recently accessed partitions if more are open(0 disables)
+                uint32_t max_open{strwlen32_t(getenv("TANK_MAX_OPEN_PARTITIONS") ?: "0").as_uint32()};
+        } partitions_lru;
         timer_node                                                          set_reactor_state_idle_timer{.type = timer_node::ContainerType::ForceSetReactorStateIdle, .node.node.leaf_p = nullptr};
         timer_node                                                          try_become_cluster_leader_timer{.type = timer_node::ContainerType::TryBecomeClusterLeader, .node.node.leaf_p = nullptr};
         std::vector<wait_ctx *>                                             now_awake;
@@ -2617,27 +3415,116 @@ class Service {
         switch_dlist                                                        deferred_produce_responses_expiration_list{&deferred_produce_responses_expiration_list, &deferred_produce_responses_expiration_list};
         uint64_t                                                            deferred_produce_responses_next_expiration{std::numeric_limits<uint64_t>::max()};
         std::vector<topic_partition *>                                      isr_dirty_list;
+        std::vector<topic_partition *>                                      acks_dirty_list;
         std::vector<topic_partition *>                                      cluster_partitions_dirty;
+        struct {
+                std::vector<topic_partition *> queue;
+                size_t                         next{0};
+        } cluster_repairs;
         std::vector<isr_entry *>                                            reusable_isr_entries;
         simple_allocator                                                    isr_entries_allocator{sizeof(isr_entry) * 128};
-        std::vector<wait_ctx *>                                             waitCtxPool[TANK_Limits::max_topic_partitions];
         robin_hood::unordered_map<strwlen8_t, Switch::shared_refptr<topic>> topics;
+        // topics are never unregistered, so a Prometheus response can be rendered
+        // over multiple reactor loop iterations by tracking an index into this list
+        std::vector<topic *>                                                topics_list;
+        std::vector<connection *>                                           prom_pending_render;
+        struct {
+                robin_hood::unordered_map<std::string, std::unique_ptr<consumer_group>> groups;
+                // commits accepted since the last reactor loop iteration
+                // they are all appended as a single bundle in flush_consumer_groups_commits()
+                std::vector<consumer_group::pending_commit>         pending_commits;
+                std::vector<std::pair<connection_handle, uint32_t>> pending_acks;
+        } consumer_groups;
 	uint32_t total_open_partitions{0}, open_partitions_time{0};
 	time32_t no_roll_until{0};
         size_t                                                              partitions_io_failed_cnt{0};
+        // bundles rejected because their CRC32C didn't match their content
+        struct {
+                uint64_t produce{0}, replication{0};
+        } checksum_failures;
+        // see flush_file_contents()
+        uint64_t hot_tail_bytes_out{0};
+        // Streaming file contents to connections is scheduled in deficit round-robin order, so that
+        // a few connections consuming from older segments won't starve replication and tailing consumers.
+        //
+        // A connection is granted a quantum(weighted by the traffic class of the content) when it begins streaming, and once that's
+        // exhausted, it yields and waits in ready[] for its class's next turn; run_tx_sched() grants the next quanta, in order of class priority.
+        // Data vector payloads(e.g produce responses, consume response headers) are not scheduled; they are never held back by other connections.
+        static constexpr uint32_t tx_sched_quantum{256 * 1024};
+        struct {
+                switch_dlist ready[size_t(tx_class::Max)];
+                uint32_t     weights[size_t(tx_class::Max)];
+                uint64_t     bytes_out[size_t(tx_class::Max)]{0};
+                uint64_t     yields{0};
+
+                bool any_ready() const noexcept {
+                        for (const auto &it : ready) {
+                                if (!it.empty()) {
+                                        return true;
+                                }
+                        }
+                        return false;
+                }
+        } tx_sched;
+        // The socket and the payloads of a connection that was shut down while MSG_ZEROCOPY sends were pending
+        struct zerocopy_lingerer final {
+                int      fd;
+                uint32_t issued, completed;
+                payload *front, *back;
+                uint64_t expires;
+        };
+        // Data vector payloads of at least threshold bytes(TANK_ZEROCOPY_THRESHOLD, 0 disables) are sent to client connections with MSG_ZEROCOPY.
+        // The kernel references the payloads memory until the data is acknowledged, so we can't release them until it tells
+        // us so(see reap_zerocopy_completions()); payloads sent in the meantime are parked in the connection's zc list.
+        struct {
+                uint32_t threshold{strwlen32_t(getenv("TANK_ZEROCOPY_THRESHOLD") ?: "0").as_uint32()};
+                uint64_t sends{0}, bytes{0};
+                // sends the kernel copied anyway(e.g loopback connections); we stop using MSG_ZEROCOPY for those connections
+                uint64_t copied{0};
+                // connections shut down while sends were pending; see linger_zerocopy()
+                uint32_t                       linger_timeout{strwlen32_t(getenv("TANK_ZEROCOPY_LINGER_TIMEOUT") ?: "5000").as_uint32()};
+                std::vector<zerocopy_lingerer> lingering;
+                uint64_t                       lingering_next{std::numeric_limits<uint64_t>::max()};
+                uint64_t                       lingering_aborted{0};
+        } zerocopy;
+        // The bundle of Produce requests of at least threshold bytes(TANK_SPLICE_INGEST_THRESHOLD, 0 disables) may be
+        // spliced from the socket to the segment(socket -> pipe -> segment) instead of being read in and then written out.
+        // See consider_splice_ingest()
+        struct {
+                uint32_t threshold{strwlen32_t(getenv("TANK_SPLICE_INGEST_THRESHOLD") ?: "0").as_uint32()};
+                int      pipe[2]{-1, -1};
+                uint32_t pipe_size{0};
+                uint64_t bundles{0}, bytes{0};
+        } splice_ingest;
+        // see charge_produce_quotas()
+        struct {
+                // bytes/sec produced and consumed by each distinct client id(0 disables)
+                uint64_t client_produce_rate{strwlen32_t(getenv("TANK_CLIENT_PRODUCE_QUOTA") ?: "0").as_uint64()};
+                uint64_t client_consume_rate{strwlen32_t(getenv("TANK_CLIENT_CONSUME_QUOTA") ?: "0").as_uint64()};
+
+                robin_hood::unordered_map<std::string, std::unique_ptr<client_quota>> clients;
+                // times clients were throttled, and for how long(ms) in total
+                uint64_t produce_throttled{0}, consume_throttled{0};
+                uint64_t produce_throttle_ms{0}, consume_throttle_ms{0};
+        } quotas;
+        // see service_tls.cpp; TLS is disabled unless set
+        ssl_ctx_st *tls_ctx{nullptr};
+        ssl_ctx_st *tls_client_ctx{nullptr};
+        const char *tls_peer_name{nullptr}; // TANK_TLS_PEER_NAME
 	time32_t startup_ts;
         std::vector<topic_partition *>                                      partitions_v;
         std::mutex                                                          partitions_v_lock;
         std::vector<repl_stream *>                                          reusable_replication_streams;
         simple_allocator                                                    repl_streams_allocator;
         std::vector<IOBuffer *>                                             bufs;
+        // fewest buffers in bufs since the last trim_pools(); that many were not needed
+        size_t                                                              bufs_low_watermark{0};
         std::vector<std::unique_ptr<produce_response>>                      reusable_produce_responses;
         uint64_t                                                            next_produce_response_gen{0};
-        std::vector<data_vector_payload *>                                  reusable_data_vector_payloads;
-        std::vector<file_contents_payload *>                                reusable_file_contents_payloads;
         std::vector<connection *>                                           reusable_conns, pending_reusable_conns;
-        simple_allocator                                                    payloads_allocator;
-        std::vector<outgoing_queue *>                                       outgoingQueuesPool;
+        // payloads, outgoing queues, wait contexts
+        slab_allocator                                                      slabs;
+        uint64_t                                                            next_pools_trim{0};
         simple_allocator                                                    connections_allocators;
         switch_dlist                                                        active_partitions{&active_partitions, &active_partitions};
         switch_dlist                                                        allConnections, idle_connections{&idle_connections, &idle_connections};
@@ -2649,6 +3536,8 @@ class Service {
         switch_dlist                                                        scheduled_consume_retries_list{&scheduled_consume_retries_list, &scheduled_consume_retries_list};
         uint64_t                                                            scheduled_consume_retries_list_next{std::numeric_limits<uint64_t>::max()};
         uint64_t                                                            next_cluster_state_apply{std::numeric_limits<uint64_t>::max()};
+        uint64_t                                                            next_cluster_repairs_slice{std::numeric_limits<uint64_t>::max()};
+        uint64_t                                                            next_cluster_state_apply_slice{std::numeric_limits<uint64_t>::max()};
         uint64_t                                                            next_active_partitions_check{std::numeric_limits<uint64_t>::max()};
 
         uint64_t   next_idle_check_ts{std::numeric_limits<uint64_t>::max()};
@@ -2674,7 +3563,7 @@ class Service {
         std::atomic<bool>              sleeping alignas(64){false};
         EPoller                        poller{2048};
         pthread_t                      main_thread_id;
-        std::unique_ptr<std::thread>   sync_thread;
+        reactor_profiler               profiler;
         std::vector<topic_partition *> partitions_requested_eof;
         range32_t *                    patch_list{nullptr};
         uint32_t *                     partitions_requested_eof_patch_list_indices{nullptr};
@@ -2687,9 +3576,11 @@ class Service {
       protected:
         static uint64_t segment_lastmsg_seqnum(int, const uint64_t);
 
+        static uint32_t segment_logical_size(int, const uint32_t from = 0);
+
         static void rebuild_index(int, int, const uint64_t);
 
-        static uint32_t verify_log(int);
+        static uint32_t verify_log(int, const bool mutable_segment, const bool checksums_only = false);
 
         static void verify_index(int, const bool);
 
@@ -2700,6 +3591,8 @@ class Service {
 
         int safe_open(const char *path, int flags, mode_t mode = 0);
 
+        bool retire_file(const int, topic_partition *, const char *, const bool recycle = false);
+
         void track_log_cleanup(topic_partition_log *log) {
                 cleanup_tracker.emplace_back(log);
         }
@@ -30,6 +30,13 @@ bool Service::process_status(connection *const c, [[maybe_unused]] const uint8_t
 	resp->pack(static_cast<time32_t>(startup_ts));
 	resp->pack(static_cast<uint32_t>(TANK_VERSION));
 
+        // reactor profiler; see reactor_profiler
+        resp->pack(static_cast<uint32_t>(profiler.stalls.load(std::memory_order_relaxed)));
+        resp->pack(static_cast<uint32_t>(profiler.slow_ops_total));
+        resp->pack(static_cast<uint32_t>(std::accumulate(std::begin(profiler.slow_ops),
+                                                         std::begin(profiler.slow_ops) + profiler.slow_ops_cnt,
+                                                         uint32_t(0), [](const auto prev, const auto &op) noexcept { return std::max(prev, op.duration); })));
+
         *reinterpret_cast<uint32_t *>(resp->At(size_offset)) = resp->size() - size_offset - sizeof(uint32_t);
 
         auto payload = get_data_vector_payload();
@@ -44,6 +51,119 @@ bool Service::process_status(connection *const c, [[maybe_unused]] const uint8_t
         return try_tx(c);
 }
 
+// Creates a new topic in standalone mode, and returns the CreateTopic response error code
+// Used by process_create_topic() and for internal topics, e.g consumer groups offsets
+uint8_t Service::create_local_topic(const str_view8 topicName, const uint16_t partitionsCnt, const partition_config &partitionConfig, const str_view32 config) {
+        static constexpr bool trace{false};
+        // we are going to create .<topic-name>
+        // and when we are done with it, we are going to rename it to <topic-name>
+        // this is important because for any reason we may not get the chance to create
+        // all partitions directories/files in there, and we don't want to leave a mess if that happens
+        char                           topicPath[PATH_MAX];
+        const auto                     topicPathLen = Snprint(topicPath, sizeof(topicPath), basePath_, "/.", topicName, "/");
+        std::vector<topic_partition *> list;
+
+        if (trace) {
+                SLog("Will try to create ", str_view32(topicPath, topicPathLen), "\n");
+        }
+
+        if (mkdir(topicPath, 0775) == -1) {
+                if (trace) {
+                        SLog("Failed to mkdir(", topicPath, "):", strerror(errno), "\n");
+                }
+
+                return 2;
+        }
+
+        const auto cleanup = [&]() {
+                while (!list.empty()) {
+                        list.back()->Release();
+                        list.pop_back();
+                }
+
+                topicPath[topicPathLen] = '\0';
+                rm_tankdir(topicPath);
+        };
+
+        try {
+                auto t = Switch::make_sharedref<topic>(topicName, partitionConfig);
+
+                TANK_EXPECT(t->use_count() == 1);
+                // see Service::open_partition_log()
+                t->flags |= unsigned(topic::Flags::under_construction);
+
+                for (uint16_t i{0}; i < partitionsCnt; ++i) {
+                        try {
+                                auto _p = init_local_partition(i, t.get(), partitionConfig, true).release();
+
+                                TANK_EXPECT(_p->use_count() == 1);
+                                list.emplace_back(_p);
+                        } catch (...) {
+                                cleanup();
+                                return 2;
+                        }
+                }
+
+                if (config) {
+                        int fd;
+
+                        strcpy(topicPath + topicPathLen, "config");
+                        fd = safe_open(topicPath, O_WRONLY | O_CREAT | O_LARGEFILE, 0775);
+                        if (fd == -1) {
+                                if (trace) {
+                                        SLog("open(", topicPath, ") failed:", strerror(errno), "\n");
+                                }
+
+                                cleanup();
+                                return 2;
+                        } else if (write(fd, config.p, config.len) != config.len) {
+                                if (trace) {
+                                        SLog("write for (", topicPath, ") failed:", strerror(errno), "\n");
+                                }
+
+                                TANKUtil::safe_close(fd);
+                                unlink(topicPath);
+                                cleanup();
+                                return 2;
+                        } else {
+                                TANKUtil::safe_close(fd);
+                        }
+                }
+
+                topicPath[topicPathLen - 1] = '\0';
+                if (rename(topicPath, Buffer{}.append(basePath_, "/", topicName).c_str()) == -1) {
+                        if (trace) {
+                                SLog("Failed to commit topic, unable to rename ", topicPath, ": ", strerror(errno), "\n");
+                        }
+
+                        cleanup();
+                        return 2;
+                }
+
+                if (trace) {
+                        SLog("Created topic\n");
+                }
+
+                TANK_EXPECT(t->flags & unsigned(topic::Flags::under_construction));
+                t->flags ^= unsigned(topic::Flags::under_construction);
+
+                t->register_partitions(list.data(), list.size());
+                list.clear();
+
+                TANK_EXPECT(t->use_count() == 1);
+
+                register_topic(t.get());
+                return 0;
+        } catch (const std::exception &e) {
+                if (trace) {
+                        SLog("Exception caught:", e.what(), "\n");
+                }
+
+                cleanup();
+                return 2;
+        }
+}
+
 bool Service::process_create_topic(connection *const c, const uint8_t *p, const size_t len) {
         static constexpr bool trace{false};
 
@@ -74,8 +194,7 @@ bool Service::process_create_topic(connection *const c, const uint8_t *p, const
         p += config.size();
 
         resp->pack(static_cast<uint8_t>(TankAPIMsgType::CreateTopic));
-        const auto                     sizeOffset = resp->size();
-        std::vector<topic_partition *> list;
+        const auto sizeOffset = resp->size();
 
         resp->RoomFor(sizeof(uint32_t));
 
@@ -127,119 +246,11 @@ bool Service::process_create_topic(connection *const c, const uint8_t *p, const
                                 return true;
                         }
 
-                        // we are going to create .<topic-name>
-                        // and when we are done with it, we are going to rename it to <topic-name>
-                        // this is important because for any reason we may not get the chance to create
-                        // all partitions directories/files in there, and we don't want to leave a mess if that happens
-                        char       topicPath[PATH_MAX];
-                        const auto topicPathLen = Snprint(topicPath, sizeof(topicPath), basePath_, "/.", topicName, "/");
-
-                        if (trace) {
-                                SLog("Will try to create ", str_view32(topicPath, topicPathLen), "\n");
-                        }
-
-                        if (mkdir(topicPath, 0775) == -1) {
-                                if (trace) {
-                                        SLog("Failed to mkdir(", topicPath, "):", strerror(errno), "\n");
-                                }
-
-                                resp->pack(static_cast<uint8_t>(2));
-                        } else {
-                                const auto cleanup = [&]() {
-                                        topicPath[topicPathLen] = '\0';
-                                        rm_tankdir(topicPath);
-                                };
-
-                                try {
-                                        auto t = Switch::make_sharedref<topic>(topicName, partitionConfig);
-
-                                        TANK_EXPECT(t->use_count() == 1);
-                                        // see Service::open_partition_log()
-                                        t->flags |= unsigned(topic::Flags::under_construction);
-
-                                        for (uint16_t i{0}; i < partitionsCnt; ++i) {
-                                                try {
-                                                        auto _p = init_local_partition(i, t.get(), partitionConfig, true).release();
-
-                                                        TANK_EXPECT(_p->use_count() == 1);
-                                                        list.emplace_back(_p);
-                                                } catch (...) {
-                                                        cleanup();
-                                                        resp->pack(static_cast<uint8_t>(2));
-                                                        goto l1;
-                                                }
-                                        }
-
-                                        if (config) {
-                                                int fd;
-
-                                                strcpy(topicPath + topicPathLen, "config");
-                                                fd = safe_open(topicPath, O_WRONLY | O_CREAT | O_LARGEFILE, 0775);
-                                                if (fd == -1) {
-                                                        if (trace) {
-                                                                SLog("open(", topicPath, ") failed:", strerror(errno), "\n");
-                                                        }
-
-                                                        cleanup();
-                                                        resp->pack(static_cast<uint8_t>(2));
-                                                        goto l1;
-                                                } else if (write(fd, config.p, config.len) != config.len) {
-                                                        if (trace) {
-                                                                SLog("write for (", topicPath, ") failed:", strerror(errno), "\n");
-                                                        }
-
-                                                        TANKUtil::safe_close(fd);
-                                                        unlink(topicPath);
-                                                        cleanup();
-                                                        resp->pack(static_cast<uint8_t>(2));
-                                                        goto l1;
-                                                } else {
-                                                        TANKUtil::safe_close(fd);
-                                                }
-                                        }
-
-                                        topicPath[topicPathLen - 1] = '\0';
-                                        if (rename(topicPath, Buffer{}.append(basePath_, "/", topicName).c_str()) == -1) {
-                                                if (trace) {
-                                                        SLog("Failed to commit topic, unable to rename ", topicPath, ": ", strerror(errno), "\n");
-                                                }
-
-                                                cleanup();
-                                                resp->pack(static_cast<uint8_t>(2));
-                                                goto l1;
-                                        }
-
-                                        if (trace) {
-                                                SLog("Created topic\n");
-                                        }
-
-                                        TANK_EXPECT(t->flags & unsigned(topic::Flags::under_construction));
-                                        t->flags ^= unsigned(topic::Flags::under_construction);
-                                        t->register_partitions(list.data(), list.size());
-                                        list.clear();
-
-                                        TANK_EXPECT(t->use_count() == 1);
-
-                                        register_topic(t.get());
-                                        resp->pack(static_cast<uint8_t>(0));
-                                } catch (const std::exception &e) {
-                                        if (trace) {
-                                                SLog("Exception caught:", e.what(), "\n");
-                                        }
-
-                                        cleanup();
-                                        resp->pack(static_cast<uint8_t>(2));
-                                }
-                        }
+                        resp->pack(create_local_topic(topicName, partitionsCnt, partitionConfig, config));
                 }
         }
 
 l1:
-        while (!list.empty()) {
-                list.back()->Release();
-                list.pop_back();
-        }
-
         *reinterpret_cast<uint32_t *>(resp->At(sizeOffset)) = resp->size() - sizeOffset - sizeof(uint32_t);
 
         auto payload = get_data_vector_payload();
@@ -524,14 +535,23 @@ bool Service::process_msg(connection *const c, const uint8_t msg, const uint8_t
         }
 
         c->verify();
+        profiler.cur.msg = msg;
 
+        if (park_request(c, msg, data, len)) {
+                return true;
+        }
+
+        return dispatch_msg(c, msg, data, len);
+}
+
+// see process_msg() and drain_parked_requests()
+bool Service::dispatch_msg(connection *const c, const uint8_t msg, const uint8_t *const data, const size_t len) {
         switch (TankAPIMsgType(msg)) {
                 case TankAPIMsgType::Produce:
                 case TankAPIMsgType::ProduceWithSeqnum:
                         return process_produce(TankAPIMsgType(msg), c, data, len);
 
                 case TankAPIMsgType::Consume:
-                        [[fallthrough]];
                 case TankAPIMsgType::ConsumePeer:
                         return process_consume(static_cast<TankAPIMsgType>(msg), c, data, len);
 
@@ -550,6 +570,15 @@ bool Service::process_msg(connection *const c, const uint8_t msg, const uint8_t
                 case TankAPIMsgType::Status:
                         return process_status(c, data, len);
 
+                case TankAPIMsgType::JoinGroup:
+                        return process_join_group(c, data, len);
+
+                case TankAPIMsgType::CommitOffsets:
+                        return process_commit_offsets(c, data, len);
+
+                case TankAPIMsgType::FetchOffsets:
+                        return process_fetch_offsets(c, data, len);
+
                 default:
                         return shutdown(c, __LINE__);
         }
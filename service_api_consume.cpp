@@ -50,6 +50,10 @@ bool Service::process_consume(const TankAPIMsgType _msg,
                 replica_id = 0;
                 peer       = nullptr;
 
+                // see service_quotas.cpp
+                track_client_quota(c, client_id, client_version);
+                c->as.tank.throttle.consume_request_id = request_id;
+
                 if (trace) {
                         SLog("Consume request from client [", client_id,
                              "] version ", client_version,
@@ -231,8 +235,11 @@ bool Service::process_consume(const TankAPIMsgType _msg,
                                         resp_hdr->pack(static_cast<uint8_t>(0xfd));
                                         respond_now = true;
                                         continue;
-                                } else if (partition_leader != self) {
+                                } else if (partition_leader != self && !(consume_req && partition->cluster.isr.find(self))) {
                                         // ask to redirect for this partition
+                                        //
+                                        // clients may consume from any ISR member, not just the leader; we 'll serve
+                                        // them up to the highwater mark we know about(see update_follower_hwmark())
                                         if (trace) {
                                                 SLog("Different leader\n");
                                         }
@@ -285,11 +292,12 @@ bool Service::process_consume(const TankAPIMsgType _msg,
                                 }
                         } else {
                         l100:
-                                range32_t  range;
-                                bool       first_bundle_is_sparse;
-                                uint64_t   start;
-                                const bool fetch_only_committed = consume_req;
-                                auto       res                  = partition->read_from_local(fetch_only_committed, abs_seq_num, fetch_size);
+                                range32_t        range;
+                                bool             first_bundle_is_sparse;
+                                uint64_t         start;
+                                hot_tail_chunk * chunk;
+                                const bool       fetch_only_committed = consume_req;
+                                auto             res                  = partition->read_from_local(fetch_only_committed, abs_seq_num, fetch_size);
                                 const auto hwmark               = partition_hwmark(partition);
                                 const auto ceil_seqnum          = (false == cluster_aware() || _msg != TankAPIMsgType::Consume)
                                                              ? log->lastAssignedSeqNum
@@ -317,6 +325,12 @@ bool Service::process_consume(const TankAPIMsgType _msg,
                                                         // register_consumer_wait()
                                                         // will see that we do the right thing here
                                                         track_partition_eof(partition);
+                                                } else if (const auto leader = partition->cluster.leader.node; ca && leader != self) {
+                                                        // we are an ISR follower, and we either haven't caught up with the leader yet, or
+                                                        // the leader hasn't piggybacked its highwater mark to us yet; let the leader deal with it
+                                                        resp_hdr->pack(static_cast<uint8_t>(0xfc));
+                                                        resp_hdr->pack(leader->ep.addr4, leader->ep.port);
+                                                        respond_now = true;
                                                 } else {
                                                         resp_hdr->pack(static_cast<uint8_t>(1));
                                                         resp_hdr->pack(static_cast<uint64_t>(0));
@@ -384,6 +398,9 @@ bool Service::process_consume(const TankAPIMsgType _msg,
                                                 resp_hdr->pack(ceil_seqnum);
                                                 resp_hdr->pack(range.len);
 
+                                                // if set, we 'll write the content from memory; see topic_partition_log::hot_tail
+                                                chunk = log->hot_tail_chunk_for(res.fdh.get(), range);
+
 #ifdef __linux__
                                                 // Initiate readahead on that range so that our subsequent sendfile() from that file will be satisfied from the cache, and will not block on disk I/O
                                                 // (assuming we have initiated readahead early enough and other activity on the system did not in the meantime flush pages from cache)
@@ -399,7 +416,7 @@ bool Service::process_consume(const TankAPIMsgType _msg,
                                                 // http://lxr.free-electrons.com/source/mm/readahead.c
                                                 // 	Looks like it will only deal with pages not mapped yet. The cost should be mininal, though
                                                 // 	the kernel does have to iterate all pages in the range and look each of those in a RBT.
-                                                if (range.size() > 4096) {
+                                                if (!chunk && range.size() > 4096) {
                                                         // See https://github.com/phaistos-networks/TANK/issues/14 for measurements
                                                         const uint64_t b = trace ? Timings::Microseconds::Tick() : 0;
 
@@ -423,7 +440,17 @@ bool Service::process_consume(const TankAPIMsgType _msg,
                                                 {
                                                         auto p = get_file_contents_payload();
 
-                                                        p->init(res.fdh.get(), range, start, topic);
+                                                        p->init(res.fdh.get(), range, start, topic, partition);
+                                                        if (chunk) {
+                                                                p->set_chunk(chunk);
+                                                        }
+
+                                                        // see Service::tx_sched
+                                                        if (consume_peer_req) {
+                                                                p->cls = tx_class::Replication;
+                                                        } else if (chunk || res.fdh.get() == log->cur.fdh.get()) {
+                                                                p->cls = tx_class::Tail;
+                                                        }
                                                         q->push_back(p);
 
                                                         TANK_EXPECT(p->file_range.fdhandle);
@@ -6,7 +6,9 @@
 // This, among other reasons, is because of how and why we use topic_partition::waiting_list, where
 // each value is a pair of (wait_ctx, uint8_t), the second being the index in wait_ctx::partitions[]
 // so we can't have the same partition more than once there.
-bool Service::process_produce(const TankAPIMsgType msg, connection *const c, const uint8_t *p, const size_t len) {
+//
+// If src is set, the last src->remaining bytes of the request, i.e of the last bundle, are still in the socket(see consider_splice_ingest())
+bool Service::process_produce(const TankAPIMsgType msg, connection *const c, const uint8_t *p, const size_t len, splice_source *const src) {
         static constexpr bool trace{false};
 	static constexpr bool trace_faults{false};
         if (unlikely(len < sizeof(uint16_t) + sizeof(uint32_t) + sizeof(uint8_t))) {
@@ -21,9 +23,11 @@ bool Service::process_produce(const TankAPIMsgType msg, connection *const c, con
 
         [[maybe_unused]] const auto ca             = cluster_aware();
         auto                        self           = cluster_state.local_node.ref;
-        [[maybe_unused]] const auto client_version = decode_pod<uint16_t>(p);
+        const auto                  client_version = decode_pod<uint16_t>(p);
         const auto                  request_id     = decode_pod<uint32_t>(p);
-        p += decode_pod<uint8_t>(p); // skip client id
+        const str_view8             client_id(reinterpret_cast<const char *>(p) + 1, *p);
+
+        p += client_id.size() + sizeof(uint8_t);
 
         if (unlikely(p + sizeof(uint8_t) + sizeof(uint32_t) + sizeof(uint8_t) > end)) {
                 return shutdown(c, __LINE__);
@@ -31,6 +35,7 @@ bool Service::process_produce(const TankAPIMsgType msg, connection *const c, con
 
         [[maybe_unused]] const auto         op_required_acks = decode_pod<uint8_t>(p);
         [[maybe_unused]] const auto         ack_timeout      = decode_pod<uint32_t>(p); // TODO:
+        const auto                          durable          = op_required_acks == TANKUtil::produce_request_acks::ISR_durable();
         const auto                          topics_cnt       = decode_pod<uint8_t>(p);
         auto                                pr               = get_produce_response();
         robin_hood::unordered_map<str_view8, bool> intern_map;
@@ -87,13 +92,13 @@ bool Service::process_produce(const TankAPIMsgType msg, connection *const c, con
                                         return shutdown(c, __LINE__);
                                 }
 
-                                if (unlikely(!Compression::check_decode_varuint32(p, end))) {
+                                uint32_t bundle_len;
+
+                                if (unlikely(!Compression::decode_varuint32(p, end, &bundle_len))) {
                                         put_produce_response(pr);
                                         return shutdown(c, __LINE__);
                                 }
 
-                                const auto bundle_len = Compression::decode_varuint32(p);
-
                                 if (msg == TankAPIMsgType::ProduceWithSeqnum) {
                                         p += sizeof(uint64_t);
                                 }
@@ -117,12 +122,13 @@ bool Service::process_produce(const TankAPIMsgType msg, connection *const c, con
                 for (size_t i{0}; i < cnt; ++i) {
                         const auto partition_id = decode_pod<uint16_t>(p);
 
-                        if (unlikely(!Compression::check_decode_varuint32(p, end))) {
+                        uint32_t bundle_len;
+
+                        if (unlikely(!Compression::decode_varuint32(p, end, &bundle_len))) {
                                 put_produce_response(pr);
                                 return shutdown(c, __LINE__);
                         }
 
-                        const auto                                bundle_len = Compression::decode_varuint32(p);
                         auto                                      partition = topic->enabled_partition(partition_id);
                         uint64_t                                  first_msg_seq_num;
 
@@ -177,10 +183,31 @@ bool Service::process_produce(const TankAPIMsgType msg, connection *const c, con
         pr->client_ctx.req_id = request_id;
         c->as.tank.produce_responses_list.push_back(&pr->client_ctx.connection_ll);
 
+        // see service_quotas.cpp
+        track_client_quota(c, client_id, client_version);
+        charge_produce_quotas(c, request_id, len, pr);
+
 	if (trace) {
 		SLog(pr->participants.size(), " participants\n");
 	}
 
+        // associates the DPR with a partition
+        const auto defer_response = [&]() {
+                if (pr->deferred.expiration.ll.empty()) {
+                        // link this (D)PR for expiration
+                        // if no ack. time out has been explicitly provided, we default to 8s
+                        pr->deferred.expiration.ts = now_ms + (ack_timeout ?: 8 * 1000);
+
+                        if (deferred_produce_responses_expiration_list.empty()) {
+                                deferred_produce_responses_next_expiration = pr->deferred.expiration.ts;
+                        }
+
+                        deferred_produce_responses_expiration_list.push_back(&pr->deferred.expiration.ll);
+                }
+
+                pr->deferred.pending_partitions++;
+        };
+
         // TODO: should we verify the  participants, and if we have any issues with any of them, abort it, or only
         // process participants that are valid and ignore others?
         for (size_t pi = 0; pi < pr->participants.size(); ++pi) {
@@ -207,7 +234,7 @@ bool Service::process_produce(const TankAPIMsgType msg, connection *const c, con
 		uint8_t required_acks;
 
                 if (ca) {
-                        required_acks = topic->compute_required_peers_acks(partition, op_required_acks);
+                        required_acks = topic->compute_required_peers_acks(partition, durable ? TANKUtil::produce_request_acks::ISR() : op_required_acks);
 
 			if (trace) {
 				SLog("required_acks = ", required_acks, " from compute_required_peers_acks(", op_required_acks, ")\n");
@@ -269,10 +296,37 @@ bool Service::process_produce(const TankAPIMsgType msg, connection *const c, con
                 [[maybe_unused]] const auto e                     = p + bundle.size();
                 const auto                  bundle_flags          = decode_pod<uint8_t>(p);
                 const auto                  sparse_bundle_bit_set = bundle_flags & (1u << 6);
-                const uint32_t              msg_set_size          = ((bundle_flags >> 2) & 0xf) ?: Compression::decode_varuint32(p);
-                auto                        first_msg_seq_num     = it.update.first_msg_seq_num;
-                uint64_t                    last_msg_seq_num;
-                topic_partition_log *       log;
+                const auto                  extra_flags           = (bundle_flags & (1u << 7)) ? decode_pod<uint8_t>(p) : uint8_t(0);
+                uint64_t                    producer_id{0};
+                uint32_t                    producer_seq{0};
+
+                if (extra_flags & uint8_t(TankFlags::BundleExtraFlags::RichProducerInfo)) {
+                        p += sizeof(uint32_t) + sizeof(uint64_t) + sizeof(uint16_t);
+                }
+
+                if (extra_flags & uint8_t(TankFlags::BundleExtraFlags::ProducerSeq)) {
+                        producer_id  = decode_pod<uint64_t>(p);
+                        producer_seq = decode_pod<uint32_t>(p);
+                }
+
+                if (extra_flags & uint8_t(TankFlags::BundleExtraFlags::CRC32C)) {
+                        p += sizeof(uint32_t);
+
+                        if (unlikely(!TANKUtil::verify_bundle_crc32c(bundle.offset, e))) {
+                                if (trace) {
+                                        SLog("Bundle CRC32C mismatch\n");
+                                }
+
+                                ++checksum_failures.produce;
+                                it.res = produce_response::participant::OpRes::ChecksumMismatch;
+                                continue;
+                        }
+                }
+
+                const uint32_t       msg_set_size      = ((bundle_flags >> 2) & 0xf) ?: Compression::decode_varuint32(p);
+                auto                 first_msg_seq_num = it.update.first_msg_seq_num;
+                uint64_t             last_msg_seq_num;
+                topic_partition_log *log;
 
                 if (sparse_bundle_bit_set) {
                         first_msg_seq_num = decode_pod<uint64_t>(p);
@@ -327,8 +381,44 @@ bool Service::process_produce(const TankAPIMsgType msg, connection *const c, con
                         continue;
                 }
 
+                if (producer_id) {
+                        // idempotent producer; see topic_partition_log::producers
+                        if (!log->producers.loaded && !log->rebuild_producers_window()) {
+                                if (trace || trace_faults) {
+                                        SLog("Failed to rebuild producers window\n");
+                                }
+
+                                it.res = produce_response::participant::OpRes::IO_Fault;
+                                continue;
+                        }
+
+                        switch (log->producers.check(producer_id, producer_seq)) {
+                                case producers_window::Check::Duplicate:
+                                        // we have already appended this bundle; the producer
+                                        // is likely retrying because it didn't get our response
+                                        if (trace) {
+                                                SLog("Duplicate bundle ", producer_seq, " from producer ", producer_id, "\n");
+                                        }
+
+                                        it.res = produce_response::participant::OpRes::OK;
+                                        continue;
+
+                                case producers_window::Check::Stale:
+                                        // too old for us to know if we have appended it
+                                        if (trace) {
+                                                SLog("Stale bundle ", producer_seq, " from producer ", producer_id, "\n");
+                                        }
+
+                                        it.res = produce_response::participant::OpRes::StaleProducerSeq;
+                                        continue;
+
+                                default:
+                                        break;
+                        }
+                }
 
-                auto       res                     = log->append_bundle(curTime, bundle.offset, bundle.size(), msg_set_size, first_msg_seq_num, last_msg_seq_num);
+                auto       res                     = log->append_bundle(curTime, bundle.offset, bundle.size(), msg_set_size, first_msg_seq_num, last_msg_seq_num,
+                                                        pi + 1 == pr->participants.size() ? src : nullptr);
                 const auto bundle_last_msg_seq_num = res.msgSeqNumRange.offset + res.msgSeqNumRange.size() - 1;
 
                 if (!res.fdh) {
@@ -439,30 +529,40 @@ bool Service::process_produce(const TankAPIMsgType msg, connection *const c, con
                         }
                 }
 
+                if (producer_id) {
+                        log->producers.track(producer_id, producer_seq);
+                }
+
                 it.res = produce_response::participant::OpRes::OK;
 
                 topic->metrics.bytes_in += bundle.size();
                 topic->metrics.msgs_in += msg_set_size;
+                partition->metrics.bytes_in += bundle.size();
+                partition->metrics.msgs_in += msg_set_size;
+                partition->metrics.bytes_in_rate.reg(now_ms / 1000, bundle.size());
+
+                if (durable) {
+                        // the response is deferred until the segment has been synced, in addition to
+                        // any peers acks. Consumers may still get to the bundle before that
+                        auto r = new sync_request();
+
+                        defer_response();
+
+                        r->fdh                = log->cur.fdh;
+                        r->dpr                = pr;
+                        r->dpr_gen            = pr->gen;
+                        r->partition          = partition;
+                        r->pr_participant_idx = static_cast<uint8_t>(pi);
+                        it.sync_res           = produce_response::participant::OpRes::Pending;
+                        schedule_sync(log, r);
+                }
 
                 if (required_acks == 0) {
                         it.res = produce_response::participant::OpRes::OK;
                         continue;
                 }
 
-                if (pr->deferred.expiration.ll.empty()) {
-			// link this (D)PR for expiration
-			// if no ack. time out has been explicitly provided, we default to 8s
-                        pr->deferred.expiration.ts = now_ms + (ack_timeout ?: 8 * 1000); 
-
-                        if (deferred_produce_responses_expiration_list.empty()) {
-                                deferred_produce_responses_next_expiration = pr->deferred.expiration.ts;
-                        }
-
-                        deferred_produce_responses_expiration_list.push_back(&pr->deferred.expiration.ll);
-                }
-
-                // associate the DPR with this partition
-                pr->deferred.pending_partitions++;
+                defer_response();
 
                 // wait for ack. for this (partition, bundle_last_msg_seq_num)
                 auto &q = partition->cluster.pending_client_produce_acks_tracker.pending;
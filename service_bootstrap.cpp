@@ -2,10 +2,7 @@
 #if __cplusplus > 201703L
 #include <filesystem>
 #endif
-
-extern std::mutex                       mboxLock;
-extern std::vector<std::pair<int, int>> mbox;
-extern std::condition_variable          mbox_cv;
+#include <execinfo.h>
 
 namespace {
         [[maybe_unused]] std::atomic<bool> bootstrap_failed{false};
@@ -497,6 +494,10 @@ int Service::start(int argc, char **argv) {
                 Print("> Read-Only mode; some functionality/APIs will be unavailable\n");
         }
 
+        if (!cluster_aware()) {
+                load_consumer_groups();
+        }
+
         Print("(C) Phaistos Networks, S.A. - ", ansifmt::color_green, "http://phaistosnetworks.gr/", ansifmt::reset, ". Licensed under the Apache License\n\n");
 
         if (topics.empty()) {
@@ -538,37 +539,32 @@ int Service::start(int argc, char **argv) {
                 }
         }
 
-        sync_thread.reset(new std::thread([] {
-                std::vector<std::pair<int, int>> local;
-                sigset_t                         mask;
-
-                sigfillset(&mask);
-                pthread_sigmask(SIG_SETMASK, &mask, nullptr);
-                for (;;) {
-                        {
-                                std::unique_lock<std::mutex> g(mboxLock);
-
-                                while (mbox.empty()) {
-                                        mbox_cv.wait(g);
-                                }
-
-                                local = std::move(mbox);
-                                TANK_EXPECT(mbox.empty());
-                        }
-
-                        for (auto &it : local) {
-                                if (-1 == it.first) {
-                                        return;
-                                }
+#ifdef HAVE_TANK_TLS
+        // see service_tls.cpp
+        if (!init_tls()) {
+                return 1;
+        }
+#endif
 
-                                fsync(it.first);
-                                fsync(it.second);
-                        }
+        // see sync_worker(); segments stored in different devices are synced concurrently
+        for (auto n = std::max<uint32_t>(strwlen32_t(getenv("TANK_SYNC_WORKERS") ?: "4").as_uint32(), 1); n; --n) {
+                syncs.workers.emplace_back([this] {
+                        sync_worker();
+                });
+        }
 
-                        local.clear();
-                }
+        reclaimer.running.store(true, std::memory_order_relaxed);
+        reclaimer.thread.reset(new std::thread([this] {
+                reclaimer_main();
         }));
 
+        // 0 to open partitions on the reactor thread
+        for (auto n = strwlen32_t(getenv("TANK_PARTITION_OPEN_WORKERS") ?: "2").as_uint32(); n; --n) {
+                partition_opens.workers.emplace_back([this] {
+                        partition_open_worker();
+                });
+        }
+
         if (prom_listen_fd != -1) {
                 poller.insert(prom_listen_fd, POLLIN, &prom_listen_fd);
         }
@@ -583,6 +579,27 @@ int Service::start(int argc, char **argv) {
         signal(SIGINT, signal_handler);
         signal(SIGUSR1, signal_handler);
 
+        if (profiler.stall_threshold_ms) {
+                // backtrace() may need to dlopen() libgcc the first time it's invoked
+                // which is not something we want to happen in a signal handler
+                backtrace(profiler.stall_frames, 1);
+
+                // see Service::stall_watchdog()
+                signal(SIGUSR2, [](int) {
+                        auto &p = this_service->profiler;
+
+                        p.stall_frames_cnt.store(backtrace(p.stall_frames, sizeof_array(p.stall_frames)), std::memory_order_release);
+                });
+
+                profiler.watchdog.reset(new std::thread([this] {
+                        sigset_t mask;
+
+                        sigfillset(&mask);
+                        pthread_sigmask(SIG_SETMASK, &mask, nullptr);
+                        stall_watchdog();
+                }));
+        }
+
         sigemptyset(&mask);
         sigaddset(&mask, SIGPIPE);
         sigaddset(&mask, SIGHUP);
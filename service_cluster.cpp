@@ -43,9 +43,16 @@
 #include <base64.h>
 #include <compress.h>
 
-// generate and schedule a new request for peer `node`, for replication of content for `partitions`
+// generate and schedule new requests for peer `node`, for replication of content for `partitions`
+//
+// We keep up to a window of outstanding ConsumePeer requests per peer connection(TANK_REPLICATION_FETCH_WINDOW, default 4)
+// Each partition is included in at most one outstanding request, so that content for a partition is always requested and persisted in order.
+// Partitions not included in any outstanding request are split across as many new requests as the window allows, so that
+// when a response for some of them arrives, we can request more content for those partitions immediately, instead of
+// waiting for content for all other partitions replicated from that peer first.
 void Service::replicate_from(cluster_node *const node, topic_partition *const *partitions, std::size_t partitions_cnt) {
         static constexpr bool trace{false};
+        static const auto     window = std::clamp<uint32_t>(strwlen32_t(getenv("TANK_REPLICATION_FETCH_WINDOW") ?: "4").as_uint32(), 1, 64);
 
         TANK_EXPECT(node);
         TANK_EXPECT(partitions);
@@ -66,7 +73,7 @@ void Service::replicate_from(cluster_node *const node, topic_partition *const *p
 
         if (c) {
                 if (const auto state = c->as.consumer.state; state == connection::As::Consumer::State::Connecting || state == connection::As::Consumer::State::Busy) {
-                        // we are waiting for a response from an outstanding/active consume req
+                        // we have as many outstanding consume requests as the window allows
                         // or we are still trying to establish a connection
                         if (trace) {
                                 SLog("Peer CONSUME connection is busy\n");
@@ -98,8 +105,67 @@ void Service::replicate_from(cluster_node *const node, topic_partition *const *p
                 return;
         }
 
+        auto &idle     = reusable.repl_partitions;
+        auto  retry_at = std::numeric_limits<uint64_t>::max();
+
+        idle.clear();
+        for (size_t i{0}; i < partitions_cnt; ++i) {
+                auto p = partitions[i];
+
+                if (auto stream = p->cluster.rs) {
+                        if (stream->in_flight && stream->ch.get() == c) {
+                                // already requested content for this partition
+                                continue;
+                        }
+
+                        if (stream->src == node) {
+                                if (stream->checksum.stalled) {
+                                        // see consider_repl_checksum_mismatch()
+                                        continue;
+                                } else if (now_ms < stream->checksum.retry_at) {
+                                        // backing off
+                                        retry_at = std::min(retry_at, stream->checksum.retry_at);
+                                        continue;
+                                }
+                        }
+                }
+
+                idle.emplace_back(p);
+        }
+
+        if (retry_at != std::numeric_limits<uint64_t>::max()) {
+                schedule_retry_consume_from(node, retry_at);
+        }
+
+        if (idle.empty()) {
+                if (trace) {
+                        SLog("All partitions are included in outstanding requests\n");
+                }
+
+                return;
+        }
+
+        TANK_EXPECT(c->as.consumer.inflight < window);
+
+        // partitions are sorted by (topic, partition), and so are all [idle.data() + i, idle.data() + i + per_req)
+        const auto slots   = window - c->as.consumer.inflight;
+        const auto per_req = (idle.size() + slots - 1) / slots;
+
+        for (size_t i{0}; i < idle.size(); i += per_req) {
+                schedule_peer_consume_req(c, node, idle.data() + i, std::min<size_t>(per_req, idle.size() - i));
+        }
+
+        c->as.consumer.state = c->as.consumer.inflight >= window
+                                   ? connection::As::Consumer::State::Busy
+                                   : connection::As::Consumer::State::Idle;
+        try_tx(c);
+}
+
+void Service::schedule_peer_consume_req(connection *const c, cluster_node *const node, topic_partition *const *partitions, const std::size_t partitions_cnt) {
+        static constexpr bool trace{false};
+
         if (trace) {
-                SLog(ansifmt::color_green, "Will generate a CONSUME request for node ", node->id, "@", node->ep, ansifmt::reset, "\n");
+                SLog(ansifmt::color_green, "Will generate a CONSUME request for node ", node->id, "@", node->ep, " for ", partitions_cnt, " partitions", ansifmt::reset, "\n");
         }
 
         // topics are expected to be ordered
@@ -158,15 +224,18 @@ void Service::replicate_from(cluster_node *const node, topic_partition *const *p
                         }
 
                         stream->ch.set(c);
-                        stream->src = node;
+                        stream->src       = node;
+                        stream->in_flight = true;
+
+                        const auto fetch_size = std::max(stream->min_fetch_size, stream->fetch_size);
 
                         if (trace) {
-                                SLog("Will request topic ", p->owner->name(), "/", p->idx, " from seq ", next, ", min_fetch_size = ", stream->min_fetch_size, "\n");
+                                SLog("Will request topic ", p->owner->name(), "/", p->idx, " from seq ", next, ", fetch_size = ", fetch_size, "\n");
                         }
 
-                        b->pack(p->idx);                                        // partition
-                        b->pack(static_cast<uint64_t>(next));                   // absolute sequence number to consume from
-                        b->pack(static_cast<uint32_t>(stream->min_fetch_size)); // fetch size
+                        b->pack(p->idx);                                 // partition
+                        b->pack(static_cast<uint64_t>(next));            // absolute sequence number to consume from
+                        b->pack(static_cast<uint32_t>(fetch_size)); // fetch size
 
                 } while (++i < partitions_cnt && partitions[i]->owner == topic);
 
@@ -174,6 +243,7 @@ void Service::replicate_from(cluster_node *const node, topic_partition *const *p
 
                 *reinterpret_cast<uint16_t *>(b->data() + total_partitions_offset) = total_partitions;
                 ++topics_cnt;
+                --i;
         }
 
         *reinterpret_cast<uint16_t *>(b->data() + topics_cnt_offset) = topics_cnt;
@@ -182,8 +252,7 @@ void Service::replicate_from(cluster_node *const node, topic_partition *const *p
         dvp->append(b->as_s32());
         oq->push_back(dvp);
 
-        c->as.consumer.state = connection::As::Consumer::State::Busy;
-        try_tx(c);
+        c->as.consumer.inflight++;
 }
 
 // Attempt to replicate from a peer content
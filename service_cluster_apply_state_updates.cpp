@@ -69,60 +69,28 @@ void Service::conclude_bootstrap_updates() {
         }
 }
 
-// By consolidating all logic here as opposed to implementing bits and pieces everywhere we have a better chance of
-// doing this right. It also makes it possible to unit-test behavior, whereas that wasn't possible earlier
-//
-// INVARIANTS
-// - ISR set can only contain nodes from the partition's replicas set that are available()
-// - Cannot have any nodes in the ISR that are not also present in the replicas set
-// - A partition's leader must exist in the replicas set
-// - If a partition leader is set, it must also exist in the ISR
-// - A partition's leader must exist in the ISR
-// - Cluster leader must be available()
-// - A partition leader can only be missing or be NA if the partition is no longer active
-void Service::apply_cluster_state_updates() {
-        static constexpr bool trace{false};
-        TANK_EXPECT(cluster_state.local_node.ref);
-        TANK_EXPECT(cluster_state.local_node.id);
-	TANK_EXPECT(consul_state.reg_completed());
-
-        cluster_partitions_dirty.clear();
-        if (cluster_state.updates.nodes.empty() && cluster_state.updates.pm.empty() && cluster_state.updates.tm.empty() && !cluster_state.updates.cluster_leader.defined) {
-                conclude_bootstrap_updates();
-                return;
-        }
-
-        const auto                                                                 before                 = Timings::Microseconds::Tick();
-        auto &                                                                     dirty_nodes            = reusable.dirty_nodes;
-        auto &                                                                     dirty_topics           = reusable.dirty_topics;
-        auto &                                                                     dirty_partitions       = reusable.dirty_partitions;
-        auto &                                                                     v                      = reusable.part_bool_hashmap;
-        auto &                                                                     pv                     = reusable.pv;
-        auto &                                                                     nodes_replicas_updates = reusable.nodes_replicas_updates;
-        auto &                                                                     stream_start           = reusable.stream_start;
-        auto &                                                                     stream_stop            = reusable.stream_stop;
-        [[maybe_unused]] const auto                                                self                   = cluster_state.local_node.ref;
-        auto                                                                       leader_self = cluster_state.leader_self();
-        bool                                                                       promoted_to_cluster_leader{false};
-        bool                                                                       rebuild_all_available_nodes{false};
-        bool                                                                       track_all_partitions_dirty{false};
+// Applies nodes, cluster leadership and topics updates, and takes all pending partitions updates
+// so that apply_cluster_state_updates() can apply them in time slices
+void Service::begin_cluster_state_updates() {
+        static constexpr bool       trace{false};
+        auto &                      dirty_nodes  = reusable.dirty_nodes;
+        auto &                      dirty_topics = reusable.dirty_topics;
+        auto &                      updates      = cluster_state.updates;
+        [[maybe_unused]] const auto self         = cluster_state.local_node.ref;
+        auto                        leader_self  = cluster_state.leader_self();
+        bool                        promoted_to_cluster_leader{false};
+        bool                        rebuild_all_available_nodes{false};
+        bool                        track_all_partitions_dirty{false};
 
         if (trace) {
                 SLog(ansifmt::bold, ansifmt::color_brown, "::CLUSTER STATE UPDATE::", ansifmt::reset,
-                     ansifmt::color_brown, " nodes = ", cluster_state.updates.nodes.size(), ", topics = ", cluster_state.updates.tm.size(),
-                     ", partitions = ", cluster_state.updates.pm.size(),
-                     ", cluster_leader {defined: ", cluster_state.updates.cluster_leader.defined, ", value:", cluster_state.updates.cluster_leader.nid, "}", ansifmt::reset, "\n");
+                     ansifmt::color_brown, " nodes = ", updates.nodes.size(), ", topics = ", updates.tm.size(),
+                     ", partitions = ", updates.pm.size(),
+                     ", cluster_leader {defined: ", updates.cluster_leader.defined, ", value:", updates.cluster_leader.nid, "}", ansifmt::reset, "\n");
         }
 
 	dirty_nodes.clear();
 	dirty_topics.clear();
-	dirty_partitions.clear();
-	v.clear();
-	pv.clear();
-	nodes_replicas_updates.clear();
-	stream_start.clear();
-	stream_stop.clear();
-
 
 #pragma mark NODES
         for (auto &it : cluster_state.updates.nodes) {
@@ -168,7 +136,7 @@ void Service::apply_cluster_state_updates() {
                         if (!becoming_avail) {
                                 // so that we will check for a new leader if possible
                                 for (auto p : node->replica_for) {
-                                        dirty_partitions.insert(p);
+                                        schedule_partition_repair(p);
                                 }
 
                                 // INVARIANT: no longer available nodes cannot be in ISRs
@@ -289,7 +257,7 @@ void Service::apply_cluster_state_updates() {
                         }
 
                         for (auto p : *l) {
-                                dirty_partitions.insert(p);
+                                schedule_partition_repair(p);
                         }
                 }
         }
@@ -320,7 +288,7 @@ void Service::apply_cluster_state_updates() {
                                 if (auto l = t->partitions_) {
                                         for (auto p : *l) {
                                                 p->cluster.flags |= unsigned(topic_partition::Cluster::Flags::GC_ISR);
-                                                dirty_partitions.insert(p);
+                                                schedule_partition_repair(p);
 						invalidate_replicated_partitions_from_peer_cache_by_partition(p);
                                         }
                                 }
@@ -339,7 +307,7 @@ void Service::apply_cluster_state_updates() {
 
                                                 TANK_EXPECT(p);
                                                 p->cluster.flags |= unsigned(topic_partition::Cluster::Flags::GC_ISR);
-                                                dirty_partitions.insert(p);
+                                                schedule_partition_repair(p);
 						invalidate_replicated_partitions_from_peer_cache_by_partition(p);
                                         }
                                 } else if (update > cur) {
@@ -348,7 +316,7 @@ void Service::apply_cluster_state_updates() {
 
                                                 TANK_EXPECT(p);
 						p->cluster.flags |= unsigned(topic_partition::Cluster::Flags::GC_ISR);
-                                                dirty_partitions.insert(p);
+                                                schedule_partition_repair(p);
 						invalidate_replicated_partitions_from_peer_cache_by_partition(p);
                                         }
                                 }
@@ -367,23 +335,88 @@ void Service::apply_cluster_state_updates() {
 
                                 if (auto l = t->partitions_) {
                                         for (auto p : *l) {
-                                                dirty_partitions.insert(p);
+                                                schedule_partition_repair(p);
                                         }
                                 }
                         }
                 }
         }
 
+        if (promoted_to_cluster_leader) {
+                // TODO: do whatever
+        }
+
+        // partitions updates are applied in time slices(see apply_cluster_state_updates()), because
+        // reconciling a partition's state may close its log or bump its hwmark, and there may be thousands of them.
+        // We take them all now so that updates received while we are still applying those are deferred to the next batch
+        for (auto &it : updates.pm) {
+                updates.applying.emplace_back(it.first, std::move(it.second));
+        }
+
+        updates.nodes.clear();
+        updates.pm.clear();
+        updates.tm.clear();
+        updates.a.reuse();
+}
+
+// By consolidating all logic here as opposed to implementing bits and pieces everywhere we have a better chance of
+// doing this right. It also makes it possible to unit-test behavior, whereas that wasn't possible earlier
+//
+// INVARIANTS
+// - ISR set can only contain nodes from the partition's replicas set that are available()
+// - Cannot have any nodes in the ISR that are not also present in the replicas set
+// - A partition's leader must exist in the replicas set
+// - If a partition leader is set, it must also exist in the ISR
+// - A partition's leader must exist in the ISR
+// - Cluster leader must be available()
+// - A partition leader can only be missing or be NA if the partition is no longer active
+//
+// Nodes, cluster leadership and topics updates are applied at once(see begin_cluster_state_updates()), and
+// partitions updates are applied in time slices; whatever is left is applied in subsequent reactor
+// loop iterations(see next_cluster_state_apply_slice)
+void Service::apply_cluster_state_updates() {
+        static constexpr bool     trace{false};
+        static constexpr uint64_t slice_budget{2000}; // us
+        auto &                    updates = cluster_state.updates;
+
+        TANK_EXPECT(cluster_state.local_node.ref);
+        TANK_EXPECT(cluster_state.local_node.id);
+	TANK_EXPECT(consul_state.reg_completed());
+
+        if (updates.applying_next == updates.applying.size()) {
+                if (updates.nodes.empty() && updates.pm.empty() && updates.tm.empty() && !updates.cluster_leader.defined) {
+                        return;
+                }
+
+                begin_cluster_state_updates();
+        }
+
+        const auto                  before                 = Timings::Microseconds::Tick();
+        auto &                      v                      = reusable.part_bool_hashmap;
+        auto &                      pv                     = reusable.pv;
+        auto &                      nodes_replicas_updates = reusable.nodes_replicas_updates;
+        [[maybe_unused]] const auto self                   = cluster_state.local_node.ref;
+        const auto                  leader_self            = cluster_state.leader_self();
+
+	v.clear();
+	pv.clear();
+	nodes_replicas_updates.clear();
+
 	// XXX: order we reconcile partition updates is important
 	// (replicas first, leader second, ISR third)
 	// Notice that we *only* cleanup ISR (see GC_ISR) after we have
 	// applied partitions state because we need to know who the leader is, and we process
 	// leadership state update after process topology updates.
 #pragma mark PARTITIONS
-        for (auto &it : cluster_state.updates.pm) {
-                auto p     = it.first;
-                auto state = it.second.get();
-                bool dirty{false};
+        for (uint32_t n{0}; updates.applying_next < updates.applying.size(); ++n) {
+                if (n && 0 == (n & 63) && Timings::Microseconds::Since(before) >= slice_budget) {
+                        break;
+                }
+
+                auto &it    = updates.applying[updates.applying_next++];
+                auto  p     = it.first;
+                auto  state = it.second.get();
+                bool  dirty{false};
 
 #if 0
                 if (trace && (state->leader.defined || state->replicas.updated || state->isr_update)) {
@@ -488,7 +521,7 @@ void Service::apply_cluster_state_updates() {
 				p->cluster.flags |= unsigned(topic_partition::Cluster::Flags::GC_ISR);
 
                                 p->cluster.replicas.nodes   = new_set;
-                                dirty_partitions.insert(p);
+                                schedule_partition_repair(p);
 
 				invalidate_replicated_partitions_from_peer_cache_by_partition(p);
                         }
@@ -675,12 +708,12 @@ void Service::apply_cluster_state_updates() {
 
                 if (dirty) {
                         TANK_EXPECT(p);
-                        dirty_partitions.insert(p);
+                        schedule_partition_repair(p);
                 }
         }
 
         if (trace) {
-                SLog("dirty_partitions:", dirty_partitions.size(), ", leader_self = ", leader_self, "\n");
+                SLog("pending repairs:", cluster_repairs.queue.size() - cluster_repairs.next, ", leader_self = ", leader_self, "\n");
         }
 
 #pragma mark DEFERRED UPDATES
@@ -769,10 +802,67 @@ void Service::apply_cluster_state_updates() {
         }
 
 
-        // now that we have reconciled consul state updates with inmemory state
-        // we can repair or react to those based on wether this node is the cluster leader or leader for any of the dirty partitions
+
+#pragma mark FINALIZE
+        if (updates.applying_next == updates.applying.size()) {
+                updates.applying.clear();
+                updates.applying_next         = 0;
+                next_cluster_state_apply_slice = std::numeric_limits<uint64_t>::max();
+        } else {
+                // resume ASAP, but only after we get to process I/O
+                next_cluster_state_apply_slice = now_ms;
+        }
+
+        if (trace) {
+                SLog(ansifmt::bold, ansifmt::color_brown, ansifmt::bgcolor_blue, "::END CLUSTER STATE UPDATE SLICE::", ansifmt::reset,
+                     " pending partitions updates: ", updates.applying.size() - updates.applying_next,
+                     ", took ", duration_repr(Timings::Microseconds::Since(before)), "\n");
+        }
+}
+
+void Service::schedule_partition_repair(topic_partition *p) {
+        if (0 == (p->cluster.flags & unsigned(topic_partition::Cluster::Flags::RepairPending))) {
+                p->cluster.flags |= unsigned(topic_partition::Cluster::Flags::RepairPending);
+                cluster_repairs.queue.emplace_back(p);
+                next_cluster_repairs_slice = now_ms;
+        }
+}
+
+// now that we have reconciled consul state updates with inmemory state
+// we can repair or react to those based on wether this node is the cluster leader or leader for any of the dirty partitions
+//
+// Cluster leadership changes and nodes availability changes may dirty thousands of partitions, and repairing
+// a partition may open or close its log, so we only repair as many as we can within a time slice, and the remaining
+// ones in subsequent reactor loop iterations(see next_cluster_repairs_slice), so that we won't stall I/O processing
+void Service::repair_cluster_partitions() {
+        static constexpr bool     trace{false};
+        static constexpr uint64_t slice_budget{2000}; // us
+        auto &                    queue = cluster_repairs.queue;
+
+        if (cluster_repairs.next == queue.size()) {
+                conclude_bootstrap_updates();
+                return;
+        }
+
+        const auto                  before       = Timings::Microseconds::Tick();
+        auto &                      stream_start = reusable.stream_start;
+        auto &                      stream_stop  = reusable.stream_stop;
+        [[maybe_unused]] const auto self         = cluster_state.local_node.ref;
+        const auto                  leader_self  = cluster_state.leader_self();
+
+        stream_start.clear();
+        stream_stop.clear();
+
 #pragma mark DEFERRED REPAIRS
-        for (auto p : dirty_partitions) {
+        for (uint32_t n{0}; cluster_repairs.next < queue.size(); ++n) {
+                if (n && 0 == (n & 63) && Timings::Microseconds::Since(before) >= slice_budget) {
+                        break;
+                }
+
+                auto p = queue[cluster_repairs.next++];
+
+                p->cluster.flags &= ~unsigned(topic_partition::Cluster::Flags::RepairPending);
+
                 auto       part_leader           = p->cluster.leader.node;
                 const auto partition_leader_self = part_leader == self;
                 const auto req_leader            = p->require_leader();
@@ -956,32 +1046,28 @@ void Service::apply_cluster_state_updates() {
                 }
         }
 
-	conclude_bootstrap_updates();
+        if (cluster_repairs.next == queue.size()) {
+                queue.clear();
+                cluster_repairs.next       = 0;
+                next_cluster_repairs_slice = std::numeric_limits<uint64_t>::max();
+
+                conclude_bootstrap_updates();
+        } else {
+                // resume ASAP, but only after we get to process I/O
+                next_cluster_repairs_slice = now_ms;
+        }
 
-#pragma mark FINALIZE
         if (trace) {
                 SLog("cluster_partitions_dirty: ", cluster_partitions_dirty.size(),
                      ", stream_stop: ", stream_stop.size(),
                      ", stream_start:", stream_start.size(),
-                     ", promoted_to_cluster_leader: ", promoted_to_cluster_leader, "\n");
+                     ", pending repairs: ", queue.size() - cluster_repairs.next,
+                     ", took ", duration_repr(Timings::Microseconds::Since(before)), "\n");
         }
 
         if (!stream_start.empty() || !stream_stop.empty()) {
                 replicate_partitions(&stream_start, &stream_stop);
         }
-
-        if (promoted_to_cluster_leader) {
-                // TODO: do whatever
-        }
-
-        cluster_state.updates.nodes.clear();
-        cluster_state.updates.pm.clear();
-        cluster_state.updates.tm.clear();
-	cluster_state.updates.a.reuse();
-
-        if (trace) {
-                SLog(ansifmt::bold, ansifmt::color_brown, ansifmt::bgcolor_blue, "::END CLUSTER STATE UPDATE::", ansifmt::reset, " took ", duration_repr(Timings::Microseconds::Since(before)), "\n");
-        }
 }
 
 void Service::apply_deferred_updates() {
@@ -1006,9 +1092,20 @@ void Service::apply_deferred_updates() {
         expanded.clear();
         promotions.clear();
 
-        // other than applying deferred updates it will also potentially add
-        // partitions into cluster_partitions_dirty
-        apply_cluster_state_updates();
+        if (next_cluster_state_apply == std::numeric_limits<uint64_t>::max() || next_cluster_state_apply_slice <= now_ms) {
+                // only if not postponed, or if partitions updates are still pending
+                apply_cluster_state_updates();
+        }
+
+        if (cluster_state.updates.applying_next != cluster_state.updates.applying.size()) {
+                // we only repair partitions once all partitions updates of this batch have been applied, so that
+                // repairs, and the updates we may generate for them, won't consider partially reconciled state
+                return;
+        }
+
+        // other than repairing partitions dirtied by cluster state updates, it will also
+        // potentially add partitions into cluster_partitions_dirty
+        repair_cluster_partitions();
 
         if (const auto n = cluster_partitions_dirty.size()) {
                 gen_partition_nodes_updates(cluster_partitions_dirty.data(), n, &reduced, &expanded, &promotions);
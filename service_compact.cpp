@@ -1,4 +1,5 @@
 #include "service_common.h"
+#include "bundle_columnar.h"
 
 int Rename(const char *oldpath, const char *newpath) {
         static constexpr bool trace{false};
@@ -129,22 +130,46 @@ static void compact_partition(topic_partition_log *const log, const char *const
 
                 msgSeqNum = baseSeqNum;
                 for (const auto *p = static_cast<const uint8_t *>(fileData), *const e = p + fileSize; p < e;) {
-                        const auto     bundleLen          = Compression::decode_varuint32(p);
-                        const auto     nextBundle         = p + bundleLen;
-                        const auto     bundleFlags        = *p++; // header flags
-                        const auto     codec              = bundleFlags & 3;
-                        const bool     sparseBundleBitSet = bundleFlags & (1u << 6);
-                        const uint32_t msgsSetSize        = ((bundleFlags >> 2) & 0xf) ?: Compression::decode_varuint32(p);
+                        uint32_t bundleLen, msgsSetSize;
+
+                        if (!Compression::decode_varuint32(p, e, &bundleLen) || !bundleLen || bundleLen > e - p) {
+                                throw Switch::data_error("malformed bundle");
+                        }
+
+                        const auto nextBundle         = p + bundleLen;
+                        const auto bundleFlags        = *p++; // header flags
+                        const auto codec              = bundleFlags & 3;
+                        const bool sparseBundleBitSet = bundleFlags & (1u << 6);
+                        const auto extraFlags         = (bundleFlags & (1u << 7)) && p != nextBundle ? *p : uint8_t(0);
+
+                        if (!TANKUtil::skip_bundle_extra_hdr(bundleFlags, p, nextBundle)) {
+                                throw Switch::data_error("malformed bundle header");
+                        }
+
+                        msgsSetSize = (bundleFlags >> 2) & 0xf;
+                        if (!msgsSetSize && !Compression::decode_varuint32(p, nextBundle, &msgsSetSize)) {
+                                throw Switch::data_error("malformed bundle header");
+                        }
 
                         if (trace_msgs) {
                                 SLog("New bundle msgSetSize = ", msgsSetSize, ", bundleFlags = ", bundleFlags, ", codec = ", codec, "\n");
                         }
 
                         if (sparseBundleBitSet) {
+                                if (p + sizeof(uint64_t) > nextBundle) {
+                                        throw Switch::data_error("malformed bundle header");
+                                }
+
                                 firstMsgSeqNum = decode_pod<uint64_t>(p);
 
                                 if (msgsSetSize != 1) {
-                                        lastMsgSeqNum = firstMsgSeqNum + Compression::decode_varuint32(p) + 1;
+                                        uint32_t delta;
+
+                                        if (!Compression::decode_varuint32(p, nextBundle, &delta)) {
+                                                throw Switch::data_error("malformed bundle header");
+                                        }
+
+                                        lastMsgSeqNum = firstMsgSeqNum + delta + 1;
                                 } else {
                                         lastMsgSeqNum = firstMsgSeqNum;
                                 }
@@ -211,6 +236,41 @@ static void compact_partition(topic_partition_log *const log, const char *const
                                 SLog("Parsing Message Set(codec = ", codec, ") of size ", size_repr(msgSetContent.size()), "\n");
                         }
 
+                        if (extraFlags & uint8_t(TankFlags::BundleExtraFlags::Columnar)) {
+                                // rewritten using the row encoding, like all other bundles
+                                static thread_local TANKUtil::columnar::msgset_reader columnar_tls;
+                                auto &                                                columnar_reader{columnar_tls};
+                                uint32_t                                              seqNumDelta;
+
+                                if (!columnar_reader.reset(msgSetContent.offset, msgSetContent.offset + msgSetContent.size(), msgsSetSize, sparseBundleBitSet)) {
+                                        throw Switch::data_error("malformed columnar message set");
+                                }
+
+                                for (; columnar_reader.next(&msgTs, &key, &msgValue, &seqNumDelta); ++msgIdx, ++msgSeqNum) {
+                                        if (sparseBundleBitSet) {
+                                                msgSeqNum = msgIdx ? msgSeqNum + seqNumDelta : firstMsgSeqNum;
+                                        }
+
+                                        if (msgValue.empty() && !key) {
+                                                anyDropped = true;
+                                                continue;
+                                        }
+
+                                        if (codec) {
+                                                if (key) {
+                                                        key.p = reinterpret_cast<const char *>(static_cast<uintptr_t>(std::distance(ptrBase, key.data())) | ptrBit);
+                                                }
+                                                msgValue.p = reinterpret_cast<const char *>(static_cast<uintptr_t>(std::distance(ptrBase, msgValue.data())) | ptrBit);
+                                        }
+
+                                        msgs.push_back({key,
+                                                        msgSeqNum,
+                                                        msgTs,
+                                                        msgValue});
+                                }
+                                continue;
+                        }
+
                         for (const auto *p = msgSetContent.offset, *const e = p + msgSetContent.size(); p < e; ++msgIdx, ++msgSeqNum) {
                                 const auto flags = decode_pod<uint8_t>(p);
 
@@ -230,7 +290,13 @@ static void compact_partition(topic_partition_log *const log, const char *const
                                                 }
                                         } else {
                                                 // we encode delta from last - 1, but we already ++msgSeqNum in for() (in previous iteration)
-                                                msgSeqNum += Compression::decode_varuint32(p);
+                                                uint32_t delta;
+
+                                                if (!Compression::decode_varuint32(p, e, &delta)) {
+                                                        throw Switch::data_error("malformed message");
+                                                }
+
+                                                msgSeqNum += delta;
 
                                                 if (trace_msgs) {
                                                         SLog("Adjusting delta\n");
@@ -243,10 +309,18 @@ static void compact_partition(topic_partition_log *const log, const char *const
                                 }
 
                                 if (0 == (flags & uint8_t(TankFlags::BundleMsgFlags::UseLastSpecifiedTS))) {
+                                        if (p + sizeof(uint64_t) > e) {
+                                                throw Switch::data_error("malformed message");
+                                        }
+
                                         msgTs = decode_pod<uint64_t>(p);
                                 }
 
                                 if (flags & uint8_t(TankFlags::BundleMsgFlags::HaveKey)) {
+                                        if (p >= e || p + *p + sizeof(uint8_t) > e) {
+                                                throw Switch::data_error("malformed message");
+                                        }
+
                                         key.set(reinterpret_cast<const char *>(p) + 1, *p);
                                         p += key.size() + sizeof(uint8_t);
 
@@ -261,7 +335,11 @@ static void compact_partition(topic_partition_log *const log, const char *const
                                         key.reset();
                                 }
 
-                                const auto msgLen = Compression::decode_varuint32(p);
+                                uint32_t msgLen;
+
+                                if (!Compression::decode_varuint32(p, e, &msgLen) || msgLen > e - p) {
+                                        throw Switch::data_error("malformed message");
+                                }
 
                                 if (msgLen || key) {
                                         msgValue.set(reinterpret_cast<const char *>(p), msgLen);
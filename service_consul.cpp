@@ -97,8 +97,11 @@ bool Service::register_with_cluster() {
         cluster_state.updates.cluster_leader.defined = false;
         cluster_state.updates.nodes.clear();
         cluster_state.updates.pm.clear();
-        cluster_state.updates.pm.clear();
+        cluster_state.updates.tm.clear();
+        cluster_state.updates.applying.clear();
+        cluster_state.updates.applying_next = 0;
         cluster_state.updates.a.reuse();
+        next_cluster_state_apply_slice      = std::numeric_limits<uint64_t>::max();
 
         // important: need to be in all_available_nodes
         cluster_state.all_available_nodes.emplace_back(n);
@@ -0,0 +1,531 @@
+#include "service_common.h"
+
+// Consumer groups
+//
+// Committed offsets are stored in an internal compacted topic, consumer_groups_topic_name, so that
+// they survive restarts, but they are otherwise served from consumer_groups.groups[] without ever touching the disk.
+// Each committed offset is a message keyed by "<group>/<topic>/<partition>", and its content is the committed sequence number (u64).
+// Because the topic is compacted, only the last commit for each key will eventually be retained.
+//
+// Commits accepted during a reactor loop iteration are collected in consumer_groups.pending_commits
+// and are all appended as a single bundle in flush_consumer_groups_commits() at the beginning of the next iteration
+// (see Service::begin_reactor_loop_iteration()). We only respond to the clients once that bundle has been appended.
+//
+// Members join (and heartbeat by re-joining) a group, and partitions of the topics they are subscribed to are
+// assigned to them by the broker, in ranges, based on the sorted members IDs. Whenever the membership changes, the group generation is bumped
+// and members are expected to re-join in order to get their new assignment. Members that haven't re-joined within their
+// session timeout are evicted the next time the group is considered.
+//
+// This is currently only supported in standalone mode.
+static const str_view8 consumer_groups_topic_name("__consumer_offsets"_s8);
+
+consumer_group *Service::consumer_group_by_name(const str_view8 name, const bool create) {
+        std::string n(name.data(), name.size());
+        auto        it = consumer_groups.groups.find(n);
+
+        if (it != consumer_groups.groups.end()) {
+                return it->second.get();
+        } else if (!create) {
+                return nullptr;
+        }
+
+        auto g = std::make_unique<consumer_group>();
+
+        g->name = n;
+        return consumer_groups.groups.emplace(std::move(n), std::move(g)).first->second.get();
+}
+
+topic_partition *Service::consumer_groups_offsets_partition(const bool create) {
+        static constexpr bool trace{false};
+        auto                  t = topic_by_name(consumer_groups_topic_name);
+
+        if (!t && create) {
+                static const str_view32 config("log.cleanup.policy=cleanup\n"_s32);
+                partition_config        partitionConfig;
+
+                parse_partition_config(config, &partitionConfig);
+
+                if (trace) {
+                        SLog("Creating ", consumer_groups_topic_name, "\n");
+                }
+
+                if (create_local_topic(consumer_groups_topic_name, 1, partitionConfig, config)) {
+                        Print(ansifmt::color_red, "Failed to create ", consumer_groups_topic_name, ansifmt::reset, "\n");
+                        return nullptr;
+                }
+
+                t = topic_by_name(consumer_groups_topic_name);
+        }
+
+        return t ? t->partition(0) : nullptr;
+}
+
+// rebuilds the in-memory offsets table from the internal topic on startup
+void Service::load_consumer_groups() {
+        auto partition = consumer_groups_offsets_partition(false);
+
+        if (!partition) {
+                return;
+        }
+
+        const auto                                    before = Timings::Microseconds::Tick();
+        size_t                                        n{0};
+        std::function<bool(topic_partition::msg &)> l = [&](auto &m) {
+                const auto key = m.key;
+
+                if (m.data.size() != sizeof(uint64_t)) {
+                        return true;
+                }
+
+                const auto p1 = key.Search('/');
+
+                if (!p1) {
+                        return true;
+                }
+
+                const str_view8 group(key.data(), p1 - key.data());
+                str_view8       rest(p1 + 1, key.End() - (p1 + 1));
+                const auto      p2 = rest.SearchR('/');
+
+                if (!p2 || !group) {
+                        return true;
+                }
+
+                const str_view8 topic(rest.data(), p2 - rest.data());
+                const str_view8 partition(p2 + 1, rest.End() - (p2 + 1));
+
+                if (!topic || !partition.IsDigits()) {
+                        return true;
+                }
+
+                const auto *content = reinterpret_cast<const uint8_t *>(m.data.data());
+
+                consumer_group_by_name(group, true)->set_committed(std::string(topic.data(), topic.size()),
+                                                                   partition.AsUint32(),
+                                                                   decode_pod<uint64_t>(content));
+                ++n;
+                return true;
+        };
+
+        try {
+                partition_log(partition);
+                partition->foreach_msg(l);
+        } catch (const std::exception &e) {
+                Print(ansifmt::color_red, "Failed to load consumer groups offsets:", e.what(), ansifmt::reset, "\n");
+                return;
+        }
+
+        Print("> Loaded ", dotnotation_repr(n), " consumer groups offsets(", dotnotation_repr(consumer_groups.groups.size()), " groups) in ",
+              duration_repr(Timings::Microseconds::Since(before)), "\n");
+}
+
+// all consumer group API responses begin with {request id:u32, error:u8}
+IOBuffer *Service::build_consumer_group_resp(const TankAPIMsgType msg, const uint32_t req_id, const uint8_t err) {
+        auto resp = get_buf();
+
+        resp->pack(static_cast<uint8_t>(msg));
+        resp->RoomFor(sizeof(uint32_t));
+        resp->pack(req_id, err);
+        return resp;
+}
+
+bool Service::tx_consumer_group_resp(connection *const c, IOBuffer *const resp) {
+        *reinterpret_cast<uint32_t *>(resp->At(sizeof(uint8_t))) = resp->size() - sizeof(uint8_t) - sizeof(uint32_t);
+
+        auto payload = get_data_vector_payload();
+        auto q       = c->outQ ?: (c->outQ = get_outgoing_queue());
+
+        q->push_back(payload);
+
+        payload->buf     = resp;
+        payload->iov_cnt = 1;
+        payload->iov[0]  = {static_cast<void *>(resp->data()), resp->size()};
+
+        return try_tx(c);
+}
+
+void Service::flush_consumer_groups_commits() {
+        static constexpr bool trace{false};
+        auto &                pending = consumer_groups.pending_commits;
+
+        if (pending.empty()) {
+                return;
+        }
+
+        const uint32_t n = pending.size();
+        uint8_t        err{0};
+        auto           partition = consumer_groups_offsets_partition(true);
+
+        if (trace) {
+                SLog("Flushing ", n, " commits for ", consumer_groups.pending_acks.size(), " requests\n");
+        }
+
+        if (!partition) {
+                err = 2;
+        } else {
+                topic_partition_log *log;
+
+                try {
+                        log = partition_log(partition);
+                } catch (...) {
+                        log = nullptr;
+                }
+
+                if (!log) {
+                        err = 2;
+                } else {
+                        auto       b  = get_buf();
+                        const auto ts = Timings::Milliseconds::SysTime();
+                        char       key[256];
+
+                        if (n < 16) {
+                                b->pack(static_cast<uint8_t>(n << 2));
+                        } else {
+                                b->pack(static_cast<uint8_t>(0));
+                                b->encode_varuint32(n);
+                        }
+
+                        for (uint32_t i{0}; i < n; ++i) {
+                                const auto &it   = pending[i];
+                                const auto  klen = Snprint(key, sizeof(key), it.group->name, "/", it.topic, "/", it.partition);
+                                uint8_t     flags{uint8_t(TankFlags::BundleMsgFlags::HaveKey)};
+
+                                if (i) {
+                                        flags |= uint8_t(TankFlags::BundleMsgFlags::UseLastSpecifiedTS);
+                                }
+
+                                b->pack(flags);
+                                if (!i) {
+                                        b->pack(ts);
+                                }
+
+                                b->pack(str_view8(key, klen));
+                                b->encode_varuint32(sizeof(uint64_t));
+                                b->pack(it.seq_num);
+                        }
+
+                        auto res = log->append_bundle(curTime, b->data(), b->size(), n, 0, 0);
+
+                        put_buf(b);
+
+                        if (!res.fdh) {
+                                err = 2;
+                        } else {
+                                // we could have consumers of the internal topic
+                                set_hwmark(partition, res.msgSeqNumRange.offset + res.msgSeqNumRange.size() - 1);
+
+                                now_awake.clear();
+                                consider_append_res(partition, res, &now_awake);
+                                for (auto ctx : now_awake) {
+                                        wakeup_wait_ctx(ctx, nullptr);
+                                }
+                                now_awake.clear();
+
+                                for (const auto &it : pending) {
+                                        it.group->set_committed(it.topic, it.partition, it.seq_num);
+                                }
+                        }
+                }
+        }
+
+        for (auto &it : consumer_groups.pending_acks) {
+                if (auto c = it.first.get()) {
+                        tx_consumer_group_resp(c, build_consumer_group_resp(TankAPIMsgType::CommitOffsets, it.second, err));
+                }
+        }
+
+        pending.clear();
+        consumer_groups.pending_acks.clear();
+}
+
+// evicts expired members; returns true if the membership changed
+static bool evict_expired_members(consumer_group *g, const uint64_t now_ms) {
+        const auto n = g->members.size();
+
+        g->members.erase(std::remove_if(g->members.begin(), g->members.end(), [now_ms](const auto &m) noexcept {
+                                 return m.expiration <= now_ms;
+                         }),
+                         g->members.end());
+
+        return g->members.size() != n;
+}
+
+bool Service::process_join_group(connection *const c, const uint8_t *p, const size_t len) {
+        static constexpr bool trace{false};
+        const auto *const     e = p + len;
+
+        if (unlikely(len < sizeof(uint32_t) + sizeof(uint8_t) + sizeof(uint8_t) + sizeof(uint32_t) + sizeof(uint8_t))) {
+                return shutdown(c, __LINE__);
+        }
+
+        const auto      req_id = decode_pod<uint32_t>(p);
+        const str_view8 group_name(reinterpret_cast<const char *>(p) + 1, *p);
+
+        p += group_name.size() + sizeof(uint8_t);
+        if (unlikely(p + sizeof(uint8_t) > e)) {
+                return shutdown(c, __LINE__);
+        }
+
+        const str_view8 member_id(reinterpret_cast<const char *>(p) + 1, *p);
+
+        p += member_id.size() + sizeof(uint8_t);
+        if (unlikely(p + sizeof(uint32_t) + sizeof(uint8_t) > e)) {
+                return shutdown(c, __LINE__);
+        }
+
+        const auto               session_timeout = decode_pod<uint32_t>(p);
+        const auto               topics_cnt      = decode_pod<uint8_t>(p);
+        std::vector<std::string> topics;
+
+        for (uint32_t i{0}; i < topics_cnt; ++i) {
+                if (unlikely(p >= e || p + *p + sizeof(uint8_t) > e)) {
+                        return shutdown(c, __LINE__);
+                }
+
+                topics.emplace_back(reinterpret_cast<const char *>(p) + 1, *p);
+                p += topics.back().size() + sizeof(uint8_t);
+        }
+
+        std::sort(topics.begin(), topics.end());
+        topics.erase(std::unique(topics.begin(), topics.end()), topics.end());
+
+        if (trace) {
+                SLog("JoinGroup [", group_name, "] member [", member_id, "], session_timeout = ", session_timeout, ", ", topics.size(), " topics\n");
+        }
+
+        if (cluster_aware()) {
+                return tx_consumer_group_resp(c, build_consumer_group_resp(TankAPIMsgType::JoinGroup, req_id, 12));
+        } else if (!is_valid_topic_name(group_name) || !member_id) {
+                return tx_consumer_group_resp(c, build_consumer_group_resp(TankAPIMsgType::JoinGroup, req_id, 10));
+        }
+
+        auto              g = consumer_group_by_name(group_name, true);
+        const std::string id(member_id.data(), member_id.size());
+        auto              it = std::lower_bound(g->members.begin(), g->members.end(), id, [](const auto &m, const auto &id) noexcept {
+                return m.id < id;
+        });
+        const bool        present = it != g->members.end() && it->id == id;
+
+        if (session_timeout == 0) {
+                // leaving the group
+                if (present) {
+                        g->members.erase(it);
+                        ++g->generation;
+                }
+        } else if (!present) {
+                g->members.insert(it, consumer_group::member{
+                                          .id         = id,
+                                          .topics     = std::move(topics),
+                                          .expiration = now_ms + session_timeout});
+                ++g->generation;
+        } else {
+                if (it->topics != topics) {
+                        it->topics = std::move(topics);
+                        ++g->generation;
+                }
+
+                it->expiration = now_ms + session_timeout;
+        }
+
+        if (evict_expired_members(g, now_ms)) {
+                ++g->generation;
+        }
+
+        auto resp = build_consumer_group_resp(TankAPIMsgType::JoinGroup, req_id, 0);
+
+        resp->pack(g->generation, static_cast<uint16_t>(g->members.size()));
+
+        const auto self = std::find_if(g->members.begin(), g->members.end(), [&id](const auto &m) noexcept {
+                return m.id == id;
+        });
+
+        if (self == g->members.end()) {
+                resp->pack(static_cast<uint8_t>(0));
+                return tx_consumer_group_resp(c, resp);
+        }
+
+        const auto topics_cnt_offset = resp->size();
+        uint8_t    assigned_topics{0};
+
+        resp->pack(static_cast<uint8_t>(0));
+        for (const auto &topic_name : self->topics) {
+                // range assignment over the sorted members subscribed to that topic
+                const auto t = topic_by_name(str_view8(topic_name.data(), topic_name.size()));
+
+                if (!t || !t->partitions_ || t->partitions_->empty()) {
+                        continue;
+                }
+
+                uint32_t subscribers{0}, index{0};
+
+                for (const auto &m : g->members) {
+                        if (std::binary_search(m.topics.begin(), m.topics.end(), topic_name)) {
+                                if (&m == &*self) {
+                                        index = subscribers;
+                                }
+                                ++subscribers;
+                        }
+                }
+
+                const uint32_t partitions_cnt = t->partitions_->size();
+                const auto     span           = partitions_cnt / subscribers;
+                const auto     extra          = partitions_cnt % subscribers;
+                const auto     first          = index * span + std::min(index, extra);
+                const auto     cnt            = span + (index < extra);
+
+                if (!cnt) {
+                        continue;
+                }
+
+                resp->pack(str_view8(topic_name.data(), topic_name.size()), static_cast<uint16_t>(cnt));
+                for (uint32_t i{0}; i < cnt; ++i) {
+                        resp->pack(static_cast<uint16_t>(first + i));
+                }
+
+                ++assigned_topics;
+        }
+
+        *reinterpret_cast<uint8_t *>(resp->At(topics_cnt_offset)) = assigned_topics;
+        return tx_consumer_group_resp(c, resp);
+}
+
+bool Service::process_commit_offsets(connection *const c, const uint8_t *p, const size_t len) {
+        static constexpr bool trace{false};
+        const auto *const     e = p + len;
+
+        if (unlikely(len < sizeof(uint32_t) + sizeof(uint8_t) + sizeof(uint64_t) + sizeof(uint8_t))) {
+                return shutdown(c, __LINE__);
+        }
+
+        const auto      req_id = decode_pod<uint32_t>(p);
+        const str_view8 group_name(reinterpret_cast<const char *>(p) + 1, *p);
+
+        p += group_name.size() + sizeof(uint8_t);
+        if (unlikely(p + sizeof(uint64_t) + sizeof(uint8_t) > e)) {
+                return shutdown(c, __LINE__);
+        }
+
+        const auto generation = decode_pod<uint64_t>(p);
+        const auto topics_cnt = decode_pod<uint8_t>(p);
+        const auto base       = consumer_groups.pending_commits.size();
+        auto       g          = !cluster_aware() && !read_only && is_valid_topic_name(group_name)
+                           ? consumer_group_by_name(group_name, true)
+                           : nullptr;
+        bool       valid{true};
+
+        for (uint32_t i{0}; i < topics_cnt; ++i) {
+                if (unlikely(p >= e || p + *p + sizeof(uint8_t) + sizeof(uint16_t) > e)) {
+                        consumer_groups.pending_commits.resize(base);
+                        return shutdown(c, __LINE__);
+                }
+
+                const str_view8 topic_name(reinterpret_cast<const char *>(p) + 1, *p);
+
+                p += topic_name.size() + sizeof(uint8_t);
+
+                const auto partitions_cnt = decode_pod<uint16_t>(p);
+
+                if (unlikely(p + partitions_cnt * (sizeof(uint16_t) + sizeof(uint64_t)) > e)) {
+                        consumer_groups.pending_commits.resize(base);
+                        return shutdown(c, __LINE__);
+                }
+
+                if (!is_valid_topic_name(topic_name)) {
+                        valid = false;
+                }
+
+                for (uint32_t k{0}; k < partitions_cnt; ++k) {
+                        const auto partition = decode_pod<uint16_t>(p);
+                        const auto seq_num   = decode_pod<uint64_t>(p);
+
+                        if (g && valid) {
+                                consumer_groups.pending_commits.emplace_back(consumer_group::pending_commit{
+                                    .group     = g,
+                                    .topic     = std::string(topic_name.data(), topic_name.size()),
+                                    .partition = partition,
+                                    .seq_num   = seq_num});
+                        }
+                }
+        }
+
+        if (trace) {
+                SLog("CommitOffsets [", group_name, "] generation ", generation, ", ", consumer_groups.pending_commits.size() - base, " offsets\n");
+        }
+
+        uint8_t err;
+
+        if (cluster_aware()) {
+                err = 12;
+        } else if (read_only) {
+                err = 5;
+        } else if (!g || !valid) {
+                err = 10;
+        } else if (generation && generation != g->generation) {
+                // a rebalance took place; the member no longer owns those partitions
+                err = 13;
+        } else {
+                if (consumer_groups.pending_commits.size() != base) {
+                        // will respond once they have been appended; see flush_consumer_groups_commits()
+                        consumer_groups.pending_acks.emplace_back();
+                        consumer_groups.pending_acks.back().first.set(c);
+                        consumer_groups.pending_acks.back().second = req_id;
+                        return true;
+                }
+
+                err = 0;
+        }
+
+        consumer_groups.pending_commits.resize(base);
+        return tx_consumer_group_resp(c, build_consumer_group_resp(TankAPIMsgType::CommitOffsets, req_id, err));
+}
+
+bool Service::process_fetch_offsets(connection *const c, const uint8_t *p, const size_t len) {
+        const auto *const e = p + len;
+
+        if (unlikely(len < sizeof(uint32_t) + sizeof(uint8_t) + sizeof(uint8_t))) {
+                return shutdown(c, __LINE__);
+        }
+
+        const auto      req_id = decode_pod<uint32_t>(p);
+        const str_view8 group_name(reinterpret_cast<const char *>(p) + 1, *p);
+
+        p += group_name.size() + sizeof(uint8_t);
+        if (unlikely(p + sizeof(uint8_t) > e)) {
+                return shutdown(c, __LINE__);
+        }
+
+        if (cluster_aware()) {
+                return tx_consumer_group_resp(c, build_consumer_group_resp(TankAPIMsgType::FetchOffsets, req_id, 12));
+        }
+
+        // served from memory; a group we know nothing about has no committed offsets
+        const auto  topics_cnt = decode_pod<uint8_t>(p);
+        const auto  g          = consumer_group_by_name(group_name, false);
+        auto        resp       = build_consumer_group_resp(TankAPIMsgType::FetchOffsets, req_id, 0);
+        std::string topic;
+
+        for (uint32_t i{0}; i < topics_cnt; ++i) {
+                if (unlikely(p >= e || p + *p + sizeof(uint8_t) + sizeof(uint16_t) > e)) {
+                        put_buf(resp);
+                        return shutdown(c, __LINE__);
+                }
+
+                topic.assign(reinterpret_cast<const char *>(p) + 1, *p);
+                p += topic.size() + sizeof(uint8_t);
+
+                const auto partitions_cnt = decode_pod<uint16_t>(p);
+
+                if (unlikely(p + partitions_cnt * sizeof(uint16_t) > e)) {
+                        put_buf(resp);
+                        return shutdown(c, __LINE__);
+                }
+
+                for (uint32_t k{0}; k < partitions_cnt; ++k) {
+                        const auto partition = decode_pod<uint16_t>(p);
+
+                        resp->pack(g ? g->committed(topic, partition) : std::numeric_limits<uint64_t>::max());
+                }
+        }
+
+        return tx_consumer_group_resp(c, resp);
+}
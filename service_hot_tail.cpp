@@ -0,0 +1,110 @@
+#include "service_common.h"
+
+// See topic_partition_log::hot_tail
+//
+// Invoked by append_bundle() once the bundle(iov) has been appended to the current segment at cur.fileSize
+void topic_partition_log::hot_tail_append(const uint64_t seqnum, const struct iovec *const iov, const uint32_t entry_len) {
+        const auto capacity = std::min<size_t>(config.hotTailSize, hot_tail_chunk::max_capacity);
+        auto &     ht       = hot_tail;
+
+        if (!capacity) {
+                return;
+        } else if (unlikely(entry_len > capacity)) {
+                // we 'd need to split it across chunks; start over with the next bundle
+                ht.clear();
+                return;
+        }
+
+        if (ht.fdh.get() != cur.fdh.get() || ht.end != cur.fileSize) {
+                // rolled, or first bundle appended since we opened the partition
+                ht.clear();
+                ht.fdh   = cur.fdh;
+                ht.start = ht.end = cur.fileSize;
+        }
+
+        auto chunk = ht.chunks.empty() ? nullptr : ht.chunks.back().get();
+
+        if (!chunk || chunk->size + entry_len > chunk->capacity) {
+                chunk = new hot_tail_chunk(ht.end, capacity);
+                ht.chunks.emplace_back(chunk, true);
+        }
+
+        ht.bundles.emplace_back(hot_tail_bundle{
+            .seqnum = seqnum,
+            .offset = ht.end,
+            .sparse = static_cast<bool>(*static_cast<const uint8_t *>(iov[1].iov_base) & (1u << 6))});
+
+        memcpy(chunk->data + chunk->size, iov[0].iov_base, iov[0].iov_len);
+        memcpy(chunk->data + chunk->size + iov[0].iov_len, iov[1].iov_base, iov[1].iov_len);
+        chunk->size += entry_len;
+        ht.end += entry_len;
+
+        while (ht.end - ht.start > config.hotTailSize && ht.chunks.size() > 1) {
+                ht.chunks.pop_front();
+                ht.start = ht.chunks.front()->base;
+
+                while (ht.bundles.front().offset < ht.start) {
+                        ht.bundles.pop_front();
+                }
+        }
+}
+
+// Invoked by read_cur(); if abs_seqnum is in the hot tail, determines the file range to stream by consulting
+// the hot tail bundles instead of the skiplists and the segment log
+//
+// Returns false if it's not, or if the first bundle is larger than max_size, in which case we 'll just let read_cur() deal with it
+bool topic_partition_log::hot_tail_range(const uint64_t abs_seqnum, const uint32_t max_size, const uint64_t max_abs_seq_num, lookup_res *const res) {
+        const auto &ht = hot_tail;
+
+        if (ht.bundles.empty() ||
+            ht.fdh.get() != cur.fdh.get() ||
+            ht.end != cur.fileSize ||
+            abs_seqnum < ht.bundles.front().seqnum) {
+                return false;
+        }
+
+        // the bundle that includes abs_seqnum
+        const auto first = std::prev(std::upper_bound(ht.bundles.begin(), ht.bundles.end(), abs_seqnum, [](const uint64_t s, const hot_tail_bundle &b) noexcept {
+                return s < b.seqnum;
+        }));
+        const uint64_t limit = uint64_t(first->offset) + max_size;
+
+        res->fdh                    = cur.fdh;
+        res->absBaseSeqNum          = first->seqnum;
+        res->fileOffset             = first->offset;
+        res->first_bundle_is_sparse = first->sparse;
+
+        if (max_abs_seq_num >= lastAssignedSeqNum && cur.fileSize <= limit) {
+                res->fileOffsetCeiling = cur.fileSize;
+                return true;
+        }
+
+        // bundles that follow the first bundle, and all bundles that precede them are not past (limit, max_abs_seq_num)
+        const auto end = std::partition_point(std::next(first), ht.bundles.end(), [limit, max_abs_seq_num](const hot_tail_bundle &b) noexcept {
+                return b.offset <= limit && b.seqnum - 1 <= max_abs_seq_num;
+        });
+
+        if (end == std::next(first)) {
+                return false;
+        }
+
+        res->fileOffsetCeiling = std::prev(end)->offset;
+        return true;
+}
+
+// Returns the hot tail chunk that holds the content in range of the segment fdh, if any
+hot_tail_chunk *topic_partition_log::hot_tail_chunk_for(const fd_handle *const fdh, const range32_t range) const noexcept {
+        const auto &ht = hot_tail;
+
+        if (ht.fdh.get() != fdh || range.offset < ht.start || range.stop() > ht.end) {
+                return nullptr;
+        }
+
+        // chunks base offsets are monotonically increasing
+        const auto it = std::upper_bound(ht.chunks.begin(), ht.chunks.end(), range.offset, [](const uint32_t o, const auto &c) noexcept {
+                return o < c->base;
+        });
+        const auto chunk = std::prev(it)->get();
+
+        return range.stop() <= chunk->base + chunk->size ? chunk : nullptr;
+}
@@ -109,3 +109,20 @@ void Service::update_hwmark(topic_partition *p, const uint64_t hwmark) {
 
         consider_highwatermark_update(p, hwmark);
 }
+
+// Invoked by process_peer_consume_resp() with the highwater mark the partition leader piggybacked on its response
+//
+// Followers that are in the ISR serve client CONSUME requests up to the highwater mark they know about(see process_consume()),
+// so that consumers can be spread across the replica set. We don't track the file offset of the highwater mark here, and
+// consider_append_res() is not invoked for replicated content, so wait contexts will use read_from_local() once woken up.
+void Service::update_follower_hwmark(topic_partition *p, const uint64_t leader_hwmark) {
+        TANK_EXPECT(p);
+        const auto known = std::min(leader_hwmark, partition_log(p)->lastAssignedSeqNum);
+
+        if (!known || known <= p->hwmark()) {
+                return;
+        }
+
+        set_hwmark(p, known, nullptr, 0);
+        consider_highwatermark_update(p, known);
+}
@@ -1,5 +1,68 @@
 #include "service_common.h"
 
+// Mutable segments are preallocated(see process_segment_op()), so their file size is not their logical size.
+// The preallocated region reads as zeros, and a bundle is never 0 bytes long, so the segment ends at
+// the first bundle whose length is 0. from is the offset of a bundle, e.g the last one recorded in the segment index.
+//
+// A bundle that was partially written before a crash may be followed by zeros too; we can only tell for bundles that carry a CRC32C,
+// and in that case the segment ends where that bundle begins. append_bundle() releases the preallocated region before it appends a
+// bundle without one, so such a bundle would extend past the end of the file instead.
+uint32_t Service::segment_logical_size(int log_fd, const uint32_t from) {
+        const auto file_size = lseek64(log_fd, 0, SEEK_END);
+
+        if (file_size <= from) {
+                return file_size;
+        }
+
+        // unwritten extents are reported as holes, so we won't need to read the preallocated region
+        const auto hole     = lseek64(log_fd, from, SEEK_HOLE);
+        const auto end      = hole >= from ? std::min(hole, file_size) : file_size;
+        const auto vma_dtor = [end](void *ptr) noexcept {
+                if (ptr && ptr != MAP_FAILED) {
+                        munmap(ptr, end);
+                }
+        };
+
+        if (end == from) {
+                return from;
+        }
+
+        std::unique_ptr<void, decltype(vma_dtor)> vma(mmap(nullptr, end, PROT_READ, MAP_SHARED, log_fd, 0), vma_dtor);
+
+        if (vma.get() == MAP_FAILED) {
+                throw Switch::system_error("mmap() failed:", strerror(errno));
+        }
+
+        const auto *const base = static_cast<const uint8_t *>(vma.get()), *const e = base + end;
+        const auto *      p    = base + from;
+
+        madvise(vma.get(), end, MADV_SEQUENTIAL | MADV_DONTDUMP);
+        while (p < e) {
+                const auto *const bundle = p;
+                uint32_t          bundle_len;
+
+                if (!Compression::decode_varuint32(p, e, &bundle_len) || !bundle_len) {
+                        p = bundle;
+                        break;
+                }
+
+                const auto bundle_end = p + bundle_len;
+
+                if (bundle_end > e) {
+                        // if the segment was not preallocated, the caller will deal with it
+                        return end < file_size ? bundle - base : file_size;
+                } else if ((bundle_end == e || *bundle_end == 0) && !TANKUtil::verify_bundle_crc32c(p, bundle_end)) {
+                        // last bundle; partially written
+                        p = bundle;
+                        break;
+                }
+
+                p = bundle_end;
+        }
+
+        return p - base;
+}
+
 // return the absolute sequence number of the last message in the segment
 uint64_t Service::segment_lastmsg_seqnum(int log_fd, const uint64_t base_seqnum) {
         const auto file_size = lseek(log_fd, 0, SEEK_END);
@@ -19,10 +82,17 @@ uint64_t Service::segment_lastmsg_seqnum(int log_fd, const uint64_t base_seqnum)
         madvise(file_data, file_size, MADV_SEQUENTIAL | MADV_DONTDUMP);
 
         for (const auto *p = static_cast<const uint8_t *>(file_data), *const e = p + file_size; p < e;) {
-                const auto     bundle_size      = Compression::decode_varuint32(p);
+                const auto bundle_size = Compression::decode_varuint32(p);
+
+                if (!bundle_size) {
+                        // preallocated; see segment_logical_size()
+                        break;
+                }
+
                 const auto     next_bundle      = p + bundle_size;
                 const auto     bundle_hdr_flags = decode_pod<uint8_t>(p);
                 const bool     sparse_bundle    = bundle_hdr_flags & (1u << 6);
+                [[maybe_unused]] const auto extra_flags = TANKUtil::skip_bundle_extra_hdr(bundle_hdr_flags, p);
                 const uint32_t msgset_size      = ((bundle_hdr_flags >> 2) & 0xf) ?: Compression::decode_varuint32(p);
 
                 if (sparse_bundle) {
@@ -73,6 +143,11 @@ void Service::rebuild_index(int logFd, int indexFd, const uint64_t base_seqnum)
                 const auto bundleLen   = Compression::decode_varuint32(p);
                 const auto next_bundle = p + bundleLen;
 
+                if (!bundleLen) {
+                        // preallocated; see segment_logical_size()
+                        break;
+                }
+
                 if (unlikely(next_bundle > e)) {
                         if (getenv("TANK_FORCE_SALVAGE_CURSEGMENT")) {
                                 if (ftruncate(indexFd, 0) == -1) {
@@ -95,6 +170,7 @@ void Service::rebuild_index(int logFd, int indexFd, const uint64_t base_seqnum)
 
                 const auto     bundle_hdr_flags = decode_pod<uint8_t>(p);
                 const bool     sparse_bundle    = bundle_hdr_flags & (1u << 6);
+                [[maybe_unused]] const auto extra_flags = TANKUtil::skip_bundle_extra_hdr(bundle_hdr_flags, p);
                 const uint32_t msgset_size      = ((bundle_hdr_flags >> 2) & 0xf) ?: Compression::decode_varuint32(p);
 
                 TANK_EXPECT(p <= e);
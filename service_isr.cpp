@@ -115,6 +115,23 @@ isr_entry *Service::isr_bind(topic_partition *p, cluster_node *peer, const uint3
 #endif
 
 void Service::isr_dispose(isr_entry *isr) {
+        TANK_EXPECT(isr);
+        auto partition = isr->partition();
+
+        isr_unlink(isr);
+
+#ifndef HWM_UPDATE_BASED_ON_ACKS
+	rebuild_partition_tracked_isrs(partition);
+#endif
+
+        // if we are removing a broker from the ISR of a partition, we need to consider if
+        // the invariants are satisfied for a pending client produce response
+        consider_pending_client_produce_responses(partition);
+}
+
+// removes the ISR entry from the partition's and the node's ISR lists and releases it
+// you are supposed to rebuild the partition's ISR tracker and consider its pending produce responses; see isr_dispose()
+void Service::isr_unlink(isr_entry *isr) {
         static constexpr bool trace{false};
         TANK_EXPECT(isr);
         auto partition = isr->partition();
@@ -161,14 +178,6 @@ void Service::isr_dispose(isr_entry *isr) {
                 }
         }
 #endif
-
-#ifndef HWM_UPDATE_BASED_ON_ACKS
-	rebuild_partition_tracked_isrs(partition);
-#endif
-
-        // if we are removing a broker from the ISR of a partition, we need to consider if
-        // the invariants are satisfied for a pending client produce response
-        consider_pending_client_produce_responses(partition);
 }
 
 // called when failed to get a CONSUME request for the last partition message didn't happen in time
@@ -186,10 +195,20 @@ void Service::expire_isr_ack(isr_entry *isr) {
         // detach from pending ack.list if not detached already
         isr->pending_next_ack_ll.try_detach_and_reset();
 
+#ifndef HWM_UPDATE_BASED_ON_ACKS
+        // many ISR entries of the same partition may expire together(e.g when a peer goes away)
+        // so we only get rid of the ISR entry here, and rebuild the ISR tracker, consider the pending produce responses
+        // and persist the ISR once for the partition, in process_dirty_partitions_acks()
+        isr_unlink(isr);
+
+        partition->cluster.flags |= unsigned(topic_partition::Cluster::Flags::ISRExpired);
+        mark_partition_acks_dirty(partition);
+#else
         // and get rid of this ISR entry
         isr_dispose(isr);
 
         persist_isr(partition, __LINE__);
+#endif
 }
 
 void Service::consider_isr_pending_ack() {
@@ -325,7 +344,7 @@ void Service::isr_touch(isr_entry *const isr_e, const uint64_t advertised_lastms
                                         }
                                 }
 
-                                update_hwmark(p, data[0].lsn);
+                                mark_partition_acks_dirty(p);
                         }
 
                         return;
@@ -350,6 +369,6 @@ void Service::isr_touch(isr_entry *const isr_e, const uint64_t advertised_lastms
                 }
         }
 
-        update_hwmark(p, data[0].lsn);
+        mark_partition_acks_dirty(p);
 }
 #endif
@@ -1,9 +1,12 @@
 #include "service_common.h"
+#include "bundle_columnar.h"
 
 int Rename(const char *oldpath, const char *newpath);
 int Unlink(const char *pathname);
 
-uint32_t Service::verify_log(int fd) {
+// If checksums_only is set, only the bundles framing and the CRC32C of bundles that carry one are verified; messages are not decoded
+// Only a mutable segment may be preallocated, i.e followed by zeros; see segment_logical_size()
+uint32_t Service::verify_log(int fd, const bool mutable_segment, const bool checksums_only) {
         const auto fileSize = lseek64(fd, 0, SEEK_END);
 
         if (!fileSize) {
@@ -14,6 +17,7 @@ uint32_t Service::verify_log(int fd) {
         strwlen8_t                          key;
         strwlen32_t                         msgContent;
         IOBuffer                            cb;
+        TANKUtil::columnar::msgset_reader   columnar_reader;
         range_base<const uint8_t *, size_t> msgSetContent;
         uint64_t                            msgSeqNum{1}, firstMsgSeqNum, lastMsgSeqNum;
         static constexpr bool               trace{false};
@@ -31,26 +35,66 @@ uint32_t Service::verify_log(int fd) {
 
         for (const auto *p = static_cast<uint8_t *>(fileData), *const e = p + fileSize, *const base = p; p != e;) {
                 const auto *const bundleBase = p;
-                const auto        bundleLen  = Compression::decode_varuint32(p);
-                const auto        nextBundle = p + bundleLen;
+                uint32_t          bundleLen, msgsSetSize;
 
-                TANK_EXPECT(p < e);
-                TANK_EXPECT(bundleLen);
+                if (unlikely(!Compression::decode_varuint32(p, e, &bundleLen))) {
+                        throw Switch::data_error("Malformed bundle length at offset ", bundleBase - base);
+                }
+
+                const auto nextBundle = p + bundleLen;
+
+                if (!bundleLen) {
+                        if (unlikely(!mutable_segment)) {
+                                throw Switch::data_error("Unexpected 0 bytes long bundle at offset ", bundleBase - base);
+                        } else if (unlikely(std::any_of(bundleBase, e, [](const uint8_t c) noexcept { return c != 0; }))) {
+                                throw Switch::data_error("Unexpected content in the preallocated region past offset ", bundleBase - base);
+                        }
+
+                        // preallocated region of a mutable segment
+                        break;
+                }
+
+                if (unlikely(bundleLen > std::size_t(e - p))) {
+                        throw Switch::data_error("Bundle at offset ", bundleBase - base, " extends past the end of the segment");
+                }
+
+                if (unlikely(!TANKUtil::verify_bundle_crc32c(p, nextBundle))) {
+                        throw Switch::data_error("Bundle CRC32C mismatch at offset ", bundleBase - base);
+                }
 
                 const auto bundleFlags        = *p++;
                 const auto codec              = bundleFlags & 3;
                 const bool sparseBundleBitSet = bundleFlags & (1u << 6);
-                const auto msgsSetSize        = ((bundleFlags >> 2) & 0xf) ?: Compression::decode_varuint32(p);
+                const auto extraFlags         = (bundleFlags & (1u << 7)) && p != nextBundle ? *p : uint8_t(0);
+
+                if (unlikely(!TANKUtil::skip_bundle_extra_hdr(bundleFlags, p, nextBundle))) {
+                        throw Switch::data_error("Malformed bundle header at offset ", bundleBase - base);
+                }
+
+                msgsSetSize = (bundleFlags >> 2) & 0xf;
+                if (!msgsSetSize && unlikely(!Compression::decode_varuint32(p, nextBundle, &msgsSetSize))) {
+                        throw Switch::data_error("Malformed bundle header at offset ", bundleBase - base);
+                }
 
                 if (trace) {
                         SLog("Bundle, flags = ", bundleFlags, ", codec = ", codec, ", sparseBundleBitSet = ", sparseBundleBitSet, ", msgsSetSize = ", msgsSetSize, "\n");
                 }
 
                 if (sparseBundleBitSet) {
+                        if (unlikely(p + sizeof(uint64_t) > nextBundle)) {
+                                throw Switch::data_error("Malformed bundle header at offset ", bundleBase - base);
+                        }
+
                         firstMsgSeqNum = decode_pod<uint64_t>(p);
 
                         if (msgsSetSize != 1) {
-                                lastMsgSeqNum = firstMsgSeqNum + Compression::decode_varuint32(p) + 1;
+                                uint32_t delta;
+
+                                if (unlikely(!Compression::decode_varuint32(p, nextBundle, &delta))) {
+                                        throw Switch::data_error("Malformed bundle header at offset ", bundleBase - base);
+                                }
+
+                                lastMsgSeqNum = firstMsgSeqNum + delta + 1;
                         } else {
                                 lastMsgSeqNum = firstMsgSeqNum;
                         }
@@ -70,6 +114,12 @@ uint32_t Service::verify_log(int fd) {
                         Print(msgSeqNum, " => OFFSET ", bundleBase - base, "\n");
                 }
 
+                if (checksums_only) {
+                        msgSeqNum += msgsSetSize;
+                        p = nextBundle;
+                        continue;
+                }
+
                 if (codec) {
                         cb.clear();
                         if (!Compression::UnCompress(Compression::Algo::SNAPPY, p, nextBundle - p, &cb)) {
@@ -84,9 +134,31 @@ uint32_t Service::verify_log(int fd) {
                 [[maybe_unused]] uint64_t msgTs{0};
                 uint32_t                  msgIdx{0};
 
+                if (extraFlags & uint8_t(TankFlags::BundleExtraFlags::Columnar)) {
+                        uint32_t seqNumDelta;
+
+                        if (unlikely(!columnar_reader.reset(msgSetContent.offset, msgSetContent.offset + msgSetContent.len, msgsSetSize, sparseBundleBitSet))) {
+                                throw Switch::data_error("Malformed columnar message set at offset ", bundleBase - base);
+                        }
+
+                        for (; columnar_reader.next(&msgTs, &key, &msgContent, &seqNumDelta); ++msgIdx, ++msgSeqNum) {
+                                if (sparseBundleBitSet) {
+                                        msgSeqNum = msgIdx ? msgSeqNum + seqNumDelta : firstMsgSeqNum;
+                                }
+
+                                if (trace) {
+                                        Print("MSG:", msgSeqNum, ", size = ", msgContent.size(), "\n");
+                                }
+                        }
+
+                        p = nextBundle;
+                        continue;
+                }
+
                 for (const auto *p = msgSetContent.offset, *const e = p + msgSetContent.len; p != e; ++msgIdx, ++msgSeqNum) {
                         // Next message set message
                         const auto flags = *p++;
+                        uint32_t   msgLen;
 
                         if (sparseBundleBitSet) {
                                 if (msgIdx == 0 || msgIdx == msgsSetSize - 1) {
@@ -97,22 +169,38 @@ uint32_t Service::verify_log(int fd) {
                                         // incremented in for()
                                 } else {
                                         // delta from prev - 1
-                                        msgSeqNum += Compression::decode_varuint32(p);
+                                        uint32_t delta;
+
+                                        if (unlikely(!Compression::decode_varuint32(p, e, &delta))) {
+                                                throw Switch::data_error("Malformed message in bundle at offset ", bundleBase - base);
+                                        }
+
+                                        msgSeqNum += delta;
                                 }
                         }
 
                         if (!(flags & uint8_t(TankFlags::BundleMsgFlags::UseLastSpecifiedTS))) {
+                                if (unlikely(p + sizeof(uint64_t) > e)) {
+                                        throw Switch::data_error("Malformed message in bundle at offset ", bundleBase - base);
+                                }
+
                                 msgTs = decode_pod<uint64_t>(p);
                         }
 
                         if (flags & uint8_t(TankFlags::BundleMsgFlags::HaveKey)) {
+                                if (unlikely(p >= e || p + sizeof(uint8_t) + *p > e)) {
+                                        throw Switch::data_error("Malformed message in bundle at offset ", bundleBase - base);
+                                }
+
                                 key.set(reinterpret_cast<const char *>(p) + 1, *p);
                                 p += key.size() + sizeof(uint8_t);
                         } else {
                                 key.reset();
                         }
 
-                        const auto msgLen = Compression::decode_varuint32(p);
+                        if (unlikely(!Compression::decode_varuint32(p, e, &msgLen) || msgLen > std::size_t(e - p))) {
+                                throw Switch::data_error("Malformed message in bundle at offset ", bundleBase - base);
+                        }
 
                         msgContent.set(reinterpret_cast<const char *>(p), msgLen);
                         p += msgLen;
@@ -134,6 +222,16 @@ bool Service::close_partition_log(topic_partition *partition) {
         TANK_EXPECT(partition);
         auto log = partition->_log.get();
 
+        if (log && log->compacting.load()) {
+                // can't touch this while a compaction is on-going
+                // XXX: may need to use CAS to set this to some other magic value
+                // so that we won't be attempting to compacting them while its closed
+                // i.e tri-state(open, close, open-compacting)
+                //
+                // it remains tracked in active_partitions, so that we 'll try again later
+                return false;
+        }
+
         // need to make sure we are no longer tracking this
         if (partition->access.ll.try_detach_and_reset() && active_partitions.empty()) {
                 next_active_partitions_check = std::numeric_limits<uint64_t>::max();
@@ -145,14 +243,6 @@ bool Service::close_partition_log(topic_partition *partition) {
                 return false;
         }
 
-        if (log->compacting.load()) {
-                // can't touch this while a compaction is on-going
-                // XXX: may need to use CAS to set this to some other magic value
-                // so that we won't be attempting to compacting them while its closed
-                // i.e tri-state(open, close, open-compacting)
-                return false;
-        }
-
 
         auto topic = partition->owner;
 
@@ -171,6 +261,27 @@ bool Service::close_partition_log(topic_partition *partition) {
         return true;
 }
 
+// Waits for the segments and reclaimer threads to be done with the partition's files; see process_segment_op() and reclaimer_main()
+//
+// The reactor thread shouldn't get here: consider_active_partitions() won't close partitions with pending file operations, and
+// client requests that involve closed partitions are parked until a partition open worker has loaded them(see park_request()).
+// It only blocks on the reactor thread if a partition that was closed by a cluster state update is accessed again shortly after.
+void Service::wait_pending_file_ops(const topic_partition *partition) {
+        if (partition->file_ops_pending()) {
+                std::unique_lock<std::mutex> lock(file_ops.lock);
+
+                file_ops.cond.wait(lock, [partition] { return !partition->file_ops_pending(); });
+        }
+}
+
+// Invoked by the segments and reclaimer threads once they have decremented a partition's pending file operations
+void Service::file_op_completed() {
+        // so that we won't miss a waiter that's about to wait
+        file_ops.lock.lock();
+        file_ops.lock.unlock();
+        file_ops.cond.notify_all();
+}
+
 int Service::reset_partition_log(topic_partition *partition) {
         [[maybe_unused]] static constexpr bool trace{false};
         TANK_EXPECT(partition);
@@ -185,6 +296,7 @@ int Service::reset_partition_log(topic_partition *partition) {
         }
 
 	TANK_EXPECT(false == read_only);
+        wait_pending_file_ops(partition);
 
         char       basePath[PATH_MAX];
         const auto basePathLen = snprintf(basePath, sizeof(basePath), "%.*s/%.*s/%u/",
@@ -216,6 +328,40 @@ int Service::reset_partition_log(topic_partition *partition) {
 }
 
 void Service::open_partition_log(topic_partition *partition, const partition_config &conf) {
+        TANK_EXPECT(!partition->_log); // already initialized?
+        const auto before = Timings::Milliseconds::Tick();
+        bool       have_files{false};
+
+        DEFER({
+                open_partitions_time += Timings::Milliseconds::Since(before);
+        });
+
+        install_partition_log(partition, load_partition_log(partition, conf, &have_files), have_files);
+}
+
+// Called on the reactor thread, once a partition log has been loaded by load_partition_log()
+void Service::install_partition_log(topic_partition *partition, topic_partition_log *l, const bool have_files) {
+        TANK_EXPECT(!partition->_log);
+
+        partition->_log.reset(l);
+        if (have_files) {
+                partition->flags &= ~unsigned(topic_partition::Flags::NoDataFiles);
+        }
+
+        track_accessed_partition(partition, curTime);
+        set_hwmark(partition, l->lastAssignedSeqNum);
+
+        partition->open_ok = true;
+        if (++total_open_partitions > partitions_lru.max_open && partitions_lru.max_open) {
+                // see consider_active_partitions()
+                next_active_partitions_check = now_ms;
+        }
+}
+
+// Scans the partition directory, repairs it if needed, and loads the partition log
+// This doesn't touch any state shared with the reactor thread, so that it can also run on a partition open worker
+// see Service::partition_open_worker()
+topic_partition_log *Service::load_partition_log(topic_partition *partition, const partition_config &conf, bool *const have_files) {
         static constexpr bool trace{false};
         const auto            before = Timings::Microseconds::Tick();
         char                  basePath[PATH_MAX];
@@ -226,9 +372,7 @@ void Service::open_partition_log(topic_partition *partition, const partition_con
                                           static_cast<int>(topic->name_.size()),
                                           topic->name_.data(), partition->idx);
 
-        TANK_EXPECT(!partition->_log); // already initialized?
-
-        track_accessed_partition(partition, curTime);
+        wait_pending_file_ops(partition);
 
         if (trace) {
                 SLog(ansifmt::bold, ansifmt::color_green, ansifmt::inverse, "OPENING PARTITION ", topic->name(),
@@ -242,11 +386,7 @@ void Service::open_partition_log(topic_partition *partition, const partition_con
         }
 #endif
 #endif
-	const auto __before = Timings::Milliseconds::Tick();
-
-        DEFER({
-                open_partitions_time += Timings::Milliseconds::Since(__before);
-        });
+        std::unique_ptr<topic_partition_log> log_guard;
 
         try {
                 struct rosegment_ctx final {
@@ -262,6 +402,7 @@ void Service::open_partition_log(topic_partition *partition, const partition_con
                 std::vector<strwlen32_t>     swapped;
                 uint64_t                     curLogSeqNum{0};
                 uint32_t                     curLogCreateTS{0};
+                bool                         curLogNameEncodesTS{false};
                 const strwlen32_t            b(basePath, basePathLen);
                 int                          fd;
                 bool                         processSwapped{true};
@@ -272,7 +413,7 @@ void Service::open_partition_log(topic_partition *partition, const partition_con
 
                 l->partition = partition;
                 l->config    = conf;
-                partition->_log.reset(l);
+                log_guard.reset(l);
 
                 l->roSegments                                = nullptr;
                 l->cur.index.ondisk.data                     = nullptr;
@@ -281,6 +422,42 @@ void Service::open_partition_log(topic_partition *partition, const partition_con
                 l->cur.index.ondisk.lastRecorded.relSeqNum   = 0;
                 l->cur.index.ondisk.lastRecorded.absPhysical = 0;
 
+                // Seals a mutable segment(<seqnum>_<ts>.log, or <seqnum>.log if !name_encodes_ts) that is not the latest, by renaming it to its immutable segment name
+                const auto seal_mutable_segment = [&basePath](const uint64_t base_seqnum, const uint32_t created_ts, const bool name_encodes_ts) {
+                        const auto  path = name_encodes_ts
+                                              ? Buffer::build(basePath, base_seqnum, "_", created_ts, ".log")
+                                              : Buffer::build(basePath, base_seqnum, ".log");
+                        struct stat st;
+                        int         fd = open(path.data(), O_RDWR | O_LARGEFILE);
+
+                        if (fd == -1) {
+                                throw Switch::system_error("Failed to open(", path, "):", strerror(errno));
+                        }
+
+                        DEFER({
+                                TANKUtil::safe_close(fd);
+                        });
+
+                        if (fstat(fd, &st) == -1) {
+                                throw Switch::system_error("fstat() failed:", strerror(errno));
+                        }
+
+                        const auto     last_avail_seqnum = segment_lastmsg_seqnum(fd, base_seqnum);
+                        const uint32_t freeze_ts         = st.st_mtime;
+
+                        // release blocks preallocated past the end of the segment
+                        if (ftruncate(fd, segment_logical_size(fd)) == -1) {
+                                Print("Failed to ftruncate(", path, "):", strerror(errno), "\n");
+                        }
+
+                        if (Rename(path.data(), Buffer::build(basePath, base_seqnum, "-", last_avail_seqnum, "_", freeze_ts, ".ilog").data()) == -1) {
+                                throw Switch::system_error("Failed to Rename():", strerror(errno));
+                        }
+
+                        Print("Sealed mutable segment ", path, "\n");
+                        return rosegment_ctx{base_seqnum, last_avail_seqnum, freeze_ts};
+                };
+
                 *b.CopyTo(_base_path) = '\0';
 
                 // Scan the partitiond directory
@@ -377,6 +554,10 @@ void Service::open_partition_log(topic_partition *partition, const partition_con
                                 // num_ts.log
                                 // the later encodes the creation timestamp in the path, which is useful because
                                 // we 'd like to know when this was created, when we restart the service and get to continue using the selected log
+                                uint64_t seq;
+                                uint32_t created_ts{0};
+                                bool     name_encodes_ts;
+
                                 if (const auto *const p = r.first.Search('_')) {
                                         *name.CopyTo(_base_path + b.size() + 1) = '\0';
 
@@ -387,9 +568,12 @@ void Service::open_partition_log(topic_partition *partition, const partition_con
 
                                         if (0 == st.st_size) {
                                                 // This is a stray - whatever the reason this is here, it needs to go
-                                                Print("Found a stray ", _base_path, ", deleting it\n");
-						TANK_EXPECT(false == read_only);
-                                                unlink(_base_path);
+                                                if (read_only) {
+                                                        Print("Ignoring stray ", _base_path, "\n");
+                                                } else {
+                                                        Print("Found a stray ", _base_path, ", deleting it\n");
+                                                        unlink(_base_path);
+                                                }
                                                 continue;
                                         }
 
@@ -398,43 +582,51 @@ void Service::open_partition_log(topic_partition *partition, const partition_con
 
                                         if (!seqRepr.IsDigits() || !tsRepr.IsDigits()) {
                                                 throw Switch::system_error("Unexpected name ", name);
-                                        } else {
-                                                const auto seq = seqRepr.as_uint64();
-
-                                                TANK_EXPECT(seq);
+                                        }
 
-                                                curLogSeqNum   = seq;
-                                                curLogCreateTS = tsRepr.AsUint32();
+                                        seq             = seqRepr.as_uint64();
+                                        created_ts      = tsRepr.AsUint32();
+                                        name_encodes_ts = true;
+                                } else if (unlikely(!r.first.all_of_digits())) {
+                                        throw Switch::system_error("Unexpected name ", name);
+                                } else {
+                                        seq             = r.first.as_uint64();
+                                        name_encodes_ts = false;
+                                }
 
-                                                if (!curLogSeqNum) {
-                                                        Print(ansifmt::bold, ansifmt::color_red, "Unexpected, curLogSeqNum == 0 from ", _base_path, ansifmt::reset, " name='", name, "'\n");
-                                                        std::abort();
-                                                }
+                                if (!seq) {
+                                        Print(ansifmt::bold, ansifmt::color_red, "Unexpected, curLogSeqNum == 0 from ", basePath, ansifmt::reset, " name='", name, "'\n");
+                                        std::abort();
+                                }
 
-                                                if (trace) {
-                                                        SLog("curLogSeqNum = ", curLogSeqNum, ", curLogCreateTS = ", curLogCreateTS, " from ", r.first, "\n");
-                                                }
+                                if (curLogSeqNum) {
+                                        // We crashed after we rolled, but before the segments thread got to seal the
+                                        // rolled segment(see process_segment_op()). All but the latest are sealed here
+                                        if (read_only) {
+                                                throw Switch::system_error("Found unsealed rolled segment(s) in ", basePath, "; cannot seal them in read-only mode");
                                         }
-                                } else {
-                                        if (unlikely(!r.first.all_of_digits())) {
-                                                throw Switch::system_error("Unexpected name ", name);
+
+                                        if (seq > curLogSeqNum) {
+                                                roLogs.push_back(seal_mutable_segment(curLogSeqNum, curLogCreateTS, curLogNameEncodesTS));
                                         } else {
-                                                const auto seq = r.first.as_uint64();
+                                                roLogs.push_back(seal_mutable_segment(seq, created_ts, name_encodes_ts));
+                                                continue;
+                                        }
+                                }
 
-                                                TANK_EXPECT(seq);
-                                                TANK_EXPECT(!curLogSeqNum);
+                                curLogSeqNum        = seq;
+                                curLogCreateTS      = created_ts;
+                                curLogNameEncodesTS = name_encodes_ts;
 
-                                                curLogSeqNum = seq;
-                                        }
+                                if (trace) {
+                                        SLog("curLogSeqNum = ", curLogSeqNum, ", curLogCreateTS = ", curLogCreateTS, " from ", r.first, "\n");
                                 }
                         } else {
                                 Print("Unexpected name ", name, " in ", basePath, "\n");
                         }
                 }
 
-                if (any_files) {
-                        partition->flags &= ~unsigned(topic_partition::Flags::NoDataFiles);
-                }
+                *have_files = any_files;
 
                 // Finish merge process if needed and if it's possible
                 if (processSwapped == false) {
@@ -559,7 +751,7 @@ void Service::open_partition_log(topic_partition *partition, const partition_con
 
                 // Have a current segment?
                 if (curLogSeqNum) {
-                        if (curLogCreateTS) {
+                        if (curLogNameEncodesTS) {
                                 Snprint(basePath, sizeof(basePath), b, curLogSeqNum, "_", curLogCreateTS, ".log");
                         } else {
                                 Snprint(basePath, sizeof(basePath), b, curLogSeqNum, ".log");
@@ -587,7 +779,14 @@ void Service::open_partition_log(topic_partition *partition, const partition_con
 
                         if (fd == -1) {
                                 throw Switch::system_error("open(", basePath_, ") failed:", strerror(errno), ". Cannot open current segment index");
-                        } else if (lseek64(fd, 0, SEEK_END) == 0 && l->cur.fileSize) {
+                        }
+
+                        if (lseek64(fd, 0, SEEK_END) == 0) {
+                                // the segment may have been preallocated
+                                l->cur.fileSize = segment_logical_size(l->cur.fdh->fd);
+                        }
+
+                        if (lseek64(fd, 0, SEEK_END) == 0 && l->cur.fileSize) {
                                 if (trace) {
                                         SLog("Empty index, but datafile is not empty: will need to rebuild\n");
                                 }
@@ -603,7 +802,7 @@ void Service::open_partition_log(topic_partition *partition, const partition_con
                                         throw Switch::system_error("Failed to unlink(", basePath, "): ", strerror(errno));
                                 }
 
-                                if (curLogCreateTS) {
+                                if (curLogNameEncodesTS) {
                                         Snprint(basePath, sizeof(basePath), b, curLogSeqNum, "_", curLogCreateTS, ".log");
                                 } else {
                                         Snprint(basePath, sizeof(basePath), b, curLogSeqNum, ".log");
@@ -664,6 +863,13 @@ void Service::open_partition_log(topic_partition *partition, const partition_con
                                 std::abort();
                         }
 
+                        if (l->cur.index.ondisk.span) {
+                                // the segment may have been preallocated
+                                l->cur.fileSize = segment_logical_size(l->cur.fdh->fd, l->cur.index.ondisk.lastRecorded.absPhysical);
+                        }
+
+                        l->cur.preallocated = l->cur.fileSize < lseek64(l->cur.fdh->fd, 0, SEEK_END);
+
                         l->lastAssignedSeqNum = 0;
 
                         if (const auto s = l->cur.fileSize) {
@@ -716,51 +922,73 @@ void Service::open_partition_log(topic_partition *partition, const partition_con
                                         throw Switch::system_error("pread64() failed:", strerror(errno));
                                 }
 
-                                for (const auto *p = data, *const e = p + span; p < e;) {
-                                        const auto *      saved{p};
-                                        const auto        bundleLen = Compression::decode_varuint32(p);
-                                        const auto *const bundleEnd = p + bundleLen;
-
-                                        if (unlikely(bundleLen == 0 || bundleEnd > e)) {
-                                                const auto ckpt = (lastCheckpoint - data) + o;
-
-                                                Print("Likely corrupt TANK partition segment(ran out of disk space?).\n");
-                                                if (getenv("TANK_FORCE_SALVAGE_CURSEGMENT")) {
-                                                        if (ftruncate(l->cur.fdh->fd, ckpt) == -1) {
-                                                                Print("Failed to truncate:", strerror(errno), "\n");
-                                                                exit(1);
-                                                        } else if (l->cur.index.fd != -1 && ftruncate(l->cur.index.fd, 0) == -1) {
-                                                                Print("Failed to truncate:", strerror(errno), "\n");
-                                                                exit(1);
-                                                        } else {
-                                                                Print("Salvaged segment. Please restart Tank\n");
-                                                        }
+                                // doesn't return
+                                const auto corrupt = [&]() {
+                                        const auto ckpt = (lastCheckpoint - data) + o;
+
+                                        Print("Likely corrupt TANK partition segment(ran out of disk space?).\n");
+                                        if (getenv("TANK_FORCE_SALVAGE_CURSEGMENT")) {
+                                                if (ftruncate(l->cur.fdh->fd, ckpt) == -1) {
+                                                        Print("Failed to truncate:", strerror(errno), "\n");
+                                                        exit(1);
+                                                } else if (l->cur.index.fd != -1 && ftruncate(l->cur.index.fd, 0) == -1) {
+                                                        Print("Failed to truncate:", strerror(errno), "\n");
+                                                        exit(1);
                                                 } else {
-                                                        Print("Set TANK_FORCE_SALVAGE_CURSEGMENT=1 and restart Tank so that it will _delete_ the current segment index and truncate the current segment file so that it will salvage whatever's possible\n");
-                                                        Print("Can save up to ", size_repr(ckpt), ", will lose ", size_repr(s - ckpt), "\n");
-                                                        Print("Aborting\n");
+                                                        Print("Salvaged segment. Please restart Tank\n");
                                                 }
-                                                exit(1);
+                                        } else {
+                                                Print("Set TANK_FORCE_SALVAGE_CURSEGMENT=1 and restart Tank so that it will _delete_ the current segment index and truncate the current segment file so that it will salvage whatever's possible\n");
+                                                Print("Can save up to ", size_repr(ckpt), ", will lose ", size_repr(s - ckpt), "\n");
+                                                Print("Aborting\n");
+                                        }
+                                        exit(1);
+                                };
+
+                                for (const auto *p = data, *const e = p + span; p < e;) {
+                                        const auto *saved{p};
+                                        uint32_t    bundleLen, msgSetSize;
+
+                                        if (unlikely(!Compression::decode_varuint32(p, e, &bundleLen) || bundleLen == 0 || bundleLen > std::size_t(e - p))) {
+                                                corrupt();
                                         }
 
-                                        TANK_EXPECT(bundleLen);
+                                        const auto *const bundleEnd = p + bundleLen;
 
                                         lastCheckpoint = saved;
 
-                                        const auto     bundleFlags        = *p++;
-                                        const bool     sparseBundleBitSet = bundleFlags & (1u << 6);
-                                        const uint32_t msgSetSize         = ((bundleFlags >> 2) & 0xf) ?: Compression::decode_varuint32(p);
+                                        const auto bundleFlags        = *p++;
+                                        const bool sparseBundleBitSet = bundleFlags & (1u << 6);
+
+                                        if (unlikely(!TANKUtil::skip_bundle_extra_hdr(bundleFlags, p, bundleEnd))) {
+                                                corrupt();
+                                        }
+
+                                        msgSetSize = (bundleFlags >> 2) & 0xf;
+                                        if (!msgSetSize && unlikely(!Compression::decode_varuint32(p, bundleEnd, &msgSetSize))) {
+                                                corrupt();
+                                        }
 
                                         if (trace) {
                                                 SLog("bundleFlags = ", bundleFlags, ", sparseBundleBitSet = ", sparseBundleBitSet, ", msgSetSize = ", msgSetSize, "\n");
                                         }
 
                                         if (sparseBundleBitSet) {
+                                                if (unlikely(p + sizeof(uint64_t) > bundleEnd)) {
+                                                        corrupt();
+                                                }
+
                                                 const auto firstMsgSeqNum = decode_pod<uint64_t>(p);
                                                 uint64_t   lastMsgSeqNum;
 
                                                 if (msgSetSize != 1) {
-                                                        lastMsgSeqNum = firstMsgSeqNum + Compression::decode_varuint32(p) + 1;
+                                                        uint32_t delta;
+
+                                                        if (unlikely(!Compression::decode_varuint32(p, bundleEnd, &delta))) {
+                                                                corrupt();
+                                                        }
+
+                                                        lastMsgSeqNum = firstMsgSeqNum + delta + 1;
                                                 } else {
                                                         lastMsgSeqNum = firstMsgSeqNum;
                                                 }
@@ -787,7 +1015,6 @@ void Service::open_partition_log(topic_partition *partition, const partition_con
                                 TANK_EXPECT(l->cur.sinceLastUpdate == 0); // not an empty current segment log
 
                                 l->lastAssignedSeqNum = next - 1;
-                                set_hwmark(partition, l->lastAssignedSeqNum);
 
                                 if (trace) {
                                         SLog(ansifmt::bold, "Set lastAssignedSeqNum = ", l->lastAssignedSeqNum, ansifmt::reset, "\n");
@@ -818,7 +1045,7 @@ void Service::open_partition_log(topic_partition *partition, const partition_con
                         }
 
                         l->cur.createdTS                    = curLogCreateTS ?: now;
-                        l->cur.nameEncodesTS                = curLogCreateTS;
+                        l->cur.nameEncodesTS                = curLogNameEncodesTS;
                         l->cur.flush_state.pendingFlushMsgs = 0;
                         l->cur.flush_state.nextFlushTS      = config.flushIntervalSecs ? now + config.flushIntervalSecs : UINT32_MAX;
 
@@ -849,38 +1076,47 @@ void Service::open_partition_log(topic_partition *partition, const partition_con
                                 Print(ansifmt::bold, ansifmt::color_red, "Looks like someone deleted the active segment from ", basePath, ansifmt::reset, "\n");
 
                                 l->lastAssignedSeqNum = l->roSegments->back()->lastAvailSeqNum;
-                                set_hwmark(partition, l->lastAssignedSeqNum);
-                        } else {
-                                set_hwmark(partition, 0);
                         }
                 }
-
-		partition->open_ok = true;		
-		++total_open_partitions;
         } catch (const std::exception &e) {
-                // we need to _close_ the partition explicitly because we couldn't open it
-                // this should reclaim resources, and partition will no longer be considered open, because it is not
+                // log_guard will reclaim whatever we have acquired so far
                 if (trace) {
                         SLog("Exception:", e.what(), "\n");
                 }
 
-		close_partition_log(partition);
                 throw;
         }
 
         if (trace) {
-                SLog("Took ", duration_repr(Timings::Microseconds::Since(before)), " to open_partition_log()\n");
+                SLog("Took ", duration_repr(Timings::Microseconds::Since(before)), " to load_partition_log()\n");
         }
+
+        return log_guard.release();
 }
 
 topic_partition_log *Service::partition_log(topic_partition *const p) {
         TANK_EXPECT(p);
 
-        if (!p->_log) {
-                open_partition_log(p, p->owner->partitionConf);
-        } else {
+        // so that we know which partition was involved if this operation turns out to be slow
+        profiler.cur.partition = p;
+
+        if (p->_log) {
                 TANK_EXPECT(p->access.ll.empty() == false);
-                p->access.last_access = curTime;
+                track_accessed_partition(p, curTime);
+        } else if (const auto it = partition_opens.inflight.find(p); it != partition_opens.inflight.end()) {
+                // scheduled to be opened by a partition open worker; we can't open it concurrently
+                auto op = it->second;
+
+                if (!op->loaded.load(std::memory_order_acquire)) {
+                        await_partition_open(op);
+                }
+
+                adopt_loaded_partition_log(op);
+                if (!p->_log) {
+                        throw Switch::system_error("Failed to open partition log");
+                }
+        } else {
+                open_partition_log(p, p->owner->partitionConf);
         }
 
         return p->_log.get();
@@ -0,0 +1,163 @@
+#include "service_common.h"
+
+slab_allocator::slab_allocator() {
+        huge_pages = getenv("TANK_HUGEPAGE_SLABS");
+        slab_size  = huge_pages ? 2 * 1024 * 1024 : 256 * 1024;
+
+        for (uint8_t i{0}; i < classes_cnt; ++i) {
+                auto &sc = classes[i];
+
+                sc.obj_size      = uint32_t(1) << (min_class_bits + i);
+                sc.objs_per_slab = (slab_size - objs_offset()) / sc.obj_size;
+                TANK_EXPECT(sc.objs_per_slab);
+        }
+}
+
+slab_allocator::~slab_allocator() {
+        // objects still in use are not tracked, but we are going away anyway
+        for (auto &sc : classes) {
+                for (auto l : {&sc.partial, &sc.empty}) {
+                        while (!l->empty()) {
+                                auto s = switch_list_entry(slab, ll, l->next);
+
+                                s->ll.detach_and_reset();
+                                munmap(s, slab_size);
+                        }
+                }
+        }
+}
+
+slab_allocator::slab *slab_allocator::new_slab(size_class *const sc) {
+        void *ptr{MAP_FAILED};
+
+        if (huge_pages) {
+                // huge pages are naturally aligned to their size
+                ptr = mmap(nullptr, slab_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        }
+
+        if (ptr == MAP_FAILED) {
+                // over-allocate so that we can align it to slab_size, and then trim the excess
+                auto       base    = reinterpret_cast<uint8_t *>(mmap(nullptr, slab_size * 2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+                const auto aligned = reinterpret_cast<uint8_t *>((reinterpret_cast<uintptr_t>(base) + slab_size - 1) & ~(slab_size - 1));
+
+                if (reinterpret_cast<void *>(base) == MAP_FAILED) {
+                        throw Switch::system_error("mmap() failed:", strerror(errno));
+                }
+
+                if (const auto head = aligned - base) {
+                        munmap(base, head);
+                }
+                if (const auto tail = (base + slab_size * 2) - (aligned + slab_size)) {
+                        munmap(aligned + slab_size, tail);
+                }
+
+                if (huge_pages) {
+                        // transparent huge pages, if HugeTLB pages are not available
+                        madvise(aligned, slab_size, MADV_HUGEPAGE);
+                }
+
+                ptr = aligned;
+        }
+
+        auto s = reinterpret_cast<slab *>(ptr);
+
+        s->ll.reset();
+        s->sc         = sc;
+        s->free_list  = nullptr;
+        s->used       = 0;
+        s->next_fresh = 0;
+        ++sc->slabs;
+        return s;
+}
+
+void slab_allocator::release_slab(slab *const s) {
+        TANK_EXPECT(0 == s->used);
+
+        s->ll.detach_and_reset();
+        --s->sc->slabs;
+        ++stats.slabs_released;
+        munmap(s, slab_size);
+}
+
+void *slab_allocator::alloc(const size_t size) {
+        if (unlikely(size > max_class_size)) {
+                stats.large_bytes += size;
+                ++stats.large_cnt;
+                return malloc(size);
+        }
+
+        auto  sc = classes + class_index(size);
+        slab *s;
+        void *res;
+
+        if (!sc->partial.empty()) {
+                s = switch_list_entry(slab, ll, sc->partial.next);
+        } else {
+                if (!sc->empty.empty()) {
+                        s = switch_list_entry(slab, ll, sc->empty.next);
+                        s->ll.detach_and_reset();
+                        --sc->empty_cnt;
+                } else {
+                        s = new_slab(sc);
+                }
+
+                sc->partial.push_back(&s->ll);
+        }
+
+        if (auto p = s->free_list) {
+                s->free_list = *reinterpret_cast<void **>(p);
+                res          = p;
+        } else {
+                res = reinterpret_cast<uint8_t *>(s) + objs_offset() + size_t(s->next_fresh++) * sc->obj_size;
+        }
+
+        if (++s->used == sc->objs_per_slab) {
+                // full; we 'll get to it again via release()
+                s->ll.detach_and_reset();
+        }
+
+        sc->peak = std::max(sc->peak, ++sc->in_use);
+        return res;
+}
+
+void slab_allocator::release(void *const ptr, const size_t size) {
+        if (unlikely(size > max_class_size)) {
+                stats.large_bytes -= size;
+                --stats.large_cnt;
+                free(ptr);
+                return;
+        }
+
+        auto s  = reinterpret_cast<slab *>(reinterpret_cast<uintptr_t>(ptr) & ~(slab_size - 1));
+        auto sc = s->sc;
+
+        TANK_EXPECT(sc == classes + class_index(size));
+        TANK_EXPECT(s->used);
+
+        *reinterpret_cast<void **>(ptr) = s->free_list;
+        s->free_list                    = ptr;
+        --sc->in_use;
+
+        if (0 == --s->used) {
+                s->ll.try_detach_and_reset();
+                sc->empty.push_back(&s->ll);
+                ++sc->empty_cnt;
+        } else if (s->used == sc->objs_per_slab - 1) {
+                // was full
+                sc->partial.push_back(&s->ll);
+        }
+}
+
+void slab_allocator::trim() {
+        for (auto &sc : classes) {
+                // enough slabs to serve the peak demand since the last trim()
+                const auto target = (sc.peak + sc.objs_per_slab - 1) / sc.objs_per_slab;
+
+                while (sc.slabs > target && sc.empty_cnt) {
+                        release_slab(switch_list_entry(slab, ll, sc.empty.prev));
+                        --sc.empty_cnt;
+                }
+
+                sc.peak = sc.in_use;
+        }
+}
@@ -0,0 +1,348 @@
+#include "service_common.h"
+
+// Opening a partition log requires scanning its directory, possibly repairing it, and mmap()ing indices, which can
+// take long for partitions with many segments. Client requests that involve partitions that are not open are parked(see park_request()),
+// the partitions are loaded by the partition open workers, and the requests are processed once they are all open.
+//
+// Every other partition_log() access still opens the partition synchronously; if it has already been scheduled, it's taken
+// off the queue and loaded on the reactor thread, unless a worker is already loading it, so that it's never loaded twice concurrently.
+void Service::partition_open_worker() {
+        sigset_t mask;
+
+        sigfillset(&mask);
+        pthread_sigmask(SIG_SETMASK, &mask, nullptr);
+        for (;;) {
+                pending_partition_open *op;
+
+                {
+                        std::unique_lock<std::mutex> lock(partition_opens.workLock);
+
+                        partition_opens.workCond.wait(lock, [this] { return partition_opens.stop || !partition_opens.queue.empty(); });
+                        if (partition_opens.stop) {
+                                return;
+                        }
+
+                        op = partition_opens.queue.front();
+                        partition_opens.queue.pop_front();
+                }
+
+                load_scheduled_partition_log(op);
+
+                {
+                        std::lock_guard<std::mutex> lock(partition_opens.workLock);
+
+                        op->loaded.store(true, std::memory_order_release);
+                }
+                // see partition_log()
+                partition_opens.loadedCond.notify_all();
+
+                run_on_main_thread([op]() {
+                        this_service->complete_partition_open(op);
+                });
+        }
+}
+
+void Service::load_scheduled_partition_log(pending_partition_open *op) {
+        const auto before    = Timings::Milliseconds::Tick();
+        auto       partition = op->partition;
+
+        try {
+                op->log = load_partition_log(partition, op->conf, &op->have_files);
+        } catch (const std::exception &e) {
+                Print("Failed to open partition ", partition->owner->name(), "/", partition->idx, ":", e.what(), "\n");
+        }
+
+        op->duration_ms = Timings::Milliseconds::Since(before);
+}
+
+// Invoked by partition_log() on the reactor thread, for a partition scheduled to be opened by a worker
+// If no worker has gotten to it yet, it's loaded here, instead of waiting for the partitions queued ahead of it.
+// Otherwise, we wait for the worker that's loading it.
+void Service::await_partition_open(pending_partition_open *op) {
+        std::unique_lock<std::mutex> lock(partition_opens.workLock);
+        auto &                       queue = partition_opens.queue;
+
+        if (const auto it = std::find(queue.begin(), queue.end(), op); it != queue.end()) {
+                queue.erase(it);
+                lock.unlock();
+
+                load_scheduled_partition_log(op);
+                op->loaded.store(true, std::memory_order_release);
+
+                // so that the requests parked on it are processed in the next reactor loop iteration, as if a worker had loaded it
+                run_on_main_thread([op]() {
+                        this_service->complete_partition_open(op);
+                });
+        } else {
+                partition_opens.loadedCond.wait(lock, [op] { return op->loaded.load(std::memory_order_acquire); });
+        }
+}
+
+pending_partition_open *Service::schedule_partition_open(topic_partition *partition) {
+        if (const auto it = partition_opens.inflight.find(partition); it != partition_opens.inflight.end()) {
+                return it->second;
+        }
+
+        auto op = new pending_partition_open();
+
+        op->partition = partition;
+        op->conf      = partition->owner->partitionConf;
+        partition_opens.inflight.emplace(partition, op);
+
+        partition_opens.workLock.lock();
+        partition_opens.queue.push_back(op);
+        partition_opens.workLock.unlock();
+        partition_opens.workCond.notify_one();
+
+        return op;
+}
+
+void Service::adopt_loaded_partition_log(pending_partition_open *op) {
+        TANK_EXPECT(op->loaded.load(std::memory_order_acquire));
+
+        if (op->installed) {
+                return;
+        }
+
+        op->installed = true;
+        partition_opens.inflight.erase(op->partition);
+        open_partitions_time += op->duration_ms;
+
+        if (auto l = std::exchange(op->log, nullptr)) {
+                install_partition_log(op->partition, l, op->have_files);
+        }
+}
+
+void Service::complete_partition_open(pending_partition_open *op) {
+        // may have already been adopted by partition_log()
+        adopt_loaded_partition_log(op);
+
+        // even if we failed to load the partition log; the parked requests
+        // will attempt to open it again, and will fail accordingly
+        for (auto r : op->waiters) {
+                if (0 == --r->pending_opens) {
+                        if (r->cancelled) {
+                                delete r;
+                        } else {
+                                drain_parked_requests(r->c);
+                        }
+                }
+        }
+
+        delete op;
+}
+
+// Collects the partitions a Consume or Produce request involves that are not open, and that we would have otherwise
+// opened in order to process the request, into partition_opens.collected
+//
+// Returns false if the request is malformed; the request handler will deal with it
+bool Service::collect_partitions_to_open(const uint8_t msg, const uint8_t *p, const size_t len) {
+        const auto *const end      = p + len;
+        const auto        ca       = cluster_aware();
+        auto              self     = cluster_state.local_node.ref;
+        auto &            selected = partition_opens.collected;
+        const auto        consider = [&](const topic *t, const uint16_t partition_id) {
+                auto partition = t->enabled_partition(partition_id);
+
+                if (!partition || partition->_log) {
+                        return;
+                } else if (ca && partition->cluster.leader.node != self) {
+                        // we are not going to access it
+                        return;
+                } else if (std::find(selected.begin(), selected.end(), partition) == selected.end()) {
+                        selected.emplace_back(partition);
+                }
+        };
+
+        selected.clear();
+
+        // client version, request id
+        if (unlikely(p + sizeof(uint16_t) + sizeof(uint32_t) + sizeof(uint8_t) > end)) {
+                return false;
+        }
+        p += sizeof(uint16_t) + sizeof(uint32_t);
+
+        // client id
+        p += sizeof(uint8_t) + *p;
+
+        if (TankAPIMsgType(msg) == TankAPIMsgType::Consume) {
+                // max wait, min bytes
+                if (unlikely(p + sizeof(uint64_t) + sizeof(uint32_t) + sizeof(uint8_t) > end)) {
+                        return false;
+                }
+                p += sizeof(uint64_t) + sizeof(uint32_t);
+
+                for (auto topics_cnt = decode_pod<uint8_t>(p); topics_cnt; --topics_cnt) {
+                        if (unlikely(p >= end || p + (*p) + sizeof(uint8_t) + sizeof(uint8_t) > end)) {
+                                return false;
+                        }
+
+                        const str_view8 topic_name(reinterpret_cast<const char *>(p) + 1, *p);
+                        p += topic_name.size() + sizeof(uint8_t);
+
+                        const auto partitions_cnt = decode_pod<uint8_t>(p);
+                        auto       topic          = topic_by_name(topic_name);
+
+                        if (unlikely(p + (sizeof(uint16_t) + sizeof(uint64_t) + sizeof(uint32_t)) * partitions_cnt > end)) {
+                                return false;
+                        }
+
+                        for (uint32_t i{0}; i < partitions_cnt; ++i) {
+                                const auto partition_id = decode_pod<uint16_t>(p);
+
+                                // sequence number, fetch size
+                                p += sizeof(uint64_t) + sizeof(uint32_t);
+                                if (topic) {
+                                        consider(topic, partition_id);
+                                }
+                        }
+                }
+        } else {
+                // required acks, ack. timeout
+                if (unlikely(p + sizeof(uint8_t) + sizeof(uint32_t) + sizeof(uint8_t) > end)) {
+                        return false;
+                }
+                p += sizeof(uint8_t) + sizeof(uint32_t);
+
+                for (auto topics_cnt = decode_pod<uint8_t>(p); topics_cnt; --topics_cnt) {
+                        if (unlikely(p >= end || p + (*p) + sizeof(uint8_t) + sizeof(uint8_t) > end)) {
+                                return false;
+                        }
+
+                        const str_view8 topic_name(reinterpret_cast<const char *>(p) + 1, *p);
+                        p += topic_name.size() + sizeof(uint8_t);
+
+                        const auto partitions_cnt = decode_pod<uint8_t>(p);
+                        auto       topic          = topic_by_name(topic_name);
+
+                        for (uint32_t i{0}; i < partitions_cnt; ++i) {
+                                if (unlikely(p + sizeof(uint16_t) > end)) {
+                                        return false;
+                                }
+
+                                const auto partition_id = decode_pod<uint16_t>(p);
+
+                                if (unlikely(!Compression::check_decode_varuint32(p, end))) {
+                                        return false;
+                                }
+
+                                const auto bundle_len = Compression::decode_varuint32(p);
+
+                                if (TankAPIMsgType(msg) == TankAPIMsgType::ProduceWithSeqnum) {
+                                        p += sizeof(uint64_t);
+                                }
+
+                                p += bundle_len;
+                                if (unlikely(p > end)) {
+                                        return false;
+                                }
+
+                                if (topic && !read_only) {
+                                        consider(topic, partition_id);
+                                }
+                        }
+                }
+        }
+
+        return true;
+}
+
+// Returns true if the request was parked, because it involves partitions that are not open, or because
+// earlier requests of the connection are parked; requests of a connection are processed in order, so
+// while any are parked, requests of every type are parked behind them
+bool Service::park_request(connection *const c, const uint8_t msg, const uint8_t *const data, const size_t len) {
+        if (partition_opens.workers.empty() || c->type != connection::Type::TankClient) {
+                return false;
+        }
+
+        auto &parked = c->as.tank.parked_requests;
+
+        switch (TankAPIMsgType(msg)) {
+                case TankAPIMsgType::Produce:
+                case TankAPIMsgType::ProduceWithSeqnum:
+                case TankAPIMsgType::Consume:
+                        if (!collect_partitions_to_open(msg, data, len)) {
+                                // malformed; the request handler will deal with it, in order
+                                partition_opens.collected.clear();
+                        }
+                        break;
+
+                default:
+                        partition_opens.collected.clear();
+                        break;
+        }
+
+        if (partition_opens.collected.empty() && parked.empty()) {
+                return false;
+        }
+
+        auto r = new parked_request();
+
+        r->c             = c;
+        r->msg           = msg;
+        r->pending_opens = partition_opens.collected.size();
+        r->cancelled     = false;
+        r->content.append(reinterpret_cast<const char *>(data), len);
+
+        for (auto partition : partition_opens.collected) {
+                schedule_partition_open(partition)->waiters.emplace_back(r);
+        }
+
+        parked.push_back(&r->conn_ll);
+        return true;
+}
+
+void Service::drain_parked_requests(connection *const c) {
+        auto &parked = c->as.tank.parked_requests;
+
+        while (!parked.empty()) {
+                auto r = switch_list_entry(parked_request, conn_ll, parked.prev);
+
+                if (r->pending_opens) {
+                        break;
+                }
+
+                r->conn_ll.detach_and_reset();
+
+                const auto data = reinterpret_cast<const uint8_t *>(r->content.data());
+
+                profiler.cur.msg = r->msg;
+
+                const auto alive = dispatch_msg(c, r->msg, data, r->content.size());
+
+                delete r;
+
+                if (!alive) {
+                        // connection was shut down
+                        return;
+                }
+        }
+}
+
+void Service::cancel_parked_requests(connection *const c) {
+        auto &parked = c->as.tank.parked_requests;
+
+        while (!parked.empty()) {
+                auto r = switch_list_entry(parked_request, conn_ll, parked.next);
+
+                r->conn_ll.detach_and_reset();
+                if (r->pending_opens) {
+                        // see complete_partition_open()
+                        r->cancelled = true;
+                } else {
+                        delete r;
+                }
+        }
+}
+
+void Service::stop_partition_open_workers() {
+        partition_opens.workLock.lock();
+        partition_opens.stop = true;
+        partition_opens.workLock.unlock();
+        partition_opens.workCond.notify_all();
+
+        for (auto &t : partition_opens.workers) {
+                t.join();
+        }
+        partition_opens.workers.clear();
+}
@@ -2,14 +2,74 @@
 void rebuild_partition_tracked_isrs(topic_partition *);
 
 void isr_touch(isr_entry *, const uint64_t);
+
+void mark_partition_acks_dirty(topic_partition *);
+
+void process_dirty_partitions_acks();
 #endif
 
 void schedule_compaction(std::unique_ptr<pending_compaction> &&);
 
 void schedule_compaction(const char *, topic_partition_log *);
 
+void schedule_segment_op(segment_op *);
+
+static void process_segment_op(segment_op *);
+
+void prepare_next_segment(topic_partition_log *);
+
+void adopt_next_segment(topic_partition *, int, int);
+
+void seal_rolled_segment(topic_partition_log *, const uint64_t, const uint32_t, const int);
+
+void reclaimer_main();
+
+void reclaim_retired_files(std::vector<retired_file *> *);
+
+void stop_reclaimer();
+
+void wait_pending_file_ops(const topic_partition *);
+
+void file_op_completed();
+
 void track_accessed_partition(topic_partition *, const time_t);
 
+topic_partition_log *load_partition_log(topic_partition *, const partition_config &, bool *const);
+
+void install_partition_log(topic_partition *, topic_partition_log *, const bool);
+
+void partition_open_worker();
+
+void load_scheduled_partition_log(pending_partition_open *);
+
+void await_partition_open(pending_partition_open *);
+
+pending_partition_open *schedule_partition_open(topic_partition *);
+
+void adopt_loaded_partition_log(pending_partition_open *);
+
+void complete_partition_open(pending_partition_open *);
+
+bool collect_partitions_to_open(const uint8_t, const uint8_t *, const size_t);
+
+bool park_request(connection *, const uint8_t, const uint8_t *, const size_t);
+
+bool dispatch_msg(connection *, const uint8_t, const uint8_t *, const size_t);
+
+void drain_parked_requests(connection *);
+
+void cancel_parked_requests(connection *);
+
+void stop_partition_open_workers();
+
+void sync_worker();
+
+void schedule_sync(topic_partition_log *, sync_request *);
+
+void complete_sync_requests(std::vector<sync_request *> *);
+
+void stop_sync_workers();
+
 void consider_active_partitions();
 
 void gen_create_topic_succ(consul_request *);
@@ -40,8 +100,14 @@ void schedule_cluster_updates_apply(const char *);
 
 void apply_deferred_updates();
 
+void begin_cluster_state_updates();
+
 void apply_cluster_state_updates();
 
+void schedule_partition_repair(topic_partition *);
+
+void repair_cluster_partitions();
+
 void verify_cluster_invariants(topic_partition *p);
 
 void consider_isr(topic_partition *);
@@ -135,14 +201,7 @@ inline bool cluster_aware() const noexcept {
 }
 
 auto get_outgoing_queue() {
-        outgoing_queue *res;
-
-        if (!outgoingQueuesPool.empty()) {
-                res = outgoingQueuesPool.back();
-                outgoingQueuesPool.pop_back();
-        } else {
-                res = new outgoing_queue();
-        }
+        auto res = static_cast<outgoing_queue *>(slabs.alloc(sizeof(outgoing_queue)));
 
         res->reset();
         return res;
@@ -152,6 +211,18 @@ topic *topic_by_name(const strwlen8_t) const;
 
 void release_payload(payload *);
 
+ssize_t send_zerocopy(connection *, struct iovec *, const uint32_t);
+
+void retire_payload(connection *, data_vector_payload *);
+
+bool reap_zerocopy_completions(connection *);
+
+void release_parked_payloads(connection *, const bool);
+
+void linger_zerocopy(connection *);
+
+void consider_lingering_zerocopy();
+
 void put_outgoing_queue(outgoing_queue *);
 
 auto get_buf() {
@@ -160,6 +231,7 @@ auto get_buf() {
 	if (!bufs.empty()) {
 		res = bufs.back();
 		bufs.pop_back();
+		bufs_low_watermark = std::min(bufs_low_watermark, bufs.size());
 	}  else{
 		res = new IOBuffer();
 	}
@@ -187,52 +259,47 @@ void put_repl_stream(repl_stream *s) {
 
 void put_buf(IOBuffer *b) {
         if (b) {
-                if (b->Reserved() > 800 * 1024 || bufs.size() > 16)
+                if (bufs.size() > 256) {
                         delete b;
-                else {
-                        b->clear();
+                } else {
+                        if (b->Reserved() > 64 * 1024) {
+                                // don't hold on to whatever a large request once needed
+                                b->reset();
+                        } else {
+                                b->clear();
+                        }
                         bufs.push_back(b);
                 }
         }
 }
 
+void trim_pools();
+
 file_contents_payload *get_file_contents_payload() {
         file_contents_payload *p;
 
-        if (!reusable_file_contents_payloads.empty()) {
-                p = reusable_file_contents_payloads.back();
-                reusable_file_contents_payloads.pop_back();
-        } else {
-                p      = static_cast<file_contents_payload *>(payloads_allocator.Alloc(sizeof(file_contents_payload)));
-                p->src = payload::Source::FileContents;
-        }
-
+        p      = static_cast<file_contents_payload *>(slabs.alloc(sizeof(file_contents_payload)));
+        p->src = payload::Source::FileContents;
         p->reset();
         return p;
 }
 
 void put_file_contents_payload(file_contents_payload *p) {
 	TANK_EXPECT(p);
-        reusable_file_contents_payloads.emplace_back(p);
+        slabs.release(p, sizeof(file_contents_payload));
 }
 
 data_vector_payload *get_data_vector_payload() {
         data_vector_payload *p;
 
-        if (!reusable_data_vector_payloads.empty()) {
-                p = reusable_data_vector_payloads.back();
-                reusable_data_vector_payloads.pop_back();
-        } else {
-                p      = static_cast<data_vector_payload *>(payloads_allocator.Alloc(sizeof(data_vector_payload)));
-                p->src = payload::Source::DataVector;
-        }
-
+        p      = static_cast<data_vector_payload *>(slabs.alloc(sizeof(data_vector_payload)));
+        p->src = payload::Source::DataVector;
         p->reset();
         return p;
 }
 
 void put_data_vector_payload(data_vector_payload *p) {
-        reusable_data_vector_payloads.emplace_back(p);
+        slabs.release(p, sizeof(data_vector_payload));
 }
 
 connection *get_connection();
@@ -243,6 +310,8 @@ void register_topic(topic *const t) {
         if (false == topics.insert({t->name(), t}).second) {
                 throw Switch::exception("Topic ", t->name(), " already registered");
         }
+
+        topics_list.emplace_back(t);
 }
 
 Switch::shared_refptr<topic_partition> init_local_partition(const uint16_t idx, topic *, const partition_config &, const bool);
@@ -311,26 +380,40 @@ bool process_create_topic(connection *const c, const uint8_t *p, const size_t le
 
 bool process_status(connection *const c, const uint8_t *p, const size_t len);
 
-wait_ctx *get_waitctx(const uint32_t totalPartitions) {
-        TANK_EXPECT(totalPartitions <= sizeof_array(waitCtxPool));
-        auto &v = waitCtxPool[totalPartitions];
+uint8_t create_local_topic(const str_view8, const uint16_t, const partition_config &, const str_view32);
 
-        if (!v.empty()) {
-                auto res = v.back();
+bool process_join_group(connection *const c, const uint8_t *p, const size_t len);
 
-                v.pop_back();
-                return res;
-        } else {
-                return reinterpret_cast<wait_ctx *>(malloc(sizeof(wait_ctx) + totalPartitions * sizeof(wait_ctx_partition)));
-        }
+bool process_commit_offsets(connection *const c, const uint8_t *p, const size_t len);
+
+bool process_fetch_offsets(connection *const c, const uint8_t *p, const size_t len);
+
+consumer_group *consumer_group_by_name(const str_view8, const bool);
+
+topic_partition *consumer_groups_offsets_partition(const bool);
+
+void load_consumer_groups();
+
+void flush_consumer_groups_commits();
+
+IOBuffer *build_consumer_group_resp(const TankAPIMsgType, const uint32_t, const uint8_t);
+
+bool tx_consumer_group_resp(connection *, IOBuffer *);
+
+wait_ctx *get_waitctx(const uint32_t totalPartitions) {
+        TANK_EXPECT(totalPartitions <= TANK_Limits::max_topic_partitions);
+
+        return static_cast<wait_ctx *>(slabs.alloc(sizeof(wait_ctx) + totalPartitions * sizeof(wait_ctx_partition)));
 }
 
 void put_waitctx(wait_ctx *const ctx) {
-        waitCtxPool[ctx->total_partitions].push_back(ctx);
+        slabs.release(ctx, sizeof(wait_ctx) + ctx->total_partitions * sizeof(wait_ctx_partition));
 }
 
 bool process_pending_signals(uint64_t);
 
+void stall_watchdog();
+
 void drain_pubsub_queue();
 
 void fire_timer(timer_node *);
@@ -345,7 +428,7 @@ void wakeup_all_consumers(topic_partition *);
 
 bool register_consumer_wait(const TankAPIMsgType, connection *const c, const uint32_t requestId, const uint64_t maxWait, const uint32_t minBytes, topic_partition **const partitions, const uint32_t totalPartitions);
 
-bool process_produce(const TankAPIMsgType, connection *const c, const uint8_t *p, const size_t len);
+bool process_produce(const TankAPIMsgType, connection *const c, const uint8_t *p, const size_t len, splice_source *src = nullptr);
 
 bool process_msg(connection *const c, const uint8_t msg, const uint8_t *const data, const size_t len);
 
@@ -364,7 +447,9 @@ bool shutdown(connection *const c, const uint32_t ref);
 enum class flushop_res : uint8_t {
         NeedOutAvail,
         Shutdown,
-        Flush
+        Flush,
+        Throttled,
+        Yield
 };
 
 flushop_res flush_file_contents(connection *, payload *, const bool);
@@ -373,10 +458,26 @@ flushop_res flush_iov_impl(connection *, struct iovec *, const uint32_t, const b
 
 bool try_tx(connection *);
 
+void yield_tx(connection *, const tx_class);
+
+void run_tx_sched();
+
 void poll_outavail(connection *);
 
 void stop_poll_outavail(connection *);
 
+void update_poll_events(connection *);
+
+#ifdef HAVE_TANK_TLS
+bool init_tls();
+
+void tear_down_tls();
+
+bool begin_tls_handshake(connection *, const bool);
+
+bool tls_handshake(connection *);
+#endif
+
 void introduce_self(connection *, bool &);
 
 bool handle_consul_flush(connection *const c);
@@ -417,8 +518,24 @@ bool try_recv_consul(connection *);
 
 bool try_recv_prom(connection *);
 
+bool render_prom_metrics(connection *);
+
+void render_pending_prom_metrics();
+
 bool try_recv_tank(connection *);
 
+topic_partition *splice_ingest_partition(const uint8_t, const uint8_t *, const uint8_t *, const uint8_t *);
+
+bool consider_splice_ingest(connection *, const uint8_t, const uint8_t *, const uint8_t *, const uint32_t);
+
+bool try_splice_ingest(connection *, int *);
+
+void abandon_splice_ingest(connection *);
+
+bool open_splice_pipe();
+
+void close_splice_pipe();
+
 bool try_recv_consumer(connection *);
 
 bool try_recv(connection *);
@@ -491,6 +608,8 @@ void abort_peer_connection_local(cluster_node *, connection *);
 
 void replicate_from(cluster_node *, topic_partition *const*, const std::size_t);
 
+void schedule_peer_consume_req(connection *, cluster_node *, topic_partition *const *, const std::size_t);
+
 void try_replicate_from(const std::unordered_set<cluster_node *> &);
 
 void did_abort_repl_stream(cluster_node *);
@@ -521,6 +640,8 @@ void try_replicate_from(cluster_node *);
 
 void isr_dispose(isr_entry *);
 
+void isr_unlink(isr_entry *);
+
 #ifdef HWM_UPDATE_BASED_ON_ACKS
 isr_entry *isr_bind(topic_partition *, cluster_node *, const uint8_t, const uint32_t);
 
@@ -539,6 +660,10 @@ void abort_retry_consume_from(cluster_node *);
 
 void schedule_retry_consume_from(cluster_node *);
 
+void schedule_retry_consume_from(cluster_node *, const uint64_t);
+
+void consider_repl_checksum_mismatch(repl_stream *, const bool);
+
 const std::vector<topic_partition *> *partitions_to_replicate_from(cluster_node *);
 
 void try_abort_replication(topic_partition *, cluster_node *, const uint32_t);
@@ -607,6 +732,24 @@ void update_hwmark(topic_partition *, const topic_partition::Cluster::pending_ac
 
 void update_hwmark(topic_partition *, const uint64_t);
 
+void update_follower_hwmark(topic_partition *, const uint64_t);
+
+client_quota *client_quota_for(const str_view8);
+
+void track_client_quota(connection *, const str_view8, const uint16_t);
+
+void charge_produce_quotas(connection *, const uint32_t, const std::size_t, const produce_response *);
+
+void charge_consume_quotas(connection *, topic *, const std::size_t);
+
+void hold_consume_responses(connection *);
+
+void send_throttle_hint(connection *, const uint32_t, const uint32_t, const bool ahead = false);
+
+void throttle_connection(connection *, const uint32_t, const bool);
+
+void unthrottle_connection(connection *);
+
 
 #ifdef TRACK_ISR_MAX_ACKS
 void update_isr_max_ack(topic_partition *, isr_entry *);
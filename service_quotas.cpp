@@ -0,0 +1,181 @@
+#include "service_common.h"
+
+// Broker-side quotas
+//
+// Clients are identified by the client id they provide in Produce and Consume requests. All connections of clients that identify
+// themselves with the same client id share a produce and a consume token bucket(TANK_CLIENT_PRODUCE_QUOTA and TANK_CLIENT_CONSUME_QUOTA, bytes/sec),
+// and each topic may have its own buckets(quota.produce.bytes_per_sec and quota.consume.bytes_per_sec) shared by all clients.
+//
+// Produced bytes are charged when Produce requests are processed; if that puts any of the involved buckets in debt, we stop
+// reading requests from the connection until it's repaid. Consumed bytes are charged as we stream them(see flush_file_contents()), so
+// that content of deferred Consume responses is accounted for as well; if that puts any bucket in debt, we stop streaming to the connection
+// once the response we are streaming is complete, until it's repaid(see hold_consume_responses()).
+// Either way, clients that understand Throttle messages(client version >= 3) are told how long to back off for.
+//
+// Peers replicating from this node do not identify themselves with a client id, and are never throttled.
+client_quota *Service::client_quota_for(const str_view8 client_id) {
+        // so that clients using random client ids won't make us track too many of them
+        static constexpr std::size_t max_tracked_clients{64 * 1024};
+        auto &                       clients = quotas.clients;
+        std::string                  k(client_id.data(), client_id.size());
+
+        if (auto it = clients.find(k); it != clients.end()) {
+                return it->second.get();
+        } else if (clients.size() >= max_tracked_clients) {
+                k.clear();
+
+                if (auto it = clients.find(k); it != clients.end()) {
+                        return it->second.get();
+                }
+        }
+
+        auto res = clients.emplace(std::move(k), std::make_unique<client_quota>());
+
+        return res.first->second.get();
+}
+
+// Invoked by process_produce() and process_consume() for client requests
+void Service::track_client_quota(connection *const c, const str_view8 client_id, const uint16_t client_version) {
+        TANK_EXPECT(c->type == connection::Type::TankClient);
+        auto &t = c->as.tank;
+
+        if (!t.quota) {
+                t.quota          = client_quota_for(client_id);
+                t.throttle_hints = client_version >= 3;
+        }
+}
+
+void Service::charge_produce_quotas(connection *const c, const uint32_t request_id, const std::size_t len, const produce_response *const pr) {
+        auto     q = c->as.tank.quota;
+        uint32_t delay{0};
+
+        TANK_EXPECT(q);
+
+        delay = q->produce.charge(quotas.client_produce_rate, now_ms, len);
+
+        for (const auto &it : pr->participants) {
+                if (auto t = it.topic) {
+                        if (const auto d = t->quotas.produce.charge(t->partitionConf.produceQuota, now_ms, it.update.bundle.size())) {
+                                ++t->metrics.produce_throttled;
+                                delay = std::max(delay, d);
+                        }
+                }
+        }
+
+        if (delay) {
+                ++quotas.produce_throttled;
+                quotas.produce_throttle_ms += delay;
+                throttle_connection(c, delay, false);
+                send_throttle_hint(c, request_id, delay);
+        }
+}
+
+// Invoked by flush_file_contents() for every n bytes of topic t content streamed to the client connection c
+void Service::charge_consume_quotas(connection *const c, topic *const t, const std::size_t n) {
+        auto q     = c->as.tank.quota;
+        auto delay = q->consume.charge(quotas.client_consume_rate, now_ms, n);
+
+        if (const auto d = t->quotas.consume.charge(t->partitionConf.consumeQuota, now_ms, n)) {
+                ++t->metrics.consume_throttled;
+                delay = std::max(delay, d);
+        }
+
+        if (delay) {
+                ++quotas.consume_throttled;
+                quotas.consume_throttle_ms += delay;
+                throttle_connection(c, delay, true);
+        }
+}
+
+// Invoked by flush_file_contents() when it completes streaming a response to a connection that was throttled while streaming it.
+// A Throttle message can't be interleaved with a response's content, which is why we don't hold back in the middle of one. The hint
+// is queued ahead of whatever else is queued, so that the client is told right away, and we stop streaming consumed content
+// (but not the headers of responses queued before it) until unthrottle_connection()
+void Service::hold_consume_responses(connection *const c) {
+        auto &t = c->as.tank.throttle;
+
+        t.hold = true;
+        if (t.write_until > now_ms) {
+                send_throttle_hint(c, t.consume_request_id, t.write_until - now_ms, true);
+        }
+}
+
+// If ahead is set, the hint is queued ahead of any other queued payloads; the front payload must not have been partially sent
+void Service::send_throttle_hint(connection *const c, const uint32_t request_id, const uint32_t delay_ms, const bool ahead) {
+        if (!c->as.tank.throttle_hints) {
+                return;
+        }
+
+        auto b       = get_buf();
+        auto payload = get_data_vector_payload();
+        auto q       = c->outQ ?: (c->outQ = get_outgoing_queue());
+
+        b->pack(static_cast<uint8_t>(TankAPIMsgType::Throttle));
+        b->pack(static_cast<uint32_t>(sizeof(uint32_t) + sizeof(uint32_t)));
+        b->pack(request_id, delay_ms);
+
+        if (ahead) {
+                q->push_front(payload);
+        } else {
+                q->push_back(payload);
+        }
+        payload->buf     = b;
+        payload->iov_cnt = 1;
+        payload->iov[0]  = {static_cast<void *>(b->data()), b->size()};
+}
+
+// If consume is set, we 'll stop streaming consumed content to the connection(see tx()), otherwise we 'll stop reading requests from it
+void Service::throttle_connection(connection *const c, const uint32_t delay_ms, const bool consume) {
+        auto &     t     = c->as.tank.throttle;
+        const auto until = now_ms + delay_ms;
+
+        if (consume) {
+                t.write_until = std::max(t.write_until, until);
+        } else {
+                const auto was_reading = !t.read_until;
+
+                t.read_until = std::max(t.read_until, until);
+                if (was_reading) {
+                        update_poll_events(c);
+                }
+        }
+
+        const auto next = std::min(t.read_until ?: std::numeric_limits<uint64_t>::max(),
+                                   t.write_until ?: std::numeric_limits<uint64_t>::max());
+
+        if (!t.timer.is_linked() || t.timer.node.key != next) {
+                cancel_timer(&t.timer.node);
+                t.timer.node.key = next;
+                register_timer(&t.timer.node);
+        }
+}
+
+// Invoked when the connection's throttle timer fires
+void Service::unthrottle_connection(connection *const c) {
+        auto &t = c->as.tank.throttle;
+
+        if (t.read_until && t.read_until <= now_ms) {
+                t.read_until = 0;
+                update_poll_events(c);
+
+                // try_recv_tank() may have stopped processing requests with more in the input buffer
+                if (c->inB && !try_recv_tank(c)) {
+                        return;
+                }
+        }
+
+        if (t.write_until && t.write_until <= now_ms) {
+                t.write_until = 0;
+                t.hold        = false;
+                if (!try_tx(c)) {
+                        return;
+                }
+        }
+
+        if (const auto next = std::min(t.read_until ?: std::numeric_limits<uint64_t>::max(),
+                                       t.write_until ?: std::numeric_limits<uint64_t>::max());
+            next != std::numeric_limits<uint64_t>::max()) {
+                t.timer.node.key = next;
+                register_timer(&t.timer.node);
+        }
+}
@@ -1,5 +1,11 @@
 #include "service_common.h"
+#include <execinfo.h>
 #include <sched.h>
+#ifdef HAVE_TANK_TLS
+#include <openssl/ssl.h>
+#endif
+
+extern hdr_histogram<true> fsync_latency;
 
 static constexpr bool trace_idle{false};
 static constexpr bool trace_timers{false};
@@ -33,8 +39,20 @@ void Service::begin_reactor_loop_iteration() {
 
         gc_waitctx_deferred();
 
-        if (next_cluster_state_apply == std::numeric_limits<uint64_t>::max()) {
-                // only if not postponed
+#ifndef HWM_UPDATE_BASED_ON_ACKS
+        // peers acks collected in the previous iteration
+        process_dirty_partitions_acks();
+#endif
+
+        // all commits accepted in the previous iteration are appended as a single bundle
+        flush_consumer_groups_commits();
+
+        if (!prom_pending_render.empty()) {
+                render_pending_prom_metrics();
+        }
+
+        if (next_cluster_state_apply == std::numeric_limits<uint64_t>::max() || next_cluster_state_apply_slice <= now_ms || next_cluster_repairs_slice <= now_ms) {
+                // only if not postponed, or if partitions updates or repairs are still pending
                 apply_deferred_updates();
         }
 
@@ -175,34 +193,105 @@ void Service::consider_deferred_produce_responses() {
         }
 }
 
+void reactor_profiler::track_op(const uint64_t duration, const uint64_t now_ms) noexcept {
+        if (duration < slow_op_threshold) {
+                return;
+        }
+
+        static constexpr auto by_duration = [](const slow_op &a, const slow_op &b) noexcept {
+                return a.duration > b.duration;
+        };
+        const auto d = std::min<uint64_t>(duration, std::numeric_limits<uint32_t>::max());
+
+        ++slow_ops_total;
+        if (slow_ops_cnt == sizeof_array(slow_ops)) {
+                if (d <= slow_ops[0].duration) {
+                        return;
+                }
+
+                std::pop_heap(slow_ops, slow_ops + slow_ops_cnt, by_duration);
+                --slow_ops_cnt;
+        }
+
+        auto &op = slow_ops[slow_ops_cnt++];
+
+        op.ts       = now_ms;
+        op.duration = d;
+        op.phase    = cur.phase;
+        op.msg      = cur.msg;
+        op.fd       = cur.fd;
+
+        if (const auto p = cur.partition) {
+                const auto name = p->owner->name();
+
+                op.topic_len = std::min<size_t>(name.size(), sizeof(op.topic));
+                op.partition = p->idx;
+                memcpy(op.topic, name.data(), op.topic_len);
+        } else {
+                op.topic_len = 0;
+                op.partition = 0;
+        }
+
+        std::push_heap(slow_ops, slow_ops + slow_ops_cnt, by_duration);
+}
+
+// Runs in its own thread, and if the reactor thread has been busy with the same loop iteration
+// for longer than profiler.stall_threshold_ms, it signals it so that it captures its stack, which is then
+// written to stderr here. It is only reported once per iteration.
+void Service::stall_watchdog() {
+        const auto threshold = Timings::Milliseconds::ToMicros(profiler.stall_threshold_ms);
+        uint64_t   last_reported{0};
+
+        while (!profiler.watchdog_stop.load(std::memory_order_relaxed)) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(std::clamp<uint32_t>(profiler.stall_threshold_ms / 4, 1, 50)));
+
+                const auto start = profiler.iteration_start.load(std::memory_order_relaxed);
+
+                if (!start || start == last_reported || Timings::Microseconds::Since(start) < threshold) {
+                        continue;
+                }
+
+                last_reported = start;
+                profiler.stalls.fetch_add(1, std::memory_order_relaxed);
+                profiler.stall_frames_cnt.store(0, std::memory_order_relaxed);
+                pthread_kill(main_thread_id, SIGUSR2);
+
+                // give it a chance to capture it
+                for (uint32_t i{0}; i < 100 && !profiler.stall_frames_cnt.load(std::memory_order_acquire); ++i) {
+                        std::this_thread::sleep_for(std::chrono::microseconds(100));
+                }
+
+                const auto cnt = profiler.stall_frames_cnt.load(std::memory_order_acquire);
+
+                Print("Reactor stalled: iteration running for ", duration_repr(Timings::Microseconds::Since(start)),
+                      ", phase ", reactor_profiler::phase_name(profiler.cur.phase), "\n");
+                if (cnt > 0) {
+                        backtrace_symbols_fd(profiler.stall_frames, cnt, STDERR_FILENO);
+                }
+        }
+}
+
 int Service::reactor_main() {
+        using phase = reactor_profiler::Phase;
         unsigned iterations{0};
 
-#define _TRACE_EXPENSIVE 1
         now_ms = Timings::Milliseconds::Tick();
 
-#ifdef _TRACE_EXPENSIVE
-        uint64_t _start;
-#endif
-
         reactor_state = ReactorState::Active;
         curTime       = time(nullptr);
+        profiler.iteration_start.store(Timings::Microseconds::Tick(), std::memory_order_relaxed);
         for (uint64_t next_curtime_update{0}; reactor_state != ReactorState::Idle;) {
                 if (now_ms > next_cluster_state_apply) {
                         next_cluster_state_apply = std::numeric_limits<uint64_t>::max();
                 }
 
-#ifdef _TRACE_EXPENSIVE
-                _start = Timings::Microseconds::Tick();
-#endif
+                auto ts = profiler.begin_phase(phase::Deferred);
 
                 begin_reactor_loop_iteration();
 
-#ifdef _TRACE_EXPENSIVE
-                if (const auto delta = Timings::Microseconds::Since(_start); delta > Timings::Seconds::ToMicros(1)) {
-                        SLog("Took ", duration_repr(delta), " for op\n");
-                }
-#endif
+                ts = profiler.track_phase(phase::Deferred, ts, now_ms);
+                profiler.iterations.reg_sample(ts - profiler.iteration_start.load(std::memory_order_relaxed));
+                profiler.iteration_start.store(0, std::memory_order_relaxed);
 
                 // determine how long to wait, account for the next timer/event timestamp
                 const auto wait_until = TANKUtil::minimum(
@@ -214,7 +303,13 @@ int Service::reactor_main() {
                     timers_ebtree_next,
                     consul_state.active_conns_next_process_ts,
                     next_cluster_state_apply,
+                    next_cluster_state_apply_slice,
+                    next_cluster_repairs_slice,
                     next_active_partitions_check,
+                    next_pools_trim,
+                    zerocopy.lingering_next,
+                    prom_pending_render.empty() ? std::numeric_limits<uint64_t>::max() : now_ms,
+                    tx_sched.any_ready() ? now_ms : std::numeric_limits<uint64_t>::max(),
                     now_ms + 30 * 1000);
 
                 sleeping.store(true, std::memory_order_relaxed);
@@ -231,6 +326,9 @@ int Service::reactor_main() {
                              :
                              : "memory");
 
+                ts = profiler.track_phase(phase::Poll, ts, now_ms, false);
+                profiler.iteration_start.store(ts, std::memory_order_relaxed);
+
                 now_ms = Timings::Milliseconds::Tick();
                 if (++iterations == 10) {
                         // be kind
@@ -257,105 +355,77 @@ int Service::reactor_main() {
                                 IMPLEMENT_ME();
                         }
                 } else if (r) {
-#ifdef _TRACE_EXPENSIVE
-                        _start = Timings::Microseconds::Tick();
-#endif
+                        ts = Timings::Microseconds::Tick();
+
                         if (const auto res = process_io(r, max_conngen_process)) {
                                 return res;
                         }
 
-#ifdef _TRACE_EXPENSIVE
-                        if (const auto delta = Timings::Microseconds::Since(_start); delta > Timings::Seconds::ToMicros(1)) {
-                                SLog("Took ", duration_repr(delta), " for op\n");
-                        }
-#endif
+                        // I/O events are tracked individually; see process_io()
+                        profiler.track_phase(phase::IO, ts, now_ms, false);
                 }
 
                 if (now_ms >= timers_ebtree_next) {
-#ifdef _TRACE_EXPENSIVE
-                        _start = Timings::Microseconds::Tick();
-#endif
-
+                        ts = profiler.begin_phase(phase::Timers);
                         process_timers();
+                        profiler.track_phase(phase::Timers, ts, now_ms);
+                }
+
+                if (now_ms >= next_idle_check_ts || now_ms >= next_active_partitions_check || now_ms >= next_pools_trim || now_ms >= zerocopy.lingering_next) {
+                        ts = profiler.begin_phase(phase::Maintenance);
 
-#ifdef _TRACE_EXPENSIVE
-                        if (const auto delta = Timings::Microseconds::Since(_start); delta > Timings::Seconds::ToMicros(1)) {
-                                SLog("Took ", duration_repr(delta), " for op\n");
+                        if (now_ms >= next_idle_check_ts) {
+                                consider_idle_conns();
                         }
-#endif
-                }
 
-                if (now_ms >= next_idle_check_ts) {
-                        consider_idle_conns();
-                }
+                        if (now_ms >= next_active_partitions_check) {
+                                consider_active_partitions();
+                        }
 
-                if (now_ms >= next_active_partitions_check) {
-                        consider_active_partitions();
+                        if (now_ms >= next_pools_trim) {
+                                trim_pools();
+                        }
+
+                        if (now_ms >= zerocopy.lingering_next) {
+                                consider_lingering_zerocopy();
+                        }
+
+                        profiler.track_phase(phase::Maintenance, ts, now_ms);
                 }
 
                 if (now_ms >= consul_state.active_conns_next_process_ts) {
-#ifdef _TRACE_EXPENSIVE
-                        _start = Timings::Microseconds::Tick();
-#endif
-
+                        ts = profiler.begin_phase(phase::Consul);
                         consider_long_running_active_consul_requests();
-
-#ifdef _TRACE_EXPENSIVE
-                        if (const auto delta = Timings::Microseconds::Since(_start); delta > Timings::Seconds::ToMicros(1)) {
-                                SLog("Took ", duration_repr(delta), " for op\n");
-                        }
-#endif
+                        profiler.track_phase(phase::Consul, ts, now_ms);
                 }
 
                 if (now_ms >= isr_pending_ack_list_next) {
-#ifdef _TRACE_EXPENSIVE
-                        _start = Timings::Microseconds::Tick();
-#endif
-
+                        ts = profiler.begin_phase(phase::ISR);
                         consider_isr_pending_ack();
-
-#ifdef _TRACE_EXPENSIVE
-                        if (const auto delta = Timings::Microseconds::Since(_start); delta > Timings::Seconds::ToMicros(1)) {
-                                SLog("Took ", duration_repr(delta), " for op\n");
-                        }
-#endif
+                        profiler.track_phase(phase::ISR, ts, now_ms);
                 }
 
                 if (now_ms >= deferred_produce_responses_next_expiration) {
-#ifdef _TRACE_EXPENSIVE
-                        _start = Timings::Microseconds::Tick();
-#endif
-
+                        ts = profiler.begin_phase(phase::DeferredResponses);
                         consider_deferred_produce_responses();
-
-#ifdef _TRACE_EXPENSIVE
-                        if (const auto delta = Timings::Microseconds::Since(_start); delta > Timings::Seconds::ToMicros(1)) {
-                                SLog("Took ", duration_repr(delta), " for op\n");
-                        }
-#endif
+                        profiler.track_phase(phase::DeferredResponses, ts, now_ms);
                 }
 
                 if (now_ms >= scheduled_consume_retries_list_next) {
-#ifdef _TRACE_EXPENSIVE
-                        _start = Timings::Microseconds::Tick();
-#endif
-
+                        ts = profiler.begin_phase(phase::ConsumeRetries);
                         consider_scheduled_consume_retries();
+                        profiler.track_phase(phase::ConsumeRetries, ts, now_ms);
+                }
 
-#ifdef _TRACE_EXPENSIVE
-                        if (const auto delta = Timings::Microseconds::Since(_start); delta > Timings::Seconds::ToMicros(1)) {
-                                SLog("Took ", duration_repr(delta), " for op\n");
-                        }
-#endif
+                if (tx_sched.any_ready()) {
+                        ts = profiler.begin_phase(phase::IO);
+                        run_tx_sched();
+                        profiler.track_phase(phase::IO, ts, now_ms, false);
                 }
         }
 
         tear_down();
 
-#ifdef _TRACE_EXPENSIVE
-#undef _TRACE_EXPENSIVE
-#endif
-
         Print("TANK terminated\n");
         return 0;
 }
@@ -391,9 +461,17 @@ connection *Service::get_connection() {
         c->state.set_classsification(connection::ClassificationTracker::Type::NotClassified);
         c->outQ = nullptr;
         c->inB  = nullptr;
+        c->tls  = nullptr;
 
         c->classification.ll.reset();
         c->connectionsList.reset();
+        c->tx_sched.ll.reset();
+        c->tx_sched.deficit = 0;
+        c->tx_sched.active  = false;
+        c->zc.issued       = 0;
+        c->zc.completed    = 0;
+        c->zc.parked_front = nullptr;
+        c->zc.parked_back  = nullptr;
 
         allConnections.push_back(&c->connectionsList);
         return c;
@@ -420,6 +498,15 @@ bool Service::expected_connest(connection *c) {
                 }
 
                 c->state.flags &= ~(1u << unsigned(connection::State::Flags::NeedOutAvail));
+
+#ifdef HAVE_TANK_TLS
+                if (tls_client_ctx && !(c->state.flags & (1u << unsigned(connection::State::Flags::SecureChannel)))) {
+                        // we 'll get here again once the handshake is complete; see tls_handshake()
+                        begin_tls_handshake(c, true);
+                        return true;
+                }
+#endif
+
                 c->as.consumer.state = connection::As::Consumer::State::Idle;
                 poller.set_data_events(c->fd, c, EPOLLIN);
                 cancel_timer(&c->as.consumer.attached_timer.node);
@@ -440,7 +527,7 @@ bool Service::expected_connest(connection *c) {
                         }
                 }
 
-                poller.set_data_events(c->fd, c, EPOLLIN);
+                update_poll_events(c);
                 return false;
         }
 }
@@ -495,12 +582,32 @@ int Service::process_io(const int r, const uint64_t max_conn_gen) {
                 const auto events = it->events;
 
                 if (events & (EPOLLHUP | EPOLLERR)) {
-                        shutdown(c, __LINE__);
-                        continue;
+                        // MSG_ZEROCOPY completions are reported with EPOLLERR as well
+                        if ((events & EPOLLHUP) || c->zc.issued == c->zc.completed) {
+                                shutdown(c, __LINE__);
+                                continue;
+                        } else if (!reap_zerocopy_completions(c)) {
+                                continue;
+                        }
                 }
 
                 c->verify();
 
+                // each I/O event is tracked as an operation, so that slow ones can be attributed to
+                // a connection, and a request type/partition if we processed any(see reactor_profiler::cur)
+                const auto op_start = Timings::Microseconds::Tick();
+
+                profiler.begin_op(reactor_profiler::Phase::IO, c->fd);
+
+#ifdef HAVE_TANK_TLS
+                if (c->tls) {
+                        // see service_tls.cpp
+                        tls_handshake(c);
+                        profiler.track_op(Timings::Microseconds::Since(op_start), now_ms);
+                        continue;
+                }
+#endif
+
                 // we are checking for EPOLLOUT first as opposed to checking events for
                 // EPOLLIN first, because this helps with connection::Type::Consumer connections
                 // where we need to check if the connection is established, and we do that in
@@ -515,6 +622,7 @@ int Service::process_io(const int r, const uint64_t max_conn_gen) {
                 if (events & EPOLLOUT) {
                         if (false == expected_connest(c)) {
                                 if (!tx(c)) {
+                                        profiler.track_op(Timings::Microseconds::Since(op_start), now_ms);
                                         continue;
                                 }
                         }
@@ -525,6 +633,8 @@ int Service::process_io(const int r, const uint64_t max_conn_gen) {
 
                         try_recv(c);
                 }
+
+                profiler.track_op(Timings::Microseconds::Since(op_start), now_ms);
         }
 
         return 0;
@@ -1045,6 +1155,15 @@ void Service::fire_timer(timer_node *const ctx) {
                         cleanup_scheduled_logs();
                         break;
 
+                case timer_node::ContainerType::ThrottledConn: {
+                        auto c = containerof(connection, as.tank.throttle.timer, ctx);
+
+                        TANK_EXPECT(c->type == connection::Type::TankClient);
+                        c->verify();
+
+                        unthrottle_connection(c);
+                } break;
+
                 default:
                         IMPLEMENT_ME();
                         break;
@@ -1138,6 +1257,33 @@ void Service::schedule_retry_consume_from(cluster_node *n) {
         scheduled_consume_retries_list_next = std::min(scheduled_consume_retries_list_next, n->consume_retry_ctx.when);
 }
 
+// Retry consuming from `n` no later than `when`; used when we back off replicating a partition from `n`(see consider_repl_checksum_mismatch())
+// Unlike schedule_retry_consume_from(cluster_node *), the retry times are not monotonic, so we need to keep the list sorted by time
+void Service::schedule_retry_consume_from(cluster_node *n, const uint64_t when) {
+        TANK_EXPECT(n);
+        auto &ctx = n->consume_retry_ctx;
+
+        if (!ctx.ll.empty()) {
+                if (ctx.when <= when) {
+                        // already scheduled earlier
+                        return;
+                }
+
+                ctx.ll.detach_and_reset();
+        }
+
+        // scheduled_consume_retries_list.prev is the earliest
+        auto it = scheduled_consume_retries_list.prev;
+
+        while (it != &scheduled_consume_retries_list && switch_list_entry(cluster_node, consume_retry_ctx.ll, it)->consume_retry_ctx.when <= when) {
+                it = it->prev;
+        }
+
+        it->push_back(&ctx.ll);
+        ctx.when                            = when;
+        scheduled_consume_retries_list_next = std::min(scheduled_consume_retries_list_next, when);
+}
+
 void Service::cleanup_connection(connection *const c, [[maybe_unused]] const uint32_t ref) {
         static constexpr bool trace{false};
         TANK_EXPECT(c);
@@ -1146,7 +1292,12 @@ void Service::cleanup_connection(connection *const c, [[maybe_unused]] const uin
         c->verify();
 
         poller.erase(c->fd);
-        TANKUtil::safe_close(c->fd);
+        if (c->zc.issued != c->zc.completed) {
+                // the kernel may still be sending from our payloads
+                linger_zerocopy(c);
+        } else {
+                TANKUtil::safe_close(c->fd);
+        }
         c->fd = -1;
 
         switch (c->type) {
@@ -1196,7 +1347,10 @@ void Service::cleanup_connection(connection *const c, [[maybe_unused]] const uin
 
                 // depending on the type, we may have more work to do
                 case connection::Type::Prometheus: {
-                        //
+                        if (c->as.prometheus.pending_render) {
+                                prom_pending_render.erase(std::find(prom_pending_render.begin(), prom_pending_render.end(), c));
+                                c->as.prometheus.pending_render = false;
+                        }
                 } break;
 
                 case connection::Type::ConsulClient: {
@@ -1307,6 +1461,9 @@ void Service::cleanup_connection(connection *const c, [[maybe_unused]] const uin
                                 complete_deferred_produce_response(pr);
                         }
 
+                        cancel_parked_requests(c);
+                        cancel_timer(&c->as.tank.throttle.timer.node);
+
                         // For simplicity, place in a vector and drain it instead
                         expiredCtxList.clear();
                         for (auto it = c->as.tank.waitCtxList.next; it != &c->as.tank.waitCtxList; it = it->next) {
@@ -1345,6 +1502,13 @@ void Service::cleanup_connection(connection *const c, [[maybe_unused]] const uin
 
         // no longer tracked in allConnections
         c->connectionsList.detach_and_reset();
+        c->tx_sched.ll.try_detach_and_reset();
+
+#ifdef HAVE_TANK_TLS
+        if (auto ssl = std::exchange(c->tls, nullptr)) {
+                SSL_free(ssl);
+        }
+#endif
 
         // Release input/output resources
         if (auto b = std::exchange(c->inB, nullptr)) {
@@ -1355,6 +1519,9 @@ void Service::cleanup_connection(connection *const c, [[maybe_unused]] const uin
                 put_outgoing_queue(q);
         }
 
+        // no sends are pending; linger_zerocopy() would have taken them over otherwise
+        release_parked_payloads(c, true);
+
         // release the connection -- will be reused
         // as of the next reactor loop iteration
         put_connection(c);
@@ -1393,18 +1560,26 @@ bool Service::shutdown(connection *const c, const uint32_t ref) {
 
 void Service::stop_poll_outavail(connection *c) {
         if (c->state.flags & (1u << uint8_t(connection::State::Flags::NeedOutAvail))) {
-                poller.set_data_events(c->fd, c, EPOLLIN);
                 c->state.flags &= ~(1u << uint8_t(connection::State::Flags::NeedOutAvail));
+                update_poll_events(c);
         }
 }
 
 void Service::poll_outavail(connection *const c) {
         if (0 == (c->state.flags & (1u << uint8_t(connection::State::Flags::NeedOutAvail)))) {
                 c->state.flags |= (1u << uint8_t(connection::State::Flags::NeedOutAvail));
-                poller.set_data_events(c->fd, c, EPOLLIN | EPOLLOUT);
+                update_poll_events(c);
         }
 }
 
+// we don't poll for input while we are not reading requests from a throttled client connection; see throttle_connection()
+void Service::update_poll_events(connection *const c) {
+        const bool read   = c->type != connection::Type::TankClient || !c->as.tank.throttle.read_until;
+        const bool outavl = c->state.flags & (1u << uint8_t(connection::State::Flags::NeedOutAvail));
+
+        poller.set_data_events(c->fd, c, (read ? uint32_t(EPOLLIN) : uint32_t(0)) | (outavl ? uint32_t(EPOLLOUT) : uint32_t(0)));
+}
+
 void Service::release_payload(payload *const p) {
         TANK_EXPECT(p);
 
@@ -1426,6 +1601,14 @@ void Service::release_payload(payload *const p) {
                                 fdh->Release();
                         }
 
+                        if (auto partition = fh_p->tracker.src_partition) {
+                                partition->metrics.outq_payloads--;
+                        }
+
+                        if (auto chunk = std::exchange(fh_p->chunk, nullptr)) {
+                                chunk->Release();
+                        }
+
                         put_file_contents_payload(fh_p);
                 } break;
         }
@@ -1441,17 +1624,15 @@ void Service::release_payload(payload *const p) {
 Service::flushop_res Service::flush_file_contents(connection *const c,
                                                   payload *const    payload,
                                                   const bool        have_cork) {
-        // TODO(markp): transmit_threshold should probably be computed dynamically based on current approximate load and other signals
-        static constexpr bool        trace{false};
-        static constexpr std::size_t transmit_threshold{24 * 1024 * 1024};
+        static constexpr bool trace{false};
         TANK_EXPECT(c);
         TANK_EXPECT(payload);
         TANK_EXPECT(payload->src == payload::Source::FileContents);
 
-        auto &      it = *static_cast<file_contents_payload *>(payload);
-        int         fd = c->fd;
-        auto        q  = c->outQ;
-        std::size_t transmitted{0};
+        auto &      it    = *static_cast<file_contents_payload *>(payload);
+        int         fd    = c->fd;
+        auto        q     = c->outQ;
+        auto &      sched = c->tx_sched;
 
         q->verify();
 
@@ -1461,6 +1642,22 @@ Service::flushop_res Service::flush_file_contents(connection *const c,
         TANK_EXPECT(it.file_range.fdhandle);
         TANK_EXPECT(it.file_range.range.size());
 
+        const bool charge = c->type == connection::Type::TankClient && c->as.tank.quota;
+
+        if (charge && c->as.tank.throttle.hold) {
+                // unthrottle_connection() will resume streaming
+                return flushop_res::Throttled;
+        }
+
+        if (!sched.active) {
+                // begins streaming; joins the current round
+                sched.active  = true;
+                sched.deficit = tx_sched_quantum * tx_sched.weights[size_t(it.cls)];
+        } else if (!sched.deficit) {
+                yield_tx(c, it.cls);
+                return flushop_res::Yield;
+        }
+
         if (trace) {
                 SLog("About to transfer ", it.file_range.range, "\n");
         }
@@ -1476,15 +1673,27 @@ Service::flushop_res Service::flush_file_contents(connection *const c,
                 // if we have neglected other connections for too long.
                 //
                 // https://github.com/phaistos-networks/TANK/issues/14#issuecomment-301000261
-                const auto outLen = std::min<size_t>(range.len, maxSpan);
+                const auto outLen = std::min<size_t>({range.len, maxSpan, sched.deficit});
+
+                ssize_t    r;
 
+                if (const auto chunk = it.chunk) {
+                        // from the partition's hot tail; see topic_partition_log::hot_tail
+                        r = write(fd, chunk->data + (range.offset - chunk->base), outLen);
+                        if (r > 0) {
+                                hot_tail_bytes_out += r;
+                        }
+                } else {
 #ifdef HAVE_SENDFILE64
-                off64_t    offset = range.offset;
-                const auto r      = sendfile64(fd, it.file_range.fdhandle->fd, &offset, outLen);
+                        off64_t offset = range.offset;
+
+                        r = sendfile64(fd, it.file_range.fdhandle->fd, &offset, outLen);
 #else
-                off_t      offset = range.offset;
-                const auto r      = sendfile(fd, it.file_range.fdhandle->fd, &offset, outLen);
+                        off_t offset = range.offset;
+
+                        r = sendfile(fd, it.file_range.fdhandle->fd, &offset, outLen);
 #endif
+                }
 
                 sum += Timings::Microseconds::Since(before);
 
@@ -1504,16 +1713,24 @@ Service::flushop_res Service::flush_file_contents(connection *const c,
 
                                 return flushop_res::NeedOutAvail;
                         } else {
-                                track_shutdown(c, __LINE__, "sendfile() failed: ", strerror(errno), " for ", outLen, "\n");
+                                track_shutdown(c, __LINE__, it.chunk ? "write() failed: " : "sendfile() failed: ", strerror(errno), " for ", outLen, "\n");
                                 shutdown(c, __LINE__);
                                 return flushop_res::Shutdown;
                         }
                 } else {
                         range.len -= r;
                         range.offset += r;
+                        sched.deficit -= r;
+                        tx_sched.bytes_out[size_t(it.cls)] += r;
 
                         if (it.tracker.since) {
                                 it.tracker.src_topic->metrics.bytes_out += r;
+                                it.tracker.src_partition->metrics.bytes_out += r;
+                                it.tracker.src_partition->metrics.bytes_out_rate.reg(now_ms / 1000, r);
+                        }
+
+                        if (charge && it.tracker.src_topic) {
+                                charge_consume_quotas(c, it.tracker.src_topic, r);
                         }
 
                         if (0 == range.len) {
@@ -1539,7 +1756,17 @@ Service::flushop_res Service::flush_file_contents(connection *const c,
 
                                 q->pop_front_expected(payload);
                                 release_payload(payload);
+
+                                // the content of a response is streamed by consecutive file contents payloads
+                                if (charge && c->as.tank.throttle.write_until && !c->as.tank.throttle.hold &&
+                                    (!q->front() || q->front()->src != payload::Source::FileContents)) {
+                                        hold_consume_responses(c);
+                                }
                                 return flushop_res::Flush;
+                        } else if (!sched.deficit) {
+                                // quantum exhausted; give other connections a chance
+                                yield_tx(c, it.cls);
+                                return flushop_res::Yield;
                         }
 
                         if (r < outLen) {
@@ -1555,7 +1782,6 @@ Service::flushop_res Service::flush_file_contents(connection *const c,
                                 return flushop_res::NeedOutAvail;
                         }
 
-                        transmitted += r;
 #if 1
                         if (sum > 2'000)
 #else
@@ -1571,21 +1797,7 @@ Service::flushop_res Service::flush_file_contents(connection *const c,
                                 // clients and their connections can be served.
                                 // https://github.com/phaistos-networks/TANK/issues/14#issuecomment-301442619
                                 if (trace) {
-                                        SLog("Bailing, transmitted ", transmitted, " but spent ", sum, " ", duration_repr(sum), "\n");
-                                }
-
-                                return flushop_res::NeedOutAvail;
-                        }
-
-                        if (unlikely(transmitted > transmit_threshold)) {
-                                // Be fair to all other connections, and see if we have any connections in the listen queue for accept4()
-                                // We tansferred too much data already.
-                                //
-                                // The only downside is the overhead epoll_ctl() call(see poll_outavail() impl.)
-                                // and that if there are no other consumers/producers this is not going to produce any benefits.
-                                // https://github.com/phaistos-networks/TANK/issues/14#issuecomment-301000261
-                                if (trace) {
-                                        SLog("Transmitted too much data\n");
+                                        SLog("Bailing, deficit ", sched.deficit, " but spent ", sum, " ", duration_repr(sum), "\n");
                                 }
 
                                 return flushop_res::NeedOutAvail;
@@ -1604,12 +1816,26 @@ Service::flushop_res Service::flush_iov_impl(connection *const   c,
 
         const auto fd = c->fd;
         auto       q  = c->outQ;
+        bool       zc{false};
 
         TANK_EXPECT(q);
         TANK_EXPECT(fd > 2);
         TANK_EXPECT(iovCnt);
         q->verify();
 
+        // see Service::zerocopy
+        // we don't bother if we are going to shut down the connection once we are done; we 'd need to hold on to the payloads
+        if ((c->state.flags & ((1u << uint8_t(connection::State::Flags::ZeroCopy)) | (1u << uint8_t(connection::State::Flags::DrainingForShutdown)))) ==
+            (1u << uint8_t(connection::State::Flags::ZeroCopy))) {
+                size_t n{0};
+
+                for (uint32_t i{0}; i < iovCnt; ++i) {
+                        n += iov[i].iov_len;
+                }
+
+                zc = n >= zerocopy.threshold;
+        }
+
         if (trace) {
                 SLog(ansifmt::bold, ansifmt::color_magenta, ansifmt::inverse, "FLUSHING ", iovCnt,
                      " ivecs", ansifmt::reset, " to ", fd, "\n");
@@ -1622,7 +1848,7 @@ Service::flushop_res Service::flush_iov_impl(connection *const   c,
 
                 TANK_EXPECT(iovCnt);
 
-                auto r = writev(fd, iov, iovCnt);
+                auto r = zc ? send_zerocopy(c, iov, iovCnt) : writev(fd, iov, iovCnt);
 
                 if (trace) {
                         SLog("writev() => ", r, "\n");
@@ -1687,7 +1913,7 @@ Service::flushop_res Service::flush_iov_impl(connection *const   c,
 
                                         q->verify();
 
-                                        release_payload(it);
+                                        retire_payload(c, it);
 
                                         q->verify();
 
@@ -1743,12 +1969,52 @@ bool Service::handle_flush(connection *const c) {
                 case connection::Type::ConsulClient:
                         return handle_consul_flush(c);
 
+                case connection::Type::Prometheus:
+                        if (auto &state = c->as.prometheus; state.stage != connection::As::Prometheus::Stage::Idle) {
+                                // render the next slice in the next reactor loop iteration
+                                if (!state.pending_render) {
+                                        state.pending_render = true;
+                                        prom_pending_render.emplace_back(c);
+                                }
+                                return true;
+                        }
+
+                        try_make_idle(c);
+                        return true;
+
                 default:
                         try_make_idle(c);
                         return true;
         }
 }
 
+// Invoked by flush_file_contents() when connection c exhausted its quantum
+// It may already be waiting for its next quantum if we tried to tx() in the meantime
+void Service::yield_tx(connection *const c, const tx_class cls) {
+        if (c->tx_sched.ll.empty()) {
+                tx_sched.ready[size_t(cls)].push_back(&c->tx_sched.ll);
+                ++tx_sched.yields;
+        }
+}
+
+// Deficit round-robin: every connection that yielded is granted the quantum of its traffic class, and resumes streaming
+// Classes are served in order of priority, and connections of each class in the order they yielded
+void Service::run_tx_sched() {
+        for (size_t i{0}; i < size_t(tx_class::Max); ++i) {
+                auto &     ready   = tx_sched.ready[i];
+                const auto quantum = tx_sched_quantum * tx_sched.weights[i];
+
+                // connections that exhaust their quantum again will yield at the back of the list; we 'll get to them in the next round
+                for (auto n = ready.size(); n && !ready.empty(); --n) {
+                        auto c = switch_list_entry(connection, tx_sched.ll, ready.next);
+
+                        c->tx_sched.ll.detach_and_reset();
+                        c->tx_sched.deficit = quantum;
+                        tx(c);
+                }
+        }
+}
+
 bool Service::try_tx(connection *const c) {
         if (c->state.flags & (1u << uint8_t(connection::State::Flags::NeedOutAvail))) {
                 return true;
@@ -1853,6 +2119,8 @@ bool Service::tx(connection *const c) {
                                                 verify_local_q();
                                                 return true;
 
+                                        case flushop_res::Throttled:
+                                        case flushop_res::Yield:
                                         case flushop_res::Flush:
                                                 break;
                                 }
@@ -1905,6 +2173,8 @@ bool Service::tx(connection *const c) {
                                                 verify_local_q();
                                                 return true;
 
+                                        case flushop_res::Throttled:
+                                        case flushop_res::Yield:
                                         case flushop_res::Flush:
                                                 break;
                                 }
@@ -1934,6 +2204,18 @@ bool Service::tx(connection *const c) {
                                         verify_local_q();
                                         return true;
 
+                                case flushop_res::Throttled:
+                                case flushop_res::Yield:
+                                        // no need to poll for out availability until we are unthrottled, or
+                                        // until it's the connection's turn again(see run_tx_sched())
+                                        if (have_cork) {
+                                                Switch::SetTCPCork(fd, 0);
+                                        }
+
+                                        stop_poll_outavail(c);
+                                        verify_local_q();
+                                        return true;
+
                                 case flushop_res::Flush:
                                         break;
                         }
@@ -1959,6 +2241,10 @@ bool Service::tx(connection *const c) {
         put_outgoing_queue(q);
         c->outQ = nullptr;
 
+        // see tx_sched
+        c->tx_sched.active  = false;
+        c->tx_sched.deficit = 0;
+
         stop_poll_outavail(c);
         return handle_flush(c);
 }
@@ -2143,11 +2429,30 @@ _accept:
                 // but we can't write(fd, ..) now; so we 'll need to wait for EPOLLOUT and then ping
                 c->as.tank.flags = unsigned(connection::As::Tank::Flags::PendingIntro);
                 c->state.flags   = 1u << unsigned(connection::State::Flags::NeedOutAvail);
+
+                if (zerocopy.threshold) {
+                        static constexpr int one{1};
+
+                        if (-1 == setsockopt(c->fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one))) {
+                                if (trace) {
+                                        SLog("Unable to set SO_ZEROCOPY:", strerror(errno), "\n");
+                                }
+                        } else {
+                                c->state.flags |= 1u << unsigned(connection::State::Flags::ZeroCopy);
+                        }
+                }
                 poller.insert(c->fd, EPOLLIN | EPOLLOUT, c);
 
                 // start as idle
                 make_idle(c, __LINE__);
 
+#ifdef HAVE_TANK_TLS
+                if (tls_ctx) {
+                        // we 'll introduce ourselves once the handshake is complete
+                        begin_tls_handshake(c, false);
+                }
+#endif
+
                 if (trace) {
                         SLog("Accepted new connection\n");
                 }
@@ -2195,6 +2500,12 @@ _accept:
 bool Service::try_recv_prom(connection *const c) {
         static constexpr const bool trace{false};
         auto *const                 b = c->inB;
+
+        if (c->as.prometheus.stage != connection::As::Prometheus::Stage::Idle) {
+                // still rendering the response to a previous request
+                return true;
+        }
+
         const auto *p = b->data() + b->offset(), *const e = b->end();
 
         if (trace) {
@@ -2338,58 +2649,21 @@ bool Service::try_recv_prom(connection *const c) {
                                 } else if (!path.BeginsWith(_S("/metrics"))) {
                                         http_error(c, "404 Not Found"_s32);
                                 } else {
-                                        auto b = get_buf();
+                                        auto &state = c->as.prometheus;
 
-                                        payload->buf = b;
-                                        payload->append("HTTP/1.1 200 OK\r\nServer: TANK\r\nContent-Type: text/plain\r\nContent-Length: "_s32);
-                                        const auto content_len_o{b->size()};
-                                        b->append("                     \r\n\r\n"_s32);
-
-                                        const auto body_o{b->size()};
-#pragma mark Prometheus Metrics Response
-                                        b->append("# HELP tanksrv_topic_latency Consumer latency\n"_s32);
-                                        b->append("# TYPE tanksrv_topic_latency histogram\n"_s32);
-                                        b->append("# HELP tanksrv_topic_produced_bytes Total bytes of all accepted new messages\n"_s32);
-                                        b->append("# TYPE tanksrv_topic_produced_bytes counter\n"_s32);
-                                        b->append("# HELP tanksrv_topic_produced_msgs Total accepted messages\n"_s32);
-                                        b->append("# TYPE tanksrv_topic_produced_msgs counter\n"_s32);
-                                        b->append("# HELP tanksrv_topic_consumed_bytes Total bytes of all outgoing messages\n"_s32);
-                                        b->append("# TYPE tanksrv_topic_consumed_bytes counter\n"_s32);
-
-                                        for (const auto &it : topics) {
-                                                const auto [name, topic] = it;
-
-                                                if (const auto v = topic->metrics.bytes_in) {
-                                                        b->append(R"(tanksrv_topic_produced_bytes{m=")", name, R"("} )", v, "\n");
-                                                }
-                                                if (const auto v = topic->metrics.msgs_in) {
-                                                        b->append(R"(tanksrv_topic_produced_msgs{m=")", name, R"("} )", v, "\n");
-                                                }
-                                                if (const auto v = topic->metrics.bytes_out) {
-                                                        b->append(R"(tanksrv_topic_consumed_bytes{m=")", name, R"("} )", v, "\n");
-                                                }
-
-                                                if (const auto cnt = topic->metrics.latency.cnt) {
-                                                        uint64_t total{0};
+                                        payload->append("HTTP/1.1 200 OK\r\nServer: TANK\r\nContent-Type: text/plain\r\nTransfer-Encoding: chunked\r\n\r\n"_s32);
+                                        q->push_back(payload);
 
-                                                        for (uint32_t i{0}; i != sizeof_array(topic::metrics_struct::latency_struct::histogram_scale); ++i) {
-                                                                total += topic->metrics.latency.hist_buckets[i];
+                                        state.stage         = connection::As::Prometheus::Stage::Preamble;
+                                        state.topic_idx     = 0;
+                                        state.partition_idx = 0;
 
-                                                                if (total) {
-                                                                        b->append(R"(tanksrv_topic_latency_bucket{le=")", 
-										topic::metrics_struct::latency_struct::histogram_scale[i], R"(", n=")", name, R"("} )", total, "\n"_s32);
-                                                                }
-                                                        }
-
-                                                        b->append(R"(tanksrv_topic_latency_bucket{le="+Inf", n=")", name, R"("} )", cnt, "\n"_s32);
-                                                        b->append(R"(tanksrv_topic_latency_sum{n=")", name, R"("} )", topic->metrics.latency.sum, "\n"_s32);
-                                                        b->append(R"(tanksrv_topic_latency_count{n=")", name, R"("} )", cnt, "\n\n"_s32);
-                                                }
+                                        // the rest of the response is rendered in slices whenever the
+                                        // outgoing queue is drained; see handle_flush()
+                                        // we won't process any other requests until we are done with this one; see render_pending_prom_metrics()
+                                        if (render_prom_metrics(c)) {
+                                                return try_tx(c);
                                         }
-
-                                        b->data()[content_len_o + sprintf(b->data() + content_len_o, "%u", b->size() - body_o)] = ' ';
-                                        payload->append(b->as_s32());
-                                        q->push_back(payload);
                                 }
 
                                 if (!try_tx(c)) {
@@ -2408,6 +2682,366 @@ bool Service::try_recv_prom(connection *const c) {
         return true;
 }
 
+template <bool Atomic>
+static void render_prom_histogram(IOBuffer *const b, const str_view32 name, const str_view32 labels, const hdr_histogram<Atomic> &hist) {
+        const auto cnt = hist.count();
+        uint64_t   total{0};
+
+        if (!cnt) {
+                return;
+        }
+
+        // only buckets that tracked any samples; the rest add nothing but noise(and bytes) to the response
+        for (uint32_t i{0}; i != hdr_histogram<Atomic>::buckets_cnt; ++i) {
+                if (const auto v = __atomic_load_n(&hist.buckets[i], __ATOMIC_RELAXED)) {
+                        total += v;
+                        b->append(name, R"(_bucket{le=")", hdr_histogram<Atomic>::bucket_upper_bound(i), R"(")", labels.size() ? ","_s32 : ""_s32, labels, "} ", total, "\n"_s32);
+                }
+        }
+
+        b->append(name, R"(_bucket{le="+Inf")", labels.size() ? ","_s32 : ""_s32, labels, "} ", cnt, "\n"_s32);
+        b->append(name, "_sum{"_s32, labels, "} "_s32, __atomic_load_n(&hist.sum, __ATOMIC_RELAXED), "\n"_s32);
+        b->append(name, "_count{"_s32, labels, "} "_s32, cnt, "\n"_s32);
+}
+
+// Renders the next slice of a /metrics response, as an HTTP chunk
+// Each slice is bounded in size, so that the reactor won't stall for long when there are many topics and partitions;
+// the next slice is rendered once the previous one has been flushed (see handle_flush()), which also means
+// that slow scrapers won't get us to buffer the whole response in memory.
+//
+// Returns false once the response has been rendered completely
+bool Service::render_prom_metrics(connection *const c) {
+        static constexpr size_t slice_budget{64 * 1024};
+        auto &                  state   = c->as.prometheus;
+        auto                    q       = c->outQ ?: (c->outQ = get_outgoing_queue());
+        auto                    payload = get_data_vector_payload();
+        auto                    b       = get_buf();
+        char                    labels[256];
+
+        TANK_EXPECT(c->type == connection::Type::Prometheus);
+        TANK_EXPECT(state.stage != connection::As::Prometheus::Stage::Idle);
+
+        payload->iov_cnt = 0;
+        payload->buf     = b;
+        b->append("00000000\r\n"_s32); // chunk size; patched
+
+        const auto body_o{b->size()};
+
+        if (state.stage == connection::As::Prometheus::Stage::Preamble) {
+#pragma mark Prometheus Metrics Response
+                b->append("# HELP tanksrv_topic_latency Consumer latency\n"_s32);
+                b->append("# TYPE tanksrv_topic_latency histogram\n"_s32);
+                b->append("# HELP tanksrv_topic_produced_bytes Total bytes of all accepted new messages\n"_s32);
+                b->append("# TYPE tanksrv_topic_produced_bytes counter\n"_s32);
+                b->append("# HELP tanksrv_topic_produced_msgs Total accepted messages\n"_s32);
+                b->append("# TYPE tanksrv_topic_produced_msgs counter\n"_s32);
+                b->append("# HELP tanksrv_topic_consumed_bytes Total bytes of all outgoing messages\n"_s32);
+                b->append("# TYPE tanksrv_topic_consumed_bytes counter\n"_s32);
+                b->append("# HELP tanksrv_partition_produced_bytes Total bytes of all accepted new messages\n"_s32);
+                b->append("# TYPE tanksrv_partition_produced_bytes counter\n"_s32);
+                b->append("# HELP tanksrv_partition_produced_msgs Total accepted messages\n"_s32);
+                b->append("# TYPE tanksrv_partition_produced_msgs counter\n"_s32);
+                b->append("# HELP tanksrv_partition_consumed_bytes Total bytes of all outgoing messages\n"_s32);
+                b->append("# TYPE tanksrv_partition_consumed_bytes counter\n"_s32);
+                b->append("# HELP tanksrv_partition_produced_bytes_rate Bytes of accepted new messages during the last second\n"_s32);
+                b->append("# TYPE tanksrv_partition_produced_bytes_rate gauge\n"_s32);
+                b->append("# HELP tanksrv_partition_consumed_bytes_rate Bytes of outgoing messages during the last second\n"_s32);
+                b->append("# TYPE tanksrv_partition_consumed_bytes_rate gauge\n"_s32);
+                b->append("# HELP tanksrv_partition_outq_depth Consume responses payloads of the partition pending transmission\n"_s32);
+                b->append("# TYPE tanksrv_partition_outq_depth gauge\n"_s32);
+                b->append("# HELP tanksrv_partition_append_latency_us Time spent appending a bundle to the partition log\n"_s32);
+                b->append("# TYPE tanksrv_partition_append_latency_us histogram\n"_s32);
+                b->append("# HELP tanksrv_partition_fsync_latency_us Time spent in fdatasync() of the partition segments by the sync workers\n"_s32);
+                b->append("# TYPE tanksrv_partition_fsync_latency_us histogram\n"_s32);
+                b->append("# HELP tanksrv_partition_replication_lag Messages the ISR replica has yet to acknowledge\n"_s32);
+                b->append("# TYPE tanksrv_partition_replication_lag gauge\n"_s32);
+                b->append("# HELP tanksrv_fsync_latency_us Time spent in fdatasync() by the sync workers\n"_s32);
+                b->append("# TYPE tanksrv_fsync_latency_us histogram\n"_s32);
+                b->append("# HELP tanksrv_conn_outq_depth Payloads pending transmission to the connection\n"_s32);
+                b->append("# TYPE tanksrv_conn_outq_depth gauge\n"_s32);
+                b->append("# HELP tanksrv_reactor_phase_us Time spent in each phase of a reactor loop iteration\n"_s32);
+                b->append("# TYPE tanksrv_reactor_phase_us histogram\n"_s32);
+                b->append("# HELP tanksrv_reactor_iteration_us Time spent in a reactor loop iteration, excluding polling\n"_s32);
+                b->append("# TYPE tanksrv_reactor_iteration_us histogram\n"_s32);
+                b->append("# HELP tanksrv_reactor_stalls Reactor loop iterations that exceeded the stall threshold\n"_s32);
+                b->append("# TYPE tanksrv_reactor_stalls counter\n"_s32);
+                b->append("# HELP tanksrv_reactor_slow_ops Operations that exceeded the slow operation threshold\n"_s32);
+                b->append("# TYPE tanksrv_reactor_slow_ops counter\n"_s32);
+                b->append("# HELP tanksrv_reactor_slow_op_us Slowest operations\n"_s32);
+                b->append("# TYPE tanksrv_reactor_slow_op_us gauge\n"_s32);
+                b->append("# HELP tanksrv_bundle_checksum_failures Bundles rejected because their CRC32C didn't match their content\n"_s32);
+                b->append("# TYPE tanksrv_bundle_checksum_failures counter\n"_s32);
+                b->append("# HELP tanksrv_replication_stalled_partitions Partitions no longer replicated because of repeated CRC32C mismatches\n"_s32);
+                b->append("# TYPE tanksrv_replication_stalled_partitions gauge\n"_s32);
+                b->append("# HELP tanksrv_mem_slab_bytes Memory reserved by slabs of each size class\n"_s32);
+                b->append("# TYPE tanksrv_mem_slab_bytes gauge\n"_s32);
+                b->append("# HELP tanksrv_mem_slab_objects Objects in use of each size class\n"_s32);
+                b->append("# TYPE tanksrv_mem_slab_objects gauge\n"_s32);
+                b->append("# HELP tanksrv_mem_slabs_released Slabs released back to the OS\n"_s32);
+                b->append("# TYPE tanksrv_mem_slabs_released counter\n"_s32);
+                b->append("# HELP tanksrv_mem_large_bytes Memory of objects too large for any size class\n"_s32);
+                b->append("# TYPE tanksrv_mem_large_bytes gauge\n"_s32);
+                b->append("# HELP tanksrv_mem_pooled_bufs Buffers available for reuse\n"_s32);
+                b->append("# TYPE tanksrv_mem_pooled_bufs gauge\n"_s32);
+                b->append("# HELP tanksrv_mem_pooled_bufs_bytes Memory reserved by buffers available for reuse\n"_s32);
+                b->append("# TYPE tanksrv_mem_pooled_bufs_bytes gauge\n"_s32);
+                b->append("# HELP tanksrv_reclaimer_queue_depth Files retired and not yet closed or unlinked by the reclaimer thread\n"_s32);
+                b->append("# TYPE tanksrv_reclaimer_queue_depth gauge\n"_s32);
+                b->append("# HELP tanksrv_reclaimer_latency_us Time from a file's retirement until the reclaimer thread closed or unlinked it\n"_s32);
+                b->append("# TYPE tanksrv_reclaimer_latency_us histogram\n"_s32);
+                b->append("# HELP tanksrv_recycled_segments New segments that reused the blocks of a retired segment\n"_s32);
+                b->append("# TYPE tanksrv_recycled_segments counter\n"_s32);
+                b->append("# HELP tanksrv_hot_tail_bytes_out Bytes of consume responses written from partitions hot tails instead of their segments\n"_s32);
+                b->append("# TYPE tanksrv_hot_tail_bytes_out counter\n"_s32);
+                b->append("# HELP tanksrv_sync_batches Batches of segments synced by the sync workers\n"_s32);
+                b->append("# TYPE tanksrv_sync_batches counter\n"_s32);
+                b->append("# HELP tanksrv_synced_segments Segments synced by the sync workers, once per batch they were involved in\n"_s32);
+                b->append("# TYPE tanksrv_synced_segments counter\n"_s32);
+                b->append("# HELP tanksrv_quota_throttled Requests or consume responses that exceeded a client or topic quota\n"_s32);
+                b->append("# TYPE tanksrv_quota_throttled counter\n"_s32);
+                b->append("# HELP tanksrv_quota_throttle_ms Time client connections were throttled for\n"_s32);
+                b->append("# TYPE tanksrv_quota_throttle_ms counter\n"_s32);
+                b->append("# HELP tanksrv_topic_quota_throttled Requests or consume responses that exceeded the topic quota\n"_s32);
+                b->append("# TYPE tanksrv_topic_quota_throttled counter\n"_s32);
+                b->append("# HELP tanksrv_tx_sched_bytes Bytes of file contents streamed to connections, by traffic class\n"_s32);
+                b->append("# TYPE tanksrv_tx_sched_bytes counter\n"_s32);
+                b->append("# HELP tanksrv_tx_sched_yields Times connections exhausted their quantum and waited for their next turn\n"_s32);
+                b->append("# TYPE tanksrv_tx_sched_yields counter\n"_s32);
+                b->append("# HELP tanksrv_zerocopy_sends Data vector payloads sends with MSG_ZEROCOPY\n"_s32);
+                b->append("# TYPE tanksrv_zerocopy_sends counter\n"_s32);
+                b->append("# HELP tanksrv_zerocopy_bytes Bytes sent with MSG_ZEROCOPY\n"_s32);
+                b->append("# TYPE tanksrv_zerocopy_bytes counter\n"_s32);
+                b->append("# HELP tanksrv_zerocopy_copied MSG_ZEROCOPY completions for sends the kernel copied anyway\n"_s32);
+                b->append("# TYPE tanksrv_zerocopy_copied counter\n"_s32);
+                b->append("# HELP tanksrv_zerocopy_lingering Shut down connections waiting for their MSG_ZEROCOPY sends to complete\n"_s32);
+                b->append("# TYPE tanksrv_zerocopy_lingering gauge\n"_s32);
+                b->append("# HELP tanksrv_zerocopy_lingering_aborted Shut down connections aborted because their MSG_ZEROCOPY sends didn't complete in time\n"_s32);
+                b->append("# TYPE tanksrv_zerocopy_lingering_aborted counter\n"_s32);
+                b->append("# HELP tanksrv_splice_ingest_bundles Produced bundles spliced from the socket to the segment\n"_s32);
+                b->append("# TYPE tanksrv_splice_ingest_bundles counter\n"_s32);
+                b->append("# HELP tanksrv_splice_ingest_bytes Bytes of produced bundles spliced from the socket to the segment\n"_s32);
+                b->append("# TYPE tanksrv_splice_ingest_bytes counter\n"_s32);
+
+                render_prom_histogram(b, "tanksrv_fsync_latency_us"_s32, ""_s32, fsync_latency);
+                render_prom_histogram(b, "tanksrv_reclaimer_latency_us"_s32, ""_s32, reclaimer.latency);
+                b->append("tanksrv_reclaimer_queue_depth "_s32, reclaimer.depth.load(std::memory_order_relaxed), "\n"_s32);
+                b->append("tanksrv_recycled_segments "_s32, segments.recycled.load(std::memory_order_relaxed), "\n"_s32);
+                b->append("tanksrv_hot_tail_bytes_out "_s32, hot_tail_bytes_out, "\n"_s32);
+                b->append("tanksrv_sync_batches "_s32, syncs.batches.load(std::memory_order_relaxed), "\n"_s32);
+                b->append("tanksrv_synced_segments "_s32, syncs.synced.load(std::memory_order_relaxed), "\n"_s32);
+                b->append(R"(tanksrv_quota_throttled{op="produce"} )", quotas.produce_throttled, "\n"_s32);
+                b->append(R"(tanksrv_quota_throttled{op="consume"} )", quotas.consume_throttled, "\n"_s32);
+                b->append(R"(tanksrv_quota_throttle_ms{op="produce"} )", quotas.produce_throttle_ms, "\n"_s32);
+                b->append(R"(tanksrv_quota_throttle_ms{op="consume"} )", quotas.consume_throttle_ms, "\n"_s32);
+                b->append(R"(tanksrv_tx_sched_bytes{class="replication"} )", tx_sched.bytes_out[size_t(tx_class::Replication)], "\n"_s32);
+                b->append(R"(tanksrv_tx_sched_bytes{class="tail"} )", tx_sched.bytes_out[size_t(tx_class::Tail)], "\n"_s32);
+                b->append(R"(tanksrv_tx_sched_bytes{class="bulk"} )", tx_sched.bytes_out[size_t(tx_class::Bulk)], "\n"_s32);
+                b->append("tanksrv_tx_sched_yields "_s32, tx_sched.yields, "\n"_s32);
+                b->append("tanksrv_zerocopy_sends "_s32, zerocopy.sends, "\n"_s32);
+                b->append("tanksrv_zerocopy_bytes "_s32, zerocopy.bytes, "\n"_s32);
+                b->append("tanksrv_zerocopy_copied "_s32, zerocopy.copied, "\n"_s32);
+                b->append("tanksrv_zerocopy_lingering "_s32, zerocopy.lingering.size(), "\n"_s32);
+                b->append("tanksrv_zerocopy_lingering_aborted "_s32, zerocopy.lingering_aborted, "\n"_s32);
+                b->append("tanksrv_splice_ingest_bundles "_s32, splice_ingest.bundles, "\n"_s32);
+                b->append("tanksrv_splice_ingest_bytes "_s32, splice_ingest.bytes, "\n"_s32);
+
+                for (size_t i{0}; i != size_t(reactor_profiler::Phase::Max); ++i) {
+                        const auto name = reactor_profiler::phase_name(reactor_profiler::Phase(i));
+
+                        render_prom_histogram(b, "tanksrv_reactor_phase_us"_s32,
+                                              str_view32(labels, snprintf(labels, sizeof(labels), R"(phase="%.*s")", name.size(), name.data())),
+                                              profiler.phases[i]);
+                }
+                render_prom_histogram(b, "tanksrv_reactor_iteration_us"_s32, ""_s32, profiler.iterations);
+
+                for (const auto &sc : slabs.classes) {
+                        if (sc.slabs) {
+                                b->append(R"(tanksrv_mem_slab_bytes{class=")", sc.obj_size, R"("} )", size_t(sc.slabs) * slabs.slab_size, "\n"_s32);
+                                b->append(R"(tanksrv_mem_slab_objects{class=")", sc.obj_size, R"("} )", sc.in_use, "\n"_s32);
+                        }
+                }
+                b->append("tanksrv_mem_slabs_released "_s32, slabs.stats.slabs_released, "\n"_s32);
+                b->append("tanksrv_mem_large_bytes "_s32, slabs.stats.large_bytes, "\n"_s32);
+                b->append("tanksrv_mem_pooled_bufs "_s32, bufs.size(), "\n"_s32);
+                b->append("tanksrv_mem_pooled_bufs_bytes "_s32,
+                          std::accumulate(bufs.begin(), bufs.end(), size_t(0), [](const auto prev, const auto b) noexcept { return prev + b->Reserved(); }), "\n"_s32);
+
+                b->append(R"(tanksrv_bundle_checksum_failures{source="produce"} )", checksum_failures.produce, "\n"_s32);
+                b->append(R"(tanksrv_bundle_checksum_failures{source="replication"} )", checksum_failures.replication, "\n"_s32);
+                {
+                        size_t stalled{0};
+
+                        for (auto it = cluster_state.replication_streams.next; it != &cluster_state.replication_streams; it = it->next) {
+                                stalled += switch_list_entry(repl_stream, repl_streams_ll, it)->checksum.stalled;
+                        }
+
+                        b->append("tanksrv_replication_stalled_partitions "_s32, stalled, "\n"_s32);
+                }
+
+                b->append("tanksrv_reactor_stalls "_s32, profiler.stalls.load(std::memory_order_relaxed), "\n"_s32);
+                b->append("tanksrv_reactor_slow_ops "_s32, profiler.slow_ops_total, "\n"_s32);
+                for (size_t i{0}; i < profiler.slow_ops_cnt; ++i) {
+                        const auto &op = profiler.slow_ops[i];
+
+                        b->append(R"(tanksrv_reactor_slow_op_us{phase=")", reactor_profiler::phase_name(op.phase),
+                                  R"(",msg=")", op.msg, R"(",fd=")", op.fd,
+                                  R"(",topic=")", str_view32(op.topic, op.topic_len), R"(",partition=")", op.partition,
+                                  R"(",ts=")", op.ts, R"("} )", op.duration, "\n"_s32);
+                }
+
+                // only for connections with pending payloads, otherwise we 'd be rendering a series for every connection
+                for (auto it = allConnections.next; it != &allConnections; it = it->next) {
+                        const auto conn = switch_list_entry(connection, connectionsList, it);
+
+                        if (conn->outQ && !conn->outQ->empty()) {
+                                const auto type = [t = conn->type]() {
+                                        switch (t) {
+                                                case connection::Type::TankClient:
+                                                        return "client"_s32;
+                                                case connection::Type::Prometheus:
+                                                        return "prometheus"_s32;
+                                                case connection::Type::ConsulClient:
+                                                        return "consul"_s32;
+                                                case connection::Type::Consumer:
+                                                        return "consumer"_s32;
+                                                default:
+                                                        return "other"_s32;
+                                        }
+                                }();
+
+                                b->append(R"(tanksrv_conn_outq_depth{fd=")", conn->fd, R"(",type=")", type, R"("} )", conn->outQ->size(), "\n"_s32);
+                        }
+                }
+
+                state.stage = connection::As::Prometheus::Stage::Topics;
+        }
+
+        for (const auto now_sec = now_ms / 1000; state.topic_idx < topics_list.size() && b->size() < slice_budget;) {
+                const auto topic      = topics_list[state.topic_idx];
+                const auto name       = topic->name();
+                const auto partitions = topic->partitions_;
+
+                if (0 == state.partition_idx) {
+                        if (const auto v = topic->metrics.bytes_in) {
+                                b->append(R"(tanksrv_topic_produced_bytes{topic=")", name, R"("} )", v, "\n");
+                        }
+                        if (const auto v = topic->metrics.msgs_in) {
+                                b->append(R"(tanksrv_topic_produced_msgs{topic=")", name, R"("} )", v, "\n");
+                        }
+                        if (const auto v = topic->metrics.bytes_out) {
+                                b->append(R"(tanksrv_topic_consumed_bytes{topic=")", name, R"("} )", v, "\n");
+                        }
+                        if (const auto v = topic->metrics.produce_throttled) {
+                                b->append(R"(tanksrv_topic_quota_throttled{topic=")", name, R"(",op="produce"} )", v, "\n");
+                        }
+                        if (const auto v = topic->metrics.consume_throttled) {
+                                b->append(R"(tanksrv_topic_quota_throttled{topic=")", name, R"(",op="consume"} )", v, "\n");
+                        }
+
+                        render_prom_histogram(b, "tanksrv_topic_latency"_s32,
+                                              str_view32(labels, snprintf(labels, sizeof(labels), R"(topic="%.*s")", name.size(), name.data())),
+                                              topic->metrics.latency);
+                }
+
+                for (const auto n = partitions ? partitions->size() : 0; state.partition_idx < n && b->size() < slice_budget; ++state.partition_idx) {
+                        const auto p   = partitions->at(state.partition_idx);
+                        const auto pls = str_view32(labels, snprintf(labels, sizeof(labels), R"(topic="%.*s",partition="%u")", name.size(), name.data(), p->idx));
+
+                        if (const auto v = p->metrics.bytes_in) {
+                                b->append("tanksrv_partition_produced_bytes{"_s32, pls, "} ", v, "\n");
+                        }
+                        if (const auto v = p->metrics.msgs_in) {
+                                b->append("tanksrv_partition_produced_msgs{"_s32, pls, "} ", v, "\n");
+                        }
+                        if (const auto v = p->metrics.bytes_out) {
+                                b->append("tanksrv_partition_consumed_bytes{"_s32, pls, "} ", v, "\n");
+                        }
+                        if (const auto v = p->metrics.bytes_in_rate.last(now_sec)) {
+                                b->append("tanksrv_partition_produced_bytes_rate{"_s32, pls, "} ", v, "\n");
+                        }
+                        if (const auto v = p->metrics.bytes_out_rate.last(now_sec)) {
+                                b->append("tanksrv_partition_consumed_bytes_rate{"_s32, pls, "} ", v, "\n");
+                        }
+                        if (const auto v = p->metrics.outq_payloads) {
+                                b->append("tanksrv_partition_outq_depth{"_s32, pls, "} ", v, "\n");
+                        }
+                        if (const auto &hist = p->metrics.append_latency) {
+                                render_prom_histogram(b, "tanksrv_partition_append_latency_us"_s32, pls, *hist);
+                        }
+                        if (const auto &hist = p->metrics.fsync_latency) {
+                                render_prom_histogram(b, "tanksrv_partition_fsync_latency_us"_s32, pls, *hist);
+                        }
+
+#ifndef HWM_UPDATE_BASED_ON_ACKS
+                        if (cluster_aware() && p->log_open() && p->cluster.leader.node == cluster_state.local_node.ref) {
+                                const auto  last    = p->_log->lastAssignedSeqNum;
+                                const auto &tracker = p->cluster.isr.tracker;
+
+                                for (uint32_t i{0}; i < tracker.size; ++i) {
+                                        const auto &it = tracker.data[i];
+
+                                        if (it.nid != cluster_state.local_node.id) {
+                                                b->append("tanksrv_partition_replication_lag{"_s32, pls, R"(,node=")", it.nid, R"("} )",
+                                                          last > it.lsn ? last - it.lsn : 0, "\n"_s32);
+                                        }
+                                }
+                        }
+#endif
+                }
+
+                if (state.partition_idx >= (partitions ? partitions->size() : 0)) {
+                        ++state.topic_idx;
+                        state.partition_idx = 0;
+                }
+        }
+
+        if (const auto len = b->size() - body_o) {
+                char size_repr[16];
+
+                snprintf(size_repr, sizeof(size_repr), "%08x", static_cast<uint32_t>(len));
+                memcpy(b->data(), size_repr, 8);
+                b->append("\r\n"_s32);
+        } else {
+                b->clear();
+        }
+
+        const bool more = state.topic_idx < topics_list.size();
+
+        if (!more) {
+                b->append("0\r\n\r\n"_s32);
+                state.stage = connection::As::Prometheus::Stage::Idle;
+        }
+
+        payload->append(b->as_s32());
+        q->push_back(payload);
+        return more;
+}
+
+void Service::render_pending_prom_metrics() {
+        // render_prom_metrics() may flush and get the connection
+        // rescheduled, so we are going to swap the list
+        auto pending = std::move(prom_pending_render);
+
+        prom_pending_render.clear();
+        for (auto c : pending) {
+                TANK_EXPECT(c->type == connection::Type::Prometheus);
+                TANK_EXPECT(c->as.prometheus.pending_render);
+
+                c->as.prometheus.pending_render = false;
+
+                const auto more = render_prom_metrics(c);
+
+                if (!try_tx(c)) {
+                        continue;
+                }
+
+                if (!more && c->inB) {
+                        // requests that arrived while we were rendering the response
+                        try_recv_prom(c);
+                }
+        }
+}
+
 bool Service::try_recv_consumer(connection *const c) {
         static constexpr bool trace{false};
         auto *const           b = c->inB;
@@ -2482,7 +3116,10 @@ bool Service::try_recv_tank(connection *const c) {
         for (const auto *e = reinterpret_cast<uint8_t *>(b->end());;) {
                 const auto *p = reinterpret_cast<uint8_t *>(b->data_at_offset());
 
-                if (e - p >= sizeof(uint8_t) + sizeof(uint32_t)) {
+                if (c->as.tank.throttle.read_until) {
+                        // we 'll get to the rest once the connection is no longer throttled; see unthrottle_connection()
+                        break;
+                } else if (e - p >= sizeof(uint8_t) + sizeof(uint32_t)) {
                         const auto msg        = *p++;
                         const auto msg_length = decode_pod<uint32_t>(p);
 
@@ -2494,6 +3131,12 @@ bool Service::try_recv_tank(connection *const c) {
                         }
 
                         if (0 == (c->as.tank.flags & unsigned(connection::As::Tank::Flags::ConsideredReqHeader))) {
+                                if (p + msg_length > e && consider_splice_ingest(c, msg, p, e, msg_length)) {
+                                        // try_recv() will splice the rest of it; see service_splice.cpp
+                                        c->as.tank.flags |= unsigned(connection::As::Tank::Flags::ConsideredReqHeader);
+                                        return true;
+                                }
+
                                 // So that ingestion of future incoming data will not require buffer reallocations
                                 const auto o = std::distance(b->data(), reinterpret_cast<char *>(const_cast<uint8_t *>(p)));
 
@@ -2548,13 +3191,22 @@ bool Service::try_recv(connection *const c) {
         TANK_EXPECT(c->fd > 2);
         c->verify();
 
-        int  fd = c->fd, n;
-        auto b  = c->inB;
+        int fd = c->fd, n;
 
         if (unlikely(-1 == ioctl(fd, FIONREAD, &n))) {
                 std::abort();
         }
 
+        if (c->type == connection::Type::TankClient && c->as.tank.splice_remaining) {
+                if (!try_splice_ingest(c, &n)) {
+                        return false;
+                } else if (0 == n) {
+                        return true;
+                }
+        }
+
+        auto b = c->inB;
+
         if (!b) {
                 // in case it wasn't active to begin with
                 b = (c->inB = get_buf());
@@ -1,5 +1,9 @@
 #include "service_common.h"
 
+// varuint32 bundle length, flags, extra flags and their fields, varuint32 messages count, and the sparse bundle
+// first message seqnum and varuint32 last message seqnum delta
+static constexpr size_t max_bundle_hdr_size = 5 + sizeof(uint8_t) + sizeof(uint8_t) + TANKUtil::bundle_extra_hdr_fields_size(0xff) + 5 + sizeof(uint64_t) + 5;
+
 static TANKUtil::range_start determine_consume_file_range_start(const uint64_t                                             abs_seqnum,
                                                                 const uint64_t                                             max_abs_seq_num,
                                                                 int                                                        fd,
@@ -39,29 +43,46 @@ static TANKUtil::range_start determine_consume_file_range_start(const uint64_t
         }
 
         while (o < ceiling) {
-                const auto data = ra.read(o, sizeof(uint8_t) + sizeof(uint64_t) + sizeof(uint64_t) + sizeof(uint64_t));
-
-                if (data.size() < 32) {
-                        // TODO:
+                // we may get fewer bytes than that near the end of the segment
+                const auto        data     = ra.read(o, max_bundle_hdr_size);
+                const auto *const base_buf = data.offset;
+                const uint8_t *   p        = base_buf;
+                const auto *const e        = std::min(base_buf + data.size(), base_buf + (ceiling - o));
+                uint32_t          bundle_len, msgset_size;
+
+                if (unlikely(!base_buf || !Compression::decode_varuint32(p, e, &bundle_len) || !bundle_len || p >= e)) {
+                        // malformed or truncated; we 'll start from this bundle
+                        rs.file_offset = o;
+                        rs.abs_seqnum  = base_seqnum;
+                        break;
                 }
 
-                const auto        tiny_buf   = data.offset;
-                const auto *const base_buf   = tiny_buf;
-                const uint8_t *   p          = base_buf;
-                const auto        bundle_len = Compression::decode_varuint32(p);
-
-                TANK_EXPECT(bundle_len);
+                const auto encoded_bundle_len_len     = std::distance(base_buf, p); // how many bytes used to varint encode the bundle length
+                const auto bundleheader_flags         = decode_pod<uint8_t>(p);
+                const bool bundleheader_sparsebit_set = bundleheader_flags & (1u << 6);
 
-                const auto     encoded_bundle_len_len     = std::distance(base_buf, p); // how many bytes used to varint encode the bundle length
-                const auto     bundleheader_flags         = decode_pod<uint8_t>(p);
-                const bool     bundleheader_sparsebit_set = bundleheader_flags & (1u << 6);
-                const uint32_t msgset_size                = ((bundleheader_flags >> 2) & 0xf) ?: Compression::decode_varuint32(p);
+                msgset_size = (bundleheader_flags >> 2) & 0xf;
+                if (unlikely(!TANKUtil::skip_bundle_extra_hdr(bundleheader_flags, p, e) ||
+                             (!msgset_size && !Compression::decode_varuint32(p, e, &msgset_size)) ||
+                             (bundleheader_sparsebit_set && p + sizeof(uint64_t) > e))) {
+                        rs.file_offset = o;
+                        rs.abs_seqnum  = base_seqnum;
+                        break;
+                }
 
                 if (bundleheader_sparsebit_set) {
                         const auto first_msg_seqnum = decode_pod<uint64_t>(p);
 
                         if (msgset_size != 1) {
-                                last_msg_seqnum = first_msg_seqnum + Compression::decode_varuint32(p) + 1;
+                                uint32_t delta;
+
+                                if (unlikely(!Compression::decode_varuint32(p, e, &delta))) {
+                                        rs.file_offset = o;
+                                        rs.abs_seqnum  = base_seqnum;
+                                        break;
+                                }
+
+                                last_msg_seqnum = first_msg_seqnum + delta + 1;
                         } else {
                                 last_msg_seqnum = first_msg_seqnum;
                         }
@@ -135,7 +156,6 @@ uint32_t determine_consume_file_range_end(uint64_t
                 trace = false,
         };
         uint64_t   last_msg_seqnum;
-        int        r;
         const auto limit = max_size != std::numeric_limits<uint32_t>::max()
                                ? std::min<uint32_t>(file_size, std::max<uint32_t>(file_offset + max_size, 32))
                                : file_size;
@@ -184,32 +204,48 @@ uint32_t determine_consume_file_range_end(uint64_t
                 }
 
                 // read bundle header
-                // we may wind up reading a partial header, and that's OK
-                const auto data = ra.read(file_offset, 4);
-
-                if (unlikely(data.size() < 4)) {
-                        // we didn't get to read enough
-                        // point to the end of file
+                // we may get fewer bytes than that near the end of the segment
+                const auto        data = ra.read(file_offset, max_bundle_hdr_size);
+                const auto *const buf  = data.offset;
+                const auto *      p    = buf;
+                const auto *const e    = std::min(buf + data.size(), buf + (file_size - file_offset));
+                uint32_t          bundle_len, msgset_size;
+
+                if (unlikely(!buf || !Compression::decode_varuint32(p, e, &bundle_len) || !bundle_len || p >= e)) {
+                        // malformed or truncated; the range ends at this bundle
                         if (trace) {
-                                SLog("ODD, read just ", r, " bytes, expected at least 4\n");
+                                SLog("Unable to decode bundle header at ", file_offset, "\n");
                         }
 
                         break;
                 }
 
-                const auto     buf                     = data.offset;
-                const auto *   p                       = buf;
-                const auto     bundle_len              = Compression::decode_varuint32(p);
-                const auto     encoded_bundle_len_len  = std::distance(buf, const_cast<const uint8_t *>(p)); // how many bytes used to varint encode the bundle length
-                const auto     bundle_hdr_flags        = decode_pod<uint8_t>(p);
-                const bool     bundlehdr_sparsebit_set = bundle_hdr_flags & (1u << 6);
-                const uint32_t msgset_size             = ((bundle_hdr_flags >> 2) & 0xf) ?: Compression::decode_varuint32(p);
+                const auto encoded_bundle_len_len  = std::distance(buf, p); // how many bytes used to varint encode the bundle length
+                const auto bundle_hdr_flags        = decode_pod<uint8_t>(p);
+                const bool bundlehdr_sparsebit_set = bundle_hdr_flags & (1u << 6);
+
+                msgset_size = (bundle_hdr_flags >> 2) & 0xf;
+                if (unlikely(!TANKUtil::skip_bundle_extra_hdr(bundle_hdr_flags, p, e) ||
+                             (!msgset_size && !Compression::decode_varuint32(p, e, &msgset_size)) ||
+                             (bundlehdr_sparsebit_set && p + sizeof(uint64_t) > e))) {
+                        if (trace) {
+                                SLog("Unable to decode bundle header at ", file_offset, "\n");
+                        }
+
+                        break;
+                }
 
                 if (bundlehdr_sparsebit_set) {
                         const auto first_msg_seqnum = decode_pod<uint64_t>(p);
 
                         if (msgset_size != 1) {
-                                last_msg_seqnum = first_msg_seqnum + Compression::decode_varuint32(p) + 1;
+                                uint32_t delta;
+
+                                if (unlikely(!Compression::decode_varuint32(p, e, &delta))) {
+                                        break;
+                                }
+
+                                last_msg_seqnum = first_msg_seqnum + delta + 1;
                         } else {
                                 last_msg_seqnum = first_msg_seqnum;
                         }
@@ -280,6 +316,16 @@ lookup_res topic_partition_log::read_cur(const uint64_t absSeqNum, const uint32_
         }
 
         lookup_res  res;
+
+        if (hot_tail_range(absSeqNum, maxSize, max_abs_seq_num, &res)) {
+                // tailing consumer
+                if (trace) {
+                        SLog("From hot tail:", res.fileOffset, " to ", res.fileOffsetCeiling, "\n");
+                }
+
+                return res;
+        }
+
         const auto  relSeqNum     = static_cast<uint32_t>(absSeqNum - cur.baseSeqNum);
         const auto &skipList      = cur.index.skipList;
         const auto  skiplist_data = skipList.data();
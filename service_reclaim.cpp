@@ -0,0 +1,118 @@
+#include "service_common.h"
+
+int Unlink(const char *pathname);
+
+// fdatasync(), close() and unlink() can block for long; deleting a large segment on ext4 or xfs
+// can take tens of milliseconds. The reactor hands them off to the reclaimer thread instead.
+void retire_fd(int fd) {
+        if (!this_service || !this_service->retire_file(fd, nullptr, nullptr)) {
+                fdatasync(fd);
+                TANKUtil::safe_close(fd);
+        }
+}
+
+// Returns false if the reclaimer is not running, in which case the caller is expected to do this itself
+// This may be invoked by any thread(e.g fd_handle's are also released by the compaction thread)
+bool Service::retire_file(const int fd, topic_partition *partition, const char *path, const bool recycle) {
+        std::unique_lock<std::mutex> lock(reclaimer.workLock);
+
+        // checked under the lock, so that nothing is retired once stop_reclaimer() has cleared it
+        if (!reclaimer.running.load(std::memory_order_relaxed)) {
+                return false;
+        }
+
+        auto f = new retired_file();
+
+        f->fd        = fd;
+        f->partition = partition;
+        f->ts        = Timings::Microseconds::Tick();
+        f->recycle   = recycle;
+        if (path) {
+                TANK_EXPECT(partition);
+                f->path.append(path);
+                partition->pending_unlinks.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        reclaimer.depth.fetch_add(1, std::memory_order_relaxed);
+        reclaimer.pending.push_back(f);
+        lock.unlock();
+
+        reclaimer.workCond.notify_one();
+        return true;
+}
+
+// fdatasync()s and closes, or unlinks, all retired files
+void Service::reclaim_retired_files(std::vector<retired_file *> *const local) {
+        for (auto it = reclaimer.pending.drain(); it; it = it->next) {
+                local->push_back(it);
+        }
+        // drain() returns them in reverse order
+        std::reverse(local->begin(), local->end());
+
+        for (auto f : *local) {
+                if (f->fd != -1) {
+                        fdatasync(f->fd);
+                        TANKUtil::safe_close(f->fd);
+                } else {
+                        if (f->recycle) {
+                                // keep (at most) one retired segment log per partition, so that the next segment
+                                // we prepare can reuse its blocks; see process_segment_op()
+                                const strwlen32_t path(f->path.data(), f->path.size());
+                                const auto        dir = path.PrefixUpto(path.SearchR('/') + 1);
+
+                                link(f->path.c_str(), Buffer::build(dir, ".recycled.log").c_str());
+                        }
+
+                        if (Unlink(f->path.c_str()) == -1) {
+                                Print("Failed to unlink ", f->path, ": ", strerror(errno), "\n");
+                        }
+
+                        f->partition->pending_unlinks.fetch_sub(1, std::memory_order_release);
+                        file_op_completed();
+                }
+
+                reclaimer.latency.reg_sample(Timings::Microseconds::Since(f->ts));
+                reclaimer.depth.fetch_sub(1, std::memory_order_relaxed);
+                delete f;
+        }
+
+        local->clear();
+}
+
+void Service::reclaimer_main() {
+        std::vector<retired_file *> local;
+        sigset_t                    mask;
+
+        sigfillset(&mask);
+        pthread_sigmask(SIG_SETMASK, &mask, nullptr);
+        for (bool done = false; !done;) {
+                {
+                        std::unique_lock<std::mutex> lock(reclaimer.workLock);
+
+                        reclaimer.workCond.wait(lock, [this] { return reclaimer.pending.any() || !reclaimer.running.load(std::memory_order_relaxed); });
+                        // nothing can be retired once running is cleared, so we only need to drain once more
+                        done = !reclaimer.running.load(std::memory_order_relaxed);
+                }
+
+                reclaim_retired_files(&local);
+        }
+}
+
+void Service::stop_reclaimer() {
+        {
+                std::lock_guard<std::mutex> lock(reclaimer.workLock);
+
+                if (!reclaimer.running.exchange(false, std::memory_order_relaxed)) {
+                        return;
+                }
+        }
+
+        reclaimer.workCond.notify_one();
+        reclaimer.thread->join();
+        reclaimer.thread.reset();
+
+        // anything retired from now on is handled inline; there shouldn't be anything left, but just in case
+        std::vector<retired_file *> local;
+
+        reclaim_retired_files(&local);
+}
@@ -1,4 +1,5 @@
 #include "service_common.h"
+#include "bundle_columnar.h"
 #include <date.h>
 
 #ifndef HWM_UPDATE_BASED_ON_ACKS
@@ -369,11 +370,10 @@ void Service::complete_deferred_produce_response(produce_response *dpr) {
         try_generate_produce_response(dpr);
 }
 
-// an update associated with a DPR(deferred pending response) has been acknowledged
+// an update associated with a DPR(deferred pending response) has been acknowledged, or synced(see complete_sync_requests())
 void Service::confirm_deferred_produce_resp_partition(produce_response *dpr, [[maybe_unused]] topic_partition *p, [[maybe_unused]] const uint8_t pr_participant_idx) {
         static constexpr bool trace{false};
         TANK_EXPECT(dpr);
-        TANK_EXPECT(cluster_aware());
         TANK_EXPECT(p);
         TANK_EXPECT(dpr->deferred.pending_partitions);
 
@@ -778,7 +778,11 @@ void Service::peer_consumed_local_partition(topic_partition *p, cluster_node *pe
                         SLog("Peer hasn't caught up yet because (seq_num(", seq_num, ") <= last(", last, "))\n");
                 }
 
+#ifdef HWM_UPDATE_BASED_ON_ACKS
                 goto l1;
+#else
+                return;
+#endif
         }
 
         isr_entry *isr_e;
@@ -825,11 +829,114 @@ void Service::peer_consumed_local_partition(topic_partition *p, cluster_node *pe
 #endif
         }
 
+#ifdef HWM_UPDATE_BASED_ON_ACKS
 l1:
         // deal with any pending produce responses
         consider_pending_client_produce_responses(isr_e, p, peer, seq_num);
+#else
+        // isr_touch() only updated the ISR tracker; pending produce responses
+        // are considered once per reactor loop iteration, in process_dirty_partitions_acks()
+#endif
 }
 
+#ifndef HWM_UPDATE_BASED_ON_ACKS
+void Service::mark_partition_acks_dirty(topic_partition *p) {
+        TANK_EXPECT(p);
+
+        if (0 == (p->cluster.flags & unsigned(topic_partition::Cluster::Flags::AcksDirty))) {
+                p->cluster.flags |= unsigned(topic_partition::Cluster::Flags::AcksDirty);
+                acks_dirty_list.emplace_back(p);
+        }
+}
+
+// Peers acks(ConsumePeer requests) only update the ISR tracker of the partitions they consume from; see isr_touch().
+// This is invoked once per reactor loop iteration, and for each partition that got any acks, it advances
+// the high water mark once and completes all pending produce responses that can now be confirmed.
+//
+// With many peers acking many partitions, this means we compute the high water mark, wake up consumers and walk the
+// pending produce acks queue once per partition per iteration instead of once per peer ack, and that deferred produce
+// responses that involve multiple partitions acknowledged in the same iteration are completed together.
+// Partitions with expired ISR entries(see expire_isr_ack()) are tracked here as well, so that their ISR is
+// rebuilt and persisted once, no matter how many of their ISR entries expired.
+void Service::process_dirty_partitions_acks() {
+        static constexpr bool trace{false};
+
+        if (acks_dirty_list.empty()) {
+                return;
+        }
+
+        if (trace) {
+                SLog(acks_dirty_list.size(), " partitions with peers acks\n");
+        }
+
+        for (size_t i{0}; i < acks_dirty_list.size(); ++i) {
+                auto p = acks_dirty_list[i];
+
+                const auto isr_expired = p->cluster.flags & unsigned(topic_partition::Cluster::Flags::ISRExpired);
+
+                p->cluster.flags &= ~(unsigned(topic_partition::Cluster::Flags::AcksDirty) | unsigned(topic_partition::Cluster::Flags::ISRExpired));
+
+                if (p->cluster.leader.node != cluster_state.local_node.ref) {
+                        // no longer the leader
+                        continue;
+                }
+
+                if (isr_expired) {
+                        // ISR entries expired in consider_isr_pending_ack(); see expire_isr_ack()
+                        rebuild_partition_tracked_isrs(p);
+                        consider_pending_client_produce_responses(p);
+                        persist_isr(p, __LINE__);
+                }
+
+                const auto &tracker = p->cluster.isr.tracker;
+
+                if (!tracker.size) {
+                        continue;
+                }
+
+                // tracker.data[] is sorted by LSN in ascending order
+                const auto min_lsn = tracker.data[0].lsn;
+                const auto max_lsn = tracker.data[tracker.size - 1].lsn;
+
+                if (min_lsn > p->hwmark()) {
+                        update_hwmark(p, min_lsn);
+                }
+
+                auto &q = p->cluster.pending_client_produce_acks_tracker.pending;
+
+                for (auto it = q.begin(); it != q.end();) {
+                        auto &     pa                      = *it;
+                        auto       dpr                     = pa.deferred_resp;
+                        const auto dpr_available           = dpr->gen == pa.deferred_resp_gen;
+                        const auto bundle_last_msg_seq_num = pa.bundle_desc.last_msg_seqnum;
+
+                        if (bundle_last_msg_seq_num > max_lsn) {
+                                // ordered by bundle_last_msg_seq_num; no peer has persisted past this yet
+                                break;
+                        }
+
+                        if (dpr_available) {
+                                dpr->participants[pa.pr_participant_idx].res = produce_response::participant::OpRes::OK;
+                        }
+
+                        if (!tracker.confirmed(pa.required_acks, bundle_last_msg_seq_num)) {
+                                ++it;
+                                continue;
+                        }
+
+                        if (dpr_available) {
+                                // trampoline to try_generate_produce_response()
+                                confirm_deferred_produce_resp_partition(dpr, p, pa.pr_participant_idx);
+                        }
+
+                        it = q.erase(it);
+                }
+        }
+
+        acks_dirty_list.clear();
+}
+#endif
+
 static uint8_t choose_compression_codec(const topic_partition::msg *msgs, const size_t size) {
         if (size > 512) {
                 return 1;
@@ -1074,6 +1181,11 @@ bool Service::process_peer_consume_resp(connection *const c, const uint8_t *p, c
                 SLog(ansifmt::color_brown, ansifmt::bold, "GOT consume response for ", topics_cnt, " topics", ansifmt::reset, "\n");
         }
 
+        // responses to outstanding requests may not arrive in the order the requests were issued;
+        // we only need to know that the window is no longer full
+        if (c->as.consumer.inflight) {
+                c->as.consumer.inflight--;
+        }
         c->as.consumer.state = connection::As::Consumer::State::Idle;
 
 #pragma mark BEGIN
@@ -1107,6 +1219,13 @@ bool Service::process_peer_consume_resp(connection *const c, const uint8_t *p, c
                         const auto partition_id = decode_pod<uint16_t>(p);
                         const auto err_flags    = decode_pod<uint8_t>(p);
 
+                        if (auto _p = topic ? topic->partition(partition_id) : nullptr) {
+                                if (auto stream = _p->cluster.rs) {
+                                        // we can request more content for this partition now
+                                        stream->in_flight = false;
+                                }
+                        }
+
                         if (trace) {
                                 SLog(ansifmt::color_green, "For partition ", partition_id, ", err_flags ", err_flags, ansifmt::reset, "\n");
                         }
@@ -1163,7 +1282,7 @@ bool Service::process_peer_consume_resp(connection *const c, const uint8_t *p, c
 
                         // if we don't have this partition, ignore the received content
                         auto *const                 partition         = topic ? topic->partition(partition_id) : nullptr;
-                        [[maybe_unused]] const auto highwater_mark    = decode_pod<uint64_t>(p);
+                        const auto                  highwater_mark    = decode_pod<uint64_t>(p);
                         const auto                  bundles_chunk_len = decode_pod<uint32_t>(p); // length of this particion's chunk that contains 0+ bundles
                         const uint64_t              requested_seqnum  = partition
                                                               ? (partition_log(partition)->lastAssignedSeqNum + 1)
@@ -1214,7 +1333,7 @@ bool Service::process_peer_consume_resp(connection *const c, const uint8_t *p, c
                         const auto                  partition_bundles = bundles_chunk;
                         uint64_t                    first_msg_seqnum, last_msg_seqnum;
                         const uint8_t *             need_from, *need_upto;
-                        bool                        any_captured{false}, first_sparse{false};
+                        bool                        any_captured{false}, first_sparse{false}, checksum_mismatch{false};
 
                         bundles_chunk += bundles_chunk_len; // skip bundles for this partition
 
@@ -1235,7 +1354,9 @@ bool Service::process_peer_consume_resp(connection *const c, const uint8_t *p, c
                                 need_from = p;
                                 need_upto = p + 512;
 
-                                if (unlikely(!Compression::check_decode_varuint32(p, chunk_end))) {
+                                uint32_t bundle_len;
+
+                                if (unlikely(!Compression::decode_varuint32(p, chunk_end, &bundle_len))) {
                                         if (trace) {
                                                 SLog("Unable to decode bundle_len\n");
                                         }
@@ -1243,7 +1364,6 @@ bool Service::process_peer_consume_resp(connection *const c, const uint8_t *p, c
                                         break;
                                 }
 
-                                const auto bundle_len = Compression::decode_varuint32(p);
                                 const auto bundle_end = p + bundle_len;
 
                                 // assume we will need until the end of the bundle at least
@@ -1259,6 +1379,7 @@ bool Service::process_peer_consume_resp(connection *const c, const uint8_t *p, c
                                 }
 
                                 // BEGIN: bundle header
+                                const auto                          bundle_hdr       = p;
                                 const auto                          bundle_hdr_flags = decode_pod<uint8_t>(p);
                                 const auto                          codec            = bundle_hdr_flags & 3;
                                 const auto                          sparse_bundle    = bundle_hdr_flags & (1u << 6);
@@ -1266,11 +1387,23 @@ bool Service::process_peer_consume_resp(connection *const c, const uint8_t *p, c
                                 uint64_t                            msgset_end;
                                 range_base<const uint8_t *, size_t> msgset_content;
 
+                                if (unlikely(!TANKUtil::skip_bundle_extra_hdr(bundle_hdr_flags, p, chunk_end))) {
+                                        break;
+                                }
+
+                                // we can only verify bundles we got in full; we 'll get the rest of a partial bundle
+                                // in the next consume response, along with the bundle header
+                                if (bundle_end <= chunk_end && unlikely(!TANKUtil::verify_bundle_crc32c(bundle_hdr, bundle_end))) {
+                                        ++checksum_failures.replication;
+
+                                        // won't persist it or anything past it; we 'll fetch it again, see below
+                                        checksum_mismatch = true;
+                                        break;
+                                }
+
                                 if (0 == msgset_size) {
-                                        if (unlikely(!Compression::check_decode_varuint32(p, chunk_end))) {
+                                        if (unlikely(!Compression::decode_varuint32(p, chunk_end, &msgset_size))) {
                                                 break;
-                                        } else {
-                                                msgset_size = Compression::decode_varuint32(p);
                                         }
                                 }
 
@@ -1282,11 +1415,13 @@ bool Service::process_peer_consume_resp(connection *const c, const uint8_t *p, c
                                         first_msg_seqnum = decode_pod<uint64_t>(p);
 
                                         if (msgset_size != 1) {
-                                                if (unlikely(!Compression::check_decode_varuint32(p, chunk_end))) {
+                                                uint32_t delta;
+
+                                                if (unlikely(!Compression::decode_varuint32(p, chunk_end, &delta))) {
                                                         break;
                                                 }
 
-                                                last_msg_seqnum = first_msg_seqnum + Compression::decode_varuint32(p) + 1;
+                                                last_msg_seqnum = first_msg_seqnum + delta + 1;
                                         } else {
                                                 last_msg_seqnum = first_msg_seqnum;
                                         }
@@ -1318,6 +1453,13 @@ bool Service::process_peer_consume_resp(connection *const c, const uint8_t *p, c
                                         continue;
                                 }
 
+                                const bool columnar = TANKUtil::bundle_is_columnar(bundle_hdr);
+
+                                if (columnar && bundle_end > chunk_end) {
+                                        // columnar message sets can only be decoded in full
+                                        break;
+                                }
+
                                 if (codec) {
                                         if (trace) {
                                                 SLog("Need to decompress for ", codec, "\n");
@@ -1362,6 +1504,38 @@ bool Service::process_peer_consume_resp(connection *const c, const uint8_t *p, c
                                         SLog("Scanning message set of length ", size_repr(msgset_content.size()), "\n");
                                 }
 
+                                if (columnar) {
+                                        // persist_peer_partitions_content() will encode them using the row encoding
+                                        static thread_local TANKUtil::columnar::msgset_reader columnar_tls;
+                                        auto &                                                columnar_reader{columnar_tls};
+                                        str_view32                                            content;
+                                        uint32_t                                              seqnum_delta;
+
+                                        if (!columnar_reader.reset(msgset_content.offset, msgset_content.offset + msgset_content.size(), msgset_size, sparse_bundle)) {
+                                                if (trace) {
+                                                        SLog("Malformed columnar message set\n");
+                                                }
+
+                                                goto next_partition;
+                                        }
+
+                                        for (; columnar_reader.next(&ts, &key, &content, &seqnum_delta); ++msg_idx, ++log_base_seqnum) {
+                                                if (sparse_bundle) {
+                                                        log_base_seqnum = msg_idx ? log_base_seqnum + seqnum_delta : first_msg_seqnum;
+                                                }
+
+                                                if (log_base_seqnum >= min_accepted_seqnum) {
+                                                        partition_msgs.emplace_back(topic_partition::msg{
+                                                            .seqNum = log_base_seqnum,
+                                                            .ts     = ts,
+                                                            .key    = key,
+                                                            .data   = content});
+                                                }
+                                        }
+
+                                        continue;
+                                }
+
                                 for (const auto *p = msgset_content.offset, *const msgset_end = p + msgset_content.size();; ++msg_idx, ++log_base_seqnum) {
                                         if (!codec && any_captured) {
                                                 // this makes sense because we didn't need to decompress the bundle
@@ -1389,12 +1563,12 @@ bool Service::process_peer_consume_resp(connection *const c, const uint8_t *p, c
                                                 } else if (msg_idx == msgset_size - 1) {
                                                         log_base_seqnum = last_msg_seqnum;
                                                 } else {
-                                                        if (unlikely(!Compression::check_decode_varuint32(p, msgset_end))) {
+                                                        uint32_t delta;
+
+                                                        if (unlikely(!Compression::decode_varuint32(p, msgset_end, &delta))) {
                                                                 goto next_partition;
                                                         }
 
-                                                        const auto delta = Compression::decode_varuint32(p);
-
                                                         // not going to set log_base_seqnum to (delta + 1)
                                                         // because we 'll (++log_base_seqnum) at the end of the iteration anyway
                                                         log_base_seqnum += delta;
@@ -1430,7 +1604,9 @@ bool Service::process_peer_consume_resp(connection *const c, const uint8_t *p, c
                                                 key.reset();
                                         }
 
-                                        if (unlikely(!Compression::check_decode_varuint32(p, msgset_end))) {
+                                        uint32_t len;
+
+                                        if (unlikely(!Compression::decode_varuint32(p, msgset_end, &len))) {
                                                 if (trace) {
                                                         SLog("Not Enough Content Available\n");
                                                 }
@@ -1438,8 +1614,6 @@ bool Service::process_peer_consume_resp(connection *const c, const uint8_t *p, c
                                                 goto next_partition;
                                         }
 
-                                        const auto len = Compression::decode_varuint32(p);
-
                                         if (const auto e = p + len; e > msgset_end) {
                                                 if (!codec && any_captured) {
                                                         // see above
@@ -1487,14 +1661,29 @@ bool Service::process_peer_consume_resp(connection *const c, const uint8_t *p, c
                         static constexpr const size_t alignment     = 4 * 1024;
                         const auto                    next_min_span = (std::distance(need_from, need_upto) + alignment - 1) & (-alignment); // aligned to 4k
 
+                        persist_peer_partitions_content(partition, partition_msgs, first_sparse);
+                        update_follower_hwmark(partition, highwater_mark);
+
                         if (auto stream = partition->cluster.rs) {
                                 // there's a replication stream already
                                 // we use it to replicate partition messages from the leader to this node
                                 // update min_fetch_size for the next CONSUME request from that
                                 stream->min_fetch_size = next_min_span;
-                        }
 
-                        persist_peer_partitions_content(partition, partition_msgs, first_sparse);
+                                // if we are still behind the leader, fetch more next time so that we can
+                                // catch up in fewer round-trips, otherwise gradually fall back to the default
+                                if (highwater_mark > partition_log(partition)->lastAssignedSeqNum) {
+                                        stream->fetch_size = std::min(stream->fetch_size * 2, repl_stream::max_fetch_size);
+                                } else {
+                                        stream->fetch_size = std::max(stream->fetch_size / 2, repl_stream::default_fetch_size);
+                                }
+
+                                if (!checksum_mismatch) {
+                                        stream->checksum.failures = 0;
+                                } else {
+                                        consider_repl_checksum_mismatch(stream, !partition_msgs.empty());
+                                }
+                        }
                 }
         }
 #pragma mark END
@@ -1505,6 +1694,36 @@ bool Service::process_peer_consume_resp(connection *const c, const uint8_t *p, c
         return true;
 }
 
+// We got a bundle that failed CRC32C verification while replicating stream->partition
+// If we got no content before it, this is another failure to get past the same bundle; we 'll back off exponentially
+// before fetching again, and if that keeps happening, we 'll stop replicating that partition from that peer
+// instead of re-fetching the same corrupt bundle forever. The leader will then eventually drop this node from the ISR.
+void Service::consider_repl_checksum_mismatch(repl_stream *const stream, const bool made_progress) {
+        auto   partition = stream->partition;
+        auto   src       = stream->src;
+        auto & ctx       = stream->checksum;
+
+        if (made_progress) {
+                ctx.failures = 0;
+        }
+
+        if (0 == ctx.failures++) {
+                Print("Bundle CRC32C mismatch replicating ", partition->owner->name(), "/", partition->idx, " from ", src->id, "@", src->ep,
+                      " at ", partition_log(partition)->lastAssignedSeqNum + 1, "; will retry\n");
+        }
+
+        if (ctx.failures >= repl_stream::max_checksum_failures) {
+                Print(ansifmt::bold, ansifmt::color_red, "Giving up replicating ", partition->owner->name(), "/", partition->idx, " from ", src->id, "@", src->ep,
+                      ": bundle at ", partition_log(partition)->lastAssignedSeqNum + 1, " failed CRC32C verification ", ctx.failures, " times",
+                      ansifmt::reset, "\n");
+
+                ctx.stalled = true;
+                return;
+        }
+
+        ctx.retry_at = now_ms + (100u << (ctx.failures - 1));
+}
+
 void Service::invalidate_replicated_partitions_from_peer_cache(cluster_node *n) TANK_NOEXCEPT_IF_NORUNTIME_CHECKS {
         static constexpr bool trace{false};
 
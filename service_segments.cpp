@@ -0,0 +1,228 @@
+#include "service_common.h"
+
+int Rename(const char *oldpath, const char *newpath);
+
+// The segments thread creates the next segment files of partitions that are about to roll, and seals
+// rolled segments, so that topic_partition_log::roll() won't need to block the reactor on the filesystem.
+//
+// A partition's next segment files are named .next.log and .next.index; files that begin with '.' are
+// ignored by open_partition_log() and reset_partition_log(). roll() renames them to their real names on
+// the reactor thread, because both renames must have been completed before we append to the new segment.
+// If the broker crashes before the rolled segment is sealed, open_partition_log() will find
+// more than one mutable(.log) segments, and will seal all but the latest one.
+//
+// The next segment log is preallocated to maxSegmentSize, so that appending to it won't change its size or
+// allocate blocks. It still costs fdatasync() a metadata commit: preallocated extents are unwritten, and the first
+// write to each converts it. If a retired segment was recycled(see reclaimer_main()), we reuse its blocks instead of allocating
+// new ones. See segment_logical_size() for how we determine its logical size.
+// Segments of partitions we appended bundles without a CRC32C to are not preallocated(log_size is 0); see append_bundle()
+void Service::process_segment_op(segment_op *op) {
+        static constexpr bool trace{false};
+        char                  path[PATH_MAX], new_path[PATH_MAX];
+
+        switch (op->type) {
+                case segment_op::Type::Prepare: {
+                        static constexpr int flags = O_RDWR | O_CREAT | O_TRUNC | O_NOATIME | O_LARGEFILE;
+                        int                  log_fd, index_fd{-1};
+                        bool                 recycled;
+
+                        snprintf(path, sizeof(path), "%s.recycled.log", op->basePartitionPath);
+                        snprintf(new_path, sizeof(new_path), "%s.next.log", op->basePartitionPath);
+                        recycled = rename(path, new_path) == 0;
+                        log_fd   = open(new_path, recycled ? (flags & ~O_TRUNC) : flags, 0775);
+
+                        if (log_fd != -1) {
+                                snprintf(path, sizeof(path), "%s.next.index", op->basePartitionPath);
+                                index_fd = open(path, flags | O_APPEND, 0775);
+
+                                if (index_fd == -1) {
+                                        TANKUtil::safe_close(log_fd);
+                                        log_fd = -1;
+                                }
+                        }
+
+                        if (log_fd == -1) {
+                                Print("Failed to prepare next segment in ", op->basePartitionPath, ":", strerror(errno), "\n");
+                        } else {
+                                const off64_t log_size = op->prepare.log_size;
+                                struct stat64 st;
+
+                                if (!log_size) {
+                                        // not preallocated; see prepare_next_segment()
+                                        if (recycled) {
+                                                ftruncate(log_fd, 0);
+                                        }
+                                } else if (recycled) {
+                                        // the recycled segment's content must read as zeros; this keeps its blocks allocated
+                                        if (fstat64(log_fd, &st) == 0 && st.st_size > log_size) {
+                                                ftruncate(log_fd, log_size);
+                                        }
+
+                                        if (fallocate(log_fd, FALLOC_FL_ZERO_RANGE, 0, log_size) == -1) {
+                                                if (trace) {
+                                                        SLog("fallocate(FALLOC_FL_ZERO_RANGE) failed:", strerror(errno), "\n");
+                                                }
+
+                                                recycled = false;
+                                                ftruncate(log_fd, 0);
+                                        } else {
+                                                this_service->segments.recycled.fetch_add(1, std::memory_order_relaxed);
+                                        }
+                                }
+
+                                // best effort; if this fails, the segment will just grow as we append to it
+                                if (log_size && !recycled && fallocate(log_fd, 0, 0, log_size) == -1 && trace) {
+                                        SLog("fallocate() failed:", strerror(errno), "\n");
+                                }
+
+                                fallocate(index_fd, FALLOC_FL_KEEP_SIZE, 0, op->prepare.index_size);
+                        }
+
+                        run_on_main_thread([partition = op->partition, log_fd, index_fd]() {
+                                this_service->adopt_next_segment(partition, log_fd, index_fd);
+                        });
+                } break;
+
+                case segment_op::Type::Seal: {
+                        const auto &s = op->seal;
+
+                        if (s.name_encodes_ts) {
+                                snprintf(path, sizeof(path), "%s%" PRIu64 "_%" PRIu32 ".log", op->basePartitionPath, s.base_seqnum, s.created_ts);
+                        } else {
+                                snprintf(path, sizeof(path), "%s%" PRIu64 ".log", op->basePartitionPath, s.base_seqnum);
+                        }
+                        snprintf(new_path, sizeof(new_path), "%s%" PRIu64 "-%" PRIu64 "_%" PRIu32 ".ilog",
+                                 op->basePartitionPath, s.base_seqnum, s.last_avail_seqnum, s.freeze_ts);
+
+                        if (Rename(path, new_path) == -1) {
+                                // open_partition_log() will seal it if we restart
+                                Print("Failed to seal rolled segment ", path, ":", strerror(errno), "\n");
+                        }
+
+                        // release blocks preallocated past the end of the segment
+                        if (ftruncate(s.log_fd, s.file_size) == -1 && trace) {
+                                SLog("ftruncate() failed:", strerror(errno), "\n");
+                        }
+                        TANKUtil::safe_close(s.log_fd);
+
+                        if (s.index_fd != -1) {
+                                fdatasync(s.index_fd);
+                                TANKUtil::safe_close(s.index_fd);
+                        }
+
+                        op->partition->pending_seals.fetch_sub(1, std::memory_order_release);
+                        this_service->file_op_completed();
+                } break;
+
+                default:
+                        break;
+        }
+}
+
+void Service::schedule_segment_op(segment_op *op) {
+        static std::once_flag onceFlag;
+
+        std::call_once(onceFlag, [this] {
+                segments.thread.reset(new std::thread([this]() {
+                        std::vector<segment_op *> localWork;
+                        sigset_t                  mask;
+
+                        sigfillset(&mask);
+                        pthread_sigmask(SIG_SETMASK, &mask, nullptr);
+                        for (bool done = false; !done;) {
+                                std::unique_lock<std::mutex> lock(segments.workLock);
+
+                                segments.workCond.wait(lock, [this] { return segments.pending.any(); });
+                                for (auto it = segments.pending.drain(); it; it = it->next) {
+                                        localWork.push_back(it);
+                                }
+                                lock.unlock();
+
+                                // drain() returns them in reverse order
+                                std::reverse(localWork.begin(), localWork.end());
+                                for (auto op : localWork) {
+                                        if (op->type == segment_op::Type::Stop) {
+                                                done = true;
+                                        } else {
+                                                process_segment_op(op);
+                                        }
+
+                                        delete op;
+                                }
+                                localWork.clear();
+                        }
+                }));
+        });
+
+        segments.pending.push_back(op);
+
+        // so that we won't miss the thread while it's about to wait
+        segments.workLock.lock();
+        segments.workLock.unlock();
+        segments.workCond.notify_one();
+}
+
+void Service::prepare_next_segment(topic_partition_log *log) {
+        auto partition = log->partition;
+        auto op        = new segment_op();
+
+        TANK_EXPECT(!(partition->flags & unsigned(topic_partition::Flags::NextSegmentPending)));
+        TANK_EXPECT(log->next_segment.log_fd == -1);
+
+        partition->flags |= unsigned(topic_partition::Flags::NextSegmentPending);
+
+        op->type               = segment_op::Type::Prepare;
+        op->partition          = partition;
+        op->prepare.log_size   = log->next_segment.preallocate ? log->config.maxSegmentSize : 0;
+        op->prepare.index_size = log->config.maxIndexSize;
+        snprintf(op->basePartitionPath, sizeof(op->basePartitionPath), "%.*s/%.*s/%u/",
+                 static_cast<int>(basePath_.size()), basePath_.data(),
+                 static_cast<int>(partition->owner->name().size()), partition->owner->name().data(), partition->idx);
+
+        schedule_segment_op(op);
+}
+
+void Service::adopt_next_segment(topic_partition *partition, int log_fd, int index_fd) {
+        partition->flags &= ~unsigned(topic_partition::Flags::NextSegmentPending);
+
+        if (log_fd == -1) {
+                return;
+        }
+
+        if (auto log = partition->_log.get(); log && log->next_segment.log_fd == -1) {
+                log->next_segment.log_fd   = log_fd;
+                log->next_segment.index_fd = index_fd;
+        } else {
+                // the log was closed in the meantime
+                TANKUtil::safe_close(log_fd);
+                TANKUtil::safe_close(index_fd);
+        }
+}
+
+void Service::seal_rolled_segment(topic_partition_log *log, const uint64_t last_avail_seqnum, const uint32_t freeze_ts, const int index_fd) {
+        auto       partition = log->partition;
+        auto       op        = new segment_op();
+        const auto log_fd    = dup(log->cur.fdh->fd);
+
+        if (log_fd == -1) {
+                delete op;
+                throw Switch::system_error("dup() failed:", strerror(errno));
+        }
+
+        op->type                   = segment_op::Type::Seal;
+        op->partition              = partition;
+        op->seal.base_seqnum       = log->cur.baseSeqNum;
+        op->seal.last_avail_seqnum = last_avail_seqnum;
+        op->seal.created_ts        = log->cur.createdTS;
+        op->seal.freeze_ts         = freeze_ts;
+        op->seal.name_encodes_ts   = log->cur.nameEncodesTS;
+        op->seal.file_size         = log->cur.fileSize;
+        op->seal.log_fd            = log_fd;
+        op->seal.index_fd          = index_fd;
+        snprintf(op->basePartitionPath, sizeof(op->basePartitionPath), "%.*s/%.*s/%u/",
+                 static_cast<int>(basePath_.size()), basePath_.data(),
+                 static_cast<int>(partition->owner->name().size()), partition->owner->name().data(), partition->idx);
+
+        partition->pending_seals.fetch_add(1, std::memory_order_relaxed);
+        schedule_segment_op(op);
+}
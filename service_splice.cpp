@@ -0,0 +1,270 @@
+#include "service_common.h"
+#include <fcntl.h>
+
+// See Service::splice_ingest
+//
+// Large bundles are usually compressed by the producers, and we don't need to look past their header, so instead of reading them in
+// and then writing them out to the segment, we move them from the socket to a pipe, and from the pipe to the segment.
+//
+// We only do so for Produce requests for a single partition, that's already open, when the bundle is not checksummed(we 'd need
+// its content to verify it), and when we can have all of the bundle content we haven't read yet queued in the socket receive buffer. We set the socket's
+// receive low watermark so that we won't be notified until then, and then splice it in one go, so that we won't need to deal with concurrent appends
+// to the partition while we are waiting for more content.
+//
+// Returns the partition of the single bundle of the Produce request content [p, msg_end), if that partition is open
+// and the request is otherwise eligible for splicing, or nullptr
+//
+// [p, e) is what we have received so far of the request content; the bundle header must be in there
+topic_partition *Service::splice_ingest_partition(const uint8_t msg, const uint8_t *p, const uint8_t *const e, const uint8_t *const msg_end) {
+        // client version, request id, client id
+        if (p + sizeof(uint16_t) + sizeof(uint32_t) + sizeof(uint8_t) > e) {
+                return nullptr;
+        }
+        p += sizeof(uint16_t) + sizeof(uint32_t);
+        p += *p + sizeof(uint8_t);
+
+        // required acks, ack timeout, topics count, topic name
+        if (p + sizeof(uint8_t) + sizeof(uint32_t) + sizeof(uint8_t) + sizeof(uint8_t) > e) {
+                return nullptr;
+        }
+        p += sizeof(uint8_t) + sizeof(uint32_t);
+
+        if (decode_pod<uint8_t>(p) != 1) {
+                return nullptr;
+        }
+
+        if (p + *p + sizeof(uint8_t) + sizeof(uint8_t) + sizeof(uint16_t) > e) {
+                return nullptr;
+        }
+
+        const str_view8 topic_name(reinterpret_cast<const char *>(p) + 1, *p);
+        uint32_t        bundle_len;
+
+        p += topic_name.size() + sizeof(uint8_t);
+        if (decode_pod<uint8_t>(p) != 1) {
+                return nullptr;
+        }
+
+        const auto partition_id = decode_pod<uint16_t>(p);
+
+        if (!Compression::decode_varuint32(p, e, &bundle_len)) {
+                return nullptr;
+        }
+
+        if (msg == uint8_t(TankAPIMsgType::ProduceWithSeqnum)) {
+                p += sizeof(uint64_t);
+        }
+
+        if (p + bundle_len != msg_end || p >= e) {
+                return nullptr;
+        }
+
+        // the bundle header must be in memory; flags, extra flags and their fields, messages count and sparse bundle sequence numbers
+        const auto bundle_flags = decode_pod<uint8_t>(p);
+        const auto extra_flags  = (bundle_flags & (1u << 7)) && p < e ? *p : uint8_t(0);
+        uint32_t   msgset_size  = (bundle_flags >> 2) & 0xf;
+
+        if (!TANKUtil::skip_bundle_extra_hdr(bundle_flags, p, e)) {
+                return nullptr;
+        }
+
+        if (extra_flags & uint8_t(TankFlags::BundleExtraFlags::CRC32C)) {
+                return nullptr;
+        }
+
+        if (0 == msgset_size && !Compression::decode_varuint32(p, e, &msgset_size)) {
+                return nullptr;
+        }
+
+        if (bundle_flags & (1u << 6)) {
+                // first message seqnum, and last message seqnum delta if there's more than one message
+                uint32_t last_delta;
+
+                if (p + sizeof(uint64_t) > e) {
+                        return nullptr;
+                }
+                p += sizeof(uint64_t);
+
+                if (msgset_size != 1 && !Compression::decode_varuint32(p, e, &last_delta)) {
+                        return nullptr;
+                }
+        }
+
+        auto t         = topic_by_name(topic_name);
+        auto partition = t ? t->enabled_partition(partition_id) : nullptr;
+
+        if (!partition || !partition->_log) {
+                return nullptr;
+        }
+
+        return partition;
+}
+
+// Invoked by try_recv_tank() when it first considers the header of a request that hasn't been received in full
+// [p, e) is what we have received so far of the request content
+bool Service::consider_splice_ingest(connection *const c, const uint8_t msg, const uint8_t *p, const uint8_t *const e, const uint32_t msg_length) {
+        // so that the socket receive buffer can hold all of it
+        static constexpr uint32_t max_remaining{2 * 1024 * 1024};
+        static constexpr bool     trace{false};
+        const auto                remaining = msg_length - static_cast<uint32_t>(e - p);
+        const auto *const         msg_end   = p + msg_length;
+
+        if (!splice_ingest.threshold ||
+            msg_length < splice_ingest.threshold ||
+            remaining > max_remaining ||
+            (msg != uint8_t(TankAPIMsgType::Produce) && msg != uint8_t(TankAPIMsgType::ProduceWithSeqnum)) ||
+            !c->as.tank.parked_requests.empty()) {
+                return false;
+        }
+
+        auto partition = splice_ingest_partition(msg, p, e, msg_end);
+
+        if (!partition) {
+                return false;
+        }
+
+        if (splice_ingest.pipe[0] == -1 && !open_splice_pipe()) {
+                return false;
+        }
+
+        if (const int lowat = remaining; -1 == setsockopt(c->fd, SOL_SOCKET, SO_RCVLOWAT, &lowat, sizeof(lowat))) {
+                if (trace) {
+                        SLog("Unable to set SO_RCVLOWAT:", strerror(errno), "\n");
+                }
+
+                return false;
+        }
+
+        if (trace) {
+                SLog("Will splice ", remaining, " bytes for ", partition->owner->name(), "/", partition->idx, "\n");
+        }
+
+        c->as.tank.splice_remaining = remaining;
+        return true;
+}
+
+// Invoked by try_recv() once there are *n bytes in the socket receive buffer; n is updated to account for the content we spliced
+// Returns false if the connection was shut down
+bool Service::try_splice_ingest(connection *const c, int *const n) {
+        const auto remaining = c->as.tank.splice_remaining;
+
+        if (static_cast<uint32_t>(*n) < remaining) {
+                // we were notified before all of it was queued, e.g because the socket is under memory pressure
+                abandon_splice_ingest(c);
+                return true;
+        }
+
+        auto        b          = c->inB;
+        const auto *p          = reinterpret_cast<const uint8_t *>(b->data_at_offset());
+        const auto  msg        = *p++;
+        const auto  msg_length = decode_pod<uint32_t>(p);
+
+        if (!splice_ingest_partition(msg, p, reinterpret_cast<const uint8_t *>(b->end()), p + msg_length)) {
+                // the partition was closed(e.g by consider_active_partitions()) or disabled since consider_splice_ingest()
+                // we 'll read in the rest of the request, and process it as usual
+                abandon_splice_ingest(c);
+                return true;
+        }
+
+        auto src = splice_source{
+            .fd         = c->fd,
+            .pipe       = {splice_ingest.pipe[0], splice_ingest.pipe[1]},
+            .pipe_size  = splice_ingest.pipe_size,
+            .remaining  = remaining,
+            .pipe_dirty = false};
+
+        abandon_splice_ingest(c);
+        c->as.tank.flags &= ~unsigned(connection::As::Tank::Flags::ConsideredReqHeader);
+
+        profiler.cur.msg = msg;
+        if (!process_produce(TankAPIMsgType(msg), c, p, msg_length, &src)) {
+                return false;
+        }
+
+        if (src.pipe_dirty) {
+                close_splice_pipe();
+        }
+
+        if (const auto spliced = remaining - src.remaining) {
+                ++splice_ingest.bundles;
+                splice_ingest.bytes += spliced;
+        }
+
+        // we didn't append it(e.g partition is no longer available, or duplicate bundle), or we failed to
+        for (uint8_t discard[16 * 1024]; src.remaining;) {
+                if (const auto r = read(c->fd, discard, std::min<size_t>(src.remaining, sizeof(discard))); r > 0) {
+                        src.remaining -= r;
+                } else if (-1 == r && EINTR == errno) {
+                        continue;
+                } else {
+                        track_shutdown(c, __LINE__, "Failed to discard bundle content\n");
+                        return shutdown(c, __LINE__);
+                }
+        }
+
+        // that request was all we had received
+        c->inB = nullptr;
+        b->clear();
+        put_buf(b);
+        try_make_idle(c);
+
+        *n -= remaining;
+        return true;
+}
+
+// We 'll just read in the rest of the request as usual
+void Service::abandon_splice_ingest(connection *const c) {
+        static constexpr int lowat{1};
+
+        c->as.tank.splice_remaining = 0;
+        setsockopt(c->fd, SOL_SOCKET, SO_RCVLOWAT, &lowat, sizeof(lowat));
+}
+
+bool Service::open_splice_pipe() {
+        if (-1 == pipe2(splice_ingest.pipe, O_NONBLOCK | O_CLOEXEC)) {
+                splice_ingest.pipe[0] = splice_ingest.pipe[1] = -1;
+                return false;
+        }
+
+        // the larger the pipe, the fewer splice() calls; this may fail(see /proc/sys/fs/pipe-max-size)
+        fcntl(splice_ingest.pipe[1], F_SETPIPE_SZ, 1024 * 1024);
+        splice_ingest.pipe_size = fcntl(splice_ingest.pipe[1], F_GETPIPE_SZ);
+        return true;
+}
+
+void Service::close_splice_pipe() {
+        for (auto &fd : splice_ingest.pipe) {
+                if (fd != -1) {
+                        TANKUtil::safe_close(fd);
+                        fd = -1;
+                }
+        }
+}
+
+// Invoked by topic_partition_log::append_bundle(); moves all remaining bytes from the socket to fd at offset
+bool splice_source::splice_to(const int out, loff_t offset) {
+        while (remaining) {
+                const auto r = splice(fd, nullptr, pipe[1], nullptr, std::min(remaining, pipe_size), SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+                if (-1 == r && EINTR == errno) {
+                        continue;
+                } else if (r <= 0) {
+                        return false;
+                }
+
+                remaining -= r;
+
+                for (auto n = r; n;) {
+                        if (const auto w = splice(pipe[0], nullptr, out, &offset, n, SPLICE_F_MOVE); w > 0) {
+                                n -= w;
+                        } else if (-1 == w && EINTR == errno) {
+                                continue;
+                        } else {
+                                pipe_dirty = true;
+                                return false;
+                        }
+                }
+        }
+
+        return true;
+}
@@ -0,0 +1,187 @@
+#include "service_common.h"
+
+// fdatasync() latency(us), recorded by the sync workers
+extern hdr_histogram<true> fsync_latency;
+
+// Segment logs are fdatasync()ed by a pool of sync workers; periodically(see topic_partition_log::schedule_flush()), and
+// for durable produce requests, which are not acknowledged until the bundles they appended have been synced(see process_produce()).
+//
+// Requests are grouped by the device the segments are stored in. A device is synced by at most one worker at a time, which
+// takes all the requests pending for it as a batch, and syncs every segment involved in the batch once; requests scheduled in the meantime
+// accumulate and are synced in the next batch, so that however many partitions are produced to concurrently, there are only so many
+// fdatasync()s in flight per device, and durable produce throughput does not degrade much compared to acknowledging writes immediately.
+// Different devices are synced concurrently by different workers.
+void Service::sync_worker() {
+        std::vector<sync_request *> batch;
+        std::vector<int>            fds, failed;
+        std::vector<uint32_t>       latencies;
+        sigset_t                    mask;
+
+        sigfillset(&mask);
+        pthread_sigmask(SIG_SETMASK, &mask, nullptr);
+        for (;;) {
+                sync_device *d;
+
+                {
+                        std::unique_lock<std::mutex> lock(syncs.workLock);
+
+                        syncs.workCond.wait(lock, [this] { return syncs.stop || !syncs.ready.empty(); });
+                        if (syncs.ready.empty()) {
+                                // pending requests are synced before we exit
+                                return;
+                        }
+
+                        d = syncs.ready.front();
+                        syncs.ready.pop_front();
+                        d->queued = false;
+                        d->busy   = true;
+                        batch.swap(d->pending);
+                }
+
+                fds.clear();
+                for (const auto r : batch) {
+                        fds.emplace_back(r->fdh->fd);
+                        if (r->index_fd != -1) {
+                                fds.emplace_back(r->index_fd);
+                        }
+                }
+                std::sort(fds.begin(), fds.end());
+                fds.erase(std::unique(fds.begin(), fds.end()), fds.end());
+
+                // initiate write-back of all dirty pages first, so that the device can service them concurrently
+                // the fdatasync()s that follow will mostly wait for I/O that is already in flight
+                if (fds.size() > 1) {
+                        for (const auto fd : fds) {
+                                sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+                        }
+                }
+
+                failed.clear();
+                latencies.clear();
+                for (const auto fd : fds) {
+                        const auto b = Timings::Microseconds::Tick();
+
+                        if (fdatasync(fd) == -1) {
+                                failed.emplace_back(fd);
+                        }
+
+                        const auto took = Timings::Microseconds::Since(b);
+
+                        fsync_latency.reg_sample(took);
+                        latencies.emplace_back(std::min<uint64_t>(took, std::numeric_limits<uint32_t>::max()));
+                }
+
+                for (auto r : batch) {
+                        // fds[] is sorted; latencies[] is in the same order
+                        const auto latency_of = [&](const int fd) noexcept {
+                                return latencies[std::lower_bound(fds.begin(), fds.end(), fd) - fds.begin()];
+                        };
+
+                        r->failed = std::binary_search(failed.begin(), failed.end(), r->fdh->fd) ||
+                                    (r->index_fd != -1 && std::binary_search(failed.begin(), failed.end(), r->index_fd));
+                        r->latency = latency_of(r->fdh->fd) + (r->index_fd != -1 ? latency_of(r->index_fd) : 0);
+
+                        if (r->index_fd != -1) {
+                                TANKUtil::safe_close(r->index_fd);
+                                r->index_fd = -1;
+                        }
+                }
+
+                syncs.batches.fetch_add(1, std::memory_order_relaxed);
+                syncs.synced.fetch_add(fds.size(), std::memory_order_relaxed);
+
+                run_on_main_thread([v = new std::vector<sync_request *>(std::move(batch))]() {
+                        this_service->complete_sync_requests(v);
+                });
+                batch.clear();
+
+                {
+                        std::lock_guard<std::mutex> g(syncs.workLock);
+
+                        d->busy = false;
+                        if (!d->pending.empty()) {
+                                // we 'll likely get to it next
+                                d->queued = true;
+                                syncs.ready.push_back(d);
+                        }
+                }
+        }
+}
+
+void Service::schedule_sync(topic_partition_log *log, sync_request *r) {
+        bool notify{false};
+
+        // so that we can track the partition's fdatasync() latency when the request completes
+        if (!r->partition) {
+                r->partition = log->partition;
+        }
+        r->partition->Retain();
+
+        if (!log->sync_dev) {
+                struct stat64 st;
+
+                // if this fails, we 'll just group it with whatever else fails
+                log->sync_dev = fstat64(log->cur.fdh->fd, &st) == 0 ? st.st_dev : 0;
+        }
+
+        syncs.workLock.lock();
+
+        auto &d = syncs.devices[*log->sync_dev];
+
+        if (!d) {
+                d.reset(new sync_device());
+                d->dev = *log->sync_dev;
+        }
+
+        d->pending.emplace_back(r);
+        if (!d->busy && !d->queued) {
+                d->queued = true;
+                syncs.ready.push_back(d.get());
+                notify = true;
+        }
+
+        syncs.workLock.unlock();
+
+        if (notify) {
+                syncs.workCond.notify_one();
+        }
+}
+
+void Service::complete_sync_requests(std::vector<sync_request *> *v) {
+        for (auto r : *v) {
+                auto  partition = r->partition;
+                auto &hist      = partition->metrics.fsync_latency;
+
+                if (!hist) {
+                        hist.reset(new hdr_histogram<>());
+                }
+                hist->reg_sample(r->latency);
+
+                // cookie check; the DPR may have expired, or the client connection may have gone away
+                if (auto dpr = r->dpr; dpr && dpr->gen == r->dpr_gen) {
+                        dpr->participants[r->pr_participant_idx].sync_res = r->failed
+                                                                                ? produce_response::participant::OpRes::IO_Fault
+                                                                                : produce_response::participant::OpRes::OK;
+
+                        // trampoline to try_generate_produce_response()
+                        confirm_deferred_produce_resp_partition(dpr, partition, r->pr_participant_idx);
+                }
+
+                partition->Release();
+                delete r;
+        }
+
+        delete v;
+}
+
+void Service::stop_sync_workers() {
+        syncs.workLock.lock();
+        syncs.stop = true;
+        syncs.workLock.unlock();
+        syncs.workCond.notify_all();
+
+        for (auto &t : syncs.workers) {
+                t.join();
+        }
+        syncs.workers.clear();
+}
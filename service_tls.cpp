@@ -0,0 +1,166 @@
+#include "service_common.h"
+#ifdef HAVE_TANK_TLS
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+
+// Client connections are TLS encrypted if a certificate is provided(TANK_TLS_CERT, and TANK_TLS_KEY unless the key is in the same file).
+// Connections to peers for replication are encrypted as well. Peer certificates are always verified, against TANK_TLS_CA if set, or
+// the system's default trust store otherwise, and must have been issued for the peer's IP address, or for TANK_TLS_PEER_NAME if set
+// (e.g a certificate shared by all nodes of the cluster).
+//
+// OpenSSL is only used for the handshake; once that's complete, the session is handed to the kernel(kTLS), and the SSL is released.
+// From then on, we read(), writev() and sendfile() like we do for plaintext connections, and the kernel encrypts and decrypts the
+// records, so that we keep streaming segments content without copying it to userspace.
+// If kTLS can't be enabled for a connection(e.g the tls kernel module is not loaded, or no cipher supported by the kernel was negotiated), we shut it down.
+//
+// We don't issue session tickets, so that clients won't need to process any post-handshake messages, which kTLS won't do for them.
+static SSL_CTX *new_tls_ctx(const SSL_METHOD *method) {
+        auto ctx = SSL_CTX_new(method);
+
+        if (!ctx) {
+                return nullptr;
+        }
+
+        SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+        SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS | SSL_OP_NO_COMPRESSION | SSL_OP_NO_RENEGOTIATION);
+
+        // ciphers supported by kTLS
+        if (SSL_CTX_set_cipher_list(ctx, "ECDHE+AESGCM:ECDHE+CHACHA20") != 1 ||
+            SSL_CTX_set_ciphersuites(ctx, "TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384:TLS_CHACHA20_POLY1305_SHA256") != 1) {
+                SSL_CTX_free(ctx);
+                return nullptr;
+        }
+
+        return ctx;
+}
+
+bool Service::init_tls() {
+        const char *const cert = getenv("TANK_TLS_CERT");
+        const char *const key  = getenv("TANK_TLS_KEY") ?: cert;
+        const char *const ca   = getenv("TANK_TLS_CA");
+
+        if (!cert) {
+                return true;
+        }
+
+        tls_ctx        = new_tls_ctx(TLS_server_method());
+        tls_client_ctx = new_tls_ctx(TLS_client_method());
+
+        if (!tls_ctx || !tls_client_ctx) {
+                Print("Failed to initialize TLS:", ERR_error_string(ERR_get_error(), nullptr), "\n");
+                return false;
+        }
+
+        SSL_CTX_set_num_tickets(tls_ctx, 0);
+        if (SSL_CTX_use_certificate_chain_file(tls_ctx, cert) != 1 ||
+            SSL_CTX_use_PrivateKey_file(tls_ctx, key, SSL_FILETYPE_PEM) != 1 ||
+            SSL_CTX_check_private_key(tls_ctx) != 1) {
+                Print("Failed to load TLS certificate ", cert, " and key ", key, ":", ERR_error_string(ERR_get_error(), nullptr), "\n");
+                return false;
+        }
+
+        if (ca) {
+                if (SSL_CTX_load_verify_locations(tls_client_ctx, ca, nullptr) != 1) {
+                        Print("Failed to load TLS CA ", ca, ":", ERR_error_string(ERR_get_error(), nullptr), "\n");
+                        return false;
+                }
+        } else if (SSL_CTX_set_default_verify_paths(tls_client_ctx) != 1) {
+                Print("Failed to load the default TLS CA locations; set TANK_TLS_CA:", ERR_error_string(ERR_get_error(), nullptr), "\n");
+                return false;
+        }
+
+        SSL_CTX_set_verify(tls_client_ctx, SSL_VERIFY_PEER, nullptr);
+        tls_peer_name = getenv("TANK_TLS_PEER_NAME");
+        return true;
+}
+
+void Service::tear_down_tls() {
+        if (tls_ctx) {
+                SSL_CTX_free(std::exchange(tls_ctx, nullptr));
+        }
+
+        if (tls_client_ctx) {
+                SSL_CTX_free(std::exchange(tls_client_ctx, nullptr));
+        }
+}
+
+// Invoked for accepted client connections, and for connections to peers once they are established
+bool Service::begin_tls_handshake(connection *const c, const bool client) {
+        auto ssl = SSL_new(client ? tls_client_ctx : tls_ctx);
+
+        if (!ssl || SSL_set_fd(ssl, c->fd) != 1) {
+                if (ssl) {
+                        SSL_free(ssl);
+                }
+
+                track_shutdown(c, __LINE__, "Failed to initialize TLS session\n");
+                return shutdown(c, __LINE__);
+        }
+
+        if (client) {
+                // we only connect to peers; verify that we are talking to the peer we meant to
+                const auto &ep = c->as.consumer.node->ep;
+                const auto  ok = tls_peer_name
+                                    ? SSL_set1_host(ssl, tls_peer_name) == 1 && SSL_set_tlsext_host_name(ssl, tls_peer_name) == 1
+                                    : X509_VERIFY_PARAM_set1_ip(SSL_get0_param(ssl), reinterpret_cast<const unsigned char *>(&ep.addr4), sizeof(ep.addr4)) == 1;
+
+                if (!ok) {
+                        SSL_free(ssl);
+                        track_shutdown(c, __LINE__, "Failed to set TLS peer identity\n");
+                        return shutdown(c, __LINE__);
+                }
+
+                SSL_set_connect_state(ssl);
+        } else {
+                SSL_set_accept_state(ssl);
+        }
+
+        c->tls = ssl;
+        return tls_handshake(c);
+}
+
+// Invoked by process_io() while the handshake is in progress
+bool Service::tls_handshake(connection *const c) {
+        auto ssl = c->tls;
+
+        TANK_EXPECT(ssl);
+        ERR_clear_error();
+
+        if (const auto r = SSL_do_handshake(ssl); r != 1) {
+                switch (SSL_get_error(ssl, r)) {
+                        case SSL_ERROR_WANT_READ:
+                                poller.set_data_events(c->fd, c, EPOLLIN);
+                                return true;
+
+                        case SSL_ERROR_WANT_WRITE:
+                                poller.set_data_events(c->fd, c, EPOLLOUT);
+                                return true;
+
+                        default:
+                                track_shutdown(c, __LINE__, "TLS handshake failed:", ERR_error_string(ERR_get_error(), nullptr), "\n");
+                                return shutdown(c, __LINE__);
+                }
+        }
+
+        if (!BIO_get_ktls_send(SSL_get_wbio(ssl)) || !BIO_get_ktls_recv(SSL_get_rbio(ssl))) {
+                Print("Unable to use kTLS for TLS connection(cipher ", SSL_get_cipher_name(ssl), "); is the tls kernel module loaded?\n");
+                track_shutdown(c, __LINE__, "kTLS not available\n");
+                return shutdown(c, __LINE__);
+        }
+
+        // the kernel owns the session now; SSL_set_fd() won't close the socket
+        SSL_free(std::exchange(c->tls, nullptr));
+        c->state.flags |= 1u << unsigned(connection::State::Flags::SecureChannel);
+
+        if (c->type == connection::Type::Consumer) {
+                // we held off considering it established until now
+                expected_connest(c);
+        } else {
+                // PendingIntro
+                update_poll_events(c);
+        }
+
+        return true;
+}
+#endif
@@ -1,54 +1,157 @@
 #include "service_common.h"
 
+// tank verify [-c] [-j threads] path..
+//
+// Paths can be segment log and index files, or directories, which are scanned recursively; you can verify
+// all partitions by specifying the base path.
+// -c only verifies the bundles framing and the CRC32C of bundles that carry one, which is much faster
+// than decoding every message, and is what you likely want for periodic scrubbing.
+// -j verifies that many files concurrently.
 int Service::verify(char *paths[], const int cnt) {
-        size_t n{0}, tot{0};
-        bool   anyFailed{false};
+        std::vector<std::string> files;
+        bool                     checksums_only{false};
+        unsigned                 threads_cnt{1};
+        std::atomic<size_t>      next{0}, tot{0}, bytes{0};
+        std::atomic<bool>        anyFailed{false};
+        std::mutex               print_lock;
+        const auto               before = Timings::Microseconds::Tick();
+        const auto               collect = [&files](auto &&self, const char *path) -> void {
+                struct stat64 st;
+
+                if (stat64(path, &st) == -1) {
+                        throw Switch::system_error("stat(", path, ") failed:", strerror(errno));
+                } else if (!S_ISDIR(st.st_mode)) {
+                        files.emplace_back(path);
+                        return;
+                }
+
+                std::vector<std::string> entries;
+
+                for (auto &&name : DirectoryEntries(path)) {
+                        if (name.front() != '.') {
+                                entries.emplace_back(std::string(path) + "/" + std::string(name.data(), name.size()));
+                        }
+                }
+
+                std::sort(entries.begin(), entries.end());
+                for (const auto &it : entries) {
+                        self(self, it.c_str());
+                }
+        };
 
         for (int i{0}; i < cnt; ++i) {
                 const char *const path = paths[i];
-                const strwlen32_t fullPath(path);
-                const auto        ext = fullPath.Extension();
 
-                if (ext.Eq(_S("ilog")) || ext.Eq(_S("log")) || ext.Eq(_S("index"))) {
-                        int fd = open(path, O_RDONLY | O_LARGEFILE);
+                if (!strcmp(path, "-c")) {
+                        checksums_only = true;
+                } else if (!strcmp(path, "-j")) {
+                        if (++i == cnt) {
+                                Print("Expected number of threads for -j\n");
+                                return 1;
+                        }
 
-                        if (fd == -1) {
-				Print("open(", path, ") failed:", strerror(errno), "\n");
+                        threads_cnt = std::clamp<unsigned>(strwlen32_t(paths[i]).as_uint32(), 1, 256);
+                } else {
+                        try {
+                                collect(collect, path);
+                        } catch (const std::exception &e) {
+                                Print(e.what(), "\n");
                                 return 1;
                         }
+                }
+        }
 
-                        DEFER({ close(fd); });
+        const auto verify_file = [&](const std::string &path) {
+                const strwlen32_t fullPath(path.data(), path.size());
+                const auto        ext = fullPath.Extension();
 
-                        Print("Verifying ", fullPath, " (", size_repr(lseek64(fd, 0, SEEK_END)), ") ..\n");
+                if (!ext.Eq(_S("ilog")) && !ext.Eq(_S("log")) && !ext.Eq(_S("index"))) {
+                        std::lock_guard<std::mutex> g(print_lock);
 
-                        try {
-                                if (ext.Eq(_S("ilog")) || ext.Eq(_S("log"))) {
-                                        const auto r = Service::verify_log(fd);
+                        Print("Ignoring ", fullPath, "\n");
+                        return false;
+                }
 
-                                        Print("> ", dotnotation_repr(r), " msgs\n");
-                                        tot += r;
-                                } else if (ext.Eq(_S("index"))) {
-                                        auto name = fullPath;
+                int fd = open(path.c_str(), O_RDONLY | O_LARGEFILE);
+
+                if (fd == -1) {
+                        std::lock_guard<std::mutex> g(print_lock);
+
+                        Print("open(", fullPath, ") failed:", strerror(errno), "\n");
+                        anyFailed = true;
+                        return false;
+                }
+
+                DEFER({ close(fd); });
+
+                const auto size = lseek64(fd, 0, SEEK_END);
+
+                if (threads_cnt == 1) {
+                        Print("Verifying ", fullPath, " (", size_repr(size), ") ..\n");
+                }
+
+                try {
+                        if (ext.Eq(_S("ilog")) || ext.Eq(_S("log"))) {
+                                const auto r = Service::verify_log(fd, ext.Eq(_S("log")), checksums_only);
 
-                                        if (const auto p = name.SearchR('/')) {
-                                                name = name.SuffixFrom(p + 1);
-					}
+                                if (threads_cnt == 1) {
+                                        Print("> ", dotnotation_repr(r), " msgs\n");
+                                }
+                                tot += r;
+                        } else if (!checksums_only) {
+                                auto name = fullPath;
 
-                                        Service::verify_index(fd, name.Divided('_').second.Eq(_S("64")));
+                                if (const auto p = name.SearchR('/')) {
+                                        name = name.SuffixFrom(p + 1);
                                 }
-                        } catch (const std::exception &e) {
-                                Print(ansifmt::bold, ansifmt::color_red, "Failed to verify (", fullPath, ansifmt::reset, ")\n");
-                                anyFailed = true;
+
+                                Service::verify_index(fd, name.Divided('_').second.Eq(_S("64")));
                         }
+                } catch (const std::exception &e) {
+                        std::lock_guard<std::mutex> g(print_lock);
 
-                        ++n;
-                } else {
-                        Print("Ignoring ", fullPath, "\n");
+                        Print(ansifmt::bold, ansifmt::color_red, "Failed to verify (", fullPath, ansifmt::reset, "): ", e.what(), "\n");
+                        anyFailed = true;
                 }
+
+                bytes += size;
+                return true;
+        };
+        const auto worker = [&]() {
+                size_t n{0};
+
+                for (size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < files.size();) {
+                        n += verify_file(files[i]);
+                }
+                return n;
+        };
+        size_t n{0};
+
+        if (threads_cnt == 1) {
+                n = worker();
+        } else {
+                std::vector<std::thread> threads;
+                std::atomic<size_t>      verified{0};
+
+                for (unsigned i{0}; i < threads_cnt; ++i) {
+                        threads.emplace_back([&]() {
+                                verified += worker();
+                        });
+                }
+
+                for (auto &t : threads) {
+                        t.join();
+                }
+
+                n = verified.load();
         }
 
+        const auto duration = Timings::Microseconds::Since(before);
+
         if (!anyFailed) {
-                Print(ansifmt::color_green, "All ", dotnotation_repr(n), " files verified OK, ", dotnotation_repr(tot), " messages", ansifmt::reset, "\n");
+                Print(ansifmt::color_green, "All ", dotnotation_repr(n), " files verified OK, ", dotnotation_repr(tot.load()), " messages", ansifmt::reset,
+                      ", ", size_repr(bytes.load()), " in ", duration_repr(duration),
+                      " (", size_repr(bytes.load() * 1'000'000 / std::max<uint64_t>(duration, 1)), "/s)\n");
                 return 0;
         } else {
                 return 1;
@@ -139,12 +139,12 @@ bool Service::register_consumer_wait(const TankAPIMsgType _msg, connection *cons
                         // the next message past the HWMark
                         out->seqNum = out->hwmark_threshold + 1;
 
-                        if (nullptr == hwmark_fh) {
+                        if (nullptr == hwmark_fh || (cluster_aware() && p->cluster.leader.node != cluster_state.local_node.ref)) {
                                 // this should happen if partition is empty(no messages in any segment)
-                                // or simply no messages were committed.
+                                // or simply no messages were committed, or if we are an ISR follower(see update_follower_hwmark())
                                 //
                                 // we 'll fallback to read_from_local()
-                                // this should be very rare
+                                // this should be very rare for partitions we lead
                                 if (trace) {
                                         SLog("No hwmark_fh\n");
                                 }
@@ -283,7 +283,15 @@ void Service::wakeup_wait_ctx(wait_ctx *const wctx, connection *const produceCon
                                 const auto __v = it->fdh->use_count();
                                 auto       p   = get_file_contents_payload();
 
-                                p->init(it->fdh, it->range, Timings::Microseconds::Tick(), t);
+                                p->init(it->fdh, it->range, Timings::Microseconds::Tick(), t, it->partition);
+                                // content was just appended
+                                p->cls = msg == TankAPIMsgType::ConsumePeer ? tx_class::Replication : tx_class::Tail;
+                                if (const auto log = it->partition->_log.get()) {
+                                        // likely just appended; see topic_partition_log::hot_tail
+                                        if (const auto chunk = log->hot_tail_chunk_for(it->fdh, it->range)) {
+                                                p->set_chunk(chunk);
+                                        }
+                                }
                                 q->push_back(p);
 
                                 TANK_EXPECT(it->fdh->use_count() == __v + 1);
@@ -504,7 +512,8 @@ void Service::consider_highwatermark_update(topic_partition *partition, const ui
         static constexpr bool trace{false};
         TANK_EXPECT(partition);
         TANK_EXPECT(woken_up_ctx);
-        auto &waiting_list = partition->waiting_list;
+        auto &     waiting_list = partition->waiting_list;
+        const bool leader       = cluster_aware() && partition->cluster.leader.node == cluster_state.local_node.ref;
 
         if (trace) {
                 SLog(ansifmt::color_magenta, "Will consider HWM update for ",
@@ -523,6 +532,19 @@ void Service::consider_highwatermark_update(topic_partition *partition, const ui
                 }
 
                 if (ctx->hwmark_threshold == std::numeric_limits<uint64_t>::max()) {
+                        if (leader && it->_msg == TankAPIMsgType::ConsumePeer) {
+                                // Followers only learn of the hwmark from our ConsumePeer responses(see update_follower_hwmark()), and
+                                // they serve consumers up to it, so respond now even if there is no new content, instead of when more
+                                // content is appended or the request times out
+                                if (trace) {
+                                        SLog("Waking up peer so that it learns of the new hwmark\n");
+                                }
+
+                                partition->erase_from_waiting_list(i);
+                                woken_up_ctx->emplace_back(it);
+                                continue;
+                        }
+
                         // handled by consider_append_res()
                         if (trace) {
                                 SLog("Not relevant -- like a consumer(peer) connection\n");
@@ -559,7 +581,11 @@ void Service::consider_highwatermark_update(topic_partition *partition, const ui
                 if (!ctx->fdh) {
                         // it's OK if we don't respect minBytes here
                         // this onyl happens very rarely and consumers are expected to retry
-                        auto                 res = partition->read_from_local(false, ctx->seqNum, it->minBytes);
+                        //
+                        // if we are an ISR follower(see update_follower_hwmark()), we must not serve content past
+                        // the hwmark we know of, which may be behind what we have replicated
+                        const bool           follower = cluster_aware() && partition->cluster.leader.node != cluster_state.local_node.ref;
+                        auto                 res      = partition->read_from_local(follower, ctx->seqNum, it->minBytes);
 #if 0
                         TANKUtil::read_ahead ra(res.fdh->fd);
 
@@ -25,7 +25,8 @@ bool Service::generate_produce_response(produce_response *pr) {
         b->pack(static_cast<uint8_t>(TankAPIMsgType::Produce), static_cast<uint32_t>(0), static_cast<uint32_t>(pr->client_ctx.req_id));
 
         const auto encode_err = [b](const auto &it) {
-                switch (it.res) {
+                // a durable update is only acknowledged once synced
+                switch (it.sync_res != produce_response::participant::OpRes::OK ? it.sync_res : it.res) {
                         case produce_response::participant::OpRes::OK:
                                 b->pack(static_cast<uint8_t>(0));
                                 break;
@@ -65,6 +66,14 @@ bool Service::generate_produce_response(produce_response *pr) {
                                 b->pack(static_cast<uint8_t>(0x4));
                                 break;
 
+                        case produce_response::participant::OpRes::ChecksumMismatch:
+                                b->pack(static_cast<uint8_t>(0x5));
+                                break;
+
+                        case produce_response::participant::OpRes::StaleProducerSeq:
+                                b->pack(static_cast<uint8_t>(0x6));
+                                break;
+
                         default:
                                 IMPLEMENT_ME();
                 }
@@ -73,6 +73,26 @@ bool topic_partition_log::should_roll(const uint32_t now) const {
         return false;
 }
 
+// true if we are likely going to roll soon, so that we should
+// get the segments thread to prepare the next segment for us
+bool topic_partition_log::nearing_roll(const uint32_t now) const {
+        if (read_only || cur.fileSize == UINT32_MAX) {
+                return false;
+        }
+
+        if (cur.fileSize > config.maxSegmentSize / 4 * 3) {
+                return true;
+        }
+
+        const size_t curIndexSizeBytes = cur.index.ondisk.span + (cur.index.skipList.size() * (sizeof(uint32_t) + sizeof(uint32_t)));
+
+        if (curIndexSizeBytes > config.maxIndexSize / 4 * 3) {
+                return true;
+        }
+
+        return cur.rollJitterSecs && TANKUtil::time32_delta(cur.createdTS, now) > cur.rollJitterSecs / 4 * 3;
+}
+
 bool topic_partition_log::may_switch_index_wide(const uint64_t lastMsgSeqNum) {
         // This is required for proper support for sparse segments
         // maybe instead of transforming the index we should instead roll?
@@ -94,7 +114,7 @@ bool topic_partition_log::may_switch_index_wide(const uint64_t lastMsgSeqNum) {
 void topic_partition_log::roll(const uint64_t absSeqNum, const uint64_t saved_last_assigned_seqnum) {
         static constexpr bool trace{false};
         Buffer                basePath;
-        int                   fd;
+        int                   fd, prepared_index_fd{-1};
 
         basePath.append(basePath_, "/", partition->owner->name(), "/", partition->idx, "/");
 
@@ -149,9 +169,19 @@ void topic_partition_log::roll(const uint64_t absSeqNum, const uint64_t saved_la
                         IMPLEMENT_ME();
                 }
 
+                // If we have adopted a prepared segment, the segments thread is also going to seal this one; see seal_rolled_segment()
+                const bool async_seal = next_segment.log_fd != -1;
+
+                if (!async_seal && st.st_size > cur.fileSize && ftruncate(cur.fdh->fd, cur.fileSize) == -1) {
+                        // release blocks preallocated past the end of the segment
+                        throw Switch::system_error("ftruncate() failed:", strerror(errno));
+                }
+
                 // We now encode the [first,last] range into the filename for simplicity and future-proofing; we 'd like to
                 // support sparse sequence numbers space
-                if (cur.nameEncodesTS) {
+                if (async_seal) {
+                        // renamed by the segments thread
+                } else if (cur.nameEncodesTS) {
                         if (Rename(Buffer::build(basePath, "/", cur.baseSeqNum, "_", cur.createdTS, ".log").data(),
                                    Buffer::build(basePath, "/", cur.baseSeqNum, "-", saved_last_assigned_seqnum, "_", freezeTs, ".ilog").data()) == -1) {
                                 throw Switch::system_error("Failed to Rename():", strerror(errno));
@@ -184,6 +214,12 @@ void topic_partition_log::roll(const uint64_t absSeqNum, const uint64_t saved_la
                         newROFile->index.data = nullptr;
                 }
 
+                if (async_seal) {
+                        // must be scheduled before consider_ro_segments(), and after we have mmap()ed the index
+                        this_service->seal_rolled_segment(this, saved_last_assigned_seqnum, freezeTs, cur.index.fd);
+                        cur.index.fd = -1;
+                }
+
                 const auto prevSize = newROFiles->size();
 
                 newROFiles->insert(newROFiles->end(), roSegments->begin(), roSegments->end());
@@ -233,11 +269,34 @@ void topic_partition_log::roll(const uint64_t absSeqNum, const uint64_t saved_la
 
         cur.sanity_checks();
 
+        fd               = -1;
+        cur.preallocated = false;
+        if (next_segment.log_fd != -1) {
+                // adopt the segment prepared by the segments thread
+                const auto        prepared = next_segment;
+                const strwlen32_t dir(basePath.data(), basePathLen);
+
+                next_segment.log_fd = next_segment.index_fd = -1;
+                if (Rename(Buffer::build(dir, ".next.log").data(), basePath.c_str()) == 0 &&
+                    Rename(Buffer::build(dir, ".next.index").data(), Buffer::build(dir, cur.baseSeqNum, ".index").data()) == 0) {
+                        fd                = prepared.log_fd;
+                        prepared_index_fd = prepared.index_fd;
+                        // may not be, if it was prepared after next_segment.preallocate was cleared; that only costs an ftruncate()
+                        cur.preallocated  = true;
+                } else {
+                        Print("Failed to adopt prepared segment in ", dir, ":", strerror(errno), "\n");
+                        TANKUtil::safe_close(prepared.log_fd);
+                        TANKUtil::safe_close(prepared.index_fd);
+                }
+        }
+
         // XXX:
         // Should open() .log.transient and .index.transient
         // and if both are successful, rename and use
         // as opposed to throwing an exception here and getting stuck in limbo
-        fd = this_service->safe_open(basePath.c_str(), read_only ? O_RDONLY : (O_RDWR | O_LARGEFILE | O_CREAT | O_NOATIME | O_APPEND), 0775);
+        if (-1 == fd) {
+                fd = this_service->safe_open(basePath.c_str(), read_only ? O_RDONLY : (O_RDWR | O_LARGEFILE | O_CREAT | O_NOATIME), 0775);
+        }
 
         if (-1 == fd) {
                 if (errno == ENFILE || errno == EMFILE || errno == ENOSPC || errno == EDQUOT) {
@@ -257,7 +316,9 @@ void topic_partition_log::roll(const uint64_t absSeqNum, const uint64_t saved_la
         basePath.resize(basePathLen);
         basePath.append(cur.baseSeqNum, ".index");
 
-        fd = this_service->safe_open(basePath.c_str(), read_only ? O_RDWR : (O_RDWR | O_LARGEFILE | O_CREAT | O_NOATIME | O_APPEND), 0775);
+        fd = prepared_index_fd != -1
+                 ? prepared_index_fd
+                 : this_service->safe_open(basePath.c_str(), read_only ? O_RDWR : (O_RDWR | O_LARGEFILE | O_CREAT | O_NOATIME | O_APPEND), 0775);
 
         if (-1 == fd) {
 		const auto saved_errno = errno;
@@ -341,13 +402,182 @@ void topic_partition_log::flush_index_skiplist() {
         cur.index.skipList.clear();
 }
 
+// Returns the offset of the last bundle recorded in a (relSeqNum:u32, absPhysical:u32) tuples index at or before target, or 0
+static uint32_t indexed_offset_at_or_before(const uint8_t *const index, const uint32_t index_size, const uint32_t target) noexcept {
+        const auto *const all = reinterpret_cast<const uint32_t *>(index);
+        int32_t           lo{0}, hi = (index_size / (sizeof(uint32_t) * 2)) - 1;
+        uint32_t          o{0};
+
+        while (lo <= hi) {
+                const auto mid = (lo + hi) / 2;
+
+                if (all[mid * 2 + 1] <= target) {
+                        o  = all[mid * 2 + 1];
+                        lo = mid + 1;
+                } else {
+                        hi = mid - 1;
+                }
+        }
+
+        return o;
+}
+
+// Tracks the producer sequence numbers of the bundles in [o, file_size) of the segment log fd
+// The tail may be torn(e.g a partially written bundle after a crash), so we stop at the first bundle that's not
+// fully contained in what we read. Returns false if we failed to read it.
+bool topic_partition_log::scan_producers_window(int fd, const uint32_t o, const uint32_t file_size) {
+        static constexpr bool trace{false};
+        const auto            span = file_size - o;
+
+        if (!span) {
+                return true;
+        }
+
+        auto *const data = static_cast<uint8_t *>(malloc(span));
+
+        if (unlikely(!data)) {
+                return false;
+        }
+
+        DEFER({ free(data); });
+
+        if (const auto r = pread64(fd, data, span, o); unlikely(r != span)) {
+                if (trace) {
+                        SLog("pread64() failed:", r == -1 ? strerror(errno) : "short read", "\n");
+                }
+
+                return false;
+        }
+
+        if (trace) {
+                SLog("Rebuilding producers window from ", size_repr(span), " at ", o, " for ", partition->owner->name(), "/", partition->idx, "\n");
+        }
+
+        for (const auto *p = data, *const e = p + span; p < e;) {
+                uint32_t bundle_len;
+
+                if (unlikely(!Compression::decode_varuint32(p, e, &bundle_len) || !bundle_len || bundle_len > e - p)) {
+                        break;
+                }
+
+                const auto next = p + bundle_len;
+
+                if (const auto bundle_flags = *p++; bundle_flags & (1u << 7)) {
+                        if (unlikely(p >= next)) {
+                                break;
+                        }
+
+                        const auto extra_flags = *p++;
+
+                        if (unlikely(TANKUtil::bundle_extra_hdr_fields_size(extra_flags) > size_t(next - p))) {
+                                break;
+                        }
+
+                        if (extra_flags & uint8_t(TankFlags::BundleExtraFlags::RichProducerInfo)) {
+                                p += sizeof(uint32_t) + sizeof(uint64_t) + sizeof(uint16_t);
+                        }
+
+                        if (extra_flags & uint8_t(TankFlags::BundleExtraFlags::ProducerSeq)) {
+                                const auto producer_id  = decode_pod<uint64_t>(p);
+                                const auto producer_seq = decode_pod<uint32_t>(p);
+
+                                producers.track(producer_id, producer_seq);
+                        }
+                }
+
+                p = next;
+        }
+
+        return true;
+}
+
+// Rebuilds the idempotent producers window from the bundles found in the last producers.rebuild_tail_span bytes
+// of the partition log. That's usually the tail of the current segment, but if the current segment is shorter than that(e.g
+// it was just rolled), we also consider the tail of the previous segments. We use the indices to locate the first bundle in each range.
+//
+// Returns false if we failed to read the log; we 'll try again on the next produce.
+bool topic_partition_log::rebuild_producers_window() {
+        static constexpr bool trace{false};
+        const auto            file_size = cur.fileSize;
+        uint32_t              o{0};
+
+        struct tail final {
+                int      fd;
+                uint32_t from;
+                uint32_t to;
+        };
+        // newest first
+        std::vector<tail> tails;
+        uint32_t          covered;
+
+        if (file_size > producers.rebuild_tail_span) {
+                const auto target = file_size - producers.rebuild_tail_span;
+                const auto &sl    = cur.index.skipList;
+
+                if (!sl.empty() && sl.front().second <= target) {
+                        // skiplist entries are more recent than the on-disk index entries
+                        const auto it = std::upper_bound(sl.begin(), sl.end(), target, [](const uint32_t v, const auto &e) noexcept {
+                                return v < e.second;
+                        });
+
+                        o = std::prev(it)->second;
+                } else if (cur.index.haveWideEntries) {
+                        o = cur.index.ondisk.lastRecorded.absPhysical;
+                } else if (const auto span = cur.index.ondisk.span; span && cur.index.ondisk.data && cur.index.ondisk.data != MAP_FAILED) {
+                        o = indexed_offset_at_or_before(cur.index.ondisk.data, span, target);
+                }
+        }
+
+        tails.push_back({cur.fdh ? cur.fdh->fd : -1, o, file_size});
+        covered = file_size - o;
+
+        if (roSegments) {
+                for (auto it = roSegments->rbegin(); it != roSegments->rend() && covered < producers.rebuild_tail_span; ++it) {
+                        auto seg = *it;
+
+                        if (!seg->prepare_access(partition)) {
+                                return false;
+                        }
+
+                        const auto need   = producers.rebuild_tail_span - covered;
+                        const auto target = seg->fileSize > need ? seg->fileSize - need : 0;
+                        uint32_t   from{0};
+
+                        if (target && seg->haveWideEntries) {
+                                from = seg->index.lastRecorded.absPhysical <= target ? seg->index.lastRecorded.absPhysical : 0;
+                        } else if (target && seg->index.data && seg->index.data != MAP_FAILED) {
+                                from = indexed_offset_at_or_before(seg->index.data, seg->index.fileSize, target);
+                        }
+
+                        tails.push_back({seg->fdh->fd, from, seg->fileSize});
+                        covered += seg->fileSize - from;
+                }
+        }
+
+        // oldest first, so that producers are ordered by their most recent activity
+        for (auto it = tails.rbegin(); it != tails.rend(); ++it) {
+                if (it->fd != -1 && !scan_producers_window(it->fd, it->from, it->to)) {
+                        return false;
+                }
+        }
+
+        if (trace) {
+                SLog("Tracking ", producers.map.size(), " producers\n");
+        }
+
+        producers.loaded = true;
+        return true;
+}
+
 // if (firstMsgSeqNum != 0 && lastMsgSeqNum != 0), we have expicitly specified message sequence numbers for the bundle first/last message
-append_res topic_partition_log::append_bundle(const time_t   now,
-                                              const void *   bundle,
-                                              const size_t   bundleSize,
-                                              const uint32_t bundleMsgsCnt,
-                                              const uint64_t firstMsgSeqNum,
-                                              const uint64_t lastMsgSeqNum) {
+// if src is set, only the first (bundleSize - src->remaining) bytes of the bundle are in memory, and we splice the rest from the socket
+append_res topic_partition_log::append_bundle(const time_t         now,
+                                              const void *         bundle,
+                                              const size_t         bundleSize,
+                                              const uint32_t       bundleMsgsCnt,
+                                              const uint64_t       firstMsgSeqNum,
+                                              const uint64_t       lastMsgSeqNum,
+                                              splice_source *const src) {
         static constexpr bool trace{false};
         const auto            saved_last_assigned_seqnum = lastAssignedSeqNum;
         const auto            absSeqNum                  = firstMsgSeqNum ?: lastAssignedSeqNum + 1;
@@ -390,6 +620,12 @@ append_res topic_partition_log::append_bundle(const time_t   now,
                 if (unlikely(cur.index.skipList.size() > 65536)) {
                         flush_index_skiplist();
                 }
+
+                if (next_segment.log_fd == -1 &&
+                    !(partition->flags & unsigned(topic_partition::Flags::NextSegmentPending)) &&
+                    nearing_roll(now)) {
+                        this_service->prepare_next_segment(this);
+                }
         }
 
         TANK_EXPECT(cur.fdh.use_count() >= 1);
@@ -397,20 +633,38 @@ append_res topic_partition_log::append_bundle(const time_t   now,
         uint8_t            varint[8];
         const uint8_t      varintLen = Compression::PackUInt32(bundleSize, varint) - varint;
         auto               fd        = cur.fdh->fd;
+        const auto         hdr       = static_cast<const uint8_t *>(bundle);
         const struct iovec iov[] =
             {
                 {(void *)varint, varintLen},
-                {const_cast<void *>(bundle), bundleSize}};
-        const auto                       entryLen = iov[0].iov_len + iov[1].iov_len;
+                {const_cast<void *>(bundle), src ? bundleSize - src->remaining : bundleSize}};
+        const auto                       entryLen = varintLen + bundleSize;
         const range32_t                  fileRange(cur.fileSize, entryLen);
         const auto                       before = cur.fdh.use_count();
         Switch::shared_refptr<fd_handle> fdh(cur.fdh);
-        const auto                       b = trace ? Timings::Microseconds::Tick() : uint64_t(0);
+        const auto                       b = Timings::Microseconds::Tick();
 
         TANK_EXPECT(cur.fdh.use_count() == before + 1);
 
+        if (cur.preallocated && !((hdr[0] & (1u << 7)) && (hdr[1] & uint8_t(TankFlags::BundleExtraFlags::CRC32C)))) {
+                // If this bundle is partially written before a crash, the zeros of the preallocated region that follow
+                // would make it look complete; only bundles with a CRC32C can be told apart(see segment_logical_size()).
+                // Durably release the preallocated region before we append it, so that it would extend past the end of
+                // the segment instead, and stop preallocating this partition's segments.
+                if (unlikely(ftruncate(fd, cur.fileSize) == -1 || fdatasync(fd) == -1)) {
+                        lastAssignedSeqNum = saved_last_assigned_seqnum;
+                        this_service->track_io_fail(partition);
+                        return {nullptr, {}, {}};
+                }
+
+                cur.preallocated         = false;
+                next_segment.preallocate = false;
+        }
+
         // https://github.com/phaistos-networks/TANK/issues/14
-        if (unlikely(writev(fd, iov, sizeof_array(iov)) != entryLen)) {
+        // not O_APPEND; the segment may have been preallocated
+        if (unlikely(pwritev(fd, iov, sizeof_array(iov), cur.fileSize) != iov[0].iov_len + iov[1].iov_len ||
+                     (src && !src->splice_to(fd, cur.fileSize + iov[0].iov_len + iov[1].iov_len)))) {
 		if (EDQUOT == errno || ENOSPC == errno) {
 			TANK_EXPECT(this_service);
 			this_service->no_roll_until = this_service->curTime + 60;
@@ -420,8 +674,16 @@ append_res topic_partition_log::append_bundle(const time_t   now,
                 this_service->track_io_fail(partition);
                 return {nullptr, {}, {}};
         } else {
+                const auto took = Timings::Microseconds::Since(b);
+                auto &     hist = partition->metrics.append_latency;
+
+                if (!hist) {
+                        hist.reset(new hdr_histogram<>());
+                }
+                hist->reg_sample(took);
+
                 if (trace) {
-                        SLog("writev() took ", duration_repr(Timings::Microseconds::Since(b)),
+                        SLog("pwritev() took ", duration_repr(took),
                              ", entryLen = ", entryLen,
                              ", cur.sinceLastUpdate = ", cur.sinceLastUpdate,
                              ", config.indexInterval = ", config.indexInterval, "\n");
@@ -460,6 +722,11 @@ append_res topic_partition_log::append_bundle(const time_t   now,
                         cur.sinceLastUpdate = 0;
                 }
 
+                if (!src) {
+                        hot_tail_append(absSeqNum, iov, entryLen);
+                }
+                // otherwise, the hot tail will start over with the next bundle
+
                 cur.fileSize += entryLen;
                 cur.sinceLastUpdate += entryLen;
 
@@ -489,7 +756,7 @@ append_res topic_partition_log::append_bundle(const time_t   now,
                 return {fdh, fileRange, {absSeqNum, uint16_t(bundleMsgsCnt)}};
         }
 
-        // return here and not in (writev() ! entryLen) check because some older compilers warn about
+        // return here and not in (pwritev() != entryLen) check because some older compilers warn about
         // a path with no return from a non-void function. Sigh
         return {nullptr, {}, {}};
 }
@@ -0,0 +1,210 @@
+#include "service_common.h"
+#include <linux/errqueue.h>
+
+// See Service::zerocopy
+//
+// Invoked by flush_iov_impl() instead of writev() for large payloads. If we can't use MSG_ZEROCOPY for this
+// send(the kernel ran out of option memory to track it), or for this connection at all(e.g kTLS sockets), we just writev()
+ssize_t Service::send_zerocopy(connection *const c, struct iovec *const iov, const uint32_t iovCnt) {
+        struct msghdr msg {};
+
+        msg.msg_iov    = iov;
+        msg.msg_iovlen = iovCnt;
+
+        if (const auto r = sendmsg(c->fd, &msg, MSG_ZEROCOPY); r > 0) {
+                // the kernel assigns an id to every send that transmitted any data
+                ++c->zc.issued;
+                ++zerocopy.sends;
+                zerocopy.bytes += r;
+                return r;
+        } else if (-1 == r && EOPNOTSUPP == errno) {
+                c->state.flags &= ~(1u << uint8_t(connection::State::Flags::ZeroCopy));
+        } else if (!(-1 == r && ENOBUFS == errno)) {
+                return r;
+        }
+
+        return writev(c->fd, iov, iovCnt);
+}
+
+// Invoked by flush_iov_impl() for every data vector payload that's been fully sent
+// If any sends are pending, it may have been sent by one of them, so we 'll hold on to it until they complete
+void Service::retire_payload(connection *const c, data_vector_payload *const p) {
+        auto &zc = c->zc;
+
+        if (zc.issued == zc.completed) {
+                release_payload(p);
+                return;
+        }
+
+        p->next   = nullptr;
+        p->zc_seq = zc.issued;
+
+        if (zc.parked_back) {
+                zc.parked_back->next = p;
+        } else {
+                zc.parked_front = p;
+        }
+        zc.parked_back = p;
+}
+
+// If all is set, releases all parked payloads regardless of pending sends; only when none are pending(see linger_zerocopy())
+void Service::release_parked_payloads(connection *const c, const bool all) {
+        auto &zc = c->zc;
+
+        while (auto p = zc.parked_front) {
+                if (!all && int32_t(zc.completed - static_cast<data_vector_payload *>(p)->zc_seq) < 0) {
+                        break;
+                }
+
+                zc.parked_front = p->next;
+                release_payload(p);
+        }
+
+        if (!zc.parked_front) {
+                zc.parked_back = nullptr;
+        }
+}
+
+// Drains the socket's error queue, advancing completed past all reported completions
+// Returns 0, or errno if we failed to read from the error queue
+static int drain_zerocopy_errqueue(const int fd, uint32_t &completed, bool &copied) {
+        char control[128];
+
+        for (;;) {
+                struct msghdr msg {};
+
+                msg.msg_control    = control;
+                msg.msg_controllen = sizeof(control);
+
+                if (-1 == recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT)) {
+                        if (EINTR == errno) {
+                                continue;
+                        } else if (EAGAIN == errno) {
+                                return 0;
+                        }
+
+                        return errno;
+                }
+
+                for (auto cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+                        if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+                              (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))) {
+                                continue;
+                        }
+
+                        const auto ee = reinterpret_cast<const sock_extended_err *>(CMSG_DATA(cm));
+
+                        if (ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                                continue;
+                        }
+
+                        // [ee_info, ee_data] sends completed; TCP sends complete in order
+                        if (const uint32_t next = ee->ee_data + 1; int32_t(next - completed) > 0) {
+                                completed = next;
+                        }
+
+                        if (ee->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                                copied = true;
+                        }
+                }
+        }
+}
+
+// Completions are reported via the socket's error queue, and EPOLLERR is reported while it's not empty
+// Invoked by process_io() on EPOLLERR for connections with pending sends; returns false if the connection was shut down
+bool Service::reap_zerocopy_completions(connection *const c) {
+        bool copied{false};
+
+        if (const auto e = drain_zerocopy_errqueue(c->fd, c->zc.completed, copied)) {
+                track_shutdown(c, __LINE__, "Failed to reap MSG_ZEROCOPY completions:", strerror(e), "\n");
+                return shutdown(c, __LINE__);
+        }
+
+        if (copied) {
+                // no point in pinning pages if the kernel is going to copy the data anyway
+                ++zerocopy.copied;
+                c->state.flags &= ~(1u << uint8_t(connection::State::Flags::ZeroCopy));
+        }
+
+        release_parked_payloads(c, false);
+
+        // EPOLLERR is also reported for socket errors
+        int       err{0};
+        socklen_t len = sizeof(err);
+
+        if (-1 == getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) || err) {
+                track_shutdown(c, __LINE__, "Socket error:", strerror(err), "\n");
+                return shutdown(c, __LINE__);
+        }
+
+        return true;
+}
+
+// Invoked by cleanup_connection() instead of closing the socket if MSG_ZEROCOPY sends are pending.
+// The kernel keeps transmitting(and retransmitting) straight from the payloads memory even after close(), and once
+// released, their buffers are reused by other connections, so this peer could be sent another connection's data.
+// We stop sending and take over the socket, the parked payloads, and those still queued(the front may have been
+// partially sent), until all sends complete or linger_timeout expires; see consider_lingering_zerocopy()
+void Service::linger_zerocopy(connection *const c) {
+        auto &zc = c->zc;
+        auto  q  = c->outQ;
+
+        TANK_EXPECT(zc.issued != zc.completed);
+
+        zerocopy_lingerer l{c->fd, zc.issued, zc.completed, zc.parked_front, zc.parked_back, now_ms + zerocopy.linger_timeout};
+
+        zc.parked_front = zc.parked_back = nullptr;
+
+        if (q && q->front_) {
+                if (l.back) {
+                        l.back->next = q->front_;
+                } else {
+                        l.front = q->front_;
+                }
+                l.back = q->back_;
+                q->reset();
+        }
+
+        // whatever's already in the socket buffer will still be sent
+        ::shutdown(l.fd, SHUT_WR);
+
+        zerocopy.lingering.emplace_back(l);
+        zerocopy.lingering_next = std::min<uint64_t>(zerocopy.lingering_next, now_ms + 20);
+}
+
+// Sockets of lingering connections are no longer polled, so we check their error queues periodically.
+// If the sends don't complete in time(e.g the peer stopped reading), we abort the connection; an RST close purges
+// the socket's write and retransmit queues, so the kernel won't be referencing the payloads once close() returns.
+void Service::consider_lingering_zerocopy() {
+        auto &v = zerocopy.lingering;
+
+        for (size_t i{0}; i < v.size();) {
+                auto &l = v[i];
+                bool  copied{false};
+                auto  e = drain_zerocopy_errqueue(l.fd, l.completed, copied);
+
+                if (!e && l.issued != l.completed && now_ms < l.expires) {
+                        ++i;
+                        continue;
+                }
+
+                if (l.issued != l.completed) {
+                        const struct linger abort_close { 1, 0 };
+
+                        setsockopt(l.fd, SOL_SOCKET, SO_LINGER, &abort_close, sizeof(abort_close));
+                        ++zerocopy.lingering_aborted;
+                }
+
+                TANKUtil::safe_close(l.fd);
+
+                while (auto p = l.front) {
+                        l.front = p->next;
+                        release_payload(p);
+                }
+
+                l = v.back();
+                v.pop_back();
+        }
+
+        zerocopy.lingering_next = v.empty() ? std::numeric_limits<uint64_t>::max() : now_ms + 20;
+}
@@ -73,6 +73,10 @@ namespace std {
 } // namespace std
 
 // TankClient is not marked as final, because we need to use TEST_CASE_METHOD() (see catch2)
+// see TankClient::set_tls()
+struct ssl_st;
+struct ssl_ctx_st;
+
 class TankClient {
       public:
         enum class ProduceFlags : uint8_t {
@@ -148,6 +152,34 @@ class TankClient {
                 strwlen32_t content;
         };
 
+        // A bundle exactly as it is stored in a partition's log
+        // See TankClient::set_capture_raw_bundles()
+        struct raw_bundle final {
+                uint64_t                              first_msg_seqnum;
+                uint64_t                              last_msg_seqnum;
+                uint32_t                              msgs_cnt;
+                range_base<const uint8_t *, uint32_t> content; // bundle header and message set, excluding the bundle length varint
+        };
+
+        // Partitions assigned to this member of a consumer group; see join_group()
+        struct group_assignment final {
+                uint32_t                                        clientReqId;
+                uint64_t                                        generation;
+                uint16_t                                        members_cnt;
+                range_base<const topic_partition *, uint32_t> partitions;
+        };
+
+        struct offsets_commit_ack final {
+                uint32_t clientReqId;
+        };
+
+        struct fetched_offset final {
+                uint32_t   clientReqId;
+                strwlen8_t topic;
+                uint16_t   partition;
+                uint64_t   seq_num; // std::numeric_limits<uint64_t>::max() if nothing was committed
+        };
+
         struct srv_status final {
                 struct {
                         uint32_t topics;
@@ -159,6 +191,10 @@ class TankClient {
 
                 struct {
                         uint32_t time_open_partitions;
+                        // reactor profiler
+                        uint32_t reactor_stalls;
+                        uint32_t slow_ops;
+                        uint32_t slowest_op_us; // of the most recent slow operations
                 } metrics;
 
                 struct {
@@ -176,6 +212,10 @@ class TankClient {
                 uint16_t                             partition;
                 range_base<consumed_msg *, uint32_t> msgs;
 
+                // Only set if raw bundles capture is enabled
+                // Bundles that were not decoded into msgs; they always follow any messages in msgs
+                range_base<raw_bundle *, uint32_t> bundles;
+
                 // https://github.com/phaistos-networks/TANK/issues/1
                 // For now, this is always true, but when we implement support for pseudo-streaming (see GH issue)
                 // this may be false, in which case, the response is not complete -- more messages are expected for
@@ -227,6 +267,8 @@ class TankClient {
                         Timeout,
                         UnsupportedReq,
                         InsufficientReplicas,
+                        // consumer group generation changed; the member needs to join_group() again
+                        StaleGeneration,
                 } type;
 
                 enum class Req : uint8_t {
@@ -334,6 +376,11 @@ class TankClient {
                                                 } list;
                                         } msgs;
 
+                                        struct {
+                                                uint32_t    cnt;
+                                                raw_bundle *list; // allocated if (cnt != 0)
+                                        } bundles;
+
                                         bool drained;
                                 } response;
                         } consume;
@@ -366,6 +413,16 @@ class TankClient {
                                         uint8_t len; // 0 if not cluster aware
                                 } cluster_name;
                         } srv_status;
+
+                        struct {
+                                uint64_t                      generation;
+                                uint16_t                      members_cnt;
+                                std::vector<topic_partition> *assigned;
+                        } join_group;
+
+                        struct {
+                                uint64_t seq_num;
+                        } fetch_offset;
                 } as_op;
 
                 void reset() {
@@ -439,6 +496,9 @@ class TankClient {
                         CreateTopic,
                         ReloadConfig,
                         SrvStatus,
+                        JoinGroup,
+                        CommitOffsets,
+                        FetchOffsets,
                 } type;
                 uint32_t request_id; // client request ID
 
@@ -478,12 +538,17 @@ class TankClient {
                         struct {
                                 std::pair<uint64_t, uint64_t> *v;
                         } discover_partitions;
+
+                        struct {
+                                std::vector<topic_partition> *v;
+                        } join_group;
                 } materialized_resp;
 
                 union As final {
                         struct Consume final {
                                 uint64_t max_wait;
                                 size_t   min_size;
+                                bool     capture_raw_bundles;
                         } consume;
 
                         struct CreateTopic final {
@@ -491,6 +556,12 @@ class TankClient {
                                 str_view32 config;
                         } create_topic;
 
+                        // JoinGroup, CommitOffsets and FetchOffsets
+                        struct ConsumerGroup final {
+                                str_view8  group;   // allocated
+                                str_view32 content; // allocated; encoded request content that follows the group name, if any
+                        } consumer_group;
+
                         As()
                             : create_topic{} {
                         }
@@ -675,11 +746,15 @@ class TankClient {
                         managed_buf *b;
                 } in;
 
+                // set while the TLS handshake is in progress; see TankClient::tls_handshake()
+                ssl_st *tls;
+
                 struct State final {
                         enum class Flags : uint8_t {
                                 ConnectionAttempt = 0,
                                 NeedOutAvail,
                                 RetryingConnection,
+                                SecureChannel, // TLS handshake completed, and the session was handed to the kernel
                         };
 
                         uint8_t flags;
@@ -756,6 +831,7 @@ class TankClient {
                                                 struct {
                                                         uint8_t  codec;
                                                         bool     sparse;
+                                                        bool     columnar;
                                                         bool     any_captured;
                                                         uint64_t first_msg_seqnum, last_msg_seqnum;
                                                         uint32_t size;
@@ -808,6 +884,7 @@ class TankClient {
                 void reset() noexcept {
                         in.b = nullptr;
                         fd   = -1;
+                        tls  = nullptr;
                         list.reset();
                         all_conns_list_ll.reset();
 
@@ -824,6 +901,7 @@ class TankClient {
         struct broker final {
                 static constexpr size_t max_consequtive_connection_failures{5};
                 uint64_t                blocked_until{0};
+                uint64_t                throttled_until{0}; // see TankClient::process_throttle()
                 eb64_node               unreachable_brokers_tree_node{.node.leaf_p = nullptr};
                 connection_handle       ch;
                 const Switch::endpoint  ep;
@@ -990,6 +1068,8 @@ class TankClient {
         uint64_t                                  retry_bundles_next{std::numeric_limits<uint64_t>::max()};
         eb_root                                   unreachable_brokers_tree{EB_ROOT};
         uint64_t                                  unreachable_brokers_tree_next{std::numeric_limits<uint64_t>::max()};
+        std::vector<broker *>                     throttled_brokers;
+        uint64_t                                  throttled_brokers_next{std::numeric_limits<uint64_t>::max()};
         simple_allocator                          reqs_allocator;
         std::vector<std::unique_ptr<api_request>> reusable_api_requests;
         std::vector<broker_api_request *>         reusable_broker_api_requests;
@@ -1010,8 +1090,30 @@ class TankClient {
         simple_allocator                                                     resultsAllocator{2 * 1024 * 1024};
 	struct {
 		bool report_drain_if_consumed_upto_hwmark{false};
+		bool capture_raw_bundles{false};
+		bool bundle_checksums{false};
+		bool columnar_bundles{false};
+		bool durable_acks{false};
 	} behavior;
 
+        // See TankClient::set_idempotent_producer()
+        struct {
+                uint64_t                                            id{0};
+                robin_hood::unordered_map<topic_partition, uint32_t> seqs;
+        } idempotent_producer;
+
+        // See TankClient::set_preferred_replicas()
+        struct {
+                // how many of the preferred endpoints have been ruled out for a partition, and when the first was ruled out
+                struct partition_state final {
+                        uint8_t  cnt;
+                        uint64_t since;
+                };
+
+                std::vector<Switch::endpoint>                               endpoints;
+                robin_hood::unordered_map<topic_partition, partition_state> ruled_out;
+        } preferred_replicas;
+
         std::vector<partition_content>           consumed_content;
         std::vector<fault>                       all_captured_faults;
         std::vector<produce_ack>                 produce_acks_v;
@@ -1019,6 +1121,9 @@ class TankClient {
         std::vector<reload_conf_result>          reload_conf_results_v;
         std::vector<created_topic>               created_topics_v;
         std::vector<srv_status>                  collected_cluster_status_v;
+        std::vector<group_assignment>            group_assignments_v;
+        std::vector<offsets_commit_ack>          offsets_commit_acks_v;
+        std::vector<fetched_offset>              fetched_offsets_v;
 
         robin_hood::unordered_map<uint32_t, broker_api_request *>         pending_brokers_requests;
         robin_hood::unordered_map<uint32_t, std::unique_ptr<api_request>> pending_responses;
@@ -1036,6 +1141,8 @@ class TankClient {
         std::vector<std::unique_ptr<IOBuffer>>    reusable_buffers;
         std::vector<std::unique_ptr<managed_buf>> reusable_managed_buffers;
         std::vector<range32_t>                    ranges;
+        ssl_ctx_st *                              tls_ctx{nullptr}; // see set_tls()
+        std::string                               tls_peer_name;    // see set_tls()
 
 #include "client_pragmas.h"
 };